@@ -0,0 +1,157 @@
+// 端到端基准：对本地替身服务器执行完整的deepseek::ask，与裸curl请求对比得到每轮的客户端开销，
+// 并分别测量响应解析和历史写入的耗时。服务器不限速，因此测到的全部是客户端和回环网络的开销
+// 用法: bench_e2e [turns] [tokens]   默认: 200 256
+#include "deepseek.hpp"
+#include "history.hpp"
+#include "mock_server.hpp"
+#include "output_silencer.hpp"
+#include "sse_parser.hpp"
+#include <curl/curl.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+static double elapsed_us(bench_clock::time_point start) {
+  return std::chrono::duration<double, std::micro>(bench_clock::now() - start).count();
+}
+
+static double median(std::vector<double> samples) {
+  if (samples.empty())
+    return 0.0;
+  std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+  return samples[samples.size() / 2];
+}
+
+static size_t collect_body(void *contents, size_t size, size_t nmemb, std::string *body) {
+  body->append(static_cast<char *>(contents), size * nmemb);
+  return size * nmemb;
+}
+
+// 裸curl请求：同样的请求体和长连接，不解析、不输出、不记录历史
+static std::vector<double> run_raw(const std::string &endpoint, const std::string &request_body,
+                                   int turns, std::string &captured) {
+  CURL *curl = curl_easy_init();
+  curl_slist *headers = curl_slist_append(nullptr, "Content-Type: application/json");
+  curl_easy_setopt(curl, CURLOPT_URL, endpoint.c_str());
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+  curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request_body.c_str());
+  curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE,
+                   static_cast<curl_off_t>(request_body.size()));
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, collect_body);
+  std::string body;
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
+  std::vector<double> samples;
+  for (int i = 0; i < turns; ++i) {
+    body.clear();
+    auto start = bench_clock::now();
+    curl_easy_perform(curl);
+    samples.push_back(elapsed_us(start));
+  }
+  captured = body;
+  curl_slist_free_all(headers);
+  curl_easy_cleanup(curl);
+  return samples;
+}
+
+// 回放录下的响应，测量纯解析耗时
+static double parse_cost_us(deepseek &client, bool stream, const std::string &response) {
+  const int iterations = 200;
+  std::string content;
+  auto start = bench_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    if (stream) {
+      SseParser parser;
+      content.clear();
+      // 按典型的网络回调大小切分
+      for (size_t pos = 0; pos < response.size(); pos += 1024) {
+        parser.feed(std::string_view(response).substr(pos, 1024), [&](std::string_view piece) {
+          content.append(piece.data(), piece.size());
+        });
+      }
+    } else {
+      content = client.parseResponse(response);
+    }
+  }
+  return elapsed_us(start) / iterations;
+}
+
+int main(int argc, char **argv) {
+  int turns = argc > 1 ? std::stoi(argv[1]) : 200;
+  size_t tokens = argc > 2 ? std::stoul(argv[2]) : 256;
+
+  MockServerOptions options;
+  options.tokens = tokens;
+  MockServer server(options);
+  server.start();
+
+  std::filesystem::path dir = std::filesystem::temp_directory_path() / "gf_bench_e2e";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+
+  const std::string model = "deepseek-chat";
+  const std::string system_prompt = "You are a helpful assistant.";
+  const std::string question = "请解释一下C++中的移动语义以及它和拷贝的区别？";
+
+  std::cout << "turns: " << turns << ", tokens per response: " << tokens << std::endl;
+  std::cout << "mode\task_p50_us\traw_p50_us\toverhead_us\tparse_us\thistory_us" << std::endl;
+  for (bool stream : {true, false}) {
+    Conversation conversation;
+    conversation.set_system_prompt(system_prompt);
+    conversation.append(Role::User, question);
+    std::string request_body = deepseek::build_request_body(model, conversation, stream);
+
+    std::string captured;
+    run_raw(server.endpoint(), request_body, 10, captured); // 预热
+    std::vector<double> raw = run_raw(server.endpoint(), request_body, turns, captured);
+
+    // 完整的ask：序列化、事件循环、SSE解析、输出和历史入队；每轮清空上下文使请求大小不变
+    std::string journal_path = (dir / (stream ? "stream.jsonl" : "plain.jsonl")).string();
+    std::vector<double> ask;
+    double history_us = 0.0;
+    {
+      OutputSilencer silence;
+      HistoryManager history(journal_path, turns * 2);
+      history.load_history();
+      deepseek client("bench-key", stream, &history);
+      client.set_endpoint(server.endpoint());
+      client.set_system_prompt(system_prompt);
+      for (int i = 0; i < 10 + turns; ++i) {
+        auto start = bench_clock::now();
+        client.ask(model, question);
+        if (i >= 10) {
+          ask.push_back(elapsed_us(start));
+        }
+        client.clear_conversation_context();
+      }
+
+      // 历史写入：追加入队的耗时加上落盘的耗时，均摊到每轮
+      std::string response(600, 'a');
+      auto start = bench_clock::now();
+      for (int i = 0; i < turns; ++i) {
+        history.add_entry_multi_turn(question, response, system_prompt, model);
+      }
+      history.save_history();
+      history_us = elapsed_us(start) / turns;
+    }
+
+    double parse_us;
+    {
+      deepseek client("bench-key", stream);
+      parse_us = parse_cost_us(client, stream, captured);
+    }
+
+    double ask_p50 = median(ask);
+    double raw_p50 = median(raw);
+    std::cout << (stream ? "stream" : "non-stream") << "\t" << ask_p50 << "\t" << raw_p50 << "\t"
+              << (ask_p50 - raw_p50) << "\t" << parse_us << "\t" << history_us << std::endl;
+  }
+  server.stop();
+  std::filesystem::remove_all(dir);
+  return 0;
+}
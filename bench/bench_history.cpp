@@ -0,0 +1,426 @@
+// 历史记录基准：
+// 1. 同样的条目分别存为旧的history.json、每行一条JSON的日志和二进制列式日志，
+//    比较文件大小、启动加载耗时和加载后的堆内存（列式日志的正文留在文件映射中）
+// 2. 列式日志上的会话索引构建、子串扫描和追加延迟。追加由后台线程成组写入，
+//    append只计入队耗时，drain_ms是退出时等待落盘的耗时
+// 3. 冷热分层：热文件保留最近1000条，其余由后台线程按整块分多次转存为压缩冷段。
+//    统计转存全部较早条目得到的冷段数和后台总耗时，期间每5ms追加一条并读取新增条目
+//    （聊天循环的操作）的最长耗时，冷段压缩比、加载和全量扫描（需要解压冷段）耗时，
+//    以及追加1000条之后全部在热文件中与分层两种情况下的压缩耗时（可转存的正文不足
+//    阈值时分层也不转存）
+// 4. 时间戳：创建条目的耗时与旧版在创建时格式化时间戳的耗时；在时间戳列上
+//    二分查找一天的条目、按天统计，与逐条组装条目比较时间戳的对照
+// 用法: bench_history [entries...]   默认: 1000 100000（可追加1000000）
+#include "history.hpp"
+#include "history_journal.hpp"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <malloc.h>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+static std::vector<HistoryEntry> make_entries(size_t count) {
+    std::vector<HistoryEntry> entries;
+    entries.reserve(count);
+    std::string user = "请解释一下C++中的移动语义以及它和拷贝的区别？";
+    std::string assistant(600, 'a');
+    assistant.replace(0, 60, "移动语义允许资源的所有权从一个对象转移到另一个对象，");
+    for (size_t i = 0; i < count; ++i) {
+        entries.emplace_back(user + std::to_string(i), assistant, "You are a helpful assistant.",
+                             "deepseek-chat", "session_20250613_143022_" + std::to_string(i / 10),
+                             static_cast<int>(i % 10) + 1);
+    }
+    return entries;
+}
+
+// 内容各不相同的条目，压缩比更接近真实的对话
+static std::vector<HistoryEntry> make_varied_entries(size_t count) {
+    static const char* words[] = {
+        "移动语义", "右值引用", "std::move", "拷贝构造", "资源", "所有权", "对象", "转移",
+        "template", "constexpr", "lambda", "vector", "unique_ptr", "shared_ptr", "线程",
+        "互斥锁", "条件变量", "原子操作", "内存序", "缓存行", "性能", "编译器", "优化",
+        "inline", "虚函数", "多态", "继承", "接口", "异常", "RAII", "析构函数", "迭代器",
+    };
+    const size_t word_count = sizeof(words) / sizeof(words[0]);
+    uint64_t state = 88172645463325252ull;
+    auto next = [&state]() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    };
+    std::vector<HistoryEntry> entries;
+    entries.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        std::string user = "问题" + std::to_string(i) + "：";
+        for (int w = 0; w < 12; ++w) {
+            user += words[next() % word_count];
+            user += ' ';
+        }
+        std::string assistant;
+        for (int w = 0; w < 150; ++w) {
+            assistant += words[next() % word_count];
+            assistant += (next() % 8 == 0) ? "。" : " ";
+        }
+        entries.emplace_back(user, assistant, "You are a helpful assistant.", "deepseek-chat",
+                             "session_20250613_143022_" + std::to_string(i / 10),
+                             static_cast<int>(i % 10) + 1);
+    }
+    return entries;
+}
+
+// 旧实现：每次保存都重建整个Json::Value并美化输出整个文件
+static void legacy_save(const std::vector<HistoryEntry>& entries, const std::string& path) {
+    Json::Value root;
+    Json::Value history_array(Json::arrayValue);
+    for (const auto& entry : entries) {
+        history_array.append(entry.to_json());
+    }
+    root["history"] = history_array;
+    root["total_entries"] = static_cast<int>(entries.size());
+    std::ofstream history_file(path);
+    Json::StreamWriterBuilder writer;
+    writer["indentation"] = "  ";
+    std::unique_ptr<Json::StreamWriter> json_writer(writer.newStreamWriter());
+    json_writer->write(root, &history_file);
+}
+
+// 旧实现：启动时解析整个history.json
+static std::vector<HistoryEntry> legacy_load(const std::string& path) {
+    std::ifstream history_file(path);
+    Json::CharReaderBuilder reader;
+    Json::Value root;
+    std::string errors;
+    Json::parseFromStream(reader, history_file, &root, &errors);
+    std::vector<HistoryEntry> entries;
+    for (const auto& entry_json : root["history"]) {
+        entries.push_back(HistoryEntry::from_json(entry_json));
+    }
+    return entries;
+}
+
+// 上一版的日志格式：每行一条紧凑的JSON
+static void jsonl_save(const std::vector<HistoryEntry>& entries, const std::string& path) {
+    std::ofstream out(path);
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    builder["emitUTF8"] = true;
+    std::unique_ptr<Json::StreamWriter> writer(builder.newStreamWriter());
+    for (const auto& entry : entries) {
+        writer->write(entry.to_json(), &out);
+        out << '\n';
+    }
+}
+
+static std::vector<HistoryEntry> jsonl_load(const std::string& path) {
+    std::ifstream in(path);
+    std::unique_ptr<Json::CharReader> reader(Json::CharReaderBuilder().newCharReader());
+    std::vector<HistoryEntry> entries;
+    std::string line;
+    std::string errors;
+    while (std::getline(in, line)) {
+        Json::Value root;
+        if (reader->parse(line.data(), line.data() + line.size(), &root, &errors)) {
+            entries.push_back(HistoryEntry::from_json(root));
+        }
+    }
+    return entries;
+}
+
+// 当前已分配的堆内存
+static size_t heap_bytes() {
+    return mallinfo2().uordblks;
+}
+
+static double mb(double bytes) {
+    return bytes / (1024.0 * 1024.0);
+}
+
+static double elapsed_ms(bench_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+}
+
+static double percentile(std::vector<double> samples, double p) {
+    std::sort(samples.begin(), samples.end());
+    size_t index = static_cast<size_t>(p * (samples.size() - 1));
+    return samples[index];
+}
+
+// 在加载结果存活期间测量耗时和堆内存的增量
+template <typename Load>
+static void report_format(size_t count, const char* format, const std::string& path, Load&& load) {
+    size_t before = heap_bytes();
+    auto start = bench_clock::now();
+    auto loaded = load();
+    double load_ms = elapsed_ms(start);
+    double heap = static_cast<double>(heap_bytes() - std::min(before, heap_bytes()));
+    std::cout << count << "\t" << format << "\t" << mb(std::filesystem::file_size(path)) << "\t"
+              << load_ms << "\t" << mb(heap) << std::endl;
+}
+
+int main(int argc, char** argv) {
+    std::vector<size_t> sizes;
+    for (int i = 1; i < argc; ++i) {
+        sizes.push_back(std::stoul(argv[i]));
+    }
+    if (sizes.empty()) {
+        sizes = {1000, 100000};
+    }
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "gf_bench_history";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    std::string legacy_path = (dir / "history.json").string();
+    std::string jsonl_path = (dir / "history.jsonl").string();
+    std::string journal_path = (dir / "history.gfh").string();
+
+    // 前两组只测热文件，不转存冷段
+    HistoryRetention all_hot;
+    all_hot.hot_entries = 0;
+
+    std::cout << "entries\tformat\tfile_mb\tload_ms\theap_mb" << std::endl;
+    std::vector<double> legacy_save_ms;
+    for (size_t count : sizes) {
+        {
+            auto entries = make_entries(count);
+            auto start = bench_clock::now();
+            legacy_save(entries, legacy_path);
+            legacy_save_ms.push_back(elapsed_ms(start));
+            jsonl_save(entries, jsonl_path);
+            HistoryJournal journal(journal_path);
+            HistoryColumns columns;
+            journal.rewrite(entries, columns);
+        }
+        report_format(count, "json", legacy_path, [&] { return legacy_load(legacy_path); });
+        report_format(count, "jsonl", jsonl_path, [&] { return jsonl_load(jsonl_path); });
+        report_format(count, "columnar", journal_path, [&] {
+            auto manager = std::make_unique<HistoryManager>(journal_path, static_cast<int>(count));
+            manager->set_retention(all_hot);
+            manager->load_history();
+            return manager;
+        });
+        std::filesystem::remove(legacy_path);
+        std::filesystem::remove(jsonl_path);
+        std::filesystem::remove(journal_path);
+    }
+
+    // 列式日志上的查询和追加：预先写好count条记录
+    std::cout << "\nentries\tlegacy_save_ms\tsessions_ms\tscan_ms\tappend_mean_ms\tappend_p99_ms\tdrain_ms"
+              << std::endl;
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        size_t count = sizes[i];
+        {
+            auto entries = make_entries(count);
+            HistoryJournal journal(journal_path);
+            HistoryColumns columns;
+            journal.rewrite(entries, columns);
+        }
+
+        std::vector<double> samples;
+        double sessions_ms = 0;
+        double scan_ms = 0;
+        double drain_ms = 0;
+        {
+            HistoryManager manager(journal_path, static_cast<int>(count));
+            manager.set_retention(all_hot);
+            manager.load_history();
+            auto start = bench_clock::now();
+            manager.get_all_session_ids();
+            sessions_ms = elapsed_ms(start);
+            start = bench_clock::now();
+            manager.search_history("所有权从一个对象转移到另一个对象，a");
+            scan_ms = elapsed_ms(start);
+            for (int round = 0; round < 200; ++round) {
+                auto t0 = bench_clock::now();
+                manager.add_entry_multi_turn("新的问题", "新的回答", "You are a helpful assistant.");
+                samples.push_back(elapsed_ms(t0));
+            }
+            start = bench_clock::now();
+            manager.save_history();
+            drain_ms = elapsed_ms(start);
+        }
+        std::filesystem::remove(journal_path);
+
+        double mean = 0;
+        for (double sample : samples) {
+            mean += sample;
+        }
+        mean /= samples.size();
+        std::cout << count << "\t" << legacy_save_ms[i] << "\t" << sessions_ms << "\t" << scan_ms
+                  << "\t" << mean << "\t" << percentile(samples, 0.99) << "\t" << drain_ms
+                  << std::endl;
+    }
+
+    // 冷热分层
+    const size_t hot_entries = 1000;
+    HistoryRetention tiered;
+    tiered.hot_entries = hot_entries;
+    std::string cold_dir = journal_path + ".cold";
+    auto directory_bytes = [](const std::string& path) {
+        uint64_t bytes = 0;
+        std::error_code error;
+        for (const auto& file : std::filesystem::directory_iterator(path, error)) {
+            bytes += file.file_size();
+        }
+        return bytes;
+    };
+    // 追加1000条之后压缩一次的耗时
+    auto time_compaction = [&journal_path](size_t hot_rows) {
+        HistoryJournal journal(journal_path);
+        HistoryColumns columns;
+        journal.open(columns);
+        HistoryEntry extra("新的问题", "新的回答", "You are a helpful assistant.");
+        HistoryRefresh change;
+        for (int i = 0; i < 1000; ++i) {
+            journal.append(extra, columns);
+        }
+        journal.flush();
+        auto start = bench_clock::now();
+        journal.compact(columns, 0, hot_rows, change);
+        return elapsed_ms(start);
+    };
+    std::cout << "\nentries\tseals\tseal_ms\tchat_max_ms\thot_mb\tcold_mb\tcold_ratio\tload_ms\tscan_ms"
+              << "\tcompact_all_hot_ms\tcompact_tiered_ms" << std::endl;
+    for (size_t count : sizes) {
+        auto entries = make_varied_entries(count);
+        uint64_t sealed_bytes = 0;
+        for (size_t i = 0; i + hot_entries < count; ++i) {
+            sealed_bytes += entries[i].user_message.size() + entries[i].assistant_response.size();
+        }
+        auto rewrite = [&] {
+            HistoryJournal journal(journal_path);
+            HistoryColumns columns;
+            journal.rewrite(entries, columns);
+        };
+
+        rewrite();
+        double compact_all_hot_ms = time_compaction(SIZE_MAX);
+        rewrite();
+        double seal_ms = 0;
+        double chat_max_ms = 0;
+        {
+            HistoryJournal journal(journal_path);
+            HistoryColumns columns;
+            journal.open(columns);
+            HistoryEntry extra("新的问题", "新的回答", "You are a helpful assistant.");
+            HistoryRefresh change;
+            auto start = bench_clock::now();
+            // 后台线程反复转存，直到热文件中只剩最近的条目（和不足阈值的部分）；
+            // 热文件被替换后，主线程的下一次读取重新打开
+            journal.request_seal(0, hot_entries);
+            while (journal.is_sealing()) {
+                auto t0 = bench_clock::now();
+                journal.append(extra, columns);
+                journal.refresh(columns, change, std::chrono::milliseconds(0));
+                chat_max_ms = std::max(chat_max_ms, elapsed_ms(t0));
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+            seal_ms = elapsed_ms(start);
+            journal.flush();
+        }
+        size_t seals = 0;
+        std::error_code error;
+        for (auto it = std::filesystem::directory_iterator(cold_dir, error);
+             it != std::filesystem::directory_iterator(); ++it) {
+            seals++;
+        }
+        double hot_mb = mb(std::filesystem::file_size(journal_path));
+        double cold_bytes = static_cast<double>(directory_bytes(cold_dir));
+        double load_ms = 0;
+        double scan_ms = 0;
+        {
+            auto start = bench_clock::now();
+            HistoryManager manager(journal_path, static_cast<int>(count));
+            manager.set_retention(tiered);
+            manager.load_history();
+            load_ms = elapsed_ms(start);
+            start = bench_clock::now();
+            manager.search_history("不存在的内容");
+            scan_ms = elapsed_ms(start);
+        }
+        double compact_tiered_ms = time_compaction(hot_entries);
+        std::filesystem::remove(journal_path);
+        std::filesystem::remove_all(cold_dir);
+
+        std::cout << count << "\t" << seals << "\t" << seal_ms << "\t" << chat_max_ms << "\t"
+                  << hot_mb << "\t" << mb(cold_bytes) << "\t"
+                  << (cold_bytes > 0 ? sealed_bytes / cold_bytes : 0) << "\t" << load_ms << "\t"
+                  << scan_ms << "\t" << compact_all_hot_ms << "\t" << compact_tiered_ms << std::endl;
+    }
+
+    // 时间戳与按时间查询：条目每10分钟一条，分布在多天
+    std::cout << "\nentries\tentry_ns\tlegacy_format_ns\tday_us\tdays_us\tday_scan_ms" << std::endl;
+    for (size_t count : sizes) {
+        auto entries = make_entries(count);
+        const int64_t step = 600ll * 1000000000;
+        int64_t base = entries.front().timestamp - static_cast<int64_t>(count) * step;
+        for (size_t i = 0; i < count; ++i) {
+            entries[i].timestamp = base + static_cast<int64_t>(i) * step;
+        }
+        {
+            HistoryJournal journal(journal_path);
+            HistoryColumns columns;
+            journal.rewrite(entries, columns);
+        }
+
+        // 创建条目（现在只取纳秒数）与旧版在创建时格式化时间戳的代价
+        const int rounds = 100000;
+        volatile size_t sink = 0;
+        auto start = bench_clock::now();
+        for (int i = 0; i < rounds; ++i) {
+            HistoryEntry entry("q", "a");
+            sink = sink + entry.user_message.size() + static_cast<size_t>(entry.timestamp & 1);
+        }
+        double entry_ns = elapsed_ms(start) * 1e6 / rounds;
+        start = bench_clock::now();
+        for (int i = 0; i < rounds; ++i) {
+            auto now = std::chrono::system_clock::now();
+            auto time_t = std::chrono::system_clock::to_time_t(now);
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                now.time_since_epoch()) % 1000;
+            std::stringstream ss;
+            ss << std::put_time(std::localtime(&time_t), "%Y-%m-%d %H:%M:%S");
+            ss << "." << std::setfill('0') << std::setw(3) << ms.count();
+            std::string text = ss.str();
+            sink = sink + text.size();
+        }
+        double legacy_format_ns = elapsed_ms(start) * 1e6 / rounds;
+
+        HistoryManager manager(journal_path, static_cast<int>(count));
+        manager.set_retention(all_hot);
+        manager.load_history();
+        int64_t day = history_day_start(entries[count / 2].timestamp);
+        int64_t next_day = history_day_start(day, 1);
+        manager.find_by_time(day, next_day); // 首次查询时检查时间戳列是否有序
+        start = bench_clock::now();
+        size_t found = manager.find_by_time(day, next_day).size();
+        double day_us = elapsed_ms(start) * 1000;
+        start = bench_clock::now();
+        manager.get_history_days();
+        double days_us = elapsed_ms(start) * 1000;
+        // 对照：逐条组装条目并比较时间戳
+        start = bench_clock::now();
+        size_t scanned = 0;
+        for (size_t i = 0; i < manager.get_history_count(); ++i) {
+            int64_t timestamp = manager.get_entry(i).timestamp;
+            scanned += timestamp >= day && timestamp < next_day;
+        }
+        double day_scan_ms = elapsed_ms(start);
+        if (scanned != found) {
+            std::cerr << "Mismatch: " << found << " vs " << scanned << std::endl;
+        }
+        std::filesystem::remove(journal_path);
+
+        std::cout << count << "\t" << entry_ns << "\t" << legacy_format_ns << "\t" << day_us << "\t"
+                  << days_us << "\t" << day_scan_ms << std::endl;
+    }
+    std::filesystem::remove_all(dir);
+    return 0;
+}
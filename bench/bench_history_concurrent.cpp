@@ -0,0 +1,260 @@
+// 多进程并发写入历史的压力测试：
+// 同时启动多个写进程，各自通过HistoryManager追加条目；热文件只保留很少的条目，
+// 回复带有填充使较早的条目很快达到转存的大小，压缩和后台转存冷段频繁发生并与其他
+// 进程的追加交错。另有一个读进程反复refresh，
+// 直到看到全部条目。全部退出后重新加载并检查：
+// - 每个写进程的条目都恰好出现一次，并且保持追加顺序；
+// - 全文索引能搜到抽查的条目；
+// - 读进程看到的条目数单调增加；
+// - 写进程添加条目后，同一进程立即查询的条目数和会话记录中就有这一条。
+// 任何检查失败时以非0退出。
+// 用法: bench_history_concurrent [writers] [entries_per_writer]   默认: 8 500
+#include "history.hpp"
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+// 热文件中保留的条目数和写进程保存（触发压缩）的间隔
+static const size_t kHotEntries = 64;
+static const size_t kSaveEvery = 50;
+// 每条回复的填充字节数
+static const size_t kReplyPadding = 2048;
+// 读进程等待全部条目出现的时间上限
+static const std::chrono::seconds kReaderTimeout(120);
+
+// 子进程通过管道返回的结果
+struct WorkerResult {
+    double mean_ms = 0;       // 写进程：追加的平均耗时；读进程：refresh的平均耗时
+    double p99_ms = 0;
+    uint64_t operations = 0;  // 追加或refresh的次数
+    uint64_t last_count = 0;  // 读进程最后看到的条目数
+    uint64_t violations = 0;  // 读进程看到条目数减少的次数
+    uint64_t unseen = 0;      // 写进程添加后立即查询却没有看到的条目数
+};
+
+static double elapsed_ms(bench_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+}
+
+static void summarize(std::vector<double> samples, WorkerResult& result) {
+    result.operations = samples.size();
+    if (samples.empty()) {
+        return;
+    }
+    double total = 0;
+    for (double sample : samples) {
+        total += sample;
+    }
+    result.mean_ms = total / samples.size();
+    std::sort(samples.begin(), samples.end());
+    result.p99_ms = samples[static_cast<size_t>(0.99 * (samples.size() - 1))];
+}
+
+// 每条消息带一个可以被全文索引单独命中的词
+static std::string message_of(int writer, size_t index) {
+    return "writer " + std::to_string(writer) + " entry " + std::to_string(index) + " w" +
+           std::to_string(writer) + "x" + std::to_string(index);
+}
+
+static std::string reply_of(size_t index) {
+    return "reply " + std::to_string(index) + " " + std::string(kReplyPadding, '.');
+}
+
+static HistoryRetention stress_retention() {
+    HistoryRetention retention;
+    retention.hot_entries = kHotEntries;
+    return retention;
+}
+
+static WorkerResult run_writer(const std::string& path, int writer, size_t count) {
+    HistoryManager manager(path, INT_MAX);
+    manager.set_retention(stress_retention());
+    manager.load_history();
+    // 同一毫秒启动的进程会生成相同的会话ID，每个写进程使用自己的会话
+    manager.set_current_session_id("bench_writer_" + std::to_string(writer));
+    WorkerResult result;
+    std::vector<double> samples;
+    samples.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        size_t before = manager.get_history_count();
+        auto start = bench_clock::now();
+        manager.add_entry_multi_turn(message_of(writer, i), reply_of(i),
+                                     "You are a helpful assistant.", "deepseek-chat");
+        samples.push_back(elapsed_ms(start));
+        // 不调用refresh或save_history，刚添加的条目也应可见（其他进程的条目只会使计数更大）
+        auto last = manager.get_session_history(manager.get_current_session_id(), 1);
+        if (manager.get_history_count() <= before || last.empty() ||
+            last.back().user_message != message_of(writer, i)) {
+            result.unseen++;
+        }
+        if ((i + 1) % kSaveEvery == 0) {
+            manager.save_history(); // 可能压缩，与其他进程的追加交错
+        }
+    }
+    manager.save_history();
+    summarize(samples, result);
+    return result;
+}
+
+static WorkerResult run_reader(const std::string& path, size_t expected) {
+    HistoryManager manager(path, INT_MAX);
+    manager.set_retention(stress_retention());
+    manager.load_history();
+    WorkerResult result;
+    std::vector<double> samples;
+    size_t last = manager.get_history_count();
+    auto deadline = bench_clock::now() + kReaderTimeout;
+    while (last < expected && bench_clock::now() < deadline) {
+        auto start = bench_clock::now();
+        manager.refresh();
+        samples.push_back(elapsed_ms(start));
+        size_t count = manager.get_history_count();
+        if (count < last) {
+            result.violations++;
+        }
+        last = count;
+        usleep(1000);
+    }
+    summarize(samples, result);
+    result.last_count = last;
+    return result;
+}
+
+// 在子进程中运行worker，结果写入管道后退出
+template <typename Worker>
+static pid_t spawn(int& read_fd, Worker&& worker) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        WorkerResult result = worker();
+        ssize_t written = write(fds[1], &result, sizeof(result));
+        _exit(written == static_cast<ssize_t>(sizeof(result)) ? 0 : 1);
+    }
+    close(fds[1]);
+    read_fd = fds[0];
+    return pid;
+}
+
+static bool collect(pid_t pid, int read_fd, WorkerResult& result) {
+    bool ok = read(read_fd, &result, sizeof(result)) == static_cast<ssize_t>(sizeof(result));
+    close(read_fd);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char** argv) {
+    int writers = argc > 1 ? std::stoi(argv[1]) : 8;
+    size_t per_writer = argc > 2 ? std::stoul(argv[2]) : 500;
+    size_t expected = static_cast<size_t>(writers) * per_writer;
+
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "gf_bench_history_concurrent";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    std::string path = (dir / "history.gfh").string();
+    {
+        // 先创建空的历史，所有进程从同一份存储开始
+        HistoryManager manager(path, INT_MAX);
+        manager.load_history();
+    }
+
+    // 子进程在fork之后才创建HistoryManager（及其后台线程）
+    auto start = bench_clock::now();
+    int reader_fd = -1;
+    pid_t reader = spawn(reader_fd, [&] { return run_reader(path, expected); });
+    std::vector<std::pair<pid_t, int>> children;
+    for (int w = 0; w < writers; ++w) {
+        int fd = -1;
+        pid_t pid = spawn(fd, [&, w] { return run_writer(path, w, per_writer); });
+        children.emplace_back(pid, fd);
+    }
+    bool workers_ok = true;
+    WorkerResult total;
+    std::vector<double> p99s;
+    for (const auto& child : children) {
+        WorkerResult result;
+        workers_ok = collect(child.first, child.second, result) && workers_ok;
+        total.mean_ms += result.mean_ms / writers;
+        total.unseen += result.unseen;
+        p99s.push_back(result.p99_ms);
+    }
+    double write_ms = elapsed_ms(start);
+    WorkerResult reader_result;
+    workers_ok = collect(reader, reader_fd, reader_result) && workers_ok;
+
+    // 重新加载，检查每个写进程的条目
+    HistoryManager manager(path, INT_MAX);
+    manager.set_retention(stress_retention());
+    manager.load_history();
+    std::vector<std::vector<int>> seen(writers, std::vector<int>(per_writer, 0));
+    std::vector<long> previous(writers, -1);
+    size_t out_of_order = 0;
+    size_t foreign = 0;
+    for (const auto& entry : manager.get_history()) {
+        int writer = -1;
+        long index = -1;
+        if (std::sscanf(entry.user_message.c_str(), "writer %d entry %ld", &writer, &index) != 2 ||
+            writer < 0 || writer >= writers || index < 0 || static_cast<size_t>(index) >= per_writer) {
+            foreign++;
+            continue;
+        }
+        seen[writer][index]++;
+        if (index <= previous[writer]) {
+            out_of_order++;
+        }
+        previous[writer] = index;
+    }
+    size_t lost = 0;
+    size_t duplicated = 0;
+    for (const auto& counts : seen) {
+        for (int count : counts) {
+            lost += count == 0;
+            duplicated += count > 1;
+        }
+    }
+    // 抽查全文索引
+    size_t unsearchable = 0;
+    size_t probes = 0;
+    for (int w = 0; w < writers; ++w) {
+        for (size_t i = w % 7; i < per_writer; i += 37) {
+            probes++;
+            std::string token = "w" + std::to_string(w) + "x" + std::to_string(i);
+            auto results = manager.search(token, 1);
+            if (results.empty() || manager.get_entry(results[0].index).user_message != message_of(w, i)) {
+                unsearchable++;
+            }
+        }
+    }
+
+    std::cout << "writers\tentries\twrite_ms\tappends_per_s\tappend_mean_ms\tappend_p99_ms"
+              << "\trefreshes\trefresh_mean_ms\treader_seen" << std::endl;
+    std::cout << writers << "\t" << expected << "\t" << write_ms << "\t"
+              << expected / (write_ms / 1000) << "\t" << total.mean_ms << "\t"
+              << *std::max_element(p99s.begin(), p99s.end()) << "\t" << reader_result.operations
+              << "\t" << reader_result.mean_ms << "\t" << reader_result.last_count << std::endl;
+    std::cout << "\nloaded\tlost\tduplicated\tout_of_order\tforeign\tunsearchable\treader_regressions"
+              << "\tunseen_after_add" << std::endl;
+    std::cout << manager.get_history_count() << "\t" << lost << "\t" << duplicated << "\t"
+              << out_of_order << "\t" << foreign << "\t" << unsearchable << "/" << probes << "\t"
+              << reader_result.violations << "\t" << total.unseen << std::endl;
+
+    bool ok = workers_ok && lost == 0 && duplicated == 0 && out_of_order == 0 && foreign == 0 &&
+              unsearchable == 0 && reader_result.violations == 0 && total.unseen == 0 &&
+              reader_result.last_count == expected && manager.get_history_count() == expected;
+    std::cout << (ok ? "\nOK" : "\nFAILED") << std::endl;
+    std::filesystem::remove_all(dir);
+    return ok ? 0 : 1;
+}
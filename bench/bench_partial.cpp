@@ -0,0 +1,141 @@
+// 部分回复跟踪基准：模拟流式接收一个N个token的回复，比较每个token后把累计内容
+// 整体复制给全局状态（旧实现）与追加到PartialResponse的耗时和复制的字节数
+// 用法: bench_partial [tokens...]   默认: 1000 10000
+#include "partial_response.hpp"
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+// 中英文混合的增量内容，与真实回复的token长度相近
+static std::vector<std::string> make_tokens(size_t count) {
+  static const char *pieces[] = {"移动", "语义", " the", " value", "，", " std", "::", "move", "\n", " of"};
+  std::vector<std::string> tokens;
+  tokens.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    tokens.emplace_back(pieces[(i * 7) % 10]);
+  }
+  return tokens;
+}
+
+struct Result {
+  double ms = 0.0;
+  double copied_mb = 0.0; // 为跟踪部分回复而复制的字节数
+};
+
+// 旧实现：累计内容追加后，再把整个回复复制一份给全局状态
+static Result run_legacy(const std::vector<std::string> &tokens) {
+  Result result;
+  std::string content;
+  std::string current_assistant_response;
+  size_t copied = 0;
+  auto start = bench_clock::now();
+  for (const std::string &token : tokens) {
+    content += token;
+    current_assistant_response = content;
+    copied += content.size();
+  }
+  result.ms = std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+  result.copied_mb = static_cast<double>(copied) / (1024.0 * 1024.0);
+  if (current_assistant_response.size() != content.size()) {
+    std::cerr << "unexpected size" << std::endl;
+  }
+  return result;
+}
+
+static Result run_partial(const std::vector<std::string> &tokens, PartialResponse &partial) {
+  Result result;
+  std::string content;
+  size_t copied = 0;
+  partial.clear();
+  auto start = bench_clock::now();
+  for (const std::string &token : tokens) {
+    content += token;
+    partial.append(token);
+    copied += token.size();
+  }
+  result.ms = std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+  result.copied_mb = static_cast<double>(copied) / (1024.0 * 1024.0);
+  return result;
+}
+
+// 写入的同时在另一个线程反复取快照，每个快照都必须是最终内容的前缀
+static bool verify_concurrent_snapshots(const std::vector<std::string> &tokens) {
+  std::string expected;
+  for (const std::string &token : tokens) {
+    expected += token;
+  }
+  PartialResponse partial;
+  std::atomic<bool> started{false};
+  std::atomic<bool> done{false};
+  bool prefix_ok = true;
+  size_t snapshots = 0;
+  std::thread reader([&] {
+    started.store(true);
+    do {
+      std::string snapshot = partial.snapshot();
+      if (expected.compare(0, snapshot.size(), snapshot) != 0) {
+        prefix_ok = false;
+      }
+      snapshots++;
+    } while (!done.load());
+  });
+  // 读取线程开始取快照之后才写入，否则写入可能在第一次快照之前就已结束
+  while (!started.load()) {
+    std::this_thread::yield();
+  }
+  for (const std::string &token : tokens) {
+    partial.append(token);
+  }
+  done.store(true);
+  reader.join();
+  if (!prefix_ok) {
+    std::cerr << "PartialResponse snapshot is not a prefix of the streamed content" << std::endl;
+    return false;
+  }
+  if (partial.snapshot() != expected) {
+    std::cerr << "PartialResponse final snapshot differs from the streamed content" << std::endl;
+    return false;
+  }
+  if (snapshots == 0) {
+    std::cerr << "Reader thread took no snapshots" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  std::vector<size_t> sizes;
+  for (int i = 1; i < argc; ++i) {
+    sizes.push_back(std::stoul(argv[i]));
+  }
+  if (sizes.empty()) {
+    sizes = {1000, 10000};
+  }
+
+  if (!verify_concurrent_snapshots(make_tokens(200000))) {
+    return 1;
+  }
+
+  PartialResponse partial;
+  std::cout << "tokens\tbytes\tlegacy_ms\tlegacy_copied_mb\tpartial_ms\tpartial_copied_mb\t"
+               "speedup\tsnapshot_us"
+            << std::endl;
+  for (size_t count : sizes) {
+    std::vector<std::string> tokens = make_tokens(count);
+    Result legacy = run_legacy(tokens);
+    Result buffered = run_partial(tokens, partial);
+    auto start = bench_clock::now();
+    std::string snapshot = partial.snapshot();
+    double snapshot_us =
+        std::chrono::duration<double, std::micro>(bench_clock::now() - start).count();
+    std::cout << count << "\t" << snapshot.size() << "\t" << legacy.ms << "\t"
+              << legacy.copied_mb << "\t" << buffered.ms << "\t" << buffered.copied_mb << "\t"
+              << (legacy.ms / buffered.ms) << "\t" << snapshot_us << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,191 @@
+// 请求序列化基准：模拟一个N轮的多轮会话，每轮都生成一次请求体。
+// 对比旧实现（把整个messages复制进Json::Value再整体writeString）与Conversation+RequestBuilder（只转换新消息）
+// 用法: bench_request [turns...]   默认: 10 100 1000
+#include "request_builder.hpp"
+#include <json/json.h>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+static const std::string kSystemPrompt = "You are a helpful assistant.";
+
+static std::string make_question(size_t turn) {
+  return "第" + std::to_string(turn) + "个问题：请解释一下C++中的移动语义，\"rvalue\"和\\n的区别？";
+}
+
+static std::string make_answer(size_t turn) {
+  std::string answer = "移动语义允许资源的所有权从一个对象转移到另一个对象。\n```cpp\nstd::vector<int> v2 = std::move(v1);\n```\n";
+  while (answer.size() < 1200) {
+    answer += "Moving leaves the source in a valid but unspecified state. ";
+  }
+  return answer + std::to_string(turn);
+}
+
+// 旧实现：messages是Json数组，每轮复制进请求对象并整体序列化
+static std::string legacy_build(const Json::Value &messages, bool stream) {
+  Json::Value request_body;
+  request_body["model"] = "deepseek-chat";
+  request_body["temperature"] = 0.7;
+  request_body["stream"] = stream;
+  request_body["messages"] = messages;
+  Json::StreamWriterBuilder writer;
+  return Json::writeString(writer, request_body);
+}
+
+struct Result {
+  double total_ms = 0;     // 整个会话所有轮次的序列化耗时
+  double last_turn_us = 0; // 最后一轮的耗时
+  size_t last_bytes = 0;   // 最后一轮的请求体大小
+};
+
+static Result run_legacy(size_t turns) {
+  Result result;
+  Json::Value messages(Json::arrayValue);
+  Json::Value system_message;
+  system_message["role"] = "system";
+  system_message["content"] = kSystemPrompt;
+  messages.append(system_message);
+  for (size_t turn = 0; turn < turns; ++turn) {
+    auto start = bench_clock::now();
+    Json::Value user_message;
+    user_message["role"] = "user";
+    user_message["content"] = make_question(turn);
+    messages.append(user_message);
+    std::string body = legacy_build(messages, true);
+    double us = std::chrono::duration<double, std::micro>(bench_clock::now() - start).count();
+    result.total_ms += us / 1000.0;
+    result.last_turn_us = us;
+    result.last_bytes = body.size();
+
+    Json::Value assistant_message;
+    assistant_message["role"] = "assistant";
+    assistant_message["content"] = make_answer(turn);
+    messages.append(assistant_message);
+  }
+  return result;
+}
+
+static Result run_builder(size_t turns) {
+  Result result;
+  Conversation conversation;
+  RequestBuilder builder;
+  conversation.set_system_prompt(kSystemPrompt);
+  for (size_t turn = 0; turn < turns; ++turn) {
+    std::string question = make_question(turn);
+    auto start = bench_clock::now();
+    conversation.append(Role::User, question);
+    std::string_view body = builder.build(conversation, "deepseek-chat", 0.7, true);
+    double us = std::chrono::duration<double, std::micro>(bench_clock::now() - start).count();
+    result.total_ms += us / 1000.0;
+    result.last_turn_us = us;
+    result.last_bytes = body.size();
+
+    conversation.append(Role::Assistant, make_answer(turn));
+  }
+  return result;
+}
+
+// 会话进行到第turns轮时替换系统提示并发送下一个请求的耗时
+static double legacy_swap_us(size_t turns) {
+  Json::Value messages(Json::arrayValue);
+  Json::Value system_message;
+  system_message["role"] = "system";
+  system_message["content"] = kSystemPrompt;
+  messages.append(system_message);
+  for (size_t turn = 0; turn < turns; ++turn) {
+    Json::Value user_message;
+    user_message["role"] = "user";
+    user_message["content"] = make_question(turn);
+    messages.append(user_message);
+    Json::Value assistant_message;
+    assistant_message["role"] = "assistant";
+    assistant_message["content"] = make_answer(turn);
+    messages.append(assistant_message);
+  }
+  legacy_build(messages, true);
+  auto start = bench_clock::now();
+  // 旧的set_system_prompt：逐条比较role，删除后插入到开头
+  for (Json::Value::ArrayIndex i = 0; i < messages.size(); ++i) {
+    if (messages[i]["role"].asString() == "system") {
+      messages.removeIndex(i, nullptr);
+    }
+  }
+  system_message["content"] = "You are a terse assistant.";
+  messages.insert(0, system_message);
+  legacy_build(messages, true);
+  return std::chrono::duration<double, std::micro>(bench_clock::now() - start).count();
+}
+
+static double builder_swap_us(size_t turns) {
+  Conversation conversation;
+  RequestBuilder builder;
+  conversation.set_system_prompt(kSystemPrompt);
+  for (size_t turn = 0; turn < turns; ++turn) {
+    conversation.append(Role::User, make_question(turn));
+    conversation.append(Role::Assistant, make_answer(turn));
+  }
+  builder.build(conversation, "deepseek-chat", 0.7, true);
+  auto start = bench_clock::now();
+  conversation.set_system_prompt("You are a terse assistant.");
+  builder.build(conversation, "deepseek-chat", 0.7, true);
+  return std::chrono::duration<double, std::micro>(bench_clock::now() - start).count();
+}
+
+int main(int argc, char **argv) {
+  std::vector<size_t> sizes;
+  for (int i = 1; i < argc; ++i) {
+    sizes.push_back(std::stoul(argv[i]));
+  }
+  if (sizes.empty()) {
+    sizes = {10, 100, 1000};
+  }
+
+  // 两种实现解析后应得到相同的请求
+  {
+    Json::Value messages(Json::arrayValue);
+    Conversation conversation;
+    RequestBuilder builder;
+    for (size_t turn = 0; turn < 3; ++turn) {
+      Json::Value message;
+      message["role"] = turn % 2 ? "assistant" : "user";
+      message["content"] = turn % 2 ? make_answer(turn) : make_question(turn) + "\x01\t\r";
+      messages.append(message);
+      conversation.append(turn % 2 ? Role::Assistant : Role::User, message["content"].asString());
+    }
+    // 先构建一次再设置系统提示，同时检查已转换的消息之前插入系统消息的情况
+    builder.build(conversation, "deepseek-chat", 0.7, true);
+    Json::Value system_message;
+    system_message["role"] = "system";
+    system_message["content"] = kSystemPrompt;
+    messages.insert(0, system_message);
+    conversation.set_system_prompt(kSystemPrompt);
+    Json::CharReaderBuilder reader_builder;
+    std::unique_ptr<Json::CharReader> reader(reader_builder.newCharReader());
+    std::string legacy = legacy_build(messages, true);
+    std::string_view built = builder.build(conversation, "deepseek-chat", 0.7, true);
+    Json::Value a, b;
+    std::string errors;
+    if (!reader->parse(legacy.data(), legacy.data() + legacy.size(), &a, &errors) ||
+        !reader->parse(built.data(), built.data() + built.size(), &b, &errors) || !(a == b)) {
+      std::cerr << "RequestBuilder output differs from Json::writeString: " << errors << std::endl;
+      return 1;
+    }
+  }
+
+  std::cout << "turns\tlegacy_total_ms\tbuilder_total_ms\tlegacy_last_us\tbuilder_last_us\t"
+               "legacy_bytes\tbuilder_bytes\tspeedup\tlegacy_swap_us\tbuilder_swap_us"
+            << std::endl;
+  for (size_t turns : sizes) {
+    Result legacy = run_legacy(turns);
+    Result builder = run_builder(turns);
+    std::cout << turns << "\t" << legacy.total_ms << "\t" << builder.total_ms << "\t"
+              << legacy.last_turn_us << "\t" << builder.last_turn_us << "\t" << legacy.last_bytes
+              << "\t" << builder.last_bytes << "\t" << (legacy.total_ms / builder.total_ms) << "\t"
+              << legacy_swap_us(turns) << "\t" << builder_swap_us(turns) << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,103 @@
+// 重试与对冲基准：对注入故障的本地替身服务器执行完整的deepseek::ask，
+// 比较不同策略下的成功率和延迟分位数
+// 用法: bench_retry [requests]   默认: 200
+#include "deepseek.hpp"
+#include "mock_server.hpp"
+#include "output_silencer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+struct Scenario {
+  const char *name;
+  MockServerOptions server;
+  RetryPolicy policy;
+};
+
+struct Result {
+  size_t succeeded = 0;
+  std::vector<double> latencies_ms; // 包括失败的请求
+};
+
+static double percentile(std::vector<double> samples, double p) {
+  if (samples.empty())
+    return 0.0;
+  std::sort(samples.begin(), samples.end());
+  size_t rank = static_cast<size_t>(p * static_cast<double>(samples.size()) + 0.5);
+  return samples[std::min(samples.size() - 1, rank == 0 ? 0 : rank - 1)];
+}
+
+static Result run(const Scenario &scenario, int requests) {
+  MockServer server(scenario.server);
+  server.start();
+  Result result;
+  {
+    OutputSilencer silence_stdout(STDOUT_FILENO);
+    OutputSilencer silence_stderr(STDERR_FILENO); // [retry]提示
+    deepseek client("bench-key", true);
+    client.set_endpoint(server.endpoint());
+    client.set_retry_policy(scenario.policy);
+    for (int i = 0; i < requests; ++i) {
+      auto start = bench_clock::now();
+      try {
+        if (!client.ask("deepseek-chat", "ping", false).empty()) {
+          result.succeeded++;
+        }
+      } catch (const std::exception &) {
+        // 重试之后仍然失败
+      }
+      result.latencies_ms.push_back(
+          std::chrono::duration<double, std::milli>(bench_clock::now() - start).count());
+    }
+  }
+  server.stop();
+  return result;
+}
+
+int main(int argc, char **argv) {
+  int requests = argc > 1 ? std::stoi(argv[1]) : 200;
+
+  // 瞬时故障：20%的请求返回503，不带Retry-After，使用较短的退避
+  MockServerOptions flaky;
+  flaky.tokens = 16;
+  flaky.failure_rate = 0.2;
+  flaky.failure_status = 503;
+  flaky.retry_after = -1;
+  RetryPolicy no_retry;
+  no_retry.max_attempts = 1;
+  RetryPolicy retry;
+  retry.base_delay_ms = 10;
+  retry.max_delay_ms = 100;
+
+  // 长尾延迟：5%的请求在响应前卡住300ms
+  MockServerOptions stalls;
+  stalls.tokens = 16;
+  stalls.latency_ms = 5;
+  stalls.stall_rate = 0.05;
+  stalls.stall_ms = 300;
+  RetryPolicy hedge = no_retry;
+  hedge.hedge_after_ms = 30;
+
+  const Scenario scenarios[] = {
+      {"503 20%, no retry", flaky, no_retry},
+      {"503 20%, 3 attempts", flaky, retry},
+      {"stall 5%, no hedge", stalls, no_retry},
+      {"stall 5%, hedge 30ms", stalls, hedge},
+  };
+
+  std::cout << "requests per scenario: " << requests << std::endl;
+  std::cout << "scenario\tsuccess_rate\tp50_ms\tp99_ms\tmax_ms" << std::endl;
+  for (const Scenario &scenario : scenarios) {
+    Result result = run(scenario, requests);
+    std::cout << scenario.name << "\t"
+              << static_cast<double>(result.succeeded) / static_cast<double>(requests) << "\t"
+              << percentile(result.latencies_ms, 0.50) << "\t"
+              << percentile(result.latencies_ms, 0.99) << "\t"
+              << percentile(result.latencies_ms, 1.0) << std::endl;
+  }
+  return 0;
+}
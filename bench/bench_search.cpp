@@ -0,0 +1,129 @@
+// 全文搜索基准：对比逐条扫描的search_history与倒排索引search的查询延迟
+// 用法: bench_search [entries...]   默认: 1000 10000 100000
+#include "history.hpp"
+#include "history_journal.hpp"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+static const std::vector<std::string> kChineseWords = {
+    "移动语义", "智能指针", "模板", "编译器", "内存", "线程", "并发", "数据库", "索引", "缓存",
+    "网络", "协议", "性能", "优化", "算法", "排序", "哈希表", "链表", "异常", "接口",
+    "容器", "迭代器", "析构函数", "构造函数", "虚函数", "继承", "多态", "锁", "队列", "文件",
+};
+static const std::vector<std::string> kEnglishWords = {
+    "rvalue", "reference", "unique_ptr", "shared_ptr", "template", "mutex", "thread", "vector",
+    "allocator", "lambda", "constexpr", "coroutine", "socket", "epoll", "benchmark", "latency",
+    "throughput", "cache", "index", "query", "kernel", "buffer", "stream", "parser", "json",
+};
+
+static std::string make_text(std::mt19937& rng, size_t words) {
+    std::string text;
+    for (size_t i = 0; i < words; ++i) {
+        if (rng() % 3 == 0) {
+            text += kEnglishWords[rng() % kEnglishWords.size()] + " ";
+        } else {
+            text += kChineseWords[rng() % kChineseWords.size()];
+            text += (rng() % 4 == 0) ? "，" : "的";
+        }
+    }
+    return text;
+}
+
+static std::vector<HistoryEntry> make_entries(size_t count) {
+    std::mt19937 rng(42);
+    std::vector<HistoryEntry> entries;
+    entries.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        entries.emplace_back(make_text(rng, 12), make_text(rng, 80), "You are a helpful assistant.",
+                             "deepseek-chat", "session_20250613_143022_" + std::to_string(i / 10),
+                             static_cast<int>(i % 10) + 1);
+    }
+    return entries;
+}
+
+static double elapsed_ms(bench_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+    std::vector<size_t> sizes;
+    for (int i = 1; i < argc; ++i) {
+        sizes.push_back(std::stoul(argv[i]));
+    }
+    if (sizes.empty()) {
+        sizes = {1000, 10000, 100000};
+    }
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "gf_bench_search";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+
+    // 常见词、稀有组合、短语和单个字（由包含它的二元组合并）；线性扫描只能做单个子串匹配
+    const std::vector<std::string> queries = {"移动语义", "unique_ptr", "哈希表", "epoll", "析构函数", "锁"};
+    const int rounds = 5;
+
+    std::cout << "entries\tindex_build_ms\tindex_reload_ms\tlinear_query_ms\tindex_query_ms\tspeedup\tindex_bytes"
+              << std::endl;
+    for (size_t count : sizes) {
+        std::string journal_path = (dir / "history.gfh").string();
+        {
+            auto entries = make_entries(count);
+            HistoryJournal journal(journal_path);
+            HistoryColumns columns;
+            journal.rewrite(entries, columns);
+        }
+
+        // 首次搜索时从日志分词建立索引
+        double build_ms = 0;
+        {
+            HistoryManager manager(journal_path, static_cast<int>(count));
+            manager.load_history();
+            auto start = bench_clock::now();
+            manager.search("warmup");
+            build_ms = elapsed_ms(start);
+        }
+
+        // 之后的进程直接加载索引文件
+        HistoryManager manager(journal_path, static_cast<int>(count));
+        manager.load_history();
+        auto start = bench_clock::now();
+        manager.search("warmup");
+        double reload_ms = elapsed_ms(start);
+
+        size_t linear_hits = 0;
+        start = bench_clock::now();
+        for (int round = 0; round < rounds; ++round) {
+            for (const auto& query : queries) {
+                linear_hits += manager.search_history(query).size();
+            }
+        }
+        double linear_ms = elapsed_ms(start) / (rounds * queries.size());
+
+        size_t index_hits = 0;
+        start = bench_clock::now();
+        for (int round = 0; round < rounds; ++round) {
+            for (const auto& query : queries) {
+                index_hits += manager.search(query).size();
+            }
+        }
+        double index_ms = elapsed_ms(start) / (rounds * queries.size());
+        if (index_hits != linear_hits) {
+            std::cerr << "Warning: result count differs (linear " << linear_hits
+                      << ", index " << index_hits << ")" << std::endl;
+        }
+
+        std::cout << count << "\t" << build_ms << "\t" << reload_ms << "\t" << linear_ms << "\t"
+                  << index_ms << "\t" << (linear_ms / index_ms) << "\t"
+                  << std::filesystem::file_size(journal_path + ".fts") << std::endl;
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(dir);
+    }
+    std::filesystem::remove_all(dir);
+    return 0;
+}
@@ -0,0 +1,152 @@
+// SSE流解析微基准：回放一段录制的流式响应，对比旧的逐行DOM解析与SseParser
+// 用法: bench_sse [recorded_stream.txt] [iterations]
+#include "sse_parser.hpp"
+#include <json/json.h>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// 旧实现：每行构建CharReaderBuilder、istringstream和完整的Json::Value
+static std::string legacy_extract(const std::string &line) {
+  if (line.find("data: ") != 0)
+    return "";
+  std::string json_part = line.substr(6);
+  Json::CharReaderBuilder reader;
+  Json::Value root;
+  std::string errors;
+  std::istringstream json_stream(json_part);
+  if (!Json::parseFromStream(reader, json_stream, &root, &errors))
+    return "";
+  if (root.isMember("choices") && root["choices"].isArray() &&
+      !root["choices"].empty()) {
+    const auto &choice = root["choices"][0];
+    if (choice.isMember("delta") && choice["delta"].isMember("content")) {
+      return choice["delta"]["content"].asString();
+    }
+  }
+  return "";
+}
+
+// 旧的WriteCallback主体：追加到缓冲区并逐行substr
+static size_t legacy_feed(std::string &data, const char *chunk, size_t len,
+                          std::string &full_content) {
+  size_t tokens = 0;
+  data.append(chunk, len);
+  size_t pos = 0;
+  while (true) {
+    size_t next = data.find("\n", pos);
+    if (next == std::string::npos)
+      break;
+    std::string line = data.substr(pos, next - pos);
+    std::string content = legacy_extract(line);
+    if (!content.empty()) {
+      full_content += content;
+      tokens++;
+    }
+    pos = next + 1;
+  }
+  if (pos > 0)
+    data.erase(0, pos);
+  return tokens;
+}
+
+// 生成一段与DeepSeek格式一致的流，包含中文、转义字符和\u转义
+static std::string make_stream(size_t tokens) {
+  static const char *pieces[] = {
+      "你好", "，", "这是", "一个", "测试", "。", "Hello", " world",
+      "\\n", "\\\"quoted\\\"", "\\u4f60\\u597d", "\\ud83d\\ude00", "代码",
+      "```cpp", "int main()", "{", "}", "\\t", "数据", "流"};
+  std::string out;
+  for (size_t i = 0; i < tokens; ++i) {
+    out += "data: {\"id\":\"3f0c1e5a-bench\",\"object\":\"chat.completion.chunk\","
+           "\"created\":1718000000,\"model\":\"deepseek-chat\","
+           "\"system_fingerprint\":\"fp_bench\",\"choices\":[{\"index\":0,"
+           "\"delta\":{\"content\":\"";
+    out += pieces[i % (sizeof(pieces) / sizeof(pieces[0]))];
+    out += "\"},\"logprobs\":null,\"finish_reason\":null}]}\n\n";
+  }
+  out += "data: [DONE]\n\n";
+  return out;
+}
+
+// 按伪随机大小切分，模拟网络回调边界
+static std::vector<std::pair<size_t, size_t>> split_chunks(const std::string &s) {
+  std::vector<std::pair<size_t, size_t>> chunks;
+  unsigned long state = 12345;
+  size_t pos = 0;
+  while (pos < s.size()) {
+    state = state * 1103515245 + 12345;
+    size_t len = 1 + (state >> 16) % 512;
+    len = std::min(len, s.size() - pos);
+    chunks.emplace_back(pos, len);
+    pos += len;
+  }
+  return chunks;
+}
+
+int main(int argc, char **argv) {
+  std::string stream;
+  if (argc > 1) {
+    std::ifstream in(argv[1], std::ios::binary);
+    if (!in) {
+      std::cerr << "Cannot open recorded stream: " << argv[1] << std::endl;
+      return 1;
+    }
+    std::stringstream ss;
+    ss << in.rdbuf();
+    stream = ss.str();
+  } else {
+    stream = make_stream(20000);
+  }
+  int iterations = argc > 2 ? std::stoi(argv[2]) : 20;
+  auto chunks = split_chunks(stream);
+
+  using clock = std::chrono::steady_clock;
+  std::string legacy_content, parser_content;
+  size_t legacy_tokens = 0, parser_tokens = 0;
+
+  auto start = clock::now();
+  for (int it = 0; it < iterations; ++it) {
+    std::string buffer;
+    legacy_content.clear();
+    legacy_tokens = 0;
+    for (const auto &c : chunks)
+      legacy_tokens += legacy_feed(buffer, stream.data() + c.first, c.second,
+                                   legacy_content);
+  }
+  double legacy_s = std::chrono::duration<double>(clock::now() - start).count();
+
+  start = clock::now();
+  for (int it = 0; it < iterations; ++it) {
+    SseParser parser;
+    parser_content.clear();
+    parser_tokens = 0;
+    for (const auto &c : chunks)
+      parser_tokens += parser.feed(
+          std::string_view(stream.data() + c.first, c.second),
+          [&](std::string_view content) {
+            parser_content.append(content.data(), content.size());
+          });
+  }
+  double parser_s = std::chrono::duration<double>(clock::now() - start).count();
+
+  if (legacy_content != parser_content || legacy_tokens != parser_tokens) {
+    std::cerr << "Mismatch between legacy and SseParser output!" << std::endl;
+    return 1;
+  }
+
+  double legacy_rate = legacy_tokens * iterations / legacy_s;
+  double parser_rate = parser_tokens * iterations / parser_s;
+  std::cout << "stream bytes: " << stream.size() << ", chunks: " << chunks.size()
+            << ", tokens: " << parser_tokens << ", iterations: " << iterations
+            << std::endl;
+  std::cout << "legacy (Json::Value per line): " << static_cast<long>(legacy_rate)
+            << " tokens/s" << std::endl;
+  std::cout << "SseParser (string_view):       " << static_cast<long>(parser_rate)
+            << " tokens/s" << std::endl;
+  std::cout << "speedup: " << parser_rate / legacy_rate << "x" << std::endl;
+  return 0;
+}
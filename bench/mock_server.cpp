@@ -0,0 +1,376 @@
+#include "mock_server.hpp"
+#include <json/json.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <stdexcept>
+
+namespace {
+
+// 回复内容的固定片段，覆盖中文、表情、引号、换行和制表符等需要转义的字符
+const char *const kPieces[] = {
+    "你好", "，", "这是", "一个", "测试", "。", "Hello", " world", "\n",
+    "\"quoted\"", "😀", "代码", "```cpp", "int main()", "{", "}", "\t",
+    "数据", "流"};
+const size_t kPieceCount = sizeof(kPieces) / sizeof(kPieces[0]);
+
+void append_json_string(std::string &out, const std::string &text) {
+  out += '"';
+  for (unsigned char c : text) {
+    switch (c) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    case '\t':
+      out += "\\t";
+      break;
+    case '\r':
+      out += "\\r";
+      break;
+    default:
+      if (c < 0x20) {
+        char escaped[8];
+        std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+        out += escaped;
+      } else {
+        out += static_cast<char>(c);
+      }
+    }
+  }
+  out += '"';
+}
+
+bool send_all(int fd, const std::string &data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    sent += static_cast<size_t>(n);
+  }
+  return true;
+}
+
+std::string http_chunk(const std::string &data) {
+  char size[32];
+  std::snprintf(size, sizeof(size), "%zx\r\n", data.size());
+  return size + data + "\r\n";
+}
+
+const char *status_text(int status) {
+  switch (status) {
+  case 200:
+    return "OK";
+  case 400:
+    return "Bad Request";
+  case 404:
+    return "Not Found";
+  case 429:
+    return "Too Many Requests";
+  case 502:
+    return "Bad Gateway";
+  case 503:
+    return "Service Unavailable";
+  default:
+    return "Internal Server Error";
+  }
+}
+
+// 大小写不敏感地查找请求头的值
+std::string header_value(const std::string &headers, const std::string &name) {
+  std::string lower = headers;
+  std::transform(lower.begin(), lower.end(), lower.begin(),
+                 [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+  std::string key = "\r\n" + name + ":";
+  size_t pos = lower.find(key);
+  if (pos == std::string::npos) {
+    return "";
+  }
+  pos += key.size();
+  size_t end = headers.find("\r\n", pos);
+  std::string value = headers.substr(pos, end - pos);
+  size_t first = value.find_first_not_of(' ');
+  return first == std::string::npos ? "" : value.substr(first);
+}
+
+} // namespace
+
+MockServer::MockServer(const MockServerOptions &options)
+    : options(options), listen_fd(-1), bound_port(0), running(false), requests(0) {
+  if (this->options.tokens_per_chunk == 0) {
+    this->options.tokens_per_chunk = 1;
+  }
+}
+
+MockServer::~MockServer() { stop(); }
+
+uint16_t MockServer::start() {
+  listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_fd < 0) {
+    throw std::runtime_error("socket() failed: " + std::string(std::strerror(errno)));
+  }
+  int reuse = 1;
+  ::setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(options.port);
+  if (::bind(listen_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 ||
+      ::listen(listen_fd, 128) < 0) {
+    std::string error = std::strerror(errno);
+    ::close(listen_fd);
+    listen_fd = -1;
+    throw std::runtime_error("Cannot listen on port " + std::to_string(options.port) +
+                             ": " + error);
+  }
+  socklen_t length = sizeof(address);
+  ::getsockname(listen_fd, reinterpret_cast<sockaddr *>(&address), &length);
+  bound_port = ntohs(address.sin_port);
+  running = true;
+  accept_thread = std::thread(&MockServer::accept_loop, this);
+  return bound_port;
+}
+
+void MockServer::stop() {
+  if (!running.exchange(false)) {
+    return;
+  }
+  // shutdown使阻塞在accept/recv中的线程立即返回
+  ::shutdown(listen_fd, SHUT_RDWR);
+  accept_thread.join();
+  ::close(listen_fd);
+  listen_fd = -1;
+  std::vector<std::thread> threads;
+  {
+    std::lock_guard<std::mutex> lock(connections_mutex);
+    for (int fd : connection_fds) {
+      ::shutdown(fd, SHUT_RDWR);
+    }
+    threads.swap(connection_threads);
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+std::string MockServer::endpoint() const {
+  return "http://127.0.0.1:" + std::to_string(bound_port) + "/v1/chat/completions";
+}
+
+void MockServer::accept_loop() {
+  while (running) {
+    int fd = ::accept(listen_fd, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    // 逐token写出的小包不能被Nagle算法攒起来，否则token间隔失真
+    int nodelay = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    std::lock_guard<std::mutex> lock(connections_mutex);
+    connection_fds.push_back(fd);
+    connection_threads.emplace_back(&MockServer::serve_connection, this, fd);
+  }
+}
+
+void MockServer::serve_connection(int fd) {
+  std::string buffer;
+  char chunk[16384];
+  bool keep_alive = true;
+  while (running && keep_alive) {
+    // 读取请求头
+    size_t header_end;
+    while ((header_end = buffer.find("\r\n\r\n")) == std::string::npos) {
+      ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+      if (n <= 0) {
+        keep_alive = false;
+        break;
+      }
+      buffer.append(chunk, static_cast<size_t>(n));
+    }
+    if (!keep_alive) {
+      break;
+    }
+    std::string headers = buffer.substr(0, header_end + 2);
+    size_t content_length = 0;
+    std::string length_value = header_value(headers, "content-length");
+    if (!length_value.empty()) {
+      content_length = std::stoul(length_value);
+    }
+    // 读取请求体
+    size_t body_start = header_end + 4;
+    while (buffer.size() < body_start + content_length) {
+      ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+      if (n <= 0) {
+        keep_alive = false;
+        break;
+      }
+      buffer.append(chunk, static_cast<size_t>(n));
+    }
+    if (!keep_alive) {
+      break;
+    }
+    std::string body = buffer.substr(body_start, content_length);
+    buffer.erase(0, body_start + content_length);
+
+    std::string connection = header_value(headers, "connection");
+    keep_alive = connection != "close" && connection != "Close";
+    if (headers.find("/chat/completions") == std::string::npos) {
+      std::string response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+      keep_alive = send_all(fd, response) && keep_alive;
+      continue;
+    }
+    uint64_t sequence = requests.fetch_add(1);
+    keep_alive = handle_request(fd, body, sequence) && keep_alive;
+  }
+  {
+    std::lock_guard<std::mutex> lock(connections_mutex);
+    connection_fds.erase(std::remove(connection_fds.begin(), connection_fds.end(), fd),
+                         connection_fds.end());
+  }
+  ::close(fd);
+}
+
+bool MockServer::handle_request(int fd, const std::string &body, uint64_t sequence) {
+  using clock = std::chrono::steady_clock;
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  Json::Value request;
+  std::string errors;
+  if (!reader->parse(body.data(), body.data() + body.size(), &request, &errors)) {
+    std::string error = "{\"error\":{\"message\":\"Invalid JSON\",\"type\":\"invalid_request_error\"}}";
+    return send_all(fd, "HTTP/1.1 400 Bad Request\r\nContent-Type: application/json\r\n"
+                        "Content-Length: " + std::to_string(error.size()) + "\r\n\r\n" + error);
+  }
+  bool stream = request.get("stream", false).asBool();
+  std::string model = request.get("model", "deepseek-chat").asString();
+  std::string last_message;
+  const Json::Value &messages = request["messages"];
+  if (messages.isArray() && !messages.empty()) {
+    last_message = messages[messages.size() - 1].get("content", "").asString();
+  }
+
+  thread_local std::mt19937_64 rng(std::random_device{}() ^ sequence);
+  auto chance = [](double rate) {
+    return rate > 0.0 && std::uniform_real_distribution<double>(0.0, 1.0)(rng) < rate;
+  };
+  double delay_ms = options.latency_ms;
+  if (chance(options.stall_rate)) {
+    delay_ms += options.stall_ms;
+  }
+  if (delay_ms > 0.0) {
+    std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(delay_ms));
+  }
+
+  bool fail = sequence < options.fail_first || chance(options.failure_rate);
+  if (fail && options.failure_status < 0) {
+    return false; // 不回复，直接断开连接
+  }
+  if (fail && options.failure_status != 0) {
+    std::string error = "{\"error\":{\"message\":\"Injected failure\",\"type\":\"server_error\"}}";
+    std::string response = "HTTP/1.1 " + std::to_string(options.failure_status) + " " +
+                           status_text(options.failure_status) +
+                           "\r\nContent-Type: application/json\r\n";
+    if ((options.failure_status == 429 || options.failure_status == 503) &&
+        options.retry_after >= 0) {
+      response += "Retry-After: " + std::to_string(options.retry_after) + "\r\n";
+    }
+    response += "Content-Length: " + std::to_string(error.size()) + "\r\n\r\n" + error;
+    return send_all(fd, response);
+  }
+  // failure_status为0时回复到一半断开连接
+  size_t tokens = fail ? options.tokens / 2 : options.tokens;
+
+  std::string id = "\"mock-" + std::to_string(sequence) + "\"";
+  std::string created = std::to_string(
+      std::chrono::duration_cast<std::chrono::seconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count());
+  auto token_text = [&](size_t i) {
+    return i == 0 ? "echo: " + last_message + " " : std::string(kPieces[i % kPieceCount]);
+  };
+
+  if (!stream) {
+    std::string content;
+    for (size_t i = 0; i < options.tokens; ++i) {
+      content += token_text(i);
+    }
+    std::string json = "{\"id\":" + id + ",\"object\":\"chat.completion\",\"created\":" +
+                       created + ",\"model\":";
+    append_json_string(json, model);
+    json += ",\"choices\":[{\"index\":0,\"message\":{\"role\":\"assistant\",\"content\":";
+    append_json_string(json, content);
+    json += "},\"finish_reason\":\"stop\"}],\"usage\":{\"prompt_tokens\":" +
+            std::to_string(body.size() / 4) +
+            ",\"completion_tokens\":" + std::to_string(options.tokens) +
+            ",\"total_tokens\":" + std::to_string(body.size() / 4 + options.tokens) + "}}";
+    std::string response = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+                           "Content-Length: " + std::to_string(json.size()) + "\r\n\r\n";
+    if (fail) {
+      send_all(fd, response + json.substr(0, json.size() / 2));
+      return false;
+    }
+    return send_all(fd, response + json);
+  }
+
+  if (!send_all(fd, "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+                    "Cache-Control: no-cache\r\nTransfer-Encoding: chunked\r\n\r\n")) {
+    return false;
+  }
+  std::string prefix = "data: {\"id\":" + id +
+                       ",\"object\":\"chat.completion.chunk\",\"created\":" + created +
+                       ",\"model\":";
+  append_json_string(prefix, model);
+  prefix += ",\"system_fingerprint\":\"fp_mock\",\"choices\":[{\"index\":0,\"delta\":{\"content\":";
+  const std::string suffix = "},\"logprobs\":null,\"finish_reason\":null}]}\n\n";
+
+  auto start = clock::now();
+  std::string events;
+  for (size_t i = 0; i < tokens; ++i) {
+    events += prefix;
+    append_json_string(events, token_text(i));
+    events += suffix;
+    bool last = i + 1 == tokens;
+    if ((i + 1) % options.tokens_per_chunk != 0 && !last) {
+      continue;
+    }
+    if (options.tokens_per_second > 0.0) {
+      std::this_thread::sleep_until(
+          start + std::chrono::duration_cast<clock::duration>(
+                      std::chrono::duration<double>(i / options.tokens_per_second)));
+    }
+    if (!running || !send_all(fd, http_chunk(events))) {
+      return false;
+    }
+    events.clear();
+  }
+  if (fail) {
+    return false; // 不发送结束标记，直接断开
+  }
+  return send_all(fd, http_chunk("data: {\"id\":" + id +
+                                 ",\"object\":\"chat.completion.chunk\",\"choices\":[{\"index\":0,"
+                                 "\"delta\":{},\"finish_reason\":\"stop\"}]}\n\n") +
+                          http_chunk("data: [DONE]\n\n") + "0\r\n\r\n");
+}
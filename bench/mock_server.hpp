@@ -0,0 +1,80 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief 本地替身服务器的行为参数
+ */
+struct MockServerOptions {
+  uint16_t port = 0;               // 监听端口，0表示由系统分配
+  size_t tokens = 64;              // 每个回复的token数
+  double tokens_per_second = 0.0;  // 流式输出速率，0表示不限速
+  size_t tokens_per_chunk = 1;     // 每次写出（一个HTTP chunk）包含的SSE事件数
+  double latency_ms = 0.0;         // 发送响应头之前的延迟，模拟排队和预填充
+  double failure_rate = 0.0;       // 请求失败的概率
+  size_t fail_first = 0;           // 前N个请求必定失败，用于可重复的重试测试
+  int failure_status = 500;        // 失败时的HTTP状态码，0表示回复到一半时断开连接，
+                                   // -1表示不回复直接断开连接
+  int retry_after = 1;             // 429/503附带的Retry-After秒数，-1表示不发送
+  double stall_rate = 0.0;         // 请求被额外拖延的概率，模拟长尾延迟
+  double stall_ms = 0.0;           // 被拖延的请求在响应头之前额外等待的时间
+};
+
+/**
+ * @brief 说 /v1/chat/completions 协议的本地替身服务器
+ *
+ * 支持流式（SSE，chunked编码）和非流式两种回复，格式与DeepSeek一致：
+ * 首个token回显最后一条消息，之后是包含中文、转义字符和\u转义的固定片段。
+ * 每个连接一个线程并支持keep-alive，因此可以用来测量客户端的连接复用。
+ * 仅用于基准测试和本地调试，不做任何鉴权。
+ */
+class MockServer {
+public:
+  explicit MockServer(const MockServerOptions &options);
+  ~MockServer();
+
+  MockServer(const MockServer &) = delete;
+  MockServer &operator=(const MockServer &) = delete;
+
+  /**
+   * @brief 开始监听并在后台线程中接受连接
+   * @return 实际监听的端口
+   * @throws std::runtime_error 无法监听时
+   */
+  uint16_t start();
+
+  /**
+   * @brief 停止服务，断开所有连接并等待线程退出
+   */
+  void stop();
+
+  /**
+   * @brief 客户端应使用的完整URL
+   */
+  std::string endpoint() const;
+
+  /**
+   * @brief 已处理的请求数
+   */
+  uint64_t requests_served() const { return requests.load(); }
+
+private:
+  MockServerOptions options;
+  int listen_fd;
+  uint16_t bound_port;
+  std::atomic<bool> running;
+  std::atomic<uint64_t> requests;
+  std::thread accept_thread;
+  std::mutex connections_mutex;
+  std::vector<int> connection_fds;
+  std::vector<std::thread> connection_threads;
+
+  void accept_loop();
+  void serve_connection(int fd);
+  // 处理一个请求，返回连接是否可以继续复用
+  bool handle_request(int fd, const std::string &body, uint64_t sequence);
+};
@@ -0,0 +1,84 @@
+// 本地DeepSeek替身服务器，用于在没有API密钥时调试客户端和跑端到端基准
+// 用法: mock_server [--port 8080] [--tokens 64] [--rate 0] [--chunk 1]
+//                   [--latency 0] [--fail-rate 0] [--fail-first 0] [--fail-status 500]
+//                   [--retry-after 1] [--stall-rate 0] [--stall-ms 0]
+// 客户端配置 "api_endpoint" 或使用 gf --endpoint 指向打印出的URL即可
+#include "arg_parser.hpp"
+#include "mock_server.hpp"
+#include <csignal>
+#include <iostream>
+#include <pthread.h>
+#include <string>
+
+int main(int argc, char **argv) {
+  arg_parser parser(argc, argv);
+  if (parser.has_option("--help") || parser.has_option("-h")) {
+    std::cout << "Usage: mock_server [options]\n"
+              << "  --port <num>         Port to listen on (default: 8080, 0 = any)\n"
+              << "  --tokens <num>       Tokens per response (default: 64)\n"
+              << "  --rate <tokens/s>    Streaming rate, 0 = unlimited (default: 0)\n"
+              << "  --chunk <num>        SSE events per network write (default: 1)\n"
+              << "  --latency <ms>       Delay before the response headers (default: 0)\n"
+              << "  --fail-rate <0..1>   Probability that a request fails (default: 0)\n"
+              << "  --fail-first <num>   Fail the first N requests (default: 0)\n"
+              << "  --fail-status <code> HTTP status of failures, 0 = drop the connection\n"
+              << "                       halfway through the response, -1 = drop it\n"
+              << "                       without responding; pass -1 as --fail-status=-1\n"
+              << "                       (default: 500)\n"
+              << "  --retry-after <s>    Retry-After sent with 429/503, -1 = none (default: 1)\n"
+              << "  --stall-rate <0..1>  Probability that a request is stalled (default: 0)\n"
+              << "  --stall-ms <ms>      Extra delay of stalled requests (default: 0)\n";
+    return 0;
+  }
+
+  MockServerOptions options;
+  options.port = 8080;
+  try {
+    if (parser.has_option("--port"))
+      options.port = static_cast<uint16_t>(std::stoul(parser.get_option_value("--port")));
+    if (parser.has_option("--tokens"))
+      options.tokens = std::stoul(parser.get_option_value("--tokens"));
+    if (parser.has_option("--rate"))
+      options.tokens_per_second = std::stod(parser.get_option_value("--rate"));
+    if (parser.has_option("--chunk"))
+      options.tokens_per_chunk = std::stoul(parser.get_option_value("--chunk"));
+    if (parser.has_option("--latency"))
+      options.latency_ms = std::stod(parser.get_option_value("--latency"));
+    if (parser.has_option("--fail-rate"))
+      options.failure_rate = std::stod(parser.get_option_value("--fail-rate"));
+    if (parser.has_option("--fail-first"))
+      options.fail_first = std::stoul(parser.get_option_value("--fail-first"));
+    if (parser.has_option("--fail-status"))
+      options.failure_status = std::stoi(parser.get_option_value("--fail-status"));
+    if (parser.has_option("--retry-after"))
+      options.retry_after = std::stoi(parser.get_option_value("--retry-after"));
+    if (parser.has_option("--stall-rate"))
+      options.stall_rate = std::stod(parser.get_option_value("--stall-rate"));
+    if (parser.has_option("--stall-ms"))
+      options.stall_ms = std::stod(parser.get_option_value("--stall-ms"));
+  } catch (const std::exception &e) {
+    std::cerr << "Invalid option value: " << e.what() << std::endl;
+    return 1;
+  }
+
+  // 服务线程继承屏蔽的信号，由主线程用sigwait统一等待退出信号
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  MockServer server(options);
+  try {
+    server.start();
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  std::cout << "Mock DeepSeek server listening on " << server.endpoint() << std::endl;
+  int signal = 0;
+  sigwait(&signals, &signal);
+  server.stop();
+  std::cout << "Served " << server.requests_served() << " requests" << std::endl;
+  return 0;
+}
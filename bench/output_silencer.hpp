@@ -0,0 +1,32 @@
+#pragma once
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <iostream>
+
+// 客户端会把回复和提示打印到终端，测量期间把指定的输出重定向到/dev/null
+class OutputSilencer {
+  int fd;
+  int saved;
+
+public:
+  explicit OutputSilencer(int target = STDOUT_FILENO) : fd(target) {
+    std::cout.flush();
+    std::cerr.flush();
+    std::fflush(nullptr);
+    saved = dup(fd);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, fd);
+    close(null_fd);
+  }
+  ~OutputSilencer() {
+    std::cout.flush();
+    std::cerr.flush();
+    std::fflush(nullptr);
+    dup2(saved, fd);
+    close(saved);
+  }
+
+  OutputSilencer(const OutputSilencer &) = delete;
+  OutputSilencer &operator=(const OutputSilencer &) = delete;
+};
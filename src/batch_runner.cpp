@@ -0,0 +1,469 @@
+#include "batch_runner.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include "global_manager.hpp"
+
+namespace {
+
+// 每个结果输出为一行紧凑的JSON
+std::string write_line(const Json::Value &output) {
+  Json::StreamWriterBuilder writer;
+  writer["indentation"] = "";
+  writer["emitUTF8"] = true;
+  writer["precision"] = 3;
+  writer["precisionType"] = "decimal";
+  return Json::writeString(writer, output);
+}
+
+} // namespace
+
+BatchRunner::BatchRunner(deepseek &client, HistoryManager *hist_manager,
+                         const BatchOptions &options)
+    : client(client), history_manager(hist_manager), options(options) {
+  if (this->options.concurrency == 0) {
+    this->options.concurrency = 1;
+  }
+}
+
+bool BatchRunner::load_jobs() {
+  std::ifstream input(options.input_path);
+  if (!input.is_open()) {
+    std::cerr << "Error: Cannot open batch file: " << options.input_path
+              << std::endl;
+    return false;
+  }
+  Json::CharReaderBuilder reader;
+  std::unique_ptr<Json::CharReader> json_reader(reader.newCharReader());
+  std::string line;
+  size_t line_number = 0;
+  while (std::getline(input, line)) {
+    line_number++;
+    if (line.empty() || line.find_first_not_of(" \t\r") == std::string::npos) {
+      continue;
+    }
+    Json::Value item;
+    std::string errors;
+    if (!json_reader->parse(line.data(), line.data() + line.size(), &item,
+                            &errors)) {
+      std::cerr << "Warning: Skipping invalid JSON on line " << line_number
+                << ": " << errors << std::endl;
+      continue;
+    }
+    BatchJob job;
+    if (item.isString()) {
+      job.prompt = item.asString();
+    } else if (item.isObject()) {
+      job.prompt = item.get("prompt", "").asString();
+      job.id = item.get("id", "").asString();
+      job.system_prompt =
+          item.get("system_prompt", options.system_prompt).asString();
+      job.model = item.get("model", options.model).asString();
+    }
+    if (job.prompt.empty()) {
+      std::cerr << "Warning: Skipping line " << line_number
+                << " without a prompt." << std::endl;
+      continue;
+    }
+    if (job.system_prompt.empty()) {
+      job.system_prompt = options.system_prompt;
+    }
+    if (job.model.empty()) {
+      job.model = options.model;
+    }
+    job.index = jobs.size();
+    if (job.id.empty()) {
+      job.id = std::to_string(line_number);
+    }
+    jobs.push_back(std::move(job));
+  }
+  return true;
+}
+
+bool BatchRunner::admit() {
+  RateLimiter *limiter = client.get_rate_limiter();
+  if (!limiter) {
+    return true;
+  }
+  auto now = StreamContext::clock::now();
+  if (throttled && now < throttled_until) {
+    return false;
+  }
+  long wait = limiter->try_acquire(RequestPriority::Background);
+  if (wait > 0) {
+    if (!throttled) {
+      throttled = true;
+      throttled_since = now;
+    }
+    throttled_until = now + std::chrono::milliseconds(wait);
+    return false;
+  }
+  if (throttled) {
+    throttled = false;
+    client.get_metrics().record_throttle(
+        std::chrono::duration<double, std::milli>(now - throttled_since).count());
+  }
+  return true;
+}
+
+bool BatchRunner::finish_cached(BatchJob &job, std::string &line) {
+  ResponseCache *cache = client.get_response_cache();
+  if (!cache) {
+    return false;
+  }
+  Conversation conversation;
+  conversation.set_system_prompt(job.system_prompt);
+  conversation.append(Role::User, job.prompt);
+  job.cache_request = ResponseCache::make_request(job.model, deepseek::kTemperature, conversation);
+  job.cache_key = ResponseCache::make_key(job.cache_request);
+  std::string response;
+  bool hit = cache->lookup(job.cache_key, job.cache_request, response);
+  client.get_metrics().record_cache_lookup(hit);
+  if (!hit) {
+    return false;
+  }
+
+  Json::Value output;
+  output["index"] = static_cast<Json::UInt64>(job.index);
+  output["id"] = job.id;
+  output["prompt"] = job.prompt;
+  output["latency_ms"] = 0.0;
+  output["response"] = response;
+  output["cached"] = true;
+  stats.succeeded++;
+  if (history_manager) {
+    history_manager->add_entry_multi_turn(job.prompt, response, job.system_prompt, job.model);
+  }
+  line = write_line(output);
+  return true;
+}
+
+void BatchRunner::start_job(CURLM *multi, BatchJob &job) {
+  // 重试时沿用第一次生成的请求体
+  if (job.request_body.empty()) {
+    Conversation conversation;
+    conversation.set_system_prompt(job.system_prompt);
+    conversation.append(Role::User, job.prompt);
+    job.request_body =
+        deepseek::build_request_body(job.model, conversation, client.is_stream_mode());
+  }
+
+  job.cancel = std::make_shared<CancellationToken>();
+  CURL *curl = client.get_connection_pool().acquire();
+  curl_easy_setopt(curl, CURLOPT_POSTFIELDS, job.request_body.c_str());
+  curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE,
+                   static_cast<curl_off_t>(job.request_body.size()));
+  if (client.is_stream_mode()) {
+    job.stream_ctx.echo = false; // 批处理不向终端输出token
+    job.stream_ctx.cancel = job.cancel.get();
+    job.stream_ctx.handle = curl;
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, deepseek::WriteCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &job.stream_ctx);
+  } else {
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION,
+                     deepseek::WriteCallbackNonStream);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &job.raw_response);
+  }
+  curl_easy_setopt(curl, CURLOPT_PRIVATE, &job);
+  curl_easy_setopt(curl, CURLOPT_TIMEOUT, 120L);
+  curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 10L);
+  job.stream_ctx.start_time = StreamContext::clock::now();
+  if (job.attempts++ == 0) {
+    job.submitted = job.stream_ctx.start_time;
+  }
+  job.handle = curl;
+  curl_multi_add_handle(multi, curl);
+  job.cancel->attach(multi);
+  active_jobs.push_back(&job);
+}
+
+bool BatchRunner::schedule_retry(BatchJob &job, CURLcode result) {
+  const RetryPolicy &policy = client.get_retry_policy();
+  if (job.cancel->is_cancelled() || job.attempts >= policy.max_attempts) {
+    return false;
+  }
+  long status = 0;
+  curl_easy_getinfo(job.handle, CURLINFO_RESPONSE_CODE, &status);
+  bool retryable = result != CURLE_OK ? RetryPolicy::is_retryable_error(result)
+                                      : RetryPolicy::is_retryable_status(status);
+  long retry_after = policy.retry_after_ms(job.handle);
+  if (!retryable || retry_after > policy.max_retry_after_ms) {
+    return false;
+  }
+  client.get_metrics().record_failure();
+  client.get_metrics().record_retry();
+  long delay = backoff.delay_ms(policy, job.attempts, retry_after);
+  if (status == 429 && client.get_rate_limiter()) {
+    // 服务端限流时让共享同一密钥的所有进程一起暂停
+    client.get_rate_limiter()->penalize(delay);
+  }
+  job.retry_at = StreamContext::clock::now() + std::chrono::milliseconds(delay);
+
+  // 丢弃这次尝试的状态，句柄归还连接池，请求体留给下一次尝试
+  client.get_connection_pool().record_transfer(job.handle);
+  client.get_connection_pool().release(job.handle);
+  job.handle = nullptr;
+  if (client.get_rate_limiter()) {
+    client.get_rate_limiter()->release();
+  }
+  job.cancel->detach();
+  job.raw_response.clear();
+  job.stream_ctx = StreamContext();
+  auto active = std::find(active_jobs.begin(), active_jobs.end(), &job);
+  if (active != active_jobs.end()) {
+    *active = active_jobs.back();
+    active_jobs.pop_back();
+  }
+  waiting_jobs.push_back(&job);
+  return true;
+}
+
+std::string BatchRunner::finish_job(BatchJob &job, CURLcode result) {
+  long status = 0;
+  curl_easy_getinfo(job.handle, CURLINFO_RESPONSE_CODE, &status);
+  client.get_connection_pool().record_transfer(job.handle);
+
+  Json::Value output;
+  output["index"] = static_cast<Json::UInt64>(job.index);
+  output["id"] = job.id;
+  output["prompt"] = job.prompt;
+
+  std::string response;
+  std::string error;
+  uint64_t tokens = 0;
+  bool complete = false; // 流式收到[DONE]、非流式解析成功，只有完整的回复才写入缓存
+  if (result == CURLE_ABORTED_BY_CALLBACK && job.cancel->is_cancelled()) {
+    error = GlobalManager::getInstance().isInterrupted() ? "Interrupted"
+                                                         : "Cancelled";
+  } else if (result != CURLE_OK || !RetryPolicy::is_success_status(status)) {
+    error = describe_failure(result, status,
+                             client.is_stream_mode() ? job.stream_ctx.error_body
+                                                     : job.raw_response);
+  } else if (client.is_stream_mode()) {
+    response = std::move(job.stream_ctx.content);
+    tokens = job.stream_ctx.token_count;
+    complete = job.stream_ctx.parser.is_done();
+  } else {
+    response = client.parseResponse(job.raw_response, &complete);
+    // 非流式响应使用服务端返回的usage统计token
+    Json::CharReaderBuilder reader;
+    Json::Value root;
+    std::string errors;
+    std::istringstream json_stream(job.raw_response);
+    if (Json::parseFromStream(reader, json_stream, &root, &errors)) {
+      tokens = root["usage"].get("completion_tokens", 0).asUInt64();
+    }
+  }
+  if (error.empty() && response.empty()) {
+    error = "Empty response";
+  }
+  if (error.empty()) {
+    client.get_metrics().record(RequestMetrics::collect(
+        job.handle, client.is_stream_mode() ? &job.stream_ctx : nullptr,
+        job.request_body.size(), job.raw_response));
+  } else if (!job.cancel->is_cancelled()) {
+    client.get_metrics().record_failure();
+  }
+
+  double latency = std::chrono::duration<double>(StreamContext::clock::now() -
+                                                 job.submitted)
+                       .count();
+  output["latency_ms"] = latency * 1000.0;
+  if (job.attempts > 1) {
+    output["attempts"] = job.attempts;
+  }
+  if (error.empty()) {
+    output["response"] = response;
+    output["tokens"] = static_cast<Json::UInt64>(tokens);
+    if (job.stream_ctx.has_tokens()) {
+      output["ttft_ms"] = job.stream_ctx.time_to_first_token() * 1000.0;
+    }
+    stats.succeeded++;
+    stats.tokens += tokens;
+    if (client.get_response_cache() && !job.cache_key.empty() && complete) {
+      client.get_response_cache()->store(job.cache_key, job.cache_request, job.model, response);
+    }
+    if (history_manager) {
+      history_manager->add_entry_multi_turn(job.prompt, response,
+                                            job.system_prompt, job.model);
+    }
+  } else {
+    output["error"] = error;
+    stats.failed++;
+  }
+
+  // 释放请求占用的内存，句柄归还连接池
+  job.request_body.clear();
+  job.request_body.shrink_to_fit();
+  job.raw_response.clear();
+  job.raw_response.shrink_to_fit();
+  client.get_connection_pool().release(job.handle);
+  job.handle = nullptr;
+  if (client.get_rate_limiter()) {
+    client.get_rate_limiter()->release();
+  }
+  job.cancel->detach();
+  auto active = std::find(active_jobs.begin(), active_jobs.end(), &job);
+  if (active != active_jobs.end()) {
+    *active = active_jobs.back();
+    active_jobs.pop_back();
+  }
+
+  return write_line(output);
+}
+
+void BatchRunner::emit(std::ostream &out, size_t index,
+                       const std::string &line) {
+  if (!options.preserve_order) {
+    out << line << '\n' << std::flush;
+    return;
+  }
+  // 按输入顺序输出：暂存乱序完成的结果，直到前面的结果都已写出
+  pending_output.emplace(index, line);
+  auto it = pending_output.find(next_output_index);
+  while (it != pending_output.end()) {
+    out << it->second << '\n';
+    pending_output.erase(it);
+    it = pending_output.find(++next_output_index);
+  }
+  out << std::flush;
+}
+
+bool BatchRunner::run() {
+  if (!load_jobs()) {
+    return false;
+  }
+  stats = BatchStats();
+  stats.total = jobs.size();
+
+  std::ofstream output_file;
+  if (!options.output_path.empty()) {
+    output_file.open(options.output_path, std::ios::out | std::ios::trunc);
+    if (!output_file.is_open()) {
+      std::cerr << "Error: Cannot open output file: " << options.output_path
+                << std::endl;
+      return false;
+    }
+  }
+  std::ostream &out = options.output_path.empty() ? std::cout : output_file;
+
+  CURLM *multi = curl_multi_init();
+  if (!multi) {
+    throw std::runtime_error("Failed to initialize cURL multi handle");
+  }
+  client.get_connection_pool().set_max_idle_handles(options.concurrency);
+
+  auto start = std::chrono::steady_clock::now();
+  size_t next_job = 0;
+  size_t in_flight = 0;
+  while (next_job < jobs.size() || in_flight > 0) {
+    // 重新发出退避时间已到的任务
+    auto now = StreamContext::clock::now();
+    for (size_t i = 0; i < waiting_jobs.size();) {
+      if (waiting_jobs[i]->retry_at > now || !GlobalManager::getInstance().isRunning() ||
+          !admit()) {
+        i++;
+        continue;
+      }
+      start_job(multi, *waiting_jobs[i]);
+      waiting_jobs[i] = waiting_jobs.back();
+      waiting_jobs.pop_back();
+    }
+    // 补足并发数，命中缓存的任务直接输出，不占用并发和限流名额
+    while (in_flight < options.concurrency && next_job < jobs.size() &&
+           GlobalManager::getInstance().isRunning()) {
+      BatchJob &job = jobs[next_job];
+      std::string line;
+      if (job.cache_key.empty() && finish_cached(job, line)) {
+        emit(out, job.index, line);
+        next_job++;
+        continue;
+      }
+      if (!admit()) {
+        break;
+      }
+      start_job(multi, job);
+      next_job++;
+      in_flight++;
+    }
+    if (in_flight == 0 && !throttled) {
+      break; // 被中断，不再启动新的请求
+    }
+
+    int running = 0;
+    curl_multi_perform(multi, &running);
+
+    int remaining = 0;
+    while (CURLMsg *msg = curl_multi_info_read(multi, &remaining)) {
+      if (msg->msg != CURLMSG_DONE) {
+        continue;
+      }
+      BatchJob *job = nullptr;
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &job);
+      CURLcode result = msg->data.result;
+      curl_multi_remove_handle(multi, msg->easy_handle);
+      if (schedule_retry(*job, result)) {
+        continue;
+      }
+      emit(out, job->index, finish_job(*job, result));
+      in_flight--;
+    }
+
+    if (GlobalManager::getInstance().isInterrupted()) {
+      // 信号处理函数只写自管道，由事件循环取消所有进行中的请求
+      for (BatchJob *job : active_jobs) {
+        job->cancel->cancel();
+      }
+    }
+    // 已取消的请求立即移出事件循环，记为失败，不等待服务端
+    for (size_t i = 0; i < active_jobs.size();) {
+      BatchJob *job = active_jobs[i];
+      if (!job->cancel->is_cancelled()) {
+        i++;
+        continue;
+      }
+      curl_multi_remove_handle(multi, job->handle);
+      emit(out, job->index, finish_job(*job, CURLE_ABORTED_BY_CALLBACK));
+      in_flight--; // finish_job把最后一个任务换到了位置i
+    }
+    if (!GlobalManager::getInstance().isRunning()) {
+      break; // 被中断，不再启动新的请求，等待重试的任务与未启动的任务一样没有结果
+    }
+    if (running > 0 || !waiting_jobs.empty() || throttled) {
+      // 同时等待中断自管道，Ctrl+C不必等到某个请求有数据；
+      // 取消令牌通过curl_multi_wakeup唤醒poll
+      struct curl_waitfd interrupt_fd;
+      interrupt_fd.fd = GlobalManager::getInstance().getInterruptFd();
+      interrupt_fd.events = CURL_WAIT_POLLIN;
+      interrupt_fd.revents = 0;
+      // 有任务等待重试时最多等到最早的重试时间
+      int timeout_ms = 1000;
+      for (BatchJob *job : waiting_jobs) {
+        auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+            job->retry_at - StreamContext::clock::now());
+        timeout_ms = std::max(0, std::min<int>(timeout_ms, static_cast<int>(wait.count()) + 1));
+      }
+      // 被限流时最多等到限流器给出的时间
+      if (throttled) {
+        auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+            throttled_until - StreamContext::clock::now());
+        timeout_ms = std::max(0, std::min<int>(timeout_ms, static_cast<int>(wait.count()) + 1));
+      }
+      curl_multi_poll(multi, &interrupt_fd, interrupt_fd.fd >= 0 ? 1 : 0, timeout_ms,
+                      nullptr);
+    }
+  }
+  curl_multi_cleanup(multi);
+  // 中断时未启动的任务没有结果，写出剩余已完成的结果
+  for (const auto &pending : pending_output) {
+    out << pending.second << '\n';
+  }
+  pending_output.clear();
+  out << std::flush;
+
+  stats.elapsed_seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+  return stats.failed == 0 && stats.succeeded == stats.total;
+}
@@ -0,0 +1,116 @@
+#pragma once
+#include <curl/curl.h>
+#include <json/json.h>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+#include "deepseek.hpp"
+#include "history.hpp"
+#include "stream_context.hpp"
+
+/**
+ * @brief 批处理模式的选项
+ */
+struct BatchOptions {
+  std::string input_path;      // 输入的prompts.jsonl
+  std::string output_path;     // 输出的结果jsonl，为空时输出到stdout
+  size_t concurrency = 4;      // 同时进行的请求数
+  bool preserve_order = false; // true按输入顺序输出，false按完成顺序输出
+  std::string model;           // 默认模型
+  std::string system_prompt;   // 默认系统提示
+};
+
+/**
+ * @brief 批处理的吞吐统计
+ */
+struct BatchStats {
+  size_t total = 0;     // 请求总数
+  size_t succeeded = 0; // 成功的请求数
+  size_t failed = 0;    // 失败的请求数
+  uint64_t tokens = 0;  // 收到的token总数
+  double elapsed_seconds = 0.0;
+};
+
+/**
+ * @brief 基于curl multi的非交互式批处理
+ *
+ * 从jsonl文件读取prompt，保持最多concurrency个请求同时进行，
+ * 每完成一个请求就写出一行结果并记录到历史。连接复用deepseek实例的连接池，
+ * 瞬时故障按deepseek实例的重试策略退避后重试（不做对冲）。deepseek实例
+ * 设置了限流时，每个请求以后台优先级申请名额，为交互式会话让路；启用了
+ * 响应缓存时，命中缓存的任务不发出请求，直接输出缓存的回复。
+ */
+class BatchRunner {
+private:
+  // 单个批处理任务
+  struct BatchJob {
+    size_t index = 0;
+    std::string id;
+    std::string prompt;
+    std::string system_prompt;
+    std::string model;
+    std::string request_body;
+    std::string cache_key;    // 响应缓存的键，查找过缓存后不为空
+    std::string cache_request; // 规范化的请求，与回复一起写入缓存用于校验
+    std::string raw_response; // 非流式模式下的原始响应
+    StreamContext stream_ctx;
+    CancellationTokenPtr cancel; // 每个请求独立的取消令牌
+    CURL *handle = nullptr;
+    int attempts = 0;            // 已经发出的次数
+    StreamContext::clock::time_point submitted;  // 第一次发出的时间
+    StreamContext::clock::time_point retry_at;   // 等待重试时的下次发出时间
+  };
+
+  deepseek &client;
+  HistoryManager *history_manager;
+  BatchOptions options;
+  BatchStats stats;
+  std::vector<BatchJob> jobs;
+  std::vector<BatchJob *> active_jobs; // 正在进行的任务
+  std::vector<BatchJob *> waiting_jobs; // 失败后等待重试的任务，仍占用一个并发名额
+  Backoff backoff;
+  StreamContext::clock::time_point throttled_until; // 限流器要求等待到此时
+  StreamContext::clock::time_point throttled_since; // 本轮被限流推迟的开始时间
+  bool throttled = false;
+  std::map<size_t, std::string> pending_output; // 按输入顺序输出时暂存的结果
+  size_t next_output_index = 0;
+
+  // 读取输入文件，每行一个JSON对象或字符串
+  bool load_jobs();
+  // 向限流器申请一个名额，返回是否可以立即发出请求
+  bool admit();
+  // 响应缓存中有这个任务的回复时直接生成输出，返回是否命中
+  bool finish_cached(BatchJob &job, std::string &line);
+  // 为任务创建请求并加入multi句柄
+  void start_job(CURLM *multi, BatchJob &job);
+  // 瞬时故障且还有重试次数时安排重试，返回是否已安排
+  bool schedule_retry(BatchJob &job, CURLcode result);
+  // 处理完成的请求，生成一行输出
+  std::string finish_job(BatchJob &job, CURLcode result);
+  // 按配置的顺序写出结果
+  void emit(std::ostream &out, size_t index, const std::string &line);
+
+public:
+  /**
+   * @brief 构造函数
+   * @param client 提供连接池和请求序列化的deepseek实例
+   * @param hist_manager 历史记录管理器，为空时不记录历史
+   * @param options 批处理选项
+   */
+  BatchRunner(deepseek &client, HistoryManager *hist_manager,
+              const BatchOptions &options);
+
+  /**
+   * @brief 执行批处理
+   * @return 是否全部请求都成功
+   */
+  bool run();
+
+  /**
+   * @brief 获取吞吐统计
+   * @return 统计信息
+   */
+  const BatchStats &get_stats() const { return stats; }
+};
@@ -0,0 +1,59 @@
+#pragma once
+#include <curl/curl.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+/**
+ * @brief 单个请求的取消令牌
+ *
+ * 每个请求持有自己的令牌，取消一个请求不会影响其他请求。令牌关联到
+ * 执行请求的curl multi事件循环后，cancel()会通过curl_multi_wakeup立即
+ * 唤醒阻塞在poll中的循环，即使服务端没有任何数据到达。
+ * cancel()可以从任意线程调用，但不是异步信号安全的，信号处理函数应
+ * 通过自管道通知事件循环，再由事件循环取消令牌。
+ */
+class CancellationToken {
+private:
+  std::atomic<bool> cancelled{false};
+  std::mutex mutex;
+  CURLM *multi = nullptr; // 正在执行该请求的事件循环
+
+public:
+  /**
+   * @brief 取消请求并唤醒关联的事件循环
+   */
+  void cancel() {
+    cancelled.store(true, std::memory_order_release);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (multi) {
+      curl_multi_wakeup(multi);
+    }
+  }
+
+  /**
+   * @brief 请求是否已被取消
+   */
+  bool is_cancelled() const {
+    return cancelled.load(std::memory_order_acquire);
+  }
+
+  /**
+   * @brief 关联执行请求的事件循环，取消时唤醒它
+   * @param loop curl multi句柄
+   */
+  void attach(CURLM *loop) {
+    std::lock_guard<std::mutex> lock(mutex);
+    multi = loop;
+  }
+
+  /**
+   * @brief 请求结束后解除关联
+   */
+  void detach() {
+    std::lock_guard<std::mutex> lock(mutex);
+    multi = nullptr;
+  }
+};
+
+using CancellationTokenPtr = std::shared_ptr<CancellationToken>;
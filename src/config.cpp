@@ -1,4 +1,5 @@
 #include "config.hpp"
+#include <algorithm>
 #include <cstdlib>
 #include <sys/stat.h>
 
@@ -26,7 +27,30 @@ void Config::load_defaults() {
     config_data["max_history_entries"] = 1000;
     config_data["default_model"] = "deepseek-chat";
     config_data["auto_save_history"] = true;
+    config_data["history_hot_entries"] = 1000;
+    config_data["history_retention_days"] = 0;
+    config_data["history_retention_mb"] = 0;
     config_data["temperature"] = 0.7;
+    config_data["api_endpoint"] = "https://api.deepseek.com/v1/chat/completions";
+    config_data["record_request_metrics"] = false;
+    config_data["metrics_file"] = "";
+    config_data["context_token_budget"] = 32000;
+    config_data["context_overflow"] = "drop";
+    config_data["context_collapsed_tokens"] = 64;
+    config_data["retry_max_attempts"] = 3;
+    config_data["retry_base_delay_ms"] = 500;
+    config_data["retry_max_delay_ms"] = 8000;
+    config_data["retry_max_retry_after_ms"] = 30000;
+    config_data["hedge_after_ms"] = 0;
+    config_data["rate_limit_rps"] = 0.0;
+    config_data["rate_limit_burst"] = 0.0;
+    config_data["rate_limit_concurrency"] = 0;
+    config_data["rate_limit_state_file"] = "";
+    config_data["response_cache_enabled"] = false;
+    config_data["response_cache_dir"] = "";
+    config_data["response_cache_ttl_seconds"] = 86400;
+    config_data["response_cache_max_mb"] = 64;
+    config_data["cache_replay_tokens_per_second"] = 0.0;
 }
 
 void Config::ensure_config_directory() {
@@ -83,7 +107,7 @@ std::string Config::get_config_path() const {
 
 std::string Config::get_history_path() const {
     std::filesystem::path config_path(config_file_path);
-    std::filesystem::path history_path = config_path.parent_path() / "history.json";
+    std::filesystem::path history_path = config_path.parent_path() / "history.gfh";
     return history_path.string();
 }
 
@@ -99,6 +123,83 @@ int Config::get_max_history_entries() const {
     return get<int>("max_history_entries", 1000);
 }
 
+HistoryRetention Config::get_history_retention() const {
+    HistoryRetention retention;
+    retention.hot_entries = static_cast<size_t>(std::max(0, get<int>("history_hot_entries", 1000)));
+    retention.max_age_seconds = static_cast<int64_t>(std::max(0, get<int>("history_retention_days", 0))) * 86400;
+    retention.max_cold_bytes = static_cast<uint64_t>(std::max(0, get<int>("history_retention_mb", 0))) << 20;
+    return retention;
+}
+
 std::string Config::get_default_model() const {
     return get<std::string>("default_model", "deepseek-chat");
 }
+
+
+std::string Config::get_api_endpoint() const {
+    return get<std::string>("api_endpoint", "https://api.deepseek.com/v1/chat/completions");
+}
+
+bool Config::get_record_request_metrics() const {
+    return get<bool>("record_request_metrics", false);
+}
+
+std::string Config::get_metrics_file() const {
+    return get<std::string>("metrics_file", "");
+}
+
+int Config::get_context_token_budget() const {
+    return get<int>("context_token_budget", 32000);
+}
+
+std::string Config::get_context_overflow() const {
+    return get<std::string>("context_overflow", "drop");
+}
+
+int Config::get_context_collapsed_tokens() const {
+    return get<int>("context_collapsed_tokens", 64);
+}
+
+RetryPolicy Config::get_retry_policy() const {
+    RetryPolicy policy;
+    policy.max_attempts = std::max(1, get<int>("retry_max_attempts", policy.max_attempts));
+    policy.base_delay_ms = std::max(0, get<int>("retry_base_delay_ms", static_cast<int>(policy.base_delay_ms)));
+    policy.max_delay_ms = std::max(0, get<int>("retry_max_delay_ms", static_cast<int>(policy.max_delay_ms)));
+    policy.max_retry_after_ms = std::max(0, get<int>("retry_max_retry_after_ms", static_cast<int>(policy.max_retry_after_ms)));
+    policy.hedge_after_ms = std::max(0, get<int>("hedge_after_ms", static_cast<int>(policy.hedge_after_ms)));
+    return policy;
+}
+
+RateLimitOptions Config::get_rate_limit() const {
+    RateLimitOptions options;
+    options.requests_per_second = std::max(0.0, get<double>("rate_limit_rps", 0.0));
+    options.burst = std::max(0.0, get<double>("rate_limit_burst", 0.0));
+    options.max_concurrency = std::max(0, get<int>("rate_limit_concurrency", 0));
+    options.state_path = get<std::string>("rate_limit_state_file", "");
+    if (options.state_path.empty()) {
+        // 默认与配置文件放在一起，使用同一配置的进程自动共享限流状态
+        std::filesystem::path config_path(config_file_path);
+        options.state_path = (config_path.parent_path() / "ratelimit.state").string();
+    }
+    return options;
+}
+
+bool Config::get_response_cache_enabled() const {
+    return get<bool>("response_cache_enabled", false);
+}
+
+ResponseCacheOptions Config::get_response_cache() const {
+    ResponseCacheOptions options;
+    options.directory = get<std::string>("response_cache_dir", "");
+    if (options.directory.empty()) {
+        std::filesystem::path config_path(config_file_path);
+        options.directory = (config_path.parent_path() / "cache").string();
+    }
+    options.ttl_seconds = std::max(0, get<int>("response_cache_ttl_seconds", 86400));
+    options.max_bytes = static_cast<uint64_t>(std::max(1, get<int>("response_cache_max_mb", 64))) << 20;
+    return options;
+}
+
+double Config::get_cache_replay_tokens_per_second() const {
+    return std::max(0.0, get<double>("cache_replay_tokens_per_second", 0.0));
+}
@@ -4,6 +4,10 @@
 #include <fstream>
 #include <iostream>
 #include <filesystem>
+#include "history.hpp"
+#include "rate_limiter.hpp"
+#include "response_cache.hpp"
+#include "retry_policy.hpp"
 
 class Config {
 private:
@@ -81,11 +85,83 @@ public:
      */
     int get_max_history_entries() const;
     
+    /**
+     * @brief 获取历史记录的分层保留策略
+     * @return 由history_hot_entries、history_retention_days和history_retention_mb组成的策略
+     */
+    HistoryRetention get_history_retention() const;
+    
     /**
      * @brief 获取默认模型名称
      * @return 默认模型名称
      */
     std::string get_default_model() const;
+    
+    /**
+     * @brief 获取API端点地址
+     * @return chat completions接口的完整URL
+     */
+    std::string get_api_endpoint() const;
+    
+    /**
+     * @brief 是否在历史记录中保存每个请求的耗时指标
+     * @return 是否保存
+     */
+    bool get_record_request_metrics() const;
+    
+    /**
+     * @brief 获取请求指标汇总文件的路径
+     * @return 文件路径，扩展名为.prom或.txt时为Prometheus文本格式，否则为JSON；为空表示不写
+     */
+    std::string get_metrics_file() const;
+    
+    /**
+     * @brief 获取每个请求的上下文token预算（本地估算值）
+     * @return token数，0表示不限制
+     */
+    int get_context_token_budget() const;
+    
+    /**
+     * @brief 获取超出上下文预算时的处理方式
+     * @return "drop"（删除最早的对话）或 "collapse"（先压缩较早的长消息）
+     */
+    std::string get_context_overflow() const;
+    
+    /**
+     * @brief 获取collapse方式下每条被压缩的消息保留的token数
+     * @return token数
+     */
+    int get_context_collapsed_tokens() const;
+    
+    /**
+     * @brief 获取瞬时故障的重试和对冲策略
+     * @return 由retry_*和hedge_after_ms选项组成的策略，缺省项使用默认值
+     */
+    RetryPolicy get_retry_policy() const;
+    
+    /**
+     * @brief 获取客户端限流配置
+     * @return 由rate_limit_*选项组成的配置；状态文件缺省为配置目录下的ratelimit.state
+     */
+    RateLimitOptions get_rate_limit() const;
+    
+    /**
+     * @brief 是否默认启用磁盘响应缓存
+     * @return 是否启用，--cache/--no-cache优先
+     */
+    bool get_response_cache_enabled() const;
+    
+    /**
+     * @brief 获取响应缓存配置
+     * @return 缓存目录（缺省为配置目录下的cache）、有效期和大小上限
+     */
+    ResponseCacheOptions get_response_cache() const;
+    
+    /**
+     * @brief 获取流式模式下回放缓存回复的速率
+     * @return 每秒token数，0表示一次输出
+     */
+    double get_cache_replay_tokens_per_second() const;
 };
 
 // 模板函数的实现
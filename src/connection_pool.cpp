@@ -0,0 +1,136 @@
+#include "connection_pool.hpp"
+#include <stdexcept>
+
+void ConnectionPool::lock_share(CURL * /*handle*/, curl_lock_data data,
+                                curl_lock_access /*access*/, void *userptr) {
+  auto *pool = static_cast<ConnectionPool *>(userptr);
+  pool->share_locks[data].lock();
+}
+
+void ConnectionPool::unlock_share(CURL * /*handle*/, curl_lock_data data,
+                                  void *userptr) {
+  auto *pool = static_cast<ConnectionPool *>(userptr);
+  pool->share_locks[data].unlock();
+}
+
+ConnectionPool::ConnectionPool(const std::string &api_key,
+                               const std::string &endpoint,
+                               size_t max_idle_handles)
+    : share(nullptr), max_idle_handles(max_idle_handles), headers(nullptr),
+      endpoint(endpoint) {
+  static std::once_flag global_init;
+  std::call_once(global_init, [] { curl_global_init(CURL_GLOBAL_DEFAULT); });
+
+  share = curl_share_init();
+  if (!share) {
+    throw std::runtime_error("Failed to initialize cURL share handle");
+  }
+  curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lock_share);
+  curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlock_share);
+  curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+  // 共享DNS、TLS会话和连接缓存，后续请求可直接复用已建立的连接
+  curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+  curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+
+  // 请求头在连接池的生命周期内只构建一次
+  headers = curl_slist_append(headers, "Content-Type: application/json");
+  headers =
+      curl_slist_append(headers, ("Authorization: Bearer " + api_key).c_str());
+}
+
+ConnectionPool::~ConnectionPool() {
+  for (CURL *handle : idle_handles) {
+    curl_easy_cleanup(handle);
+  }
+  idle_handles.clear();
+  // 必须在所有句柄清理之后才能释放share句柄
+  curl_share_cleanup(share);
+  curl_slist_free_all(headers);
+}
+
+void ConnectionPool::apply_common_options(CURL *handle) const {
+  curl_easy_setopt(handle, CURLOPT_SHARE, share);
+  curl_easy_setopt(handle, CURLOPT_URL, endpoint.c_str());
+  curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers);
+  curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+  // 保持TCP长连接，防止空闲连接被中间设备断开
+  curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+  curl_easy_setopt(handle, CURLOPT_TCP_KEEPIDLE, 30L);
+  curl_easy_setopt(handle, CURLOPT_TCP_KEEPINTVL, 15L);
+  curl_easy_setopt(handle, CURLOPT_DNS_CACHE_TIMEOUT, 300L);
+  curl_easy_setopt(handle, CURLOPT_MAXAGE_CONN, 300L);
+}
+
+CURL *ConnectionPool::acquire() {
+  CURL *handle = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    if (!idle_handles.empty()) {
+      handle = idle_handles.back();
+      idle_handles.pop_back();
+    }
+  }
+  if (handle) {
+    // reset只清除选项，连接、DNS和会话缓存都会保留
+    curl_easy_reset(handle);
+  } else {
+    handle = curl_easy_init();
+    if (!handle) {
+      throw std::runtime_error("Failed to initialize cURL");
+    }
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    stats.handles_created++;
+  }
+  std::lock_guard<std::mutex> lock(pool_mutex);
+  apply_common_options(handle);
+  return handle;
+}
+
+void ConnectionPool::release(CURL *handle) {
+  if (!handle) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(pool_mutex);
+  if (idle_handles.size() < max_idle_handles) {
+    idle_handles.push_back(handle);
+  } else {
+    curl_easy_cleanup(handle);
+  }
+}
+
+void ConnectionPool::record_transfer(CURL *handle) {
+  long num_connects = 0;
+  curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &num_connects);
+  std::lock_guard<std::mutex> lock(pool_mutex);
+  stats.requests++;
+  if (num_connects > 0) {
+    stats.new_connections += static_cast<uint64_t>(num_connects);
+  } else {
+    stats.reused_connections++;
+  }
+}
+
+void ConnectionPool::set_max_idle_handles(size_t count) {
+  std::lock_guard<std::mutex> lock(pool_mutex);
+  max_idle_handles = count;
+  while (idle_handles.size() > max_idle_handles) {
+    curl_easy_cleanup(idle_handles.back());
+    idle_handles.pop_back();
+  }
+}
+
+void ConnectionPool::set_endpoint(const std::string &url) {
+  std::lock_guard<std::mutex> lock(pool_mutex);
+  endpoint = url;
+}
+
+std::string ConnectionPool::get_endpoint() const {
+  std::lock_guard<std::mutex> lock(pool_mutex);
+  return endpoint;
+}
+
+ConnectionStats ConnectionPool::get_stats() const {
+  std::lock_guard<std::mutex> lock(pool_mutex);
+  return stats;
+}
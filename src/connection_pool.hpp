@@ -0,0 +1,107 @@
+#pragma once
+#include <curl/curl.h>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * @brief 连接复用统计信息
+ */
+struct ConnectionStats {
+  uint64_t requests = 0;           // 已完成的请求数
+  uint64_t new_connections = 0;    // 新建立的连接数
+  uint64_t reused_connections = 0; // 复用已有连接的请求数
+  uint64_t handles_created = 0;    // 创建过的easy handle数量
+};
+
+/**
+ * @brief 长连接池，负责复用cURL句柄和底层TCP/TLS连接
+ *
+ * 所有句柄共享同一个CURLSH，使DNS缓存、TLS会话缓存和连接缓存
+ * 在请求之间保留，避免每轮对话都重新握手。
+ */
+class ConnectionPool {
+private:
+  CURLSH *share;
+  std::vector<CURL *> idle_handles;
+  size_t max_idle_handles;
+  curl_slist *headers;
+  std::string endpoint;
+  ConnectionStats stats;
+  mutable std::mutex pool_mutex;
+  std::mutex share_locks[CURL_LOCK_DATA_LAST];
+
+  // CURLSH的加锁回调，保证多线程共享缓存时的安全
+  static void lock_share(CURL *handle, curl_lock_data data,
+                         curl_lock_access access, void *userptr);
+  static void unlock_share(CURL *handle, curl_lock_data data, void *userptr);
+
+  // 为句柄设置所有请求共用的选项
+  void apply_common_options(CURL *handle) const;
+
+public:
+  /**
+   * @brief constructor for ConnectionPool
+   * @param api_key API key used for the Authorization header
+   * @param endpoint URL of the chat completions endpoint
+   * @param max_idle_handles Maximum number of idle handles kept for reuse
+   * @throws std::runtime_error if the share handle cannot be created
+   */
+  ConnectionPool(const std::string &api_key, const std::string &endpoint,
+                 size_t max_idle_handles = 4);
+  ~ConnectionPool();
+
+  ConnectionPool(const ConnectionPool &) = delete;
+  ConnectionPool &operator=(const ConnectionPool &) = delete;
+
+  /**
+   * @brief Takes a handle from the pool (or creates one) with the common
+   * options already applied.
+   * @return A ready to use easy handle, never nullptr
+   * @throws std::runtime_error if cURL initialization fails
+   */
+  CURL *acquire();
+
+  /**
+   * @brief Returns a handle to the pool so that its connection can be reused.
+   * @param handle Handle previously obtained from acquire()
+   */
+  void release(CURL *handle);
+
+  /**
+   * @brief Records connection reuse statistics of a finished transfer.
+   * @param handle Handle that just completed a transfer
+   */
+  void record_transfer(CURL *handle);
+
+  /**
+   * @brief Set how many idle handles are kept for reuse
+   * @param count Maximum number of idle handles, e.g. the batch concurrency
+   */
+  void set_max_idle_handles(size_t count);
+
+  /**
+   * @brief Set the endpoint used by subsequently acquired handles
+   * @param url Full URL of the chat completions endpoint
+   */
+  void set_endpoint(const std::string &url);
+
+  /**
+   * @brief Get the endpoint URL
+   * @return Endpoint URL
+   */
+  std::string get_endpoint() const;
+
+  /**
+   * @brief Get the share handle holding DNS/TLS/connection caches
+   * @return The CURLSH handle owned by the pool
+   */
+  CURLSH *get_share() const { return share; }
+
+  /**
+   * @brief Get connection reuse statistics
+   * @return A snapshot of the statistics
+   */
+  ConnectionStats get_stats() const;
+};
@@ -0,0 +1,52 @@
+#include "context_window.hpp"
+
+ContextTrim fit_context_window(Conversation &conversation, const ContextWindowOptions &options) {
+  ContextTrim trim;
+  trim.tokens_before = conversation.total_tokens();
+  trim.tokens_after = trim.tokens_before;
+  if (options.max_tokens == 0 || trim.tokens_before <= options.max_tokens) {
+    return trim;
+  }
+
+  if (options.overflow == ContextOverflow::Collapse) {
+    // 从最早的消息开始压缩，最后一条消息不动
+    for (size_t i = 0; i + 1 < conversation.size(); ++i) {
+      if (conversation.total_tokens() <= options.max_tokens) {
+        break;
+      }
+      if (conversation.collapse(i, options.collapsed_tokens)) {
+        trim.collapsed_messages++;
+      }
+    }
+  }
+
+  // 计算需要从开头删除多少条消息，最后统一删除一次
+  size_t excess = conversation.total_tokens() > options.max_tokens
+                      ? conversation.total_tokens() - options.max_tokens
+                      : 0;
+  size_t count = 0;
+  size_t freed = 0;
+  while (count + 1 < conversation.size() && freed < excess) {
+    freed += conversation.tokens(count) + Conversation::kMessageOverheadTokens;
+    count++;
+  }
+  // 不留下以助手回复开头的半轮对话
+  while (count + 1 < conversation.size() && conversation.role(count) != Role::User) {
+    count++;
+  }
+  conversation.erase_front(count);
+  trim.dropped_messages = count;
+  trim.tokens_after = conversation.total_tokens();
+  return trim;
+}
+
+bool parse_context_overflow(const std::string &name, ContextOverflow &overflow) {
+  if (name == "drop") {
+    overflow = ContextOverflow::Drop;
+  } else if (name == "collapse") {
+    overflow = ContextOverflow::Collapse;
+  } else {
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include "conversation.hpp"
+#include <cstddef>
+#include <string>
+
+/**
+ * @brief 超出token预算时如何处理最早的对话
+ */
+enum class ContextOverflow {
+  Drop,     // 成轮删除最早的对话
+  Collapse, // 先把较早的长消息压缩为摘录，仍然超出时再删除
+};
+
+/**
+ * @brief 上下文窗口的配置
+ */
+struct ContextWindowOptions {
+  size_t max_tokens = 0; // 每个请求的token预算（估算值），0表示不限制
+  ContextOverflow overflow = ContextOverflow::Drop;
+  size_t collapsed_tokens = 64; // 压缩后的消息最多保留的token数
+};
+
+/**
+ * @brief 一次裁剪的结果
+ */
+struct ContextTrim {
+  size_t dropped_messages = 0;   // 删除的消息数
+  size_t collapsed_messages = 0; // 压缩的消息数
+  size_t tokens_before = 0;      // 裁剪前估算的token数
+  size_t tokens_after = 0;       // 裁剪后估算的token数
+
+  bool trimmed() const { return dropped_messages > 0 || collapsed_messages > 0; }
+};
+
+/**
+ * @brief 把对话裁剪到token预算以内
+ *
+ * 只处理最早的对话，系统提示和最后一条消息（即将发送的问题）始终保留；
+ * 删除时成轮进行，使剩下的对话仍然从用户消息开始。只有这些消息时仍然超出
+ * 预算的请求照常发送。
+ * @param conversation 要裁剪的对话
+ * @param options 预算和裁剪方式
+ * @return 裁剪结果
+ */
+ContextTrim fit_context_window(Conversation &conversation, const ContextWindowOptions &options);
+
+/**
+ * @brief 解析配置中的裁剪方式
+ * @param name "drop" 或 "collapse"
+ * @param overflow 解析结果
+ * @return 名称无法识别时返回false
+ */
+bool parse_context_overflow(const std::string &name, ContextOverflow &overflow);
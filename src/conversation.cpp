@@ -0,0 +1,122 @@
+#include "conversation.hpp"
+#include "token_estimate.hpp"
+#include <algorithm>
+
+namespace {
+
+// 被压缩的消息末尾的标记
+const std::string_view kCollapsedMarker = " ...[truncated]";
+
+} // namespace
+
+void Conversation::set_system_prompt(std::string_view prompt) {
+  system_prompt.assign(prompt.data(), prompt.size());
+  system_tokens = estimate_tokens(prompt);
+  ++system_version;
+}
+
+void Conversation::append(Role role, std::string_view content) {
+  if (role == Role::System) {
+    set_system_prompt(content);
+    return;
+  }
+  Message message;
+  message.offset = static_cast<uint32_t>(arena.size());
+  message.length = static_cast<uint32_t>(content.size());
+  message.tokens = static_cast<uint32_t>(estimate_tokens(content));
+  message.role = role;
+  arena.append(content.data(), content.size());
+  messages.push_back(message);
+  message_tokens += message.tokens;
+}
+
+void Conversation::truncate(size_t count) {
+  if (count >= messages.size()) {
+    return;
+  }
+  for (size_t i = count; i < messages.size(); ++i) {
+    message_tokens -= messages[i].tokens;
+  }
+  arena.resize(messages[count].offset);
+  messages.resize(count);
+  ++generation;
+}
+
+void Conversation::erase_front(size_t count) {
+  if (count == 0) {
+    return;
+  }
+  if (count >= messages.size()) {
+    erased_front += messages.size();
+    arena.clear();
+    messages.clear();
+    message_tokens = 0;
+    return;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    message_tokens -= messages[i].tokens;
+  }
+  uint32_t shift = messages[count].offset;
+  arena.erase(0, shift);
+  messages.erase(messages.begin(), messages.begin() + count);
+  for (Message &message : messages) {
+    message.offset -= shift;
+  }
+  erased_front += count;
+}
+
+bool Conversation::collapse(size_t index, size_t max_tokens) {
+  Message &message = messages[index];
+  if (message.tokens <= max_tokens) {
+    return false;
+  }
+  std::string_view text = content(index);
+  // 按估算规则逐字符累加，找到刚好不超过max_tokens的位置
+  size_t tenths = 0;
+  size_t cut = 0;
+  while (cut < text.size()) {
+    unsigned char c = static_cast<unsigned char>(text[cut]);
+    size_t width = c < 0x80 ? 1 : c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : 2;
+    tenths += c < 0x80 ? 3 : 6;
+    if (tenths > max_tokens * 10 || cut + width > text.size()) {
+      break;
+    }
+    cut += width;
+  }
+  if (cut + kCollapsedMarker.size() >= text.size()) {
+    return false;
+  }
+  // 摘录比原文短，直接覆盖原来的位置，剩下的空隙在删除消息时回收
+  std::copy(kCollapsedMarker.begin(), kCollapsedMarker.end(), &arena[message.offset + cut]);
+  message.length = static_cast<uint32_t>(cut + kCollapsedMarker.size());
+  message_tokens -= message.tokens;
+  message.tokens = static_cast<uint32_t>(estimate_tokens(content(index)));
+  message_tokens += message.tokens;
+  ++generation;
+  return true;
+}
+
+const char *Conversation::role_name(Role role) {
+  switch (role) {
+  case Role::System:
+    return "system";
+  case Role::User:
+    return "user";
+  case Role::Assistant:
+    return "assistant";
+  }
+  return "user";
+}
+
+bool Conversation::parse_role(std::string_view name, Role &role) {
+  if (name == "user") {
+    role = Role::User;
+  } else if (name == "assistant") {
+    role = Role::Assistant;
+  } else if (name == "system") {
+    role = Role::System;
+  } else {
+    return false;
+  }
+  return true;
+}
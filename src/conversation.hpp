@@ -0,0 +1,146 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief 消息的角色
+ */
+enum class Role : uint8_t { System, User, Assistant };
+
+/**
+ * @brief 紧凑的对话存储
+ *
+ * 系统提示单独存放在一个槽位中，替换时不需要查找或移动其他消息；其余消息
+ * 只记录角色和内容在连续内存区中的位置，所有内容依次追加在同一块缓冲区里。
+ * 截断只需要缩短消息表和内存区。每条消息在追加时估算一次token数并缓存，
+ * 上下文窗口据此控制请求大小。对话本身不保存任何请求格式，发送时由
+ * RequestBuilder根据版本号把变化的部分转换为JSON。
+ */
+class Conversation {
+private:
+  struct Message {
+    uint32_t offset; // 内容在arena中的起始位置
+    uint32_t length; // 内容字节数
+    uint32_t tokens; // 估算的token数
+    Role role;
+  };
+
+  std::string system_prompt;     // 系统提示槽位，为空表示没有系统提示
+  std::string arena;             // 所有消息内容依次存放
+  std::vector<Message> messages; // 不含系统提示
+  size_t system_tokens = 0;      // 系统提示估算的token数
+  size_t message_tokens = 0;     // 所有消息估算的token数之和
+  uint64_t system_version = 0;   // 每次修改系统提示时递增
+  uint64_t generation = 0;       // 每次截断或修改已有消息时递增
+  uint64_t erased_front = 0;     // 累计从开头删除的消息数
+
+public:
+  // 每条消息除内容外的固定开销（角色和分隔符），按OpenAI的计算方式取4
+  static constexpr size_t kMessageOverheadTokens = 4;
+
+  /**
+   * @brief 替换系统提示
+   * @param prompt 新的系统提示，为空时移除系统提示
+   */
+  void set_system_prompt(std::string_view prompt);
+
+  /**
+   * @brief 当前的系统提示，没有时为空
+   */
+  std::string_view get_system_prompt() const { return system_prompt; }
+
+  bool has_system_prompt() const { return !system_prompt.empty(); }
+
+  /**
+   * @brief 追加一条消息
+   * @param role 角色，System会替换系统提示
+   * @param content 消息内容（UTF-8）
+   */
+  void append(Role role, std::string_view content);
+
+  /**
+   * @brief 只保留前count条消息，系统提示不受影响
+   * @param count 保留的消息数
+   */
+  void truncate(size_t count);
+
+  /**
+   * @brief 清除所有消息，保留系统提示
+   */
+  void clear() { truncate(0); }
+
+  /**
+   * @brief 删除最早的count条消息，系统提示不受影响
+   * @param count 删除的消息数
+   */
+  void erase_front(size_t count);
+
+  /**
+   * @brief 把一条较长的消息压缩为开头的摘录
+   * @param index 消息下标
+   * @param max_tokens 摘录最多保留的token数
+   * @return 消息被压缩时返回true，本来就足够短时返回false
+   */
+  bool collapse(size_t index, size_t max_tokens);
+
+  /**
+   * @brief 消息数（不含系统提示）
+   */
+  size_t size() const { return messages.size(); }
+
+  bool empty() const { return messages.empty(); }
+
+  Role role(size_t index) const { return messages[index].role; }
+
+  /**
+   * @brief 第index条消息估算的token数（不含固定开销）
+   */
+  size_t tokens(size_t index) const { return messages[index].tokens; }
+
+  /**
+   * @brief 整个对话估算的token数，包括系统提示和每条消息的固定开销
+   */
+  size_t total_tokens() const {
+    size_t total = message_tokens + messages.size() * kMessageOverheadTokens;
+    if (!system_prompt.empty()) {
+      total += system_tokens + kMessageOverheadTokens;
+    }
+    return total;
+  }
+
+  /**
+   * @brief 第index条消息的内容
+   * @note 返回的视图在下一次追加消息之前有效
+   */
+  std::string_view content(size_t index) const {
+    const Message &message = messages[index];
+    return std::string_view(arena).substr(message.offset, message.length);
+  }
+
+  /**
+   * @brief 内容区占用的字节数（被压缩的消息留下的空隙在删除时回收）
+   */
+  size_t content_bytes() const { return arena.size(); }
+
+  uint64_t get_system_version() const { return system_version; }
+
+  uint64_t get_generation() const { return generation; }
+
+  uint64_t get_erased_front() const { return erased_front; }
+
+  /**
+   * @brief 角色在请求中的名称，如 "user"
+   */
+  static const char *role_name(Role role);
+
+  /**
+   * @brief 解析角色名称
+   * @param name 角色名称
+   * @param role 解析结果
+   * @return 名称无法识别时返回false
+   */
+  static bool parse_role(std::string_view name, Role &role);
+};
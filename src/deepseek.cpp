@@ -1,95 +1,62 @@
 #include "deepseek.hpp"
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <sstream>
 #include "global_manager.hpp"
-
-// 辅助函数：尝试从一行data: ... JSON中提取content
-static std::string extract_stream_content(const std::string &line) {
-  if (line.find("data: ") != 0)
-    return "";
-  std::string json_part = line.substr(6); // 跳过"data: "
-  Json::CharReaderBuilder reader;
-  Json::Value root;
-  std::string errors;
-  std::istringstream json_stream(json_part);
-  if (!Json::parseFromStream(reader, json_stream, &root, &errors))
-    return "";
-  if (root.isMember("choices") && root["choices"].isArray() &&
-      !root["choices"].empty()) {
-    const auto &choice = root["choices"][0];
-    if (choice.isMember("delta") && choice["delta"].isMember("content")) {
-      return choice["delta"]["content"].asString();
-    }
-  }
-  return "";
-}
+#include "sse_parser.hpp"
 
 size_t deepseek::WriteCallback(void *contents, size_t size, size_t nmemb,
-                               std::string *data) {
-  // 检查是否需要中断流式传输
-  if (GlobalManager::getInstance().isInterruptStream()) {
+                               StreamContext *ctx) {
+  // 请求已取消时不再输出，事件循环会随即移除该传输
+  if (ctx->cancel && ctx->cancel->is_cancelled()) {
     return 0;
   }
   
   size_t total_size = size * nmemb;
-  data->append((char *)contents, total_size);
-  static std::string full_content; // 用于多轮对话收集
-  size_t pos = 0;
-  while (true) {
-    // 在处理每一行时也检查中断标志
-    if (GlobalManager::getInstance().isInterruptStream()) {
-      // 保存当前已有的部分响应到全局变量
-      if (GlobalManager::getInstance().isConversationInProgress()) {
-        GlobalManager::getInstance().setCurrentAssistantResponse(full_content);
-      }
-      return total_size; // 返回已处理的大小
-    }
-    
-    size_t next = data->find("\n", pos);
-    if (next == std::string::npos)
-      break;
-    std::string line = data->substr(pos, next - pos);
-    std::string content = extract_stream_content(line);
-    if (!content.empty()) {
-      std::cout << content << std::flush;
-      full_content += content;
-      
-      // 实时更新全局响应状态（用于信号处理）
-      if (GlobalManager::getInstance().isConversationInProgress()) {
-        GlobalManager::getInstance().setCurrentAssistantResponse(full_content);
-      }
-    }
-    pos = next + 1;
+  ctx->bytes_received += total_size;
+  if (ctx->handle && ctx->http_status == 0) {
+    curl_easy_getinfo(ctx->handle, CURLINFO_RESPONSE_CODE, &ctx->http_status);
   }
-  if (data->find("data: [DONE]") != std::string::npos) {
-    *data = full_content;
-    full_content.clear();
+  // 错误响应是普通的JSON，保存下来用于报告错误，不当作回复输出
+  if (ctx->http_status >= 400) {
+    ctx->error_body.append(static_cast<const char *>(contents), total_size);
     return total_size;
   }
-  if (pos > 0)
-    data->erase(0, pos);
-  // 检查流式结束标志，遇到data: [DONE]时，将完整内容写入data，供ask返回
-  return total_size;
-}
-
-// 进度回调函数，用于检查非流式请求的中断
-int deepseek::ProgressCallback(void *clientp, curl_off_t dltotal, curl_off_t dlnow,
-                              curl_off_t ultotal, curl_off_t ulnow) {
-  // 检查是否需要中断请求
-  if (GlobalManager::getInstance().isInterruptStream()) {
-    return 1; // 返回非零值中断请求
+  size_t extracted = ctx->parser.feed(
+      std::string_view(static_cast<const char *>(contents), total_size),
+      [ctx](std::string_view content) {
+        if (ctx->echo) {
+          std::cout << content;
+        }
+        ctx->content.append(content.data(), content.size());
+        if (ctx->partial) {
+          ctx->partial->append(content);
+        }
+      });
+  if (extracted > 0) {
+    auto now = StreamContext::clock::now();
+    if (!ctx->has_tokens()) {
+      ctx->first_token_time = now;
+    } else {
+      // 同一块数据中的后续token与第一个同时到达，间隔记为0
+      ctx->token_gaps_ms.push_back(std::chrono::duration<float, std::milli>(
+                                       now - ctx->last_token_time)
+                                       .count());
+    }
+    ctx->token_gaps_ms.resize(ctx->token_gaps_ms.size() + extracted - 1, 0.0f);
+    ctx->last_token_time = now;
+    ctx->token_count += extracted;
+    if (ctx->echo) {
+      std::cout << std::flush;
+    }
   }
-  return 0; // 继续请求
+  return total_size;
 }
 
 // 非流式传输的写回调函数
 size_t deepseek::WriteCallbackNonStream(void *contents, size_t size, size_t nmemb,
                                        std::string *data) {
-  // 检查是否需要中断
-  if (GlobalManager::getInstance().isInterruptStream()) {
-    return 0; // 中断传输
-  }
-  
   size_t total_size = size * nmemb;
   data->append((char *)contents, total_size);
   return total_size;
@@ -100,57 +67,36 @@ deepseek::deepseek(const std::string &key, bool is_stream, HistoryManager* hist_
   if (key.empty()) {
     throw std::invalid_argument("API key cannot be empty");
   }
+  connection_pool = std::make_unique<ConnectionPool>(
+      api_key, "https://api.deepseek.com/v1/chat/completions");
+  multi_handle.reset(curl_multi_init());
+  if (!multi_handle) {
+    throw std::runtime_error("Failed to initialize cURL multi handle");
+  }
 }
 
-std::string deepseek::send_request(const std::string &model,
-                                   const std::string role,
-                                   const std::string &data) {
-  CURL *curl = curl_easy_init();
-  if (!curl) {
-    throw std::runtime_error("Failed to initialize cURL");
-  }
-  std::string response_str;
-  std::string url = "https://api.deepseek.com/v1/chat/completions";
-  // prepare headers
-  struct curl_slist *headers = NULL;
-  headers = curl_slist_append(headers, "Content-Type: application/json");
-  headers =
-      curl_slist_append(headers, ("Authorization: Bearer " + api_key).c_str());
-  // create JSON request body
-  Json::Value request_body;
-  request_body["model"] = model;
-  request_body["temperature"] = 0.7;
-  if (is_stream) {
-    request_body["stream"] = true; // Enable streaming mode
-  } else {
-    request_body["stream"] = false; // Disable streaming mode
-  }
-  // add user or tool messages to body
-  add_message(role, data);
-  request_body["messages"] = messages;
-  Json::StreamWriterBuilder writer;
-  std::string request_str = Json::writeString(writer, request_body);
-  if (request_str.empty()) {
-    throw std::runtime_error("Failed to create JSON request body");
-  }
-#ifdef DEBUG
-  std::cout << "Request: " << request_str << std::endl;
-#endif
-  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-  curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request_str.c_str());
-  
+void deepseek::start_attempt(Attempt &attempt, std::string_view body,
+                             const CancellationToken &token) {
+  // 从连接池获取句柄，URL、请求头和长连接选项已经设置好
+  CURL *curl = connection_pool->acquire();
+  attempt.curl = curl;
+  attempt.started = StreamContext::clock::now();
+  curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.data());
+  curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE,
+                   static_cast<curl_off_t>(body.size()));
+
   // 根据是否流式模式选择不同的回调函数
   if (is_stream) {
+    attempt.stream_ctx.cancel = &token;
+    attempt.stream_ctx.handle = curl;
+    attempt.stream_ctx.start_time = attempt.started;
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &attempt.stream_ctx);
   } else {
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallbackNonStream);
-    // 为非流式请求设置进度回调以检查中断
-    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
-    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, ProgressCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &attempt.response);
   }
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_str);
-  
+
   // 设置超时，避免无限等待
   if (is_stream) {
     curl_easy_setopt(curl, CURLOPT_TIMEOUT, 60L);  // 流式模式允许更长时间
@@ -159,32 +105,484 @@ std::string deepseek::send_request(const std::string &model,
     curl_easy_setopt(curl, CURLOPT_TIMEOUT, 30L);  // 非流式模式30秒超时
     curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 10L);
   }
-  
-  // 重置中断标志
-  GlobalManager::getInstance().setInterruptStream(false);
+}
 
-  // 发起请求
-  CURLcode res = curl_easy_perform(curl);
-  curl_slist_free_all(headers);
-  curl_easy_cleanup(curl);
-  
-  if (res != CURLE_OK) {
-    // 检查是否是被中断导致的错误
-    if (GlobalManager::getInstance().isInterruptStream()) {
+void deepseek::end_attempt(Attempt &attempt) {
+  if (attempt.limited) {
+    rate_limiter->release();
+    attempt.limited = false;
+  }
+  if (!attempt.curl) {
+    return;
+  }
+  connection_pool->record_transfer(attempt.curl);
+  // 归还句柄而不是清理，连接留在缓存中供下一轮复用
+  connection_pool->release(attempt.curl);
+  attempt.curl = nullptr;
+}
+
+deepseek::Attempt *deepseek::perform(Attempt (&attempts)[2], std::string_view body,
+                                     CancellationToken &token) {
+  GlobalManager &gm = GlobalManager::getInstance();
+  CURLM *multi = multi_handle.get();
+  bool hedging = retry_policy.hedge_after_ms > 0;
+  size_t started = 1;
+  start_attempt(attempts[0], body, token);
+  // 可能发出对冲请求时先不输出，由先收到内容的尝试接管终端
+  Attempt *winner = nullptr;
+  if (!hedging) {
+    winner = &attempts[0];
+    if (is_stream) {
+      // 收到的内容同时追加到部分回复缓冲，中断时据此保存
+      winner->stream_ctx.partial = &gm.getPartialResponse();
+    }
+  } else {
+    attempts[0].stream_ctx.echo = false;
+  }
+  curl_multi_add_handle(multi, attempts[0].curl);
+  // 关联令牌后，其他线程取消请求会通过curl_multi_wakeup唤醒poll
+  token.attach(multi);
+  auto hedge_time = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(retry_policy.hedge_after_ms);
+
+  // 中断自管道作为额外的等待描述符：收到信号时poll立即返回，
+  // 由事件循环把信号转换为对当前请求的取消
+  struct curl_waitfd interrupt_fd;
+  interrupt_fd.fd = gm.getInterruptFd();
+  interrupt_fd.events = CURL_WAIT_POLLIN;
+  interrupt_fd.revents = 0;
+  unsigned int extra_fds = interrupt_fd.fd >= 0 ? 1 : 0;
+
+  auto remove_all = [&]() {
+    token.detach();
+    for (size_t i = 0; i < started; ++i) {
+      curl_multi_remove_handle(multi, attempts[i].curl);
+    }
+  };
+  Attempt *last_done = nullptr;
+  while (true) {
+    int running = 0;
+    CURLMcode code = curl_multi_perform(multi, &running);
+    if (code != CURLM_OK) {
+      remove_all();
+      throw std::runtime_error("cURL multi error: " +
+                               std::string(curl_multi_strerror(code)));
+    }
+    int remaining = 0;
+    while (CURLMsg *msg = curl_multi_info_read(multi, &remaining)) {
+      if (msg->msg != CURLMSG_DONE) {
+        continue;
+      }
+      Attempt &attempt = msg->easy_handle == attempts[0].curl ? attempts[0] : attempts[1];
+      attempt.result = msg->data.result;
+      attempt.done = true;
+      curl_easy_getinfo(attempt.curl, CURLINFO_RESPONSE_CODE, &attempt.status);
+      curl_multi_remove_handle(multi, attempt.curl);
+      last_done = &attempt;
+    }
+
+    if (!winner) {
+      // 流式请求以先收到内容者为准，非流式请求以先成功完成者为准
+      bool all_done = true;
+      for (size_t i = 0; i < started && !winner; ++i) {
+        Attempt &attempt = attempts[i];
+        if (attempt.succeeded() || (is_stream && attempt.stream_ctx.has_tokens())) {
+          winner = &attempt;
+        }
+        all_done = all_done && attempt.done;
+      }
+      if (!winner && all_done) {
+        winner = last_done; // 全部失败，以最后失败的尝试决定是否重试
+      }
+      if (winner) {
+        // 取消另一个尝试，它的连接随之关闭
+        for (size_t i = 0; i < started; ++i) {
+          if (&attempts[i] != winner && !attempts[i].done) {
+            curl_multi_remove_handle(multi, attempts[i].curl);
+          }
+        }
+        if (is_stream && hedging) {
+          std::cout << winner->stream_ctx.content << std::flush;
+          winner->stream_ctx.echo = true;
+          gm.getPartialResponse().append(winner->stream_ctx.content);
+          winner->stream_ctx.partial = &gm.getPartialResponse();
+        }
+      }
+    }
+    if (winner && winner->done) {
+      break;
+    }
+    if (gm.isInterrupted()) {
+      token.cancel();
+    }
+    if (token.is_cancelled()) {
+      break; // 取消传输，不再等待服务端
+    }
+
+    int timeout_ms = 1000;
+    if (hedging && !winner && started == 1) {
+      auto now = std::chrono::steady_clock::now();
+      long throttled = 0;
+      if (now >= hedge_time && rate_limiter) {
+        // 对冲请求可有可无，以后台优先级申请，名额不足时推迟
+        throttled = rate_limiter->try_acquire(RequestPriority::Background);
+        attempts[1].limited = throttled == 0;
+        if (throttled > 0) {
+          hedge_time = now + std::chrono::milliseconds(throttled);
+        }
+      }
+      if (now >= hedge_time) {
+        // 第一次尝试迟迟没有响应，再发出一个相同的请求，先响应者胜出
+        start_attempt(attempts[1], body, token);
+        attempts[1].stream_ctx.echo = false;
+        curl_multi_add_handle(multi, attempts[1].curl);
+        started = 2;
+        metrics.record_hedge();
+        continue;
+      }
+      auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(hedge_time - now);
+      timeout_ms = std::min<int>(timeout_ms, static_cast<int>(wait.count()) + 1);
+    }
+    curl_multi_poll(multi, &interrupt_fd, extra_fds, timeout_ms, nullptr);
+  }
+  remove_all();
+  return winner;
+}
+
+bool deepseek::wait_for_retry(long delay_ms, CancellationToken &token) {
+  GlobalManager &gm = GlobalManager::getInstance();
+  CURLM *multi = multi_handle.get();
+  token.attach(multi);
+  struct curl_waitfd interrupt_fd;
+  interrupt_fd.fd = gm.getInterruptFd();
+  interrupt_fd.events = CURL_WAIT_POLLIN;
+  interrupt_fd.revents = 0;
+  unsigned int extra_fds = interrupt_fd.fd >= 0 ? 1 : 0;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(delay_ms);
+  while (!token.is_cancelled()) {
+    if (gm.isInterrupted()) {
+      token.cancel();
+      break;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (now >= deadline) {
+      break;
+    }
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now);
+    curl_multi_poll(multi, &interrupt_fd, extra_fds,
+                    std::min<int>(1000, static_cast<int>(wait.count()) + 1), nullptr);
+  }
+  token.detach();
+  return !token.is_cancelled();
+}
+
+bool deepseek::wait_for_rate_limit(CancellationToken &token) {
+  if (!rate_limiter) {
+    return true;
+  }
+  auto start = std::chrono::steady_clock::now();
+  bool announced = false;
+  while (long wait = rate_limiter->try_acquire(priority)) {
+    if (!announced && wait >= 1000) {
+      std::cerr << "[rate limit] waiting ~" << wait << " ms for a request slot" << std::endl;
+      announced = true;
+    }
+    if (!wait_for_retry(wait, token)) {
+      rate_limiter->abandon();
+      return false;
+    }
+  }
+  auto waited = std::chrono::steady_clock::now() - start;
+  if (waited >= std::chrono::milliseconds(1)) {
+    metrics.record_throttle(std::chrono::duration<double, std::milli>(waited).count());
+  }
+  return true;
+}
+
+std::string deepseek::replay(const std::string &response, CancellationToken &token) {
+  if (!is_stream) {
+    // 非流式请求返回与服务端相同结构的响应体
+    Json::Value root;
+    Json::Value choice;
+    choice["index"] = 0;
+    choice["message"]["role"] = "assistant";
+    choice["message"]["content"] = response;
+    choice["finish_reason"] = "stop";
+    root["object"] = "chat.completion";
+    root["choices"].append(choice);
+    Json::StreamWriterBuilder writer;
+    return Json::writeString(writer, root);
+  }
+  GlobalManager &gm = GlobalManager::getInstance();
+  PartialResponse &partial = gm.getPartialResponse();
+  if (replay_tokens_per_second <= 0.0) {
+    std::cout << response << std::flush;
+    partial.append(response);
+    return response;
+  }
+  // 每块大约一个token：最多4个字节，且不拆开UTF-8字符
+  auto start = std::chrono::steady_clock::now();
+  double interval_ms = 1000.0 / replay_tokens_per_second;
+  size_t offset = 0;
+  for (size_t chunk = 0; offset < response.size(); ++chunk) {
+    auto due = start + std::chrono::microseconds(static_cast<int64_t>(chunk * interval_ms * 1000.0));
+    auto now = std::chrono::steady_clock::now();
+    if (due > now) {
+      long wait = static_cast<long>(
+          std::chrono::duration_cast<std::chrono::milliseconds>(due - now).count());
+      if (wait > 0 && !wait_for_retry(wait, token)) {
+        return "";
+      }
+    }
+    size_t end = std::min(response.size(), offset + 4);
+    while (end < response.size() && (static_cast<unsigned char>(response[end]) & 0xC0) == 0x80) {
+      ++end;
+    }
+    std::string_view piece(response.data() + offset, end - offset);
+    std::cout << piece << std::flush;
+    partial.append(piece);
+    offset = end;
+  }
+  return response;
+}
+
+void deepseek::cancel_request() {
+  std::lock_guard<std::mutex> lock(active_request_mutex);
+  if (active_request) {
+    active_request->cancel();
+  }
+}
+
+void deepseek::set_endpoint(const std::string &url) {
+  if (!url.empty()) {
+    connection_pool->set_endpoint(url);
+  }
+}
+
+ConnectionStats deepseek::get_connection_stats() const {
+  return connection_pool->get_stats();
+}
+
+ConnectionPool &deepseek::get_connection_pool() { return *connection_pool; }
+
+MetricsRecorder &deepseek::get_metrics() { return metrics; }
+
+const RequestMetrics &deepseek::get_last_metrics() const { return last_metrics; }
+
+void deepseek::set_metrics_in_history(bool enabled) {
+  metrics_in_history = enabled;
+}
+
+void deepseek::set_metrics_file(const std::string &path) { metrics_file = path; }
+
+bool deepseek::is_stream_mode() const { return is_stream; }
+
+void deepseek::set_context_window(const ContextWindowOptions &options) {
+  context_window = options;
+}
+
+const ContextWindowOptions &deepseek::get_context_window() const { return context_window; }
+
+size_t deepseek::get_last_request_bytes() const { return last_request_bytes; }
+
+void deepseek::set_retry_policy(const RetryPolicy &policy) { retry_policy = policy; }
+
+const RetryPolicy &deepseek::get_retry_policy() const { return retry_policy; }
+
+void deepseek::set_rate_limit(const RateLimitOptions &options) {
+  if (options.enabled()) {
+    rate_limiter = std::make_unique<RateLimiter>(options);
+  } else {
+    rate_limiter.reset();
+  }
+}
+
+RateLimiter *deepseek::get_rate_limiter() { return rate_limiter.get(); }
+
+void deepseek::set_request_priority(RequestPriority value) { priority = value; }
+
+void deepseek::set_response_cache(const ResponseCacheOptions &options) {
+  response_cache = std::make_unique<ResponseCache>(options);
+}
+
+ResponseCache *deepseek::get_response_cache() { return response_cache.get(); }
+
+void deepseek::set_cache_replay_rate(double tokens_per_second) {
+  replay_tokens_per_second = tokens_per_second;
+}
+
+bool deepseek::is_last_response_cached() const { return last_from_cache; }
+
+std::string deepseek::build_request_body(const std::string &model,
+                                         const Conversation &conversation,
+                                         bool stream) {
+  RequestBuilder builder;
+  return std::string(builder.build(conversation, model, kTemperature, stream));
+}
+
+std::string deepseek::execute(std::string_view body, CancellationToken &token) {
+  for (int attempt_number = 1;; ++attempt_number) {
+    if (!wait_for_rate_limit(token)) {
+      return "";
+    }
+    Attempt attempts[2];
+    attempts[0].limited = rate_limiter != nullptr;
+    Attempt *winner;
+    try {
+      winner = perform(attempts, body, token);
+    } catch (...) {
+      for (Attempt &attempt : attempts) {
+        end_attempt(attempt);
+      }
+      throw;
+    }
+    // 被中断时已收到的部分回复已经在部分回复缓冲中，由主线程保存
+    bool cancelled = token.is_cancelled();
+
+    bool succeeded = winner && winner->succeeded();
+    bool winner_done = false;
+    bool retryable = false;
+    long retry_after = -1;
+    long status = 0;
+    std::string failure;
+    std::string response;
+    // 取消的请求不计入指标，避免人为中断拉低分位数
+    if (succeeded) {
+      last_metrics = RequestMetrics::collect(winner->curl,
+                                             is_stream ? &winner->stream_ctx : nullptr,
+                                             body.size(), winner->response);
+      last_metrics.context_tokens = conversation.total_tokens();
+      if (winner != &attempts[0]) {
+        // 对冲请求胜出时，延迟从第一次尝试发出时算起
+        double hedge_ms = std::chrono::duration<double, std::milli>(winner->started -
+                                                                   attempts[0].started)
+                              .count();
+        last_metrics.ttfb_ms += hedge_ms;
+        last_metrics.ttft_ms += hedge_ms;
+        last_metrics.total_ms += hedge_ms;
+      }
+      metrics.record(last_metrics);
+      winner_done = winner->stream_ctx.parser.is_done();
+      // 流式模式返回累计的完整内容，供ask使用
+      response = is_stream ? std::move(winner->stream_ctx.content) : std::move(winner->response);
+    } else if (!cancelled && winner) {
+      metrics.record_failure();
+      status = winner->status;
+      failure = describe_failure(winner->result, winner->status,
+                                 is_stream ? winner->stream_ctx.error_body : winner->response);
+      retryable = winner->result != CURLE_OK
+                      ? RetryPolicy::is_retryable_error(winner->result)
+                      : RetryPolicy::is_retryable_status(winner->status);
+      // 流式回复已经输出了一部分时重试会重复输出
+      if (is_stream && winner->stream_ctx.has_tokens()) {
+        retryable = false;
+      }
+      retry_after = retry_policy.retry_after_ms(winner->curl);
+    }
+    for (Attempt &attempt : attempts) {
+      end_attempt(attempt);
+    }
+    if (!metrics_file.empty() && !cancelled) {
+      metrics.write_file(metrics_file);
+    }
+
+    if (succeeded) {
+      // 流式回复只有收到[DONE]才算完整，提前断开的回复不写入缓存
+      last_complete = !cancelled && (!is_stream || winner_done);
+      return response;
+    }
+    if (cancelled) {
       return ""; // 静默返回空响应
     }
-    throw std::runtime_error("cURL error: " +
-                             std::string(curl_easy_strerror(res)));
+    if (!retryable || attempt_number >= retry_policy.max_attempts ||
+        retry_after > retry_policy.max_retry_after_ms) {
+      throw std::runtime_error(failure);
+    }
+    long delay = backoff.delay_ms(retry_policy, attempt_number, retry_after);
+    if (status == 429 && rate_limiter) {
+      // 服务端限流时让共享同一密钥的所有进程一起暂停
+      rate_limiter->penalize(delay);
+    }
+    std::cerr << "[retry] " << failure << ", retrying in " << delay << " ms (attempt "
+              << attempt_number + 1 << "/" << retry_policy.max_attempts << ")" << std::endl;
+    metrics.record_retry();
+    if (!wait_for_retry(delay, token)) {
+      return "";
+    }
   }
-  
-  // 检查是否在传输完成后才被中断
-  if (GlobalManager::getInstance().isInterruptStream() && response_str.empty()) {
-    return ""; // 静默返回空响应
+}
+
+std::string deepseek::send_request(const std::string &model,
+                                   const std::string role,
+                                   const std::string &data,
+                                   CancellationTokenPtr token) {
+  // add user or tool messages to body
+  bool added = add_message(role, data);
+  // 超出token预算时先裁剪最早的对话，使请求大小保持有界
+  ContextTrim trim = fit_context_window(conversation, context_window);
+  // 之前的消息已经序列化在构建器中，这里只转换新消息并追加尾部字段；
+  // 请求体在传输结束前保持不变，因此直接交给curl而不复制
+  std::string_view request_body =
+      request_builder.build(conversation, model, kTemperature, is_stream);
+  last_request_bytes = request_body.size();
+  if (trim.trimmed()) {
+    std::cerr << "[context] dropped " << trim.dropped_messages << ", collapsed "
+              << trim.collapsed_messages << " oldest messages: ~"
+              << trim.tokens_before << " -> ~" << trim.tokens_after << " tokens (budget "
+              << context_window.max_tokens << "), request " << request_body.size()
+              << " bytes" << std::endl;
+  }
+#ifdef DEBUG
+  std::cout << "Request: " << request_body << std::endl;
+#endif
+
+  // 相同的模型、温度和消息直接使用缓存的回复，不访问网络
+  std::string cached;
+  last_from_cache = false;
+  last_complete = false;
+  if (response_cache) {
+    pending_cache_request = ResponseCache::make_request(model, kTemperature, conversation);
+    pending_cache_key = ResponseCache::make_key(pending_cache_request);
+    last_from_cache =
+        response_cache->lookup(pending_cache_key, pending_cache_request, cached);
+    metrics.record_cache_lookup(last_from_cache);
+  }
+
+  if (!token) {
+    token = std::make_shared<CancellationToken>();
+  }
+  // 登记令牌，使cancel_request能找到正在进行的请求
+  {
+    std::lock_guard<std::mutex> lock(active_request_mutex);
+    active_request = token;
+  }
+  // 部分回复缓冲只保存本次请求的回复
+  GlobalManager::getInstance().getPartialResponse().clear();
+  std::string response_str;
+  try {
+    response_str = last_from_cache ? replay(cached, *token) : execute(request_body, *token);
+  } catch (...) {
+    {
+      std::lock_guard<std::mutex> lock(active_request_mutex);
+      active_request.reset();
+    }
+    // 请求最终失败，撤回这条消息，下一轮不会出现连续两条用户消息
+    if (added) {
+      conversation.truncate(conversation.size() - 1);
+    }
+    throw;
+  }
+  {
+    std::lock_guard<std::mutex> lock(active_request_mutex);
+    active_request.reset();
   }
   return response_str;
 }
 
-std::string deepseek::parseResponse(const std::string &json_response) {
+std::string deepseek::parseResponse(const std::string &json_response, bool *valid) {
+  if (valid) {
+    *valid = false;
+  }
   Json::CharReaderBuilder reader;
   Json::Value root;
   std::string errors;
@@ -198,6 +596,9 @@ std::string deepseek::parseResponse(const std::string &json_response) {
       !root["choices"].empty()) {
     Json::Value choice = root["choices"][0];
     if (choice.isMember("message") && choice["message"].isMember("content")) {
+      if (valid) {
+        *valid = true;
+      }
       return choice["message"]["content"].asString();
     }
   }
@@ -213,10 +614,11 @@ bool deepseek::add_message(const std::string &role,
 #endif
     return false; // Invalid message
   }
-  Json::Value message;
-  message["role"] = role;
-  message["content"] = content;
-  messages.append(message);
+  Role message_role;
+  if (!Conversation::parse_role(role, message_role)) {
+    return false; // Unknown role
+  }
+  conversation.append(message_role, content);
   return true;
 }
 
@@ -233,13 +635,15 @@ std::string deepseek::ask(const std::string &model, const std::string &question,
     
     jsonresponse = send_request(model, "user", question);
     
-    // 检查是否被中断
-    if (GlobalManager::getInstance().isInterruptStream() || jsonresponse.empty()) {
+    // 请求被取消时返回空响应
+    if (jsonresponse.empty()) {
       std::cout << "\r              \r" << std::flush; // 清除"正在思考中..."
       return ""; // 静默返回空响应
     }
     
-    response = parseResponse(jsonresponse);
+    bool valid = false;
+    response = parseResponse(jsonresponse, &valid);
+    last_complete = last_complete && valid;
     
     // 清除等待提示
     std::cout << "\r              \r" << std::flush;
@@ -249,32 +653,31 @@ std::string deepseek::ask(const std::string &model, const std::string &question,
     }
   }
   
+  // 只缓存完整的回复：错误、解析失败、被中断或提前断开的回复重放出来没有意义
+  if (response_cache && !last_from_cache && last_complete && !response.empty()) {
+    response_cache->store(pending_cache_key, pending_cache_request, model, response);
+  }
+
   // 保存到历史记录
   if (history_manager && !response.empty()) {
-    history_manager->add_entry_multi_turn(question, response, current_system_prompt, model);
+    history_manager->add_entry_multi_turn(
+        question, response, get_system_prompt(), model,
+        metrics_in_history && !last_from_cache ? last_metrics.to_json() : Json::Value());
   }
   
-  if (multi_turn && !response.empty())
+  if (multi_turn && !response.empty()) {
     add_message("assistant", response); // Store the assistant's response
-  else if (!multi_turn)
-    messages.clear(); // Clear messages for single-turn conversations
+  } else if (!multi_turn) {
+    conversation.clear(); // Clear messages for single-turn conversations
+  }
   return response;
 }
 bool deepseek::set_system_prompt(const std::string &prompt) noexcept {
   if (prompt.empty()) {
     return false; // Invalid system prompt
   }
-  current_system_prompt = prompt; // 保存当前系统提示
-  Json::Value system_message;
-  // clear previous system message if exists
-  for (Json::Value::ArrayIndex i = 0; i < this->messages.size(); ++i) {
-    if (this->messages[i]["role"].asString() == "system") {
-      this->messages.removeIndex(i, nullptr);
-    }
-  }
-  system_message["role"] = "system";
-  system_message["content"] = prompt;
-  this->messages.insert(0, system_message); // Insert at the beginning
+  // 系统提示单独存放，直接替换槽位
+  conversation.set_system_prompt(prompt);
   return true;
 }
 
@@ -283,9 +686,11 @@ void deepseek::set_history_manager(HistoryManager* hist_manager) {
 }
 
 std::string deepseek::get_system_prompt() const {
-  return current_system_prompt;
+  return std::string(conversation.get_system_prompt());
 }
 
+const Conversation &deepseek::get_conversation() const { return conversation; }
+
 std::string deepseek::start_new_session() {
   if (history_manager) {
     return history_manager->start_new_session();
@@ -311,26 +716,14 @@ void deepseek::load_session_context(const std::string& session_id, int max_turns
     return;
   }
   
-  auto session_entries = history_manager->get_session_history(session_id);
+  // 只取出需要加载的最后max_turns轮
+  auto session_entries = history_manager->get_session_history(session_id, max_turns);
   if (session_entries.empty()) {
     return;
   }
   
-  // 清除当前的messages（除了system prompt）
-  Json::Value system_message;
-  bool has_system = false;
-  for (Json::Value::ArrayIndex i = 0; i < messages.size(); ++i) {
-    if (messages[i]["role"].asString() == "system") {
-      system_message = messages[i];
-      has_system = true;
-      break;
-    }
-  }
-  
-  messages.clear();
-  if (has_system) {
-    messages.append(system_message);
-  }
+  // 清除当前的消息，系统提示不受影响
+  conversation.clear();
   
   // 限制加载的轮次数
   int start_index = 0;
@@ -338,38 +731,15 @@ void deepseek::load_session_context(const std::string& session_id, int max_turns
     start_index = static_cast<int>(session_entries.size()) - max_turns;
   }
   
-  // 按顺序添加历史对话到messages
+  // 按顺序添加历史对话
   for (int i = start_index; i < static_cast<int>(session_entries.size()); ++i) {
     const auto& entry = session_entries[i];
-    
-    // 添加用户消息
-    Json::Value user_msg;
-    user_msg["role"] = "user";
-    user_msg["content"] = entry.user_message;
-    messages.append(user_msg);
-    
-    // 添加助手回复
-    Json::Value assistant_msg;
-    assistant_msg["role"] = "assistant";
-    assistant_msg["content"] = entry.assistant_response;
-    messages.append(assistant_msg);
+    conversation.append(Role::User, entry.user_message);
+    conversation.append(Role::Assistant, entry.assistant_response);
   }
 }
 
 void deepseek::clear_conversation_context() {
   // 保留系统提示，清除其他消息
-  Json::Value system_message;
-  bool has_system = false;
-  for (Json::Value::ArrayIndex i = 0; i < messages.size(); ++i) {
-    if (messages[i]["role"].asString() == "system") {
-      system_message = messages[i];
-      has_system = true;
-      break;
-    }
-  }
-  
-  messages.clear();
-  if (has_system) {
-    messages.append(system_message);
-  }
-}
\ No newline at end of file
+  conversation.clear();
+}
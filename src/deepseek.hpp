@@ -4,19 +4,132 @@
 #include <json/value.h>
 #include <string>
 #include <atomic>
+#include <memory>
+#include <mutex>
+#include "cancellation_token.hpp"
+#include "connection_pool.hpp"
+#include "context_window.hpp"
+#include "conversation.hpp"
+#include "rate_limiter.hpp"
+#include "request_builder.hpp"
+#include "request_metrics.hpp"
+#include "response_cache.hpp"
+#include "retry_policy.hpp"
+#include "stream_context.hpp"
 #include "history.hpp"
 #include "global_manager.hpp"
 
 class deepseek {
 private:
   std::string api_key;
-  Json::Value messages{Json::arrayValue};
+  Conversation conversation;      // 当前对话，系统提示单独存放
+  RequestBuilder request_builder; // 对话的序列化缓存，每轮只转换新消息
+  ContextWindowOptions context_window; // 每个请求的token预算
+  size_t last_request_bytes = 0;       // 最近一次发送的请求体大小
   bool is_stream;
-  std::string current_system_prompt;
   HistoryManager* history_manager; // 历史记录管理器指针
   std::string current_session_id; // 当前会话ID
+  std::unique_ptr<ConnectionPool> connection_pool; // 长连接池，跨请求复用连接
+  struct MultiHandleDeleter {
+    void operator()(CURLM *multi) const { curl_multi_cleanup(multi); }
+  };
+  // 交互式请求的事件循环，除socket外还等待中断自管道和取消令牌的唤醒
+  std::unique_ptr<CURLM, MultiHandleDeleter> multi_handle;
+  std::mutex active_request_mutex;
+  CancellationTokenPtr active_request; // 正在进行的请求的取消令牌
+  MetricsRecorder metrics;             // 本次运行所有请求的指标汇总
+  RequestMetrics last_metrics;         // 最近一个成功请求的指标
+  bool metrics_in_history = false;     // 是否把请求指标写入历史记录
+  std::string metrics_file;            // 每个请求后刷新的指标文件，为空时不写
+  RetryPolicy retry_policy;            // 瞬时故障的重试和对冲策略
+  Backoff backoff;
+  std::unique_ptr<RateLimiter> rate_limiter; // 客户端限流，为空时不限流
+  RequestPriority priority = RequestPriority::Interactive; // 本实例请求的优先级
+  std::unique_ptr<ResponseCache> response_cache; // 磁盘响应缓存，为空时不缓存
+  double replay_tokens_per_second = 0.0; // 流式回放缓存回复的速率，0表示一次输出
+  std::string pending_cache_key;         // 最近一个请求的缓存键，收到回复后据此保存
+  std::string pending_cache_request;     // 最近一个请求的规范化文本，与回复一起保存用于校验
+  bool last_from_cache = false;          // 最近一个回复是否来自缓存
+  bool last_complete = false;            // 最近一个回复是否完整（2xx、流式收到[DONE]且未取消）
+
+  // 一次请求尝试，对冲时同时进行两个
+  struct Attempt {
+    CURL *curl = nullptr;
+    StreamContext::clock::time_point started;
+    StreamContext stream_ctx;
+    std::string response; // 非流式模式的响应体
+    CURLcode result = CURLE_OK;
+    long status = 0;
+    bool done = false;
+    bool limited = false; // 占用了一个限流名额
+
+    bool succeeded() const {
+      return done && result == CURLE_OK && RetryPolicy::is_success_status(status);
+    }
+  };
+
+  /**
+   * @brief Acquires a handle from the pool and prepares it for one attempt.
+   * @param attempt The attempt to prepare.
+   * @param body The request body, which must outlive the transfer.
+   * @param token The request's cancellation token.
+   */
+  void start_attempt(Attempt &attempt, std::string_view body,
+                     const CancellationToken &token);
+
+  /**
+   * @brief Records the connection statistics of an attempt and returns its
+   * handle to the pool.
+   */
+  void end_attempt(Attempt &attempt);
+
+  /**
+   * @brief Runs one attempt on the event loop, hedging it with a second
+   * identical attempt when the policy asks for it.
+   * @param attempts Storage for the primary and the hedged attempt.
+   * @param body The request body.
+   * @param token The request's cancellation token; cancelling it wakes the
+   * loop immediately.
+   * @return The attempt whose response is used (the first to respond, or the
+   * last to fail), nullptr when cancelled before either responded.
+   * @throws std::runtime_error on a curl multi error
+   */
+  Attempt *perform(Attempt (&attempts)[2], std::string_view body,
+                   CancellationToken &token);
+
+  /**
+   * @brief Sends a request body, retrying transient failures with backoff.
+   * @param body The request body.
+   * @param token The request's cancellation token.
+   * @return The response (accumulated content in streaming mode), or an
+   * empty string if the request was cancelled.
+   * @throws std::runtime_error when the request fails for good
+   */
+  std::string execute(std::string_view body, CancellationToken &token);
+
+  /**
+   * @brief Sleeps before a retry, waking up early when cancelled.
+   * @return false if the request was cancelled while waiting
+   */
+  bool wait_for_retry(long delay_ms, CancellationToken &token);
+
+  /**
+   * @brief Waits until the rate limiter admits one more request.
+   * @return false if the request was cancelled while waiting
+   */
+  bool wait_for_rate_limit(CancellationToken &token);
+
+  /**
+   * @brief Plays back a cached reply as if it were streamed, in chunks of
+   * about one token at the configured replay rate.
+   * @return The reply, or an empty string if cancelled during the replay.
+   */
+  std::string replay(const std::string &response, CancellationToken &token);
 
 public:
+  // Sampling temperature sent with every request
+  static constexpr double kTemperature = 0.7;
+
   /**
    * @brief constructor for deepseek class
    * @param key API key for authentication
@@ -26,31 +139,180 @@ public:
    * @note The API key is required for making requests to the DeepSeek API.
    */
   deepseek(const std::string &key, bool is_stream = false, HistoryManager* hist_manager = nullptr);
+
+  /**
+   * @brief Set the chat completions endpoint (e.g. a local stand-in server)
+   * @param url Full URL of the endpoint
+   */
+  void set_endpoint(const std::string &url);
+
+  /**
+   * @brief Get connection reuse statistics of this instance
+   * @return A snapshot of the connection statistics
+   */
+  ConnectionStats get_connection_stats() const;
+
+  /**
+   * @brief Get the latency/throughput metrics of all requests so far
+   * @return Reference to the metrics recorder (thread-safe)
+   */
+  MetricsRecorder &get_metrics();
+
+  /**
+   * @brief Get the metrics of the most recent successful request
+   */
+  const RequestMetrics &get_last_metrics() const;
+
+  /**
+   * @brief Whether to store each request's metrics in its history entry
+   * @param enabled true to add a "metrics" object to new history entries
+   */
+  void set_metrics_in_history(bool enabled);
+
+  /**
+   * @brief Set a file that is rewritten with the metrics summary after every
+   * request
+   * @param path Output path; ".prom"/".txt" selects the Prometheus text
+   * format, anything else JSON. Empty disables the dump.
+   */
+  void set_metrics_file(const std::string &path);
+
+  /**
+   * @brief Set the retry and hedging policy for transient failures
+   * @param policy Attempts, backoff limits and the hedging threshold
+   */
+  void set_retry_policy(const RetryPolicy &policy);
+
+  /**
+   * @brief Get the retry and hedging policy
+   */
+  const RetryPolicy &get_retry_policy() const;
+
+  /**
+   * @brief Limit the request rate and concurrency of this client
+   * @param options Token bucket, concurrency cap and the state file shared
+   * with other processes using the same API key; limits of 0 disable it.
+   */
+  void set_rate_limit(const RateLimitOptions &options);
+
+  /**
+   * @brief Get the rate limiter shared by all requests of this instance
+   * @return The limiter, or nullptr when requests are not limited
+   */
+  RateLimiter *get_rate_limiter();
+
+  /**
+   * @brief Set the priority of this instance's requests
+   * @param value Background requests yield to interactive ones waiting for
+   * the rate limiter in any process.
+   */
+  void set_request_priority(RequestPriority value);
+
+  /**
+   * @brief Enable the on-disk response cache
+   * @param options Cache directory, TTL and size limit. Identical requests
+   * (model, temperature and normalized messages) are answered from the cache
+   * without touching the network.
+   */
+  void set_response_cache(const ResponseCacheOptions &options);
+
+  /**
+   * @brief Get the response cache
+   * @return The cache, or nullptr when caching is disabled
+   */
+  ResponseCache *get_response_cache();
+
+  /**
+   * @brief Set how fast cached replies are played back in streaming mode
+   * @param tokens_per_second Approximate tokens per second, 0 prints the
+   * whole reply at once.
+   */
+  void set_cache_replay_rate(double tokens_per_second);
+
+  /**
+   * @brief Whether the most recent reply was served from the response cache
+   */
+  bool is_last_response_cached() const;
+
+  /**
+   * @brief Set the token budget of the conversation context
+   * @param options Budget and overflow handling; the oldest turns are
+   * dropped or collapsed before a request that would exceed the budget.
+   */
+  void set_context_window(const ContextWindowOptions &options);
+
+  /**
+   * @brief Get the token budget of the conversation context
+   */
+  const ContextWindowOptions &get_context_window() const;
+
+  /**
+   * @brief Get the size of the most recently sent request body
+   * @return Size in bytes, 0 before the first request
+   */
+  size_t get_last_request_bytes() const;
+
+  /**
+   * @brief Get the connection pool shared by all requests of this instance
+   * @return Reference to the connection pool
+   */
+  ConnectionPool &get_connection_pool();
+
+  /**
+   * @brief Whether responses are requested in streaming mode
+   */
+  bool is_stream_mode() const;
+
+  /**
+   * @brief Serializes a chat completions request body.
+   * @param model The model to use for the request.
+   * @param conversation The conversation to send.
+   * @param stream Whether to request a streaming response.
+   * @return The request body as a JSON string.
+   */
+  static std::string build_request_body(const std::string &model,
+                                        const Conversation &conversation,
+                                        bool stream);
   /**
    * @brief Sends a request to the DeepSeek API and returns the response.
    * @param model The model to use for the request.
    * @param role The role of the message (e.g., "user", "assistant").
    * @param data The content of the message.
-   * @return The response from the DeepSeek API as a string(typiclly json type).
+   * @param token Cancellation token for this request (optional, one is
+   * created when omitted).
+   * @return The response from the DeepSeek API as a string(typiclly json
+   * type), or an empty string if the request was cancelled. A reply served
+   * from the response cache has the same shape as a live one.
    * @throws std::runtime_error if cURL initialization fails or if the request
-   * fails.
+   * still fails after the retries allowed by the retry policy; the message is
+   * then removed from the conversation again.
    */
   std::string send_request(const std::string &model, const std::string role,
-                           const std::string &data);
+                           const std::string &data,
+                           CancellationTokenPtr token = nullptr);
+
+  /**
+   * @brief Cancels the request currently in flight, if any.
+   * @note Thread-safe; the transfer is aborted immediately even when the
+   * server is not sending anything.
+   */
+  void cancel_request();
   /**
    * @brief Parses the JSON response from the DeepSeek API and extracts the
    * reply content.
    * @param json_response The JSON response string from the API.
+   * @param valid If not null, set to whether the reply content was found.
    * @return The reply content as a string, or an error message if parsing
    * fails.
    */
-  std::string parseResponse(const std::string &json_response);
+  std::string parseResponse(const std::string &json_response, bool *valid = nullptr);
   /**
    * @brief Adds a message to the conversation history.
    * @param role The role of the message (e.g., "user", "assistant").
    * @param content The content of the message.
    * @return true if the message was added successfully, false if the message is
-   * invalid.
+   * invalid or the role is unknown.
+   * @note A "system" message replaces the system prompt.
    */
   bool add_message(const std::string &role, const std::string &content);
   /**
@@ -84,6 +346,12 @@ public:
    */
   std::string get_system_prompt() const;
 
+  /**
+   * @brief Get the current conversation
+   * @return The messages that will be sent with the next request
+   */
+  const Conversation &get_conversation() const;
+
   /**
    * @brief Start a new conversation session
    * @return New session ID
@@ -115,25 +383,16 @@ public:
   void clear_conversation_context();
 
   /**
-   * @brief Extracts the content from a streaming response line.
-   * @param line The line from the streaming response.
-   * @note the function will output the content to stdout if in stream mode.
-   * @return The extracted content as a string.
+   * @brief Write callback for streaming responses.
+   * @param contents Data received
+   * @param size Size of each element
+   * @param nmemb Number of elements
+   * @param ctx Per-request stream state that accumulates the reply
+   * @note the function will output the content to stdout if ctx->echo is set.
+   * @return Number of bytes processed, 0 to abort when cancelled
    */
   static size_t WriteCallback(void *contents, size_t size, size_t nmemb,
-                              std::string *data);
-  
-  /**
-   * @brief Progress callback for non-streaming requests to check for interruption
-   * @param clientp Client data (unused)
-   * @param dltotal Total download size
-   * @param dlnow Current download size
-   * @param ultotal Total upload size  
-   * @param ulnow Current upload size
-   * @return 0 to continue, non-zero to abort
-   */
-  static int ProgressCallback(void *clientp, curl_off_t dltotal, curl_off_t dlnow,
-                             curl_off_t ultotal, curl_off_t ulnow);
+                              StreamContext *ctx);
   
   /**
    * @brief Write callback specifically for non-streaming responses
@@ -1,9 +1,15 @@
 #pragma once
 #include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <ctime>
+#include <fcntl.h>
 #include <string>
 #include <memory>
+#include <unistd.h>
 #include "history.hpp"
 #include "config.hpp"
+#include "partial_response.hpp"
 
 /**
  * @brief 单例类用于管理所有全局变量
@@ -22,15 +28,18 @@ private:
 
     // 全局运行状态
     std::atomic<bool> running_{true};
-    std::atomic<bool> interrupt_stream_{false};
     std::atomic<bool> conversation_in_progress_{false};
     
     // 对话相关状态
     std::string current_user_input_;
-    std::string current_assistant_response_;
+    PartialResponse current_assistant_response_; // 正在接收的回复，流式请求逐个token追加
     std::string current_system_prompt_;
     std::string current_model_;
     
+    // 中断通知：信号处理函数写入自管道，事件循环在poll中等待它的读端
+    int interrupt_pipe_[2] = {-1, -1};
+    std::atomic<int64_t> interrupt_time_ns_{0}; // 收到中断信号的时刻（CLOCK_MONOTONIC）
+    
     // 管理器指针
     HistoryManager* history_manager_ = nullptr;
     Config* config_ = nullptr;
@@ -49,9 +58,6 @@ public:
     bool isRunning() const { return running_.load(); }
     void setRunning(bool running) { running_.store(running); }
     
-    bool isInterruptStream() const { return interrupt_stream_.load(); }
-    void setInterruptStream(bool interrupt) { interrupt_stream_.store(interrupt); }
-    
     bool isConversationInProgress() const { return conversation_in_progress_.load(); }
     void setConversationInProgress(bool in_progress) { conversation_in_progress_.store(in_progress); }
 
@@ -59,14 +65,70 @@ public:
     const std::string& getCurrentUserInput() const { return current_user_input_; }
     void setCurrentUserInput(const std::string& input) { current_user_input_ = input; }
     
-    const std::string& getCurrentAssistantResponse() const { return current_assistant_response_; }
-    void setCurrentAssistantResponse(const std::string& response) { current_assistant_response_ = response; }
+    // 返回已发布部分的副本，可以在写入线程追加的同时调用
+    std::string getCurrentAssistantResponse() const { return current_assistant_response_.snapshot(); }
+    void setCurrentAssistantResponse(const std::string& response) {
+        current_assistant_response_.clear();
+        current_assistant_response_.append(response);
+    }
+    
+    // 流式请求把增量内容直接追加到这里，每个token的开销与回复长度无关
+    PartialResponse& getPartialResponse() { return current_assistant_response_; }
     
     const std::string& getCurrentSystemPrompt() const { return current_system_prompt_; }
     void setCurrentSystemPrompt(const std::string& prompt) { current_system_prompt_ = prompt; }
     
     const std::string& getCurrentModel() const { return current_model_; }
     void setCurrentModel(const std::string& model) { current_model_ = model; }
+    
+    /**
+     * @brief 创建中断自管道（非阻塞、close-on-exec），需在安装信号处理函数之前调用
+     * @return 是否创建成功
+     */
+    bool initInterruptPipe() {
+        if (interrupt_pipe_[0] >= 0) {
+            return true;
+        }
+        if (::pipe(interrupt_pipe_) != 0) {
+            return false;
+        }
+        for (int fd : interrupt_pipe_) {
+            ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+            ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        return true;
+    }
+    
+    /**
+     * @brief 中断自管道的读端，可读即表示收到了中断；管道不会被读空，之后一直保持可读
+     * @return 文件描述符，未创建时为-1
+     */
+    int getInterruptFd() const { return interrupt_pipe_[0]; }
+    
+    /**
+     * @brief 通知事件循环中断（异步信号安全：只写原子变量和自管道）
+     *
+     * 事件循环被唤醒后取消各自正在进行的请求的令牌。
+     */
+    void notifyInterrupt() {
+        running_.store(false);
+        struct timespec now;
+        ::clock_gettime(CLOCK_MONOTONIC, &now);
+        int64_t expected = 0;
+        interrupt_time_ns_.compare_exchange_strong(
+            expected, static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec);
+        if (interrupt_pipe_[1] >= 0) {
+            int saved_errno = errno;
+            ssize_t ignored = ::write(interrupt_pipe_[1], "i", 1);
+            (void)ignored;
+            errno = saved_errno;
+        }
+    }
+    
+    /**
+     * @brief 是否已经收到过中断信号
+     */
+    bool isInterrupted() const { return interrupt_time_ns_.load() != 0; }
 
     // 管理器指针管理
     HistoryManager* getHistoryManager() const { return history_manager_; }
@@ -80,7 +142,6 @@ public:
      */
     void reset() {
         running_.store(true);
-        interrupt_stream_.store(false);
         conversation_in_progress_.store(false);
         current_user_input_.clear();
         current_assistant_response_.clear();
@@ -99,12 +160,13 @@ public:
     }
 
     /**
-     * @brief 保存当前状态（用于信号处理）
+     * @brief 保存当前状态（中断后由主线程调用，不能在信号处理函数中调用）
      */
     void saveCurrentState() {
         if (conversation_in_progress_.load() && history_manager_ && !current_user_input_.empty()) {
-            std::string response_to_save = current_assistant_response_.empty() ? 
-                "[对话被中断]" : current_assistant_response_ + " [已中断]";
+            std::string partial = getCurrentAssistantResponse();
+            std::string response_to_save = partial.empty() ? 
+                "[对话被中断]" : partial + " [已中断]";
             
             history_manager_->add_entry_multi_turn(
                 current_user_input_, 
@@ -115,7 +177,8 @@ public:
         }
         
         if (history_manager_) {
-            history_manager_->save_history();
+            // 只落盘不压缩：压缩可能需要数秒，会被关闭超时打断
+            history_manager_->sync_history();
         }
         
         if (config_) {
@@ -1,52 +1,158 @@
 #include "history.hpp"
+#include "history_journal.hpp"
+#include "search_index.hpp"
 #include <iomanip>
 #include <sstream>
 #include <algorithm>
+#include <cstdio>
+#include <ctime>
 #include <filesystem>
 
+// 交互命令读取新条目时，等待本进程写线程和其他进程持有的文件锁的时间上限
+static const std::chrono::milliseconds kRefreshWait(200);
+// 聊天循环每追加这么多条才检查一次是否需要转存冷段
+static const size_t kSealCheckInterval = 64;
+
+// 把记录中的请求指标格式化为一行摘要
+static std::string format_metrics(const Json::Value& metrics) {
+    std::ostringstream out;
+    out << "ttft " << metrics.get("ttft_ms", 0.0).asDouble() << " ms, total "
+        << metrics.get("total_ms", 0.0).asDouble() << " ms, "
+        << metrics.get("tokens", 0).asUInt64() << " tokens";
+    if (metrics.isMember("tokens_per_s")) {
+        out << " (" << metrics["tokens_per_s"].asDouble() << " tokens/s)";
+    }
+    if (metrics.isMember("itl_p50_ms")) {
+        out << ", itl p50/p99 " << metrics["itl_p50_ms"].asDouble() << "/"
+            << metrics["itl_p99_ms"].asDouble() << " ms";
+    }
+    return out.str();
+}
+
+// 逐行解析JSON Lines，跳过空行和无法解析的行（例如旧日志中写了一半的尾部记录）
+static size_t read_json_lines(std::istream& in, std::vector<HistoryEntry>& entries) {
+    static const std::unique_ptr<Json::CharReader> reader = [] {
+        Json::CharReaderBuilder builder;
+        return std::unique_ptr<Json::CharReader>(builder.newCharReader());
+    }();
+    size_t skipped = 0;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+        Json::Value root;
+        std::string errors;
+        if (!reader->parse(line.data(), line.data() + line.size(), &root, &errors) ||
+            !root.isObject()) {
+            skipped++;
+            continue;
+        }
+        entries.push_back(HistoryEntry::from_json(root));
+    }
+    return skipped;
+}
+
+bool parse_history_timestamp(const std::string& text, int64_t& nanoseconds) {
+    std::tm tm{};
+    int milliseconds = 0;
+    int fields = std::sscanf(text.c_str(), "%d-%d-%d%*[ T]%d:%d:%d.%d", &tm.tm_year, &tm.tm_mon,
+                             &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &milliseconds);
+    // 只有日期（当天0点），或者时间至少写到分钟
+    if (fields != 3 && fields < 5) {
+        return false;
+    }
+    if (tm.tm_mon < 1 || tm.tm_mon > 12 || tm.tm_mday < 1 || tm.tm_mday > 31) {
+        return false;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1; // 由mktime判断是否处于夏令时
+    nanoseconds = (static_cast<int64_t>(std::mktime(&tm)) * 1000 + milliseconds) * 1000000;
+    return true;
+}
+
+std::string format_history_timestamp(int64_t nanoseconds) {
+    int64_t milliseconds = nanoseconds / 1000000;
+    std::time_t seconds = static_cast<std::time_t>(milliseconds / 1000);
+    std::tm tm{};
+    localtime_r(&seconds, &tm);
+    char buffer[32];
+    size_t length = std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &tm);
+    std::snprintf(buffer + length, sizeof(buffer) - length, ".%03d",
+                  static_cast<int>(milliseconds % 1000));
+    return buffer;
+}
+
+int64_t history_day_start(int64_t nanoseconds, int days) {
+    std::time_t seconds = static_cast<std::time_t>(nanoseconds / 1000000000);
+    if (nanoseconds < 0 && nanoseconds % 1000000000 != 0) {
+        seconds--;
+    }
+    std::tm tm{};
+    localtime_r(&seconds, &tm);
+    // 由mktime规范化日期和夏令时，每天不一定是24小时
+    tm.tm_mday += days;
+    tm.tm_hour = 0;
+    tm.tm_min = 0;
+    tm.tm_sec = 0;
+    tm.tm_isdst = -1;
+    return static_cast<int64_t>(std::mktime(&tm)) * 1000000000;
+}
+
 HistoryEntry::HistoryEntry(const std::string& user_msg, const std::string& assistant_resp, 
                          const std::string& sys_prompt, const std::string& model_name,
                          const std::string& sess_id, int turn_num)
     : user_message(user_msg), assistant_response(assistant_resp), 
       system_prompt(sys_prompt), model(model_name), session_id(sess_id), turn_number(turn_num) {
-    // 生成时间戳
-    auto now = std::chrono::system_clock::now();
-    auto time_t = std::chrono::system_clock::to_time_t(now);
-    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-        now.time_since_epoch()) % 1000;
-    
-    std::stringstream ss;
-    ss << std::put_time(std::localtime(&time_t), "%Y-%m-%d %H:%M:%S");
-    ss << "." << std::setfill('0') << std::setw(3) << ms.count();
-    timestamp = ss.str();
+    // 只记录纳秒数，显示或导出时才格式化
+    timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
 }
 
 Json::Value HistoryEntry::to_json() const {
     Json::Value json;
-    json["timestamp"] = timestamp;
+    // 导出为本地时间的字符串，与旧版的历史文件一致
+    json["timestamp"] = format_history_timestamp(timestamp);
     json["user_message"] = user_message;
     json["assistant_response"] = assistant_response;
     json["system_prompt"] = system_prompt;
     json["model"] = model;
     json["session_id"] = session_id;
     json["turn_number"] = turn_number;
+    if (!metrics.isNull()) {
+        json["metrics"] = metrics;
+    }
     return json;
 }
 
 HistoryEntry HistoryEntry::from_json(const Json::Value& json) {
     HistoryEntry entry;
-    entry.timestamp = json.get("timestamp", "").asString();
+    // 旧版的历史文件中是本地时间的字符串，也接受纳秒数
+    const Json::Value& timestamp = json["timestamp"];
+    if (timestamp.isIntegral()) {
+        entry.timestamp = timestamp.asInt64();
+    } else if (timestamp.isString()) {
+        parse_history_timestamp(timestamp.asString(), entry.timestamp);
+    }
     entry.user_message = json.get("user_message", "").asString();
     entry.assistant_response = json.get("assistant_response", "").asString();
     entry.system_prompt = json.get("system_prompt", "").asString();
     entry.model = json.get("model", "deepseek-chat").asString();
     entry.session_id = json.get("session_id", "").asString();
     entry.turn_number = json.get("turn_number", 0).asInt();
+    if (json.isMember("metrics")) {
+        entry.metrics = json["metrics"];
+    }
     return entry;
 }
 
 HistoryManager::HistoryManager(const std::string& history_path, int max_entries)
-    : history_file_path(history_path), max_entries(max_entries), current_turn_number(0) {
+    : history_file_path(history_path), first_row(0),
+      journal(std::make_unique<HistoryJournal>(history_path)),
+      search_index(std::make_unique<SearchIndex>(history_path)),
+      rewrite_pending(false), known_end_id(0), appends_since_seal_check(0), session_index_ready(false), time_checked_id(0),
+      time_checked_last(0), time_ordered(true), max_entries(max_entries), current_turn_number(0) {
     // 确保历史记录目录存在
     std::filesystem::path history_file(history_path);
     std::filesystem::path history_dir = history_file.parent_path();
@@ -59,165 +165,703 @@ HistoryManager::HistoryManager(const std::string& history_path, int max_entries)
     start_new_session();
 }
 
-std::string HistoryManager::get_current_timestamp() const {
-    auto now = std::chrono::system_clock::now();
-    auto time_t = std::chrono::system_clock::to_time_t(now);
-    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-        now.time_since_epoch()) % 1000;
-    
-    std::stringstream ss;
-    ss << std::put_time(std::localtime(&time_t), "%Y-%m-%d %H:%M:%S");
-    ss << "." << std::setfill('0') << std::setw(3) << ms.count();
-    return ss.str();
+HistoryManager::~HistoryManager() {
+    // 先等日志落盘并读回本进程写出的条目，再写出引用这些记录的全文索引
+    if (journal->flush()) {
+        absorb(kRefreshWait);
+        search_index->flush();
+    }
+}
+
+void HistoryManager::set_retention(const HistoryRetention& value) {
+    retention = value;
 }
 
 bool HistoryManager::load_history() {
-    std::ifstream history_file(history_file_path);
-    if (!history_file.is_open()) {
+    columns.clear();
+    first_row = 0;
+    reset_session_index();
+    reset_time_index();
+    rewrite_pending = false;
+    
+    if (!journal->exists()) {
+        // 旧版本使用JSON Lines日志history.jsonl或整体重写的history.json，首次运行时导入
+        for (const char* extension : {".jsonl", ".json"}) {
+            std::string legacy_path = std::filesystem::path(history_file_path)
+                                          .replace_extension(extension).string();
+            if (legacy_path != history_file_path && std::filesystem::exists(legacy_path)) {
+                return import_legacy_history(legacy_path);
+            }
+        }
         // 如果历史文件不存在，创建空的历史记录
         std::cout << "History file not found, creating new history file: " 
                   << history_file_path << std::endl;
-        return save_history();
+        // 同时启动的其他进程可能已经创建了日志，此时直接使用
+        bool ok = rewrite_journal({}, true);
+        apply_retention();
+        return ok;
     }
     
-    Json::CharReaderBuilder reader;
-    Json::Value root;
-    std::string errors;
-    
-    if (!Json::parseFromStream(reader, history_file, &root, &errors)) {
-        std::cerr << "Error parsing history file: " << errors << std::endl;
-        history_file.close();
+    // 只映射日志并让各列引用快照中的数组，正文在访问时才读取
+    if (!journal->open(columns)) {
+        std::cerr << "Error reading history file: " << history_file_path << std::endl;
+        columns.clear();
+        return false;
+    }
+    known_end_id = columns.id_of(columns.rows());
+    apply_retention();
+    search_index->attach(journal->get_store_id());
+    compact_if_needed();
+    seal_if_needed();
+    return true;
+}
+
+bool HistoryManager::import_legacy_history(const std::string& legacy_path) {
+    std::ifstream history_file(legacy_path);
+    if (!history_file.is_open()) {
         return false;
     }
     
+    std::vector<HistoryEntry> entries;
+    if (std::filesystem::path(legacy_path).extension() == ".jsonl") {
+        read_json_lines(history_file, entries);
+    } else {
+        Json::CharReaderBuilder reader;
+        Json::Value root;
+        std::string errors;
+        
+        if (!Json::parseFromStream(reader, history_file, &root, &errors)) {
+            std::cerr << "Error parsing history file: " << errors << std::endl;
+            history_file.close();
+            return false;
+        }
+        
+        // 加载历史记录
+        if (root.isMember("history") && root["history"].isArray()) {
+            for (const auto& entry_json : root["history"]) {
+                entries.push_back(HistoryEntry::from_json(entry_json));
+            }
+        }
+    }
     history_file.close();
+    if (static_cast<int>(entries.size()) > max_entries) {
+        entries.erase(entries.begin(), entries.end() - std::max(max_entries, 0));
+    }
     
-    // 清空现有历史记录
-    history_entries.clear();
-    
-    // 加载历史记录
-    if (root.isMember("history") && root["history"].isArray()) {
-        for (const auto& entry_json : root["history"]) {
-            history_entries.push_back(HistoryEntry::from_json(entry_json));
+    std::cout << "Imported " << entries.size() << " entries from "
+              << legacy_path << " into " << history_file_path << std::endl;
+    return rewrite_journal(entries, true);
+}
+
+bool HistoryManager::rewrite_journal(const std::vector<HistoryEntry>& entries, bool create) {
+    bool created = true;
+    bool ok = create ? journal->create(entries, columns, created) : journal->rewrite(entries, columns);
+    first_row = 0;
+    session_slots.clear(); // 字典ID重新分配
+    reset_time_index();
+    known_end_id = columns.id_of(columns.rows());
+    // 记录编号重新从0开始，旧的全文索引作废（日志已由其他进程创建时仍然有效）
+    search_index->attach(journal->get_store_id(), created);
+    return ok;
+}
+
+void HistoryManager::sync_external(HistoryRefresh change, uint64_t first_id, uint64_t store,
+                                   size_t end_row) {
+    // 后台写线程写出的本进程条目，由本进程写入全文索引
+    auto own_rows = journal->take_own_rows();
+    if (change == HistoryRefresh::Unchanged) {
+        return;
+    }
+    if (journal->get_store_id() != store) {
+        // 历史被其他进程清空或重写：记录编号重新开始，与重新加载相同
+        first_row = 0;
+        reset_session_index();
+        reset_time_index();
+        search_index->attach(journal->get_store_id());
+    } else if (change == HistoryRefresh::Reloaded) {
+        // 热文件被其他进程压缩：行号和字典ID改变，记录编号不变；
+        // 其他进程可能已淘汰了本进程仍保留的条目，会话索引在下次查询时重建
+        first_row = first_id < columns.first_id ? 0 : std::min(columns.row_of(first_id), columns.rows());
+        reset_session_index();
+    } else {
+        size_t start = std::max(first_row, std::min(columns.row_of(known_end_id), end_row));
+        if (session_index_ready) {
+            // 新条目排在已处理的条目之后，依次加入会话索引
+            for (size_t row = start; row < end_row; ++row) {
+                index_record(row - first_row);
+            }
+        }
+        if (end_row - start <= own_rows.size()) {
+            change = HistoryRefresh::Unchanged; // 全部是本进程的条目，内存中的全文索引仍然完整
         }
     }
-    
-    return true;
+    // 其他进程的条目的倒排记录由写入的进程追加到索引文件，内存中的全文索引在下次搜索时重新加载
+    if (change != HistoryRefresh::Unchanged && search_index->is_loaded()) {
+        search_index->unload();
+    }
+    // 全文索引的记录先缓存在内存中，等日志落盘后再写出
+    for (const auto& row : own_rows) {
+        search_index->add(row.first, row.second, false);
+    }
+    known_end_id = columns.id_of(end_row);
+}
+
+void HistoryManager::absorb(std::chrono::milliseconds wait) {
+    uint64_t first_id = columns.id_of(first_row);
+    uint64_t store = journal->get_store_id();
+    HistoryRefresh change = HistoryRefresh::Unchanged;
+    if (!journal->refresh(columns, change, wait)) {
+        std::cerr << "Warning: Failed to read new history records." << std::endl;
+    }
+    sync_external(change, first_id, store, columns.rows());
+    size_t limit = static_cast<size_t>(std::max(max_entries, 0));
+    if (columns.rows() - first_row > limit) {
+        evict_oldest(columns.rows() - first_row - limit);
+    }
+}
+
+void HistoryManager::settle() const {
+    // 追加只把条目交给后台写线程，条目在被读回之前不在各列中；查询前请写线程立即写出
+    // 并读回；其他进程长时间持有锁时不再等待，条目在下次查询时可见
+    if (journal->has_unread()) {
+        const_cast<HistoryManager*>(this)->absorb(kRefreshWait);
+    }
+}
+
+void HistoryManager::refresh() {
+    absorb(kRefreshWait);
+}
+
+bool HistoryManager::compact_if_needed() {
+    // 热文件中已淘汰的条目不少于仍保留的条目时压缩，使每次追加的均摊代价保持常数；
+    // 快照之后追加的帧多于快照本身时也压缩，使加载时需要逐帧解析的部分保持较少。
+    // 转存冷段需要压缩正文，由后台线程进行（见seal_if_needed），这里保留全部热条目
+    size_t hot_start = journal->get_hot_row_start();
+    size_t live_start = std::max(first_row, hot_start);
+    size_t hot_live = columns.rows() - live_start;
+    size_t hot_evicted = live_start - hot_start;
+    size_t appended = journal->get_appended_count();
+    bool evicted = hot_evicted > 0 && hot_evicted >= hot_live;
+    bool fold = appended >= 1024 && appended * 2 > columns.rows() - hot_start;
+    if (!evicted && !fold) {
+        return true;
+    }
+    // 压缩后行号改变，记录编号不变：会话索引和全文索引都仍然有效
+    uint64_t first_id = columns.id_of(first_row);
+    uint64_t store = journal->get_store_id();
+    HistoryRefresh change = HistoryRefresh::Unchanged;
+    bool ok = journal->compact(columns, first_row, SIZE_MAX, change);
+    if (ok) {
+        first_row = first_id < columns.first_id ? 0 : std::min(columns.row_of(first_id), columns.rows());
+    } else if (first_row > columns.rows()) {
+        first_row = columns.rows();
+        reset_session_index();
+    }
+    session_slots.clear(); // 字典ID重新分配
+    // 压缩前读取到的其他进程的条目
+    sync_external(change, first_id, store, columns.rows());
+    return ok;
+}
+
+void HistoryManager::seal_if_needed() {
+    // 热文件中的条目达到hot_entries的两倍、且较早的部分组成的完整块足够大时转存
+    appends_since_seal_check = 0;
+    if (retention.hot_entries == 0 || journal->is_sealing()) {
+        return;
+    }
+    size_t hot_live = columns.rows() - std::max(first_row, journal->get_hot_row_start());
+    if (hot_live / 2 >= retention.hot_entries &&
+        journal->sealable_rows(columns, first_row, retention.hot_entries) > 0) {
+        journal->request_seal(columns.id_of(first_row), retention.hot_entries);
+    }
+}
+
+void HistoryManager::apply_retention() {
+    size_t first = first_row;
+    size_t limit = static_cast<size_t>(std::max(max_entries, 0));
+    if (columns.rows() - first > limit) {
+        first = columns.rows() - limit;
+    }
+    // 条目按追加顺序排列，从最早的一条开始扫描时间戳列（冷段中的列同样直接映射）
+    if (retention.max_age_seconds > 0) {
+        int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        int64_t cutoff = now - retention.max_age_seconds * 1000000000ll;
+        while (first < columns.rows() && columns.timestamps[first] < cutoff) {
+            ++first;
+        }
+    }
+    // 冷段总大小超出上限时，从最早的冷段开始整段淘汰
+    if (retention.max_cold_bytes > 0) {
+        auto segments = journal->get_segments();
+        uint64_t total = 0;
+        for (const auto& segment : segments) {
+            if (segment.first_row + segment.rows > first) {
+                total += segment.bytes;
+            }
+        }
+        for (const auto& segment : segments) {
+            if (total <= retention.max_cold_bytes) {
+                break;
+            }
+            if (segment.first_row + segment.rows > first) {
+                first = std::min(segment.first_row + segment.rows, columns.rows());
+                total -= segment.bytes;
+            }
+        }
+    }
+    evict_oldest(first - first_row);
+    journal->drop_segments(first_row);
 }
 
 bool HistoryManager::save_history() {
-    // 如果历史记录超过最大限制，删除最旧的记录
-    while (static_cast<int>(history_entries.size()) > max_entries) {
-        history_entries.erase(history_entries.begin());
+    // 等待后台写线程把已追加的记录全部落盘并读回，再写出引用这些记录的全文索引
+    bool synced = journal->flush();
+    absorb(std::chrono::milliseconds::max());
+    if (synced) {
+        search_index->flush();
     }
     
-    Json::Value root;
-    Json::Value history_array(Json::arrayValue);
+    // 一次性淘汰超过条目数、时长或冷段大小限制的最旧记录
+    apply_retention();
     
-    for (const auto& entry : history_entries) {
-        history_array.append(entry.to_json());
+    if (rewrite_pending) {
+        rewrite_pending = false;
+        return rewrite_journal({}) && synced;
     }
-    
-    root["history"] = history_array;
-    root["total_entries"] = static_cast<int>(history_entries.size());
-    root["last_updated"] = get_current_timestamp();
-    
-    std::ofstream history_file(history_file_path);
-    if (!history_file.is_open()) {
-        std::cerr << "Error: Cannot open history file for writing: " 
-                  << history_file_path << std::endl;
-        return false;
+    bool compacted = compact_if_needed();
+    // 压缩可能新增了冷段，再检查一次冷段总大小
+    apply_retention();
+    return compacted && synced;
+}
+
+bool HistoryManager::sync_history() {
+    if (rewrite_pending) {
+        // 清空之后还没有写入：写一个空快照，耗时与历史大小无关
+        rewrite_pending = false;
+        return rewrite_journal({});
+    }
+    return journal->flush();
+}
+
+void HistoryManager::append_entry(HistoryEntry entry) {
+    if (rewrite_pending) {
+        // 清空之后的第一条记录：整体重写，丢弃日志中已被清除的记录
+        rewrite_pending = false;
+        rewrite_journal({entry});
+        reset_session_index();
+        return;
+    }
+    // 只把条目交给后台写线程，加锁和写入都在写线程中进行，不会等待其他进程的压缩
+    if (!journal->append(entry, columns)) {
+        return;
+    }
+    // 不等待地读取已经写出的条目（包括其他进程的），拿不到锁就留到下次查询（见settle）；
+    // 超过最大限制时删除最旧的记录（通常只有一条，常数时间）
+    absorb(std::chrono::milliseconds(0));
+    // 压缩会阻塞在磁盘I/O上，留到save_history或下次加载时进行；转存冷段由后台线程进行
+    if (++appends_since_seal_check >= kSealCheckInterval) {
+        seal_if_needed();
     }
+}
+
+void HistoryManager::evict_oldest(size_t count) {
+    count = std::min(count, columns.rows() - first_row);
+    if (count == 0) {
+        return;
+    }
+    std::vector<SessionMap::value_type*> touched;
+    if (session_index_ready) {
+        for (size_t i = 0; i < count; ++i) {
+            auto* session = record_sessions[i];
+            if (touched.empty() || touched.back() != session) {
+                touched.push_back(session);
+            }
+            session->second.positions.pop_front();
+        }
+        record_sessions.erase(record_sessions.begin(), record_sessions.begin() + count);
+    }
+    first_row += count;
     
-    Json::StreamWriterBuilder writer;
-    writer["indentation"] = "  ";
-    std::unique_ptr<Json::StreamWriter> json_writer(writer.newStreamWriter());
-    json_writer->write(root, &history_file);
+    // 每个受影响的会话只处理一次：删除已空的会话，或更新其起始时间
+    std::sort(touched.begin(), touched.end());
+    touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+    for (auto* session : touched) {
+        if (session->second.positions.empty()) {
+            uint32_t id = 0;
+            if (columns.sessions.lookup(session->first, id) && id < session_slots.size()) {
+                session_slots[id] = nullptr;
+            }
+            session_index.erase(session->first);
+        } else {
+            size_t row = columns.row_of(session->second.positions.front());
+            session->second.first_timestamp = columns.timestamps[row];
+        }
+    }
+}
+
+void HistoryManager::reset_session_index() {
+    session_index.clear();
+    record_sessions.clear();
+    session_slots.clear();
+    session_index_ready = false;
+}
+
+void HistoryManager::index_record(size_t index) const {
+    size_t row = first_row + index;
+    // 按会话字典ID缓存会话索引项，不必每条记录都按字符串查找
+    uint32_t id = columns.session_ids[row];
+    if (id >= session_slots.size()) {
+        session_slots.resize(std::max<size_t>(columns.sessions.size(), id + 1), nullptr);
+    }
+    SessionMap::value_type*& slot = session_slots[id];
+    if (!slot) {
+        const std::string& session_id = columns.sessions.at(id);
+        auto it = session_index.find(session_id);
+        if (it == session_index.end()) {
+            it = session_index.emplace(session_id, SessionInfo()).first;
+            it->second.first_timestamp = columns.timestamps[row];
+        }
+        slot = &*it;
+    }
+    SessionInfo& info = slot->second;
+    info.positions.push_back(columns.id_of(row));
+    info.last_timestamp = columns.timestamps[row];
+    info.max_turn_number = std::max(info.max_turn_number, static_cast<int>(columns.turn_numbers[row]));
+    record_sessions.push_back(slot);
+}
+
+void HistoryManager::ensure_session_index() const {
+    if (session_index_ready) {
+        return;
+    }
+    // 首次查询会话时构建：只读取会话ID、时间戳和轮次列，不读取正文
+    session_index.clear();
+    record_sessions.clear();
+    session_slots.clear();
+    for (size_t i = 0; i < columns.rows() - first_row; ++i) {
+        index_record(i);
+    }
+    session_index_ready = true;
+}
+
+void HistoryManager::reset_time_index() {
+    time_checked_id = 0;
+    time_checked_last = 0;
+    time_ordered = true;
+    time_index.clear();
+}
+
+void HistoryManager::ensure_time_index() const {
+    uint64_t first_id = columns.id_of(first_row);
+    if (time_checked_id <= first_id) {
+        // 已检查的条目都已淘汰：剩下的从头检查，可能重新回到有序
+        time_checked_id = first_id;
+        time_checked_last = INT64_MIN;
+        time_ordered = true;
+        time_index.clear();
+    } else if (!time_ordered && time_index.size() > 2 * (time_checked_id - first_id)) {
+        // 时间索引中已淘汰的条目多于未淘汰的时才清理，均摊代价为常数
+        time_index.erase(std::remove_if(time_index.begin(), time_index.end(),
+                                        [first_id](const std::pair<int64_t, uint64_t>& item) {
+                                            return item.second < first_id;
+                                        }),
+                         time_index.end());
+    }
     
-    history_file.close();
-    return true;
+    // 只检查上次之后新增的条目：有序时只比较时间戳，乱序时先追加再与已有部分归并
+    size_t sorted = time_index.size();
+    for (size_t row = columns.row_of(time_checked_id); row < columns.rows(); ++row) {
+        int64_t timestamp = columns.timestamps[row];
+        if (time_ordered) {
+            if (timestamp >= time_checked_last) {
+                time_checked_last = timestamp;
+                continue;
+            }
+            // 出现乱序：此前未淘汰的条目已经有序，按原顺序放入时间索引
+            time_ordered = false;
+            time_index.reserve(columns.rows() - first_row);
+            for (size_t r = first_row; r < row; ++r) {
+                time_index.emplace_back(columns.timestamps[r], columns.id_of(r));
+            }
+            sorted = time_index.size();
+        }
+        time_index.emplace_back(timestamp, columns.id_of(row));
+    }
+    std::sort(time_index.begin() + sorted, time_index.end());
+    std::inplace_merge(time_index.begin(), time_index.begin() + sorted, time_index.end());
+    time_checked_id = columns.id_of(columns.rows());
+}
+
+size_t HistoryManager::time_lower_bound(int64_t timestamp) const {
+    if (!time_ordered) {
+        return std::lower_bound(time_index.begin(), time_index.end(),
+                                std::make_pair(timestamp, uint64_t(0))) - time_index.begin();
+    }
+    // 时间戳列直接映射自文件，在其上二分查找
+    size_t low = first_row;
+    size_t high = columns.rows();
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (columns.timestamps[middle] < timestamp) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+std::vector<size_t> HistoryManager::find_by_time(int64_t since, int64_t until) const {
+    std::vector<size_t> positions;
+    if (until <= since) {
+        return positions;
+    }
+    settle();
+    ensure_time_index();
+    size_t begin = time_lower_bound(since);
+    size_t end = time_lower_bound(until);
+    if (time_ordered) {
+        for (size_t row = begin; row < end; ++row) {
+            positions.push_back(row - first_row);
+        }
+        return positions;
+    }
+    // 时间索引中可能还有已淘汰的条目
+    uint64_t first_id = columns.id_of(first_row);
+    for (size_t i = begin; i < end; ++i) {
+        if (time_index[i].second >= first_id) {
+            positions.push_back(columns.row_of(time_index[i].second) - first_row);
+        }
+    }
+    return positions;
+}
+
+std::vector<HistoryDay> HistoryManager::get_history_days() const {
+    settle();
+    ensure_time_index();
+    std::vector<HistoryDay> days;
+    uint64_t first_id = columns.id_of(first_row);
+    size_t position = time_ordered ? first_row : 0;
+    size_t end = time_ordered ? columns.rows() : time_index.size();
+    auto timestamp_at = [this](size_t i) {
+        return time_ordered ? columns.timestamps[i] : time_index[i].first;
+    };
+    // 从最早的一条开始，每次二分查找下一天0点的位置，跳过当天的全部条目
+    while (position < end) {
+        HistoryDay day;
+        day.start = history_day_start(timestamp_at(position));
+        size_t next = std::max(time_lower_bound(history_day_start(timestamp_at(position), 1)),
+                               position + 1);
+        if (time_ordered) {
+            day.count = next - position;
+            day.first_timestamp = timestamp_at(position);
+            day.last_timestamp = timestamp_at(next - 1);
+        } else {
+            for (size_t i = position; i < next; ++i) {
+                if (time_index[i].second < first_id) {
+                    continue;
+                }
+                if (day.count++ == 0) {
+                    day.first_timestamp = time_index[i].first;
+                }
+                day.last_timestamp = time_index[i].first;
+            }
+        }
+        if (day.count > 0) {
+            days.push_back(day);
+        }
+        position = next;
+    }
+    return days;
 }
 
 void HistoryManager::add_entry(const std::string& user_message, const std::string& assistant_response,
                               const std::string& system_prompt, const std::string& model) {
-    HistoryEntry entry(user_message, assistant_response, system_prompt, model);
-    history_entries.push_back(entry);
-    
-    // 如果超过最大限制，删除最旧的记录
-    if (static_cast<int>(history_entries.size()) > max_entries) {
-        history_entries.erase(history_entries.begin());
-    }
+    append_entry(HistoryEntry(user_message, assistant_response, system_prompt, model));
 }
 
-const std::vector<HistoryEntry>& HistoryManager::get_history() const {
-    return history_entries;
+HistoryEntry HistoryManager::entry_at(size_t index) const {
+    HistoryEntry entry;
+    journal->read(columns, first_row + index, entry);
+    return entry;
+}
+
+std::vector<HistoryEntry> HistoryManager::get_history() const {
+    return get_recent_history(-1);
 }
 
 std::vector<HistoryEntry> HistoryManager::get_recent_history(int count) const {
-    if (count <= 0 || count >= static_cast<int>(history_entries.size())) {
-        return history_entries;
+    settle();
+    size_t total = columns.rows() - first_row;
+    size_t first = 0;
+    if (count > 0 && count < static_cast<int>(total)) {
+        first = total - static_cast<size_t>(count);
     }
     
-    return std::vector<HistoryEntry>(
-        history_entries.end() - count, history_entries.end());
+    std::vector<HistoryEntry> entries;
+    entries.reserve(total - first);
+    for (size_t i = first; i < total; ++i) {
+        entries.push_back(entry_at(i));
+    }
+    return entries;
 }
 
 void HistoryManager::clear_history() {
-    history_entries.clear();
+    first_row = columns.rows();
+    reset_session_index();
+    reset_time_index();
+    rewrite_pending = true;
 }
 
 size_t HistoryManager::get_history_count() const {
-    return history_entries.size();
+    settle();
+    return columns.rows() - first_row;
 }
 
 std::vector<HistoryEntry> HistoryManager::search_history(const std::string& keyword, 
                                                        bool search_user_messages,
                                                        bool search_assistant_responses) const {
     std::vector<HistoryEntry> results;
+    // 正文按原样保存，直接在其中查找，只组装匹配的条目
+    std::string buffer;
+    size_t total = get_history_count();
+    for (size_t i = 0; i < total; ++i) {
+        if (contains_text(i, keyword, search_user_messages, search_assistant_responses, buffer)) {
+            results.push_back(entry_at(i));
+        }
+    }
     
-    for (const auto& entry : history_entries) {
-        bool match = false;
-        
-        if (search_user_messages) {
-            if (entry.user_message.find(keyword) != std::string::npos) {
-                match = true;
-            }
+    return results;
+}
+
+bool HistoryManager::contains_text(size_t index, const std::string& keyword, bool search_user_messages,
+                                   bool search_assistant_responses, std::string& buffer) const {
+    size_t row = first_row + index;
+    std::string_view text = journal->body(columns, row, buffer);
+    size_t user_length = std::min<size_t>(columns.user_lengths[row], text.size());
+    std::string_view user_message = text.substr(0, user_length);
+    std::string_view assistant_response = text.substr(user_length, columns.assistant_lengths[row]);
+    return (search_user_messages && user_message.find(keyword) != std::string_view::npos) ||
+           (search_assistant_responses && assistant_response.find(keyword) != std::string_view::npos);
+}
+
+bool HistoryManager::contains_any_group(size_t index, const std::vector<std::vector<std::string>>& groups,
+                                        bool search_user_messages, bool search_assistant_responses,
+                                        std::string& buffer) const {
+    size_t row = first_row + index;
+    std::string_view text = journal->body(columns, row, buffer);
+    size_t user_length = std::min<size_t>(columns.user_lengths[row], text.size());
+    std::string_view user_message = text.substr(0, user_length);
+    std::string_view assistant_response = text.substr(user_length, columns.assistant_lengths[row]);
+    auto found = [&](const std::string& literal) {
+        return (search_user_messages && user_message.find(literal) != std::string_view::npos) ||
+               (search_assistant_responses && assistant_response.find(literal) != std::string_view::npos);
+    };
+    return std::any_of(groups.begin(), groups.end(), [&](const std::vector<std::string>& literals) {
+        return std::all_of(literals.begin(), literals.end(), found);
+    });
+}
+
+void HistoryManager::ensure_search_index() const {
+    if (search_index->is_loaded()) {
+        return;
+    }
+    // 加载已有的索引文件，只对索引之后新增的记录分词
+    std::vector<uint64_t> missing;
+    uint64_t covered = search_index->load(columns.id_of(first_row), &missing);
+    // 其他进程没有写出倒排记录的条目（例如进程崩溃）
+    for (uint64_t id : missing) {
+        size_t row = columns.row_of(id);
+        if (row >= first_row && row < columns.rows()) {
+            search_index->add(id, entry_at(row - first_row), false);
         }
-        
-        if (search_assistant_responses && !match) {
-            if (entry.assistant_response.find(keyword) != std::string::npos) {
-                match = true;
-            }
+    }
+    size_t row = covered > columns.id_of(first_row) ? std::min(columns.row_of(covered), columns.rows())
+                                                     : first_row;
+    for (; row < columns.rows(); ++row) {
+        search_index->add(columns.id_of(row), entry_at(row - first_row), false);
+    }
+    if (journal->flush()) {
+        search_index->flush();
+    }
+}
+
+std::vector<SearchResult> HistoryManager::search(const std::string& query, size_t limit,
+                                                 bool search_user_messages,
+                                                 bool search_assistant_responses) const {
+    std::vector<SearchResult> results;
+    uint32_t fields = (search_user_messages ? static_cast<uint32_t>(SearchIndex::FieldUser) : 0) |
+                      (search_assistant_responses ? static_cast<uint32_t>(SearchIndex::FieldAssistant) : 0);
+    if (fields == 0) {
+        return results;
+    }
+    settle();
+    ensure_search_index();
+    
+    // 索引中可能还有已被淘汰的记录，按记录编号映射回当前的历史位置
+    for (const auto& match : search_index->search(query, fields)) {
+        size_t row = columns.row_of(match.id);
+        if (row < first_row || row >= columns.rows()) {
+            continue;
         }
-        
-        if (match) {
-            results.push_back(entry);
+        results.push_back({row - first_row, match.score});
+        if (limit > 0 && results.size() >= limit) {
+            break;
+        }
+    }
+    if (results.empty()) {
+        // 索引只匹配整词（quote不会命中quoted），没有结果时按同样的条件逐条查找：
+        // 各个词和短语作为子串，组内都要出现，任意一组满足即可；较新的在前，得分为0
+        auto groups = SearchIndex::split_query(query);
+        std::string buffer;
+        for (size_t i = groups.empty() ? 0 : columns.rows() - first_row; i-- > 0;) {
+            if (contains_any_group(i, groups, search_user_messages, search_assistant_responses, buffer)) {
+                results.push_back({i, 0.0});
+                if (limit > 0 && results.size() >= limit) {
+                    break;
+                }
+            }
         }
     }
-    
     return results;
 }
 
-void HistoryManager::display_history(int count, bool show_details) const {
-    std::vector<HistoryEntry> entries_to_show;
-    
-    if (count == -1 || count >= static_cast<int>(history_entries.size())) {
-        entries_to_show = history_entries;
-    } else {
-        entries_to_show = get_recent_history(count);
+size_t HistoryManager::export_history(std::ostream& out) const {
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    builder["emitUTF8"] = true;
+    std::unique_ptr<Json::StreamWriter> writer(builder.newStreamWriter());
+    size_t total = get_history_count();
+    for (size_t i = 0; i < total; ++i) {
+        writer->write(entry_at(i).to_json(), &out);
+        out << '\n';
     }
-    
-    if (entries_to_show.empty()) {
-        std::cout << "No history entries found." << std::endl;
-        return;
+    return total;
+}
+
+size_t HistoryManager::import_history(std::istream& in) {
+    std::vector<HistoryEntry> entries;
+    size_t skipped = read_json_lines(in, entries);
+    if (skipped > 0) {
+        std::cerr << "Warning: Skipped " << skipped << " malformed lines." << std::endl;
     }
-    
-    std::cout << "\n=== Chat History (" << entries_to_show.size() << " entries) ===" << std::endl;
-    
-    for (size_t i = 0; i < entries_to_show.size(); ++i) {
-        const auto& entry = entries_to_show[i];
+    for (auto& entry : entries) {
+        append_entry(std::move(entry));
+    }
+    return entries.size();
+}
+
+HistoryEntry HistoryManager::get_entry(size_t index) const {
+    return entry_at(index);
+}
+
+// 逐条显示历史记录
+static void print_history_entries(const std::vector<HistoryEntry>& entries, bool show_details) {
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const auto& entry = entries[i];
         
-        std::cout << "\n[" << (i + 1) << "] " << entry.timestamp;
+        std::cout << "\n[" << (i + 1) << "] " << format_history_timestamp(entry.timestamp);
         if (show_details && !entry.model.empty()) {
             std::cout << " (Model: " << entry.model << ")";
         }
@@ -240,11 +884,71 @@ void HistoryManager::display_history(int count, bool show_details) const {
         if (show_details && !entry.system_prompt.empty()) {
             std::cout << "System Prompt: " << entry.system_prompt << std::endl;
         }
+        if (show_details && !entry.metrics.isNull()) {
+            std::cout << "Metrics: " << format_metrics(entry.metrics) << std::endl;
+        }
+    }
+}
+
+void HistoryManager::display_history(int count, bool show_details) const {
+    std::vector<HistoryEntry> entries_to_show = get_recent_history(count);
+    
+    if (entries_to_show.empty()) {
+        std::cout << "No history entries found." << std::endl;
+        return;
+    }
+    
+    std::cout << "\n=== Chat History (" << entries_to_show.size() << " entries) ===" << std::endl;
+    print_history_entries(entries_to_show, show_details);
+    std::cout << "\n=== End of History ===" << std::endl;
+}
+
+void HistoryManager::display_history_range(int64_t since, int64_t until, int count,
+                                           bool show_details) const {
+    std::vector<size_t> positions = find_by_time(since, until);
+    size_t first = 0;
+    if (count > 0 && static_cast<size_t>(count) < positions.size()) {
+        first = positions.size() - static_cast<size_t>(count);
+    }
+    
+    if (first == positions.size()) {
+        std::cout << "No history entries found in this time range." << std::endl;
+        return;
+    }
+    
+    // 只组装要显示的条目
+    std::vector<HistoryEntry> entries_to_show;
+    entries_to_show.reserve(positions.size() - first);
+    for (size_t i = first; i < positions.size(); ++i) {
+        entries_to_show.push_back(entry_at(positions[i]));
     }
     
+    std::cout << "\n=== Chat History (" << entries_to_show.size() << " of " << positions.size()
+              << " entries in range) ===" << std::endl;
+    print_history_entries(entries_to_show, show_details);
     std::cout << "\n=== End of History ===" << std::endl;
 }
 
+void HistoryManager::display_days() const {
+    auto days = get_history_days();
+    
+    if (days.empty()) {
+        std::cout << "No history entries found." << std::endl;
+        return;
+    }
+    
+    std::cout << "\n=== Chat History by Day (" << days.size()
+              << (days.size() == 1 ? " day" : " days") << ") ===" << std::endl;
+    for (const auto& day : days) {
+        // "YYYY-MM-DD HH:MM:SS.mmm"中的日期和时间部分
+        std::cout << format_history_timestamp(day.start).substr(0, 10) << "  "
+                  << day.count << (day.count == 1 ? " entry  " : " entries  ")
+                  << format_history_timestamp(day.first_timestamp).substr(11, 8) << " - "
+                  << format_history_timestamp(day.last_timestamp).substr(11, 8) << std::endl;
+    }
+    std::cout << "=== End of History ===" << std::endl;
+}
+
 std::string HistoryManager::generate_session_id() const {
     auto now = std::chrono::system_clock::now();
     auto time_t = std::chrono::system_clock::to_time_t(now);
@@ -269,50 +973,59 @@ std::string HistoryManager::get_current_session_id() const {
 
 void HistoryManager::set_current_session_id(const std::string& session_id) {
     current_session_id = session_id;
-    // 找到该会话的最大轮次编号
-    current_turn_number = 0;
-    for (const auto& entry : history_entries) {
-        if (entry.session_id == session_id && entry.turn_number > current_turn_number) {
-            current_turn_number = entry.turn_number;
-        }
-    }
+    // 从会话索引中取该会话的最大轮次编号
+    const SessionInfo* info = get_session_info(session_id);
+    current_turn_number = info ? info->max_turn_number : 0;
 }
 
 void HistoryManager::add_entry_multi_turn(const std::string& user_message, const std::string& assistant_response,
-                                         const std::string& system_prompt, const std::string& model) {
+                                         const std::string& system_prompt, const std::string& model,
+                                         const Json::Value& metrics) {
     current_turn_number++;
-    HistoryEntry entry(user_message, assistant_response, system_prompt, model, current_session_id, current_turn_number);
-    history_entries.push_back(entry);
-    
-    // 如果超过最大限制，删除最旧的记录
-    if (static_cast<int>(history_entries.size()) > max_entries) {
-        history_entries.erase(history_entries.begin());
-    }
+    HistoryEntry entry(user_message, assistant_response, system_prompt, model,
+                       current_session_id, current_turn_number);
+    entry.metrics = metrics;
+    append_entry(std::move(entry));
 }
 
-std::vector<HistoryEntry> HistoryManager::get_session_history(const std::string& session_id) const {
+std::vector<HistoryEntry> HistoryManager::get_session_history(const std::string& session_id,
+                                                             int max_turns) const {
     std::vector<HistoryEntry> session_entries;
-    for (const auto& entry : history_entries) {
-        if (entry.session_id == session_id) {
-            session_entries.push_back(entry);
-        }
+    const SessionInfo* info = get_session_info(session_id);
+    if (!info) {
+        return session_entries;
     }
     
-    // 按轮次编号排序
-    std::sort(session_entries.begin(), session_entries.end(),
-              [](const HistoryEntry& a, const HistoryEntry& b) {
-                  return a.turn_number < b.turn_number;
-              });
-    
+    // 索引中的位置按添加顺序（即轮次顺序）排列，只解析需要的最后max_turns条
+    size_t first = 0;
+    if (max_turns > 0 && info->positions.size() > static_cast<size_t>(max_turns)) {
+        first = info->positions.size() - static_cast<size_t>(max_turns);
+    }
+    session_entries.reserve(info->positions.size() - first);
+    for (size_t i = first; i < info->positions.size(); ++i) {
+        session_entries.push_back(entry_at(columns.row_of(info->positions[i]) - first_row));
+    }
     return session_entries;
 }
 
+bool HistoryManager::has_session(const std::string& session_id) const {
+    return get_session_info(session_id) != nullptr;
+}
+
+const SessionInfo* HistoryManager::get_session_info(const std::string& session_id) const {
+    settle();
+    ensure_session_index();
+    auto it = session_index.find(session_id);
+    return it == session_index.end() ? nullptr : &it->second;
+}
+
 std::vector<std::string> HistoryManager::get_all_session_ids() const {
+    settle();
+    ensure_session_index();
     std::vector<std::string> session_ids;
-    for (const auto& entry : history_entries) {
-        if (std::find(session_ids.begin(), session_ids.end(), entry.session_id) == session_ids.end()) {
-            session_ids.push_back(entry.session_id);
-        }
+    session_ids.reserve(session_index.size());
+    for (const auto& session : session_index) {
+        session_ids.push_back(session.first);
     }
     
     // 按时间排序（会话ID包含时间戳）
@@ -331,23 +1044,20 @@ void HistoryManager::display_sessions() const {
     std::cout << "\n=== Chat Sessions ===" << std::endl;
     for (size_t i = 0; i < session_ids.size(); ++i) {
         const auto& session_id = session_ids[i];
-        auto session_entries = get_session_history(session_id);
+        const SessionInfo& info = session_index.at(session_id);
         
         std::cout << "\n[" << (i + 1) << "] Session: " << session_id << std::endl;
-        std::cout << "    Turns: " << session_entries.size() << std::endl;
+        std::cout << "    Turns: " << info.positions.size() << std::endl;
+        std::cout << "    Started: " << format_history_timestamp(info.first_timestamp) << std::endl;
+        std::cout << "    Last: " << format_history_timestamp(info.last_timestamp) << std::endl;
         
-        if (!session_entries.empty()) {
-            std::cout << "    Started: " << session_entries.front().timestamp << std::endl;
-            std::cout << "    Last: " << session_entries.back().timestamp << std::endl;
-            
-            // 显示第一轮对话的简要内容
-            const auto& first_entry = session_entries.front();
-            std::string preview = first_entry.user_message;
-            if (preview.length() > 50) {
-                preview = preview.substr(0, 50) + "...";
-            }
-            std::cout << "    Preview: " << preview << std::endl;
+        // 显示第一轮对话的简要内容（只解析这一条）
+        HistoryEntry first_entry = entry_at(columns.row_of(info.positions.front()) - first_row);
+        std::string preview = first_entry.user_message;
+        if (preview.length() > 50) {
+            preview = preview.substr(0, 50) + "...";
         }
+        std::cout << "    Preview: " << preview << std::endl;
     }
     std::cout << "\n=== End of Sessions ===" << std::endl;
 }
@@ -364,7 +1074,8 @@ void HistoryManager::display_session_history(const std::string& session_id, bool
     std::cout << "Total turns: " << session_entries.size() << std::endl;
     
     for (const auto& entry : session_entries) {
-        std::cout << "\n--- Turn " << entry.turn_number << " (" << entry.timestamp << ") ---" << std::endl;
+        std::cout << "\n--- Turn " << entry.turn_number << " (" << format_history_timestamp(entry.timestamp)
+                  << ") ---" << std::endl;
         
         // 显示用户消息
         std::string user_msg = entry.user_message;
@@ -385,6 +1096,9 @@ void HistoryManager::display_session_history(const std::string& session_id, bool
             if (!entry.system_prompt.empty()) {
                 std::cout << "System Prompt: " << entry.system_prompt << std::endl;
             }
+            if (!entry.metrics.isNull()) {
+                std::cout << "Metrics: " << format_metrics(entry.metrics) << std::endl;
+            }
         }
     }
     
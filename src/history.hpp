@@ -1,44 +1,192 @@
 #pragma once
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <json/json.h>
 #include <fstream>
 #include <iostream>
 #include <chrono>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include "history_columns.hpp"
 
 struct HistoryEntry {
-    std::string timestamp;
+    int64_t timestamp;       // 自纪元起的纳秒数，显示时才格式化为本地时间
     std::string user_message;
     std::string assistant_response;
     std::string system_prompt;
     std::string model;
     std::string session_id;  // 会话ID，用于关联多轮对话
     int turn_number;         // 在当前会话中的轮次编号
+    Json::Value metrics;     // 请求的耗时指标（可选，为空时不写入）
     
-    HistoryEntry() : turn_number(0) {}
+    HistoryEntry() : timestamp(0), turn_number(0) {}
     HistoryEntry(const std::string& user_msg, const std::string& assistant_resp, 
                 const std::string& sys_prompt = "", const std::string& model_name = "deepseek-chat",
                 const std::string& sess_id = "", int turn_num = 0);
     
-    // 转换为JSON
+    // 转换为JSON（只用于导出）
     Json::Value to_json() const;
-    // 从JSON创建
+    // 从JSON创建（只用于导入）
     static HistoryEntry from_json(const Json::Value& json);
 };
 
+/**
+ * @brief 本地时间 "YYYY-MM-DD HH:MM:SS.mmm" 与自纪元起的纳秒数之间的转换
+ *
+ * 解析时时间部分可以省略或只写到分钟，日期和时间之间也可以用T分隔。
+ * @return 是否是有效的时间
+ */
+bool parse_history_timestamp(const std::string& text, int64_t& nanoseconds);
+std::string format_history_timestamp(int64_t nanoseconds);
+
+/**
+ * @brief 时间戳所在的本地日期的0点（纳秒），days不为0时取之后（或之前）第days天的0点
+ */
+int64_t history_day_start(int64_t nanoseconds, int days = 0);
+
+/**
+ * @brief 会话索引项：会话中各条目的位置和摘要信息
+ */
+struct SessionInfo {
+    std::deque<uint64_t> positions; // 条目的记录编号，按添加顺序排列
+    int64_t first_timestamp = 0;    // 最早一条的时间戳（纳秒）
+    int64_t last_timestamp = 0;     // 最新一条的时间戳（纳秒）
+    int max_turn_number = 0;        // 最大轮次编号
+};
+
+/**
+ * @brief 全文搜索结果：引用历史中的位置，不复制条目
+ */
+struct SearchResult {
+    size_t index; // 在get_history()中的位置，用get_entry读取
+    double score; // 相关度得分
+};
+
+/**
+ * @brief 按天统计的历史记录
+ */
+struct HistoryDay {
+    int64_t start = 0;           // 当天0点（纳秒）
+    size_t count = 0;            // 当天的条目数
+    int64_t first_timestamp = 0; // 当天最早一条的时间戳
+    int64_t last_timestamp = 0;  // 当天最晚一条的时间戳
+};
+
+/**
+ * @brief 历史记录的分层保留策略
+ *
+ * 最近的条目保存在热文件中，更早的条目在压缩时转存为按块压缩的冷段。
+ * 条目数上限（max_entries）、时长和冷段总大小三个条件依次生效，先满足哪个就淘汰到哪里。
+ */
+struct HistoryRetention {
+    size_t hot_entries = 1000;   // 热文件中保留的条目数（0表示不转存冷段）
+    int64_t max_age_seconds = 0; // 淘汰早于这个时长的条目（0表示不限）
+    uint64_t max_cold_bytes = 0; // 冷段总大小超出时整段淘汰最早的冷段（0表示不限）
+};
+
+/**
+ * @brief 读取或追加历史时发现的其他进程的修改
+ */
+enum class HistoryRefresh {
+    Unchanged, // 没有其他进程的修改
+    Appended,  // 其他进程追加了条目，已加入各列末尾
+    Reloaded,  // 热文件被其他进程压缩或重写，已重新打开（行号改变）
+};
+
+class HistoryJournal;
+class SearchIndex;
+
 class HistoryManager {
 private:
     std::string history_file_path;
-    std::vector<HistoryEntry> history_entries;
+    HistoryColumns columns;                  // 日志中全部条目的各列
+    size_t first_row;                        // 最早的未淘汰条目的行号，之后至多max_entries条
+    std::unique_ptr<HistoryJournal> journal; // 追加写入的持久化日志
+    std::unique_ptr<SearchIndex> search_index; // 全文倒排索引，首次搜索时加载
+    bool rewrite_pending;            // 清空历史后需要整体重写日志
+    uint64_t known_end_id;           // 本进程已处理到的记录编号，之后的条目由其他进程追加
+    HistoryRetention retention;      // 冷热分层和按时长、大小的淘汰
+    size_t appends_since_seal_check; // 上次检查是否需要转存冷段之后追加的条目数
+    
+    // 会话索引：会话ID -> 条目位置和摘要，首次查询会话时构建，之后随增删同步更新
+    using SessionMap = std::unordered_map<std::string, SessionInfo>;
+    mutable SessionMap session_index;
+    mutable std::deque<SessionMap::value_type*> record_sessions; // 与未淘汰的条目一一对应的所属会话
+    mutable std::vector<SessionMap::value_type*> session_slots;  // 会话字典ID -> 会话索引项
+    mutable bool session_index_ready;
+    
+    // 时间索引：未淘汰的条目按时间戳有序时（通常如此）直接在时间戳列上二分查找，
+    // 发现乱序的条目（例如导入了更早的记录）后才另建按时间排序的（时间戳, 记录编号）
+    mutable uint64_t time_checked_id;    // 此前的记录都已检查或加入时间索引
+    mutable int64_t time_checked_last;   // 已检查的最后一条的时间戳
+    mutable bool time_ordered;
+    mutable std::vector<std::pair<int64_t, uint64_t>> time_index;
     int max_entries;
     std::string current_session_id;  // 当前会话ID
     int current_turn_number;         // 当前会话的轮次编号
     
-    // 获取当前时间戳
-    std::string get_current_timestamp() const;
-    
     // 生成新的会话ID
     std::string generate_session_id() const;
+    
+    // 组装第index条记录
+    HistoryEntry entry_at(size_t index) const;
+    
+    // 追加新条目：写入日志，并淘汰超出上限的旧条目
+    void append_entry(HistoryEntry entry);
+    
+    // 淘汰最旧的count条记录，同步更新会话索引
+    void evict_oldest(size_t count = 1);
+    
+    // 按条目数、时长和冷段大小淘汰旧记录，并删除已整段淘汰的冷段
+    void apply_retention();
+    
+    // 会话索引的构建与维护
+    void ensure_session_index() const;
+    void reset_session_index();
+    void index_record(size_t index) const;
+    
+    // 时间索引的构建与维护
+    void ensure_time_index() const;
+    void reset_time_index();
+    // 时间戳不早于timestamp的第一条在时间顺序中的位置（有序时即行号）
+    size_t time_lower_bound(int64_t timestamp) const;
+    
+    // 日志中的过期记录或追加的帧过多时进行压缩（不转存冷段）
+    bool compact_if_needed();
+    
+    // 热文件中较早的条目足够多时，请后台线程转存为冷段（不等待）
+    void seal_if_needed();
+    
+    // 用给定条目重写日志，同时作废旧的全文索引；create为true时只在日志不存在时创建
+    bool rewrite_journal(const std::vector<HistoryEntry>& entries, bool create = false);
+    
+    // 日志读取到其他进程的修改之后，同步淘汰位置和各索引
+    // first_id、store：修改前最早的未淘汰条目的记录编号和存储编号；end_row：需要处理到的行
+    void sync_external(HistoryRefresh change, uint64_t first_id, uint64_t store, size_t end_row);
+    
+    // 读取日志中新写出的条目并同步各索引；wait为等待写线程和文件锁的时间上限
+    void absorb(std::chrono::milliseconds wait);
+    
+    // 查询之前读入本进程已追加、还没加入各列的条目（等待时间有上限），使刚添加的条目可见
+    void settle() const;
+    
+    // 首次搜索时加载全文索引并补充索引之后新增的记录
+    void ensure_search_index() const;
+    
+    // 第index条的用户消息或助手回复中是否含有子串keyword；buffer用于读取冷段中的正文
+    bool contains_text(size_t index, const std::string& keyword, bool search_user_messages,
+                       bool search_assistant_responses, std::string& buffer) const;
+    
+    // 第index条是否满足任意一组子串：组内每个子串都出现在所选字段中（见SearchIndex::split_query）
+    bool contains_any_group(size_t index, const std::vector<std::vector<std::string>>& groups,
+                            bool search_user_messages, bool search_assistant_responses,
+                            std::string& buffer) const;
+    
+    // 从旧版的history.jsonl日志或history.json导入历史记录
+    bool import_legacy_history(const std::string& legacy_path);
 
 public:
     /**
@@ -47,6 +195,13 @@ public:
      * @param max_entries 最大历史记录条数
      */
     HistoryManager(const std::string& history_path, int max_entries = 1000);
+    ~HistoryManager();
+    
+    /**
+     * @brief 设置分层保留策略，应在load_history之前调用
+     * @param retention 保留策略
+     */
+    void set_retention(const HistoryRetention& retention);
     
     /**
      * @brief 从文件加载历史记录
@@ -54,12 +209,25 @@ public:
      */
     bool load_history();
     
+    /**
+     * @brief 读取其他gf进程新追加的历史记录（只读取新增的部分，不重新加载）
+     */
+    void refresh();
+    
     /**
      * @brief 保存历史记录到文件
+     * @note 新条目在添加时已经追加到日志，这里只在需要时压缩日志
      * @return 是否成功保存
      */
     bool save_history();
     
+    /**
+     * @brief 只等待已追加的记录落盘（中断退出时使用）
+     * @note 不淘汰也不压缩，耗时与历史大小无关；压缩推迟到下次正常启动或退出
+     * @return 是否全部落盘
+     */
+    bool sync_history();
+    
     /**
      * @brief 添加历史记录条目
      * @param user_message 用户消息
@@ -94,16 +262,34 @@ public:
      * @param assistant_response 助手回复
      * @param system_prompt 系统提示（可选）
      * @param model 使用的模型（可选）
+     * @param metrics 请求的耗时指标（可选）
      */
     void add_entry_multi_turn(const std::string& user_message, const std::string& assistant_response,
-                             const std::string& system_prompt = "", const std::string& model = "deepseek-chat");
+                             const std::string& system_prompt = "", const std::string& model = "deepseek-chat",
+                             const Json::Value& metrics = Json::Value());
+    
+    /**
+     * @brief 获取指定会话的对话记录
+     * @param session_id 会话ID
+     * @param max_turns 只返回最后的max_turns轮（0表示全部）
+     * @return 该会话的历史记录，按轮次顺序排列
+     */
+    std::vector<HistoryEntry> get_session_history(const std::string& session_id,
+                                                  int max_turns = 0) const;
     
     /**
-     * @brief 获取指定会话的所有对话记录
+     * @brief 会话是否存在（O(1)）
      * @param session_id 会话ID
-     * @return 该会话的历史记录
+     * @return 是否存在
      */
-    std::vector<HistoryEntry> get_session_history(const std::string& session_id) const;
+    bool has_session(const std::string& session_id) const;
+    
+    /**
+     * @brief 获取会话的索引信息
+     * @param session_id 会话ID
+     * @return 会话信息，不存在时返回nullptr
+     */
+    const SessionInfo* get_session_info(const std::string& session_id) const;
     
     /**
      * @brief 获取所有会话ID列表
@@ -127,7 +313,7 @@ public:
      * @brief 获取所有历史记录
      * @return 历史记录向量
      */
-    const std::vector<HistoryEntry>& get_history() const;
+    std::vector<HistoryEntry> get_history() const;
     
     /**
      * @brief 获取最近的N条历史记录
@@ -148,7 +334,46 @@ public:
     size_t get_history_count() const;
     
     /**
-     * @brief 搜索历史记录
+     * @brief 通过全文索引搜索历史记录
+     *
+     * 空白分隔的词之间为AND，大写OR分隔多组条件，双引号括起的为短语，
+     * 中文按字和相邻二元组匹配。结果按相关度排序。索引只匹配整词，
+     * 没有结果时按同样的AND/OR条件把各个词和短语当作子串逐条查找（得分为0）。
+     * @param query 查询语句
+     * @param limit 最多返回的结果数（0表示全部）
+     * @param search_user_messages 是否搜索用户消息
+     * @param search_assistant_responses 是否搜索助手回复
+     * @return 匹配条目的位置和得分
+     */
+    std::vector<SearchResult> search(const std::string& query, size_t limit = 0,
+                                     bool search_user_messages = true,
+                                     bool search_assistant_responses = true) const;
+    
+    /**
+     * @brief 读取指定位置的历史记录
+     * @param index 在历史记录中的位置
+     * @return 历史记录条目
+     */
+    HistoryEntry get_entry(size_t index) const;
+    
+    /**
+     * @brief 按时间范围查找历史记录（二分查找时间索引）
+     * @param since 起始时间（纳秒，包含）
+     * @param until 结束时间（纳秒，不包含）
+     * @return 范围内条目在历史记录中的位置，按时间排序
+     */
+    std::vector<size_t> find_by_time(int64_t since, int64_t until) const;
+    
+    /**
+     * @brief 按本地日期统计历史记录
+     *
+     * 条目有序时每天只需一次二分查找，与条目数无关。
+     * @return 有记录的各天，按日期排序
+     */
+    std::vector<HistoryDay> get_history_days() const;
+    
+    /**
+     * @brief 按子串逐条扫描搜索历史记录
      * @param keyword 搜索关键词
      * @param search_user_messages 是否搜索用户消息
      * @param search_assistant_responses 是否搜索助手回复
@@ -158,10 +383,39 @@ public:
                                            bool search_user_messages = true,
                                            bool search_assistant_responses = true) const;
     
+    /**
+     * @brief 把全部历史记录导出为JSON Lines（每行一个条目）
+     * @param out 输出流
+     * @return 导出的条目数
+     */
+    size_t export_history(std::ostream& out) const;
+    
+    /**
+     * @brief 从JSON Lines导入历史记录，追加在已有记录之后
+     * @param in 输入流，每行一个export_history导出的条目
+     * @return 导入的条目数
+     */
+    size_t import_history(std::istream& in);
+    
     /**
      * @brief 显示历史记录
      * @param count 显示的记录数，-1表示显示所有
      * @param show_details 是否显示详细信息
      */
     void display_history(int count = -1, bool show_details = false) const;
+    
+    /**
+     * @brief 显示时间范围内的历史记录
+     * @param since 起始时间（纳秒，包含）
+     * @param until 结束时间（纳秒，不包含）
+     * @param count 只显示范围内最后的count条，-1表示显示所有
+     * @param show_details 是否显示详细信息
+     */
+    void display_history_range(int64_t since, int64_t until, int count = -1,
+                               bool show_details = false) const;
+    
+    /**
+     * @brief 显示每天的条目数和时间范围
+     */
+    void display_days() const;
 };
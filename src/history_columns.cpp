@@ -0,0 +1,115 @@
+#include "history_columns.hpp"
+
+uint64_t StringDictionary::hash(std::string_view text) {
+    uint64_t value = 14695981039346656037ull;
+    for (unsigned char c : text) {
+        value = (value ^ c) * 1099511628211ull;
+    }
+    return value;
+}
+
+bool StringDictionary::lookup(std::string_view text, uint32_t& id) const {
+    // 键被其他字符串占用（哈希冲突）时顺延到下一个键
+    uint64_t key = hash(text);
+    for (auto it = ids.find(key); it != ids.end(); it = ids.find(++key)) {
+        if (values[it->second] == text) {
+            id = it->second;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t StringDictionary::intern(std::string_view text, bool* added) {
+    uint32_t id = 0;
+    bool found = lookup(text, id);
+    if (added) {
+        *added = !found;
+    }
+    if (found) {
+        return id;
+    }
+    uint64_t key = hash(text);
+    while (ids.count(key)) {
+        ++key;
+    }
+    return intern(key, text);
+}
+
+uint32_t StringDictionary::intern(uint64_t key, std::string_view text) {
+    auto it = ids.find(key);
+    if (it != ids.end()) {
+        return it->second;
+    }
+    uint32_t id = static_cast<uint32_t>(values.size());
+    values.emplace_back(text);
+    keys.push_back(key);
+    ids.emplace(key, id);
+    value_bytes += text.size();
+    return id;
+}
+
+bool StringDictionary::find(uint64_t key, uint32_t& id) const {
+    auto it = ids.find(key);
+    if (it == ids.end()) {
+        return false;
+    }
+    id = it->second;
+    return true;
+}
+
+const std::string& StringDictionary::at(uint32_t id) const {
+    static const std::string empty;
+    return id < values.size() ? values[id] : empty;
+}
+
+void StringDictionary::clear() {
+    values.clear();
+    keys.clear();
+    ids.clear();
+    value_bytes = 0;
+}
+
+size_t StringDictionary::memory_usage() const {
+    // 每个字符串的对象本身、键以及哈希表节点，加上超出短字符串优化的内容
+    return values.size() * (sizeof(std::string) + sizeof(uint64_t) + 4 * sizeof(void*)) +
+           value_bytes;
+}
+
+void HistoryColumns::push_back(int64_t timestamp, uint64_t body, uint32_t user_length,
+                               uint32_t assistant_length, uint32_t metrics_length, uint32_t model,
+                               uint32_t prompt, uint32_t session, int32_t turn_number) {
+    timestamps.push_back(timestamp);
+    bodies.push_back(body);
+    user_lengths.push_back(user_length);
+    assistant_lengths.push_back(assistant_length);
+    metrics_lengths.push_back(metrics_length);
+    model_ids.push_back(model);
+    prompt_ids.push_back(prompt);
+    session_ids.push_back(session);
+    turn_numbers.push_back(turn_number);
+}
+
+void HistoryColumns::clear() {
+    first_id = 0;
+    models.clear();
+    prompts.clear();
+    sessions.clear();
+    timestamps.clear();
+    bodies.clear();
+    user_lengths.clear();
+    assistant_lengths.clear();
+    metrics_lengths.clear();
+    model_ids.clear();
+    prompt_ids.clear();
+    session_ids.clear();
+    turn_numbers.clear();
+}
+
+size_t HistoryColumns::memory_usage() const {
+    return models.memory_usage() + prompts.memory_usage() + sessions.memory_usage() +
+           timestamps.memory_usage() + bodies.memory_usage() + user_lengths.memory_usage() +
+           assistant_lengths.memory_usage() + metrics_lengths.memory_usage() +
+           model_ids.memory_usage() + prompt_ids.memory_usage() + session_ids.memory_usage() +
+           turn_numbers.memory_usage();
+}
@@ -0,0 +1,192 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief 字符串字典：把重复出现的字符串（模型名、系统提示、会话ID）驻留为整数ID
+ *
+ * 每个字符串有一个64位的键（内容的哈希，冲突时顺延），写入文件的记录用键引用字符串，
+ * 与写入顺序无关；内存中的列保存按加入顺序分配的紧凑ID。
+ */
+class StringDictionary {
+private:
+    std::deque<std::string> values;              // ID -> 字符串（deque保证引用不失效）
+    std::vector<uint64_t> keys;                  // ID -> 键
+    std::unordered_map<uint64_t, uint32_t> ids;  // 键 -> ID
+    size_t value_bytes = 0;
+
+public:
+    /**
+     * @brief 字符串内容的哈希（FNV-1a），作为键的初值
+     */
+    static uint64_t hash(std::string_view text);
+
+    /**
+     * @brief 驻留一个字符串，已存在时返回原有ID
+     * @param text 字符串
+     * @param added 为非空时返回是否新加入
+     * @return 字符串的ID
+     */
+    uint32_t intern(std::string_view text, bool* added = nullptr);
+
+    /**
+     * @brief 以指定的键驻留字符串（从文件加载时使用），键已存在时返回原有ID
+     */
+    uint32_t intern(uint64_t key, std::string_view text);
+
+    /**
+     * @brief 按键查找ID
+     * @return 是否存在
+     */
+    bool find(uint64_t key, uint32_t& id) const;
+
+    /**
+     * @brief 按内容查找ID（不加入字典）
+     * @return 是否存在
+     */
+    bool lookup(std::string_view text, uint32_t& id) const;
+
+    /**
+     * @brief 按ID取字符串，ID无效时返回空串
+     */
+    const std::string& at(uint32_t id) const;
+
+    uint64_t key_at(uint32_t id) const { return keys[id]; }
+    size_t size() const { return values.size(); }
+    void clear();
+
+    /**
+     * @brief 字典占用的堆内存（估算）
+     */
+    size_t memory_usage() const;
+};
+
+/**
+ * @brief 一列定长值：由若干段依次拼成，之后追加的值保存在内存中
+ *
+ * 每段直接引用文件映射中的数组（不复制），或者是加载时转换得到的数组（例如重新编号的
+ * 字典ID）。热文件的快照是一段，每个冷段各是一段。
+ */
+template <typename T>
+class Column {
+private:
+    struct Part {
+        const T* data;
+        size_t start; // 第一个值的行号
+    };
+    std::vector<Part> parts;
+    std::deque<std::vector<T>> owned; // 转换得到的段（deque保证数据不移动）
+    size_t parts_rows = 0;
+    std::vector<T> appended;          // 各段之后加载或追加的值
+
+    // 之后还要加入新的段时，把已追加的值也固定为一段
+    void seal() {
+        if (!appended.empty()) {
+            std::vector<T> values;
+            values.swap(appended);
+            adopt(std::move(values));
+        }
+    }
+
+public:
+    void map(const T* data, size_t count) {
+        seal();
+        if (count > 0) {
+            parts.push_back({data, parts_rows});
+            parts_rows += count;
+        }
+    }
+    void adopt(std::vector<T> values) {
+        seal();
+        if (!values.empty()) {
+            owned.push_back(std::move(values));
+            parts.push_back({owned.back().data(), parts_rows});
+            parts_rows += owned.back().size();
+        }
+    }
+    void push_back(T value) { appended.push_back(value); }
+    void clear() {
+        parts.clear();
+        owned.clear();
+        parts_rows = 0;
+        appended.clear();
+    }
+    size_t size() const { return parts_rows + appended.size(); }
+    size_t memory_usage() const {
+        size_t bytes = appended.capacity() * sizeof(T) + parts.capacity() * sizeof(Part);
+        for (const auto& values : owned) {
+            bytes += values.capacity() * sizeof(T);
+        }
+        return bytes;
+    }
+    T operator[](size_t row) const {
+        if (row >= parts_rows) {
+            return appended[row - parts_rows];
+        }
+        // 段很少，较新的行更常被访问，从后往前找
+        size_t i = parts.size() - 1;
+        while (parts[i].start > row) {
+            --i;
+        }
+        return parts[i].data[row - parts[i].start];
+    }
+};
+
+/**
+ * @brief 按列存放的历史记录
+ *
+ * 每个字段一列，按行号访问；重复的字符串字段只保存字典ID，时间戳是自纪元起的纳秒数，
+ * 消息正文不在内存中，只记录它在所属文件中的偏移和各部分长度：
+ * 一行的正文依次是用户消息、助手回复和请求指标（紧凑JSON，可为空），连续存放。
+ *
+ * 每行有一个记录编号，追加时分配，压缩和转存冷段都不改变；各行的编号连续递增，
+ * 因此只需记录第0行的编号。
+ */
+struct HistoryColumns {
+    StringDictionary models;
+    StringDictionary prompts;
+    StringDictionary sessions;
+
+    Column<int64_t> timestamps;         // 纳秒
+    Column<uint64_t> bodies;            // 正文在所属文件中的偏移（冷段中是解压后的偏移）
+    Column<uint32_t> user_lengths;
+    Column<uint32_t> assistant_lengths;
+    Column<uint32_t> metrics_lengths;
+    Column<uint32_t> model_ids;
+    Column<uint32_t> prompt_ids;
+    Column<uint32_t> session_ids;
+    Column<int32_t> turn_numbers;
+
+    uint64_t first_id = 0;              // 第0行的记录编号
+
+    size_t rows() const { return timestamps.size(); }
+
+    // 记录编号与行号的转换
+    uint64_t id_of(size_t row) const { return first_id + row; }
+    size_t row_of(uint64_t id) const { return id < first_id ? rows() : static_cast<size_t>(id - first_id); }
+
+    // 一行正文的总长度
+    uint64_t body_length(size_t row) const {
+        return static_cast<uint64_t>(user_lengths[row]) + assistant_lengths[row] +
+               metrics_lengths[row];
+    }
+
+    /**
+     * @brief 追加一行（字符串字段已驻留为ID）
+     */
+    void push_back(int64_t timestamp, uint64_t body, uint32_t user_length,
+                   uint32_t assistant_length, uint32_t metrics_length, uint32_t model,
+                   uint32_t prompt, uint32_t session, int32_t turn_number);
+
+    void clear();
+
+    /**
+     * @brief 列和字典占用的堆内存（不含文件映射）
+     */
+    size_t memory_usage() const;
+};
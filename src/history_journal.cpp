@@ -0,0 +1,1113 @@
+#include "history_journal.hpp"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using history_io::checksum;
+using history_io::pread_all;
+using history_io::sync_parent_directory;
+using history_io::write_all;
+
+// 文件头，之后是快照：正文区、三个字典、各列（格式见HistoryTables），再之后是追加的帧
+struct HistoryFileHeader {
+    char magic[4];               // "GFH1"
+    uint32_t version;            // 格式版本
+    uint64_t rows;               // 快照中的条目数
+    uint64_t frames_offset;      // 快照结束、追加帧开始的偏移
+    uint64_t dictionaries[3];    // 模型、系统提示、会话ID字典的偏移
+    uint64_t columns;            // 列区的偏移
+    uint64_t base_id;            // 快照第一行的记录编号（版本2）
+    uint64_t store_id;           // 历史存储的编号（版本2）
+};
+
+// 版本1的文件头没有最后两个字段，快照紧接在较短的文件头之后
+static const size_t kVersion1HeaderSize = offsetof(HistoryFileHeader, base_id);
+
+// 追加帧：帧头之后是length字节的内容，内容第一个字节是帧类型
+struct FrameHeader {
+    uint32_t length;   // 内容长度
+    uint32_t checksum; // 内容的FNV-1a校验和
+};
+
+enum FrameType : uint8_t {
+    FrameString = 'S', // 字典中新出现的字符串
+    FrameEntry = 'E',  // 一个条目
+};
+
+struct StringFrame {
+    uint8_t type;       // FrameString
+    uint8_t dictionary; // 0模型 1系统提示 2会话ID
+    uint8_t reserved[6];
+    uint64_t key;       // 字符串的键，之后是字符串内容
+};
+
+struct EntryFrame {
+    uint8_t type;       // FrameEntry
+    uint8_t reserved[3];
+    int32_t turn_number;
+    int64_t timestamp;  // 纳秒
+    uint64_t model;     // 各字符串字段的键
+    uint64_t prompt;
+    uint64_t session;
+    uint32_t user_length;
+    uint32_t assistant_length;
+    uint32_t metrics_length;
+    uint32_t reserved2; // 之后是正文
+};
+
+static const uint32_t kFormatVersion = 2;
+
+// 组提交预算：第一条记录入队后最多再等这么久，或攒够这么多字节就写出并fdatasync
+static const std::chrono::milliseconds kGroupCommitDelay(20);
+static const size_t kGroupCommitBytes = 256 * 1024;
+// 每次转存最多的块数（每块约64KB正文）：较早的大量条目分多次转存，退出时等待的一次转存有上限
+static const size_t kMaxSealBlocks = 128;
+// 可转存的正文不足这么多时不转存：每次转存都要重写整个热文件
+static const uint64_t kMinSealBytes = 4 * 1024 * 1024;
+// 限时加锁时两次尝试之间的间隔
+static const std::chrono::milliseconds kLockRetryInterval(1);
+
+// flock的作用域守卫，fd为-1时不加锁
+class FileLock {
+public:
+    FileLock(int fd, int operation) : fd(fd), locked(true) {
+        while (fd >= 0 && ::flock(fd, operation) != 0 && errno == EINTR) {
+        }
+    }
+    // 最多等待budget（为max时一直等待），用LOCK_NB反复尝试，拿不到时held()为false
+    FileLock(int fd, int operation, std::chrono::milliseconds budget) : fd(fd), locked(true) {
+        if (budget == std::chrono::milliseconds::max()) {
+            while (fd >= 0 && ::flock(fd, operation) != 0 && errno == EINTR) {
+            }
+            return;
+        }
+        auto deadline = std::chrono::steady_clock::now() + budget;
+        while (fd >= 0 && ::flock(fd, operation | LOCK_NB) != 0) {
+            if ((errno != EWOULDBLOCK && errno != EINTR) ||
+                std::chrono::steady_clock::now() >= deadline) {
+                locked = errno != EWOULDBLOCK && errno != EINTR; // 其他错误与阻塞版本一样视为不加锁
+                break;
+            }
+            std::this_thread::sleep_for(kLockRetryInterval);
+        }
+    }
+    ~FileLock() {
+        if (fd >= 0 && locked) {
+            ::flock(fd, LOCK_UN);
+        }
+    }
+    FileLock(const FileLock&) = delete;
+    FileLock& operator=(const FileLock&) = delete;
+
+    bool held() const { return locked; }
+
+private:
+    int fd;
+    bool locked;
+};
+
+// data中从头开始、完整且校验和正确的帧的总长度
+static uint64_t valid_frames_length(const char* data, uint64_t size) {
+    uint64_t pos = 0;
+    while (pos + sizeof(FrameHeader) <= size) {
+        FrameHeader header;
+        std::memcpy(&header, data + pos, sizeof(header));
+        if (header.length == 0 || header.length > size - pos - sizeof(header) ||
+            checksum(data + pos + sizeof(header), header.length) != header.checksum) {
+            break;
+        }
+        pos += sizeof(header) + header.length;
+    }
+    return pos;
+}
+
+static std::array<StringDictionary*, 3> dictionaries_of(HistoryColumns& columns) {
+    return {&columns.models, &columns.prompts, &columns.sessions};
+}
+
+template <typename T>
+static void put(std::string& out, const T& value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// 新的历史存储编号，全文索引据此判断是否属于当前历史
+static uint64_t generate_store_id() {
+    std::random_device device;
+    return (static_cast<uint64_t>(device()) << 32) | device();
+}
+
+HistoryJournal::HistoryJournal(const std::string& path)
+    : journal_path(path), fd(-1), lock_fd(-1), map_data(nullptr), map_size(0), journal_size(0),
+      store_id(0), base_id(0), snapshot_rows(0), appended_rows(0), hot_row_start(0),
+      queued_bytes(0), submitted(0), synced(0), flush_requested(false), stopping(false),
+      seal_requested(false), sealing(false), seal_first_id(0), seal_hot_rows(0), write_failed(false), write_fd(-1), write_lock_fd(-1), write_device(0), write_inode(0),
+      write_frames_offset(0), write_valid_end(0) {}
+
+HistoryJournal::~HistoryJournal() {
+    if (writer.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            stopping = true;
+        }
+        queue_cv.notify_one();
+        writer.join(); // 写线程退出前会写出并同步已入队的记录，不再开始新的转存
+    }
+    unmap_journal();
+    for (int descriptor : {fd, lock_fd, write_fd, write_lock_fd}) {
+        if (descriptor >= 0) {
+            ::close(descriptor);
+        }
+    }
+}
+
+bool HistoryJournal::exists() const {
+    return std::filesystem::exists(journal_path);
+}
+
+int HistoryJournal::open_lock_file() const {
+    return ::open((journal_path + ".lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+}
+
+int HistoryJournal::lock_descriptor() {
+    if (lock_fd < 0) {
+        lock_fd = open_lock_file();
+    }
+    return lock_fd;
+}
+
+bool HistoryJournal::open_descriptor() {
+    if (fd >= 0) {
+        return true;
+    }
+    fd = ::open(journal_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cerr << "Error: Cannot open history journal: "
+                  << journal_path << " (" << std::strerror(errno) << ")" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool HistoryJournal::map_journal() {
+    unmap_journal();
+    if (!open_descriptor()) {
+        return false;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        return false;
+    }
+    journal_size = static_cast<uint64_t>(st.st_size);
+    {
+        // 重新打开之后允许再次追加
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        write_failed = false;
+    }
+    if (journal_size == 0) {
+        return true; // 空文件无法映射，也不需要映射
+    }
+    void* mapped = ::mmap(nullptr, journal_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Error: Cannot map history journal: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    ::madvise(mapped, journal_size, MADV_RANDOM);
+    map_data = static_cast<const char*>(mapped);
+    map_size = journal_size;
+    return true;
+}
+
+void HistoryJournal::unmap_journal() {
+    if (map_data) {
+        ::munmap(const_cast<char*>(map_data), map_size);
+        map_data = nullptr;
+        map_size = 0;
+    }
+}
+
+bool HistoryJournal::load_snapshot(HistoryColumns& columns, uint64_t& frames_offset,
+                                   uint64_t& skip_frames) {
+    HistoryFileHeader header{};
+    if (map_size < kVersion1HeaderSize) {
+        return false;
+    }
+    std::memcpy(&header, map_data, std::min(map_size, sizeof(header)));
+    size_t header_size = header.version == 1 ? kVersion1HeaderSize : sizeof(header);
+    if (std::memcmp(header.magic, "GFH1", 4) != 0 ||
+        (header.version != 1 && header.version != kFormatVersion) || map_size < header_size ||
+        header.frames_offset > map_size || header.columns % 8 != 0 ||
+        header.columns > header.frames_offset ||
+        header.rows > (header.frames_offset - header.columns) / HistoryTables::kRowBytes) {
+        return false;
+    }
+    if (header.version == 1) {
+        // 版本1没有冷段，记录编号从0开始，用inode作为存储编号
+        struct stat st;
+        header.base_id = 0;
+        header.store_id = ::fstat(fd, &st) == 0 ? static_cast<uint64_t>(st.st_ino) : 0;
+    }
+    base_id = header.base_id;
+    store_id = header.store_id;
+
+    // 先驻留热文件的字典：此时字典为空，热文件中的ID与内存中一致，ID列可以直接映射
+    std::vector<uint32_t> ids[3];
+    if (!HistoryTables::load_dictionaries(map_data, header.columns, header.dictionaries, columns, ids)) {
+        return false;
+    }
+    uint64_t next_id = base_id;
+    if (!load_segments(columns, base_id, next_id)) {
+        return false;
+    }
+    // 转存冷段之后、替换热文件之前崩溃时，冷段与热文件有重叠，以冷段为准
+    uint64_t skip = std::min<uint64_t>(next_id - base_id, header.rows);
+    hot_row_start = columns.rows();
+    if (!HistoryTables::map_columns(map_data, header.frames_offset, header.columns, header.rows,
+                                    skip, ids, columns)) {
+        return false;
+    }
+    snapshot_rows = static_cast<size_t>(header.rows - skip);
+    frames_offset = header.frames_offset;
+    skip_frames = next_id - base_id - skip;
+    return true;
+}
+
+bool HistoryJournal::load_segments(HistoryColumns& columns, uint64_t hot_base_id, uint64_t& next_id) {
+    struct Candidate {
+        uint64_t first_id;
+        uint64_t rows;
+        std::string path;
+    };
+    std::vector<Candidate> candidates;
+    std::error_code error;
+    for (const auto& file : std::filesystem::directory_iterator(segment_directory(), error)) {
+        Candidate candidate{0, 0, file.path().string()};
+        if (file.path().extension() == ".seg" &&
+            ColdSegment::peek(candidate.path, candidate.first_id, candidate.rows) && candidate.rows > 0) {
+            candidates.push_back(std::move(candidate));
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [](const Candidate& a, const Candidate& b) { return a.first_id < b.first_id; });
+
+    // 只使用编号连续的最后一串冷段：中断的压缩可能留下已整段淘汰、与之后不相接的旧冷段
+    size_t chain_start = 0;
+    for (size_t i = 1; i < candidates.size(); ++i) {
+        uint64_t expected = candidates[i - 1].first_id + candidates[i - 1].rows;
+        if (candidates[i].first_id != expected) {
+            chain_start = i;
+        }
+    }
+    columns.first_id = hot_base_id;
+    next_id = hot_base_id;
+    if (candidates.empty() ||
+        candidates.back().first_id + candidates.back().rows < hot_base_id) {
+        if (!candidates.empty()) {
+            std::cerr << "Warning: History segments in " << segment_directory()
+                      << " do not connect to " << journal_path << ", ignoring them." << std::endl;
+        }
+        return true;
+    }
+    for (size_t i = 0; i < chain_start; ++i) {
+        ::unlink(candidates[i].path.c_str());
+    }
+
+    columns.first_id = candidates[chain_start].first_id;
+    for (size_t i = chain_start; i < candidates.size(); ++i) {
+        Segment slot{std::make_unique<ColdSegment>(candidates[i].path), columns.rows(), false};
+        if (!slot.segment->open(columns)) {
+            std::cerr << "Error: Not a valid history segment: " << candidates[i].path << std::endl;
+            return false;
+        }
+        segments.push_back(std::move(slot));
+    }
+    next_id = candidates.back().first_id + candidates.back().rows;
+    return true;
+}
+
+uint64_t HistoryJournal::scan_frames(HistoryColumns& columns, const char* data, uint64_t begin,
+                                     uint64_t end, uint64_t skip_entries) {
+    auto dictionaries = dictionaries_of(columns);
+    uint64_t pos = begin;
+    while (pos + sizeof(FrameHeader) <= end) {
+        FrameHeader header;
+        std::memcpy(&header, data + (pos - begin), sizeof(header));
+        const char* payload = data + (pos - begin) + sizeof(header);
+        if (header.length == 0 || header.length > end - pos - sizeof(header) ||
+            checksum(payload, header.length) != header.checksum) {
+            break;
+        }
+        if (payload[0] == FrameString && header.length >= sizeof(StringFrame)) {
+            StringFrame frame;
+            std::memcpy(&frame, payload, sizeof(frame));
+            if (frame.dictionary >= dictionaries.size()) {
+                break;
+            }
+            dictionaries[frame.dictionary]->intern(
+                frame.key, std::string_view(payload + sizeof(frame), header.length - sizeof(frame)));
+        } else if (payload[0] == FrameEntry && header.length >= sizeof(EntryFrame)) {
+            EntryFrame frame;
+            std::memcpy(&frame, payload, sizeof(frame));
+            if (sizeof(frame) + static_cast<uint64_t>(frame.user_length) + frame.assistant_length +
+                    frame.metrics_length != header.length) {
+                break;
+            }
+            uint32_t ids[3] = {0, 0, 0};
+            uint64_t keys[3] = {frame.model, frame.prompt, frame.session};
+            for (size_t d = 0; d < dictionaries.size(); ++d) {
+                if (!dictionaries[d]->find(keys[d], ids[d])) {
+                    std::cerr << "Warning: History record at offset " << pos
+                              << " refers to a missing string." << std::endl;
+                    ids[d] = dictionaries[d]->intern(keys[d], "");
+                }
+            }
+            if (skip_entries > 0) {
+                skip_entries--; // 已在冷段中
+            } else {
+                columns.push_back(frame.timestamp, pos + sizeof(header) + sizeof(frame),
+                                  frame.user_length, frame.assistant_length, frame.metrics_length,
+                                  ids[0], ids[1], ids[2], frame.turn_number);
+                appended_rows++;
+            }
+        } else {
+            break;
+        }
+        pos += sizeof(header) + header.length;
+    }
+    return pos;
+}
+
+bool HistoryJournal::truncate_tail(uint64_t valid_end, uint64_t file_size) {
+    journal_size = valid_end;
+    if (valid_end >= file_size) {
+        return true;
+    }
+    // 尾部写了一半的帧（崩溃导致）：截断。之前的映射仍然有效，只是不再访问被截掉的部分
+    std::cerr << "Warning: Recovering history journal, discarding "
+              << (file_size - valid_end) << " bytes of torn tail." << std::endl;
+    map_size = std::min<size_t>(map_size, valid_end);
+    if (::ftruncate(fd, static_cast<off_t>(valid_end)) != 0) {
+        std::cerr << "Error: Cannot truncate history journal: "
+                  << std::strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool HistoryJournal::catch_up(HistoryColumns& columns, HistoryRefresh& change) {
+    change = HistoryRefresh::Unchanged;
+    struct stat current;
+    struct stat opened;
+    if (fd < 0 || ::fstat(fd, &opened) != 0) {
+        return false;
+    }
+    if (::stat(journal_path.c_str(), &current) == 0 &&
+        (current.st_ino != opened.st_ino || current.st_dev != opened.st_dev)) {
+        // 热文件已被其他进程压缩或重写（rename替换）：重新打开
+        change = HistoryRefresh::Reloaded;
+        if (!reopen(columns)) {
+            return false;
+        }
+        match_own_rows(columns);
+        return true;
+    }
+    uint64_t file_size = static_cast<uint64_t>(opened.st_size);
+    if (file_size <= journal_size) {
+        return true;
+    }
+    // 只读取上次之后新增的部分，新条目的正文在访问时从文件读取
+    std::string tail(static_cast<size_t>(file_size - journal_size), '\0');
+    if (!pread_all(fd, &tail[0], tail.size(), journal_size)) {
+        return false;
+    }
+    size_t rows = columns.rows();
+    uint64_t end = scan_frames(columns, tail.data(), journal_size, file_size, 0);
+    if (columns.rows() > rows) {
+        change = HistoryRefresh::Appended;
+    }
+    match_own_rows(columns);
+    return truncate_tail(end, file_size);
+}
+
+void HistoryJournal::match_own_rows(const HistoryColumns& columns) {
+    struct stat st;
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    if (written.empty() || ::fstat(fd, &st) != 0) {
+        return;
+    }
+    // 快照之后的各行按正文偏移递增
+    size_t begin = columns.rows() - appended_rows;
+    for (auto it = written.begin(); it != written.end();) {
+        if (it->device == static_cast<uint64_t>(st.st_dev) &&
+            it->inode == static_cast<uint64_t>(st.st_ino) && it->body >= journal_size) {
+            ++it; // 还没有读到
+            continue;
+        }
+        // 写在已被替换的文件中的条目已由压缩它的进程保留，只是无法按偏移认出
+        size_t low = begin;
+        size_t high = columns.rows();
+        while (low < high) {
+            size_t middle = low + (high - low) / 2;
+            if (columns.bodies[middle] < it->body) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        if (it->device == static_cast<uint64_t>(st.st_dev) &&
+            it->inode == static_cast<uint64_t>(st.st_ino) && low < columns.rows() &&
+            columns.bodies[low] == it->body) {
+            own_rows.emplace_back(columns.id_of(low), std::move(it->entry));
+        }
+        it = written.erase(it);
+    }
+}
+
+bool HistoryJournal::open(HistoryColumns& columns) {
+    // 持有共享锁：其他进程此时不会在写入帧或替换热文件
+    FileLock lock(lock_descriptor(), LOCK_SH);
+    return reopen(columns);
+}
+
+bool HistoryJournal::load(HistoryColumns& columns) {
+    columns.clear(); // 各列可能引用冷段的映射，先于冷段释放
+    segments.clear();
+    snapshot_rows = 0;
+    appended_rows = 0;
+    hot_row_start = 0;
+    if (!map_journal()) {
+        return false;
+    }
+    uint64_t frames_offset = 0;
+    uint64_t skip_frames = 0;
+    if (!load_snapshot(columns, frames_offset, skip_frames)) {
+        std::cerr << "Error: Not a valid history file: " << journal_path << std::endl;
+        columns.clear();
+        segments.clear();
+        return false;
+    }
+    uint64_t end = scan_frames(columns, map_data + frames_offset, frames_offset, map_size, skip_frames);
+    return truncate_tail(end, journal_size);
+}
+
+bool HistoryJournal::refresh(HistoryColumns& columns, HistoryRefresh& change,
+                             std::chrono::milliseconds wait) {
+    change = HistoryRefresh::Unchanged;
+    if (fd < 0) {
+        return true; // 尚未打开
+    }
+    if (wait.count() > 0 && wait != std::chrono::milliseconds::max()) {
+        // 等待写线程和加锁共用同一个时间上限
+        auto start = std::chrono::steady_clock::now();
+        flush(wait); // 先让本进程已入队的记录写出，超时的留到下次
+        auto spent = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start);
+        wait = std::max(wait - spent, std::chrono::milliseconds(0));
+    } else if (wait.count() > 0) {
+        flush();
+    }
+    FileLock lock(lock_descriptor(), LOCK_SH, wait);
+    if (!lock.held()) {
+        return true; // 其他进程正在写入或压缩，留到下次
+    }
+    return catch_up(columns, change);
+}
+
+std::vector<std::pair<uint64_t, HistoryEntry>> HistoryJournal::take_own_rows() {
+    std::vector<std::pair<uint64_t, HistoryEntry>> rows;
+    rows.swap(own_rows);
+    std::sort(rows.begin(), rows.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+    return rows;
+}
+
+std::string_view HistoryJournal::body(const HistoryColumns& columns, size_t row,
+                                      std::string& buffer) const {
+    uint64_t offset = columns.bodies[row];
+    uint64_t length = columns.body_length(row);
+    if (row < hot_row_start) {
+        // 冷段中的行：解压所在的块
+        auto it = std::upper_bound(segments.begin(), segments.end(), row,
+                                   [](size_t r, const Segment& slot) { return r < slot.first_row; });
+        if (it == segments.begin() || !(it - 1)->segment->read(offset, length, buffer)) {
+            buffer.clear();
+        }
+        return buffer;
+    }
+    if (map_data && offset + length <= map_size) {
+        return std::string_view(map_data + offset, length);
+    }
+    // 映射之后追加的帧不在映射范围内，直接从文件读取
+    buffer.resize(length);
+    if (fd < 0 || !pread_all(fd, &buffer[0], length, offset)) {
+        buffer.clear();
+    }
+    return buffer;
+}
+
+bool HistoryJournal::read(const HistoryColumns& columns, size_t row, HistoryEntry& entry) const {
+    std::string buffer;
+    std::string_view text = body(columns, row, buffer);
+    if (text.size() != columns.body_length(row)) {
+        std::cerr << "Warning: Cannot read history record at offset " << columns.bodies[row]
+                  << std::endl;
+        return false;
+    }
+    size_t user_length = columns.user_lengths[row];
+    size_t assistant_length = columns.assistant_lengths[row];
+    entry.timestamp = columns.timestamps[row];
+    entry.user_message.assign(text.substr(0, user_length));
+    entry.assistant_response.assign(text.substr(user_length, assistant_length));
+    entry.system_prompt = columns.prompts.at(columns.prompt_ids[row]);
+    entry.model = columns.models.at(columns.model_ids[row]);
+    entry.session_id = columns.sessions.at(columns.session_ids[row]);
+    entry.turn_number = columns.turn_numbers[row];
+    entry.metrics = Json::Value();
+    std::string_view metrics = text.substr(user_length + assistant_length);
+    if (!metrics.empty()) {
+        static const std::unique_ptr<Json::CharReader> reader = [] {
+            Json::CharReaderBuilder builder;
+            return std::unique_ptr<Json::CharReader>(builder.newCharReader());
+        }();
+        std::string errors;
+        reader->parse(metrics.data(), metrics.data() + metrics.size(), &entry.metrics, &errors);
+    }
+    return true;
+}
+
+std::string HistoryJournal::serialize_metrics(const Json::Value& metrics) {
+    if (metrics.isNull()) {
+        return std::string();
+    }
+    static const std::unique_ptr<Json::StreamWriter> writer = [] {
+        Json::StreamWriterBuilder builder;
+        builder["indentation"] = "";
+        builder["emitUTF8"] = true;
+        // 请求指标中的毫秒数保留3位小数即可
+        builder["precision"] = 3;
+        builder["precisionType"] = "decimal";
+        return std::unique_ptr<Json::StreamWriter>(builder.newStreamWriter());
+    }();
+    std::ostringstream out;
+    writer->write(metrics, &out);
+    return out.str();
+}
+
+// 在out末尾写一个完整的帧，返回帧内容的起始位置
+static size_t put_frame(std::string& out, const void* fixed, size_t fixed_size,
+                        std::initializer_list<std::string_view> parts) {
+    size_t start = out.size();
+    FrameHeader header{static_cast<uint32_t>(fixed_size), 0};
+    for (std::string_view part : parts) {
+        header.length += static_cast<uint32_t>(part.size());
+    }
+    put(out, header);
+    out.append(static_cast<const char*>(fixed), fixed_size);
+    for (std::string_view part : parts) {
+        out.append(part.data(), part.size());
+    }
+    header.checksum = checksum(out.data() + start + sizeof(header), header.length);
+    std::memcpy(&out[start + offsetof(FrameHeader, checksum)], &header.checksum,
+                sizeof(header.checksum));
+    return start + sizeof(header);
+}
+
+bool HistoryJournal::append(const HistoryEntry& entry, HistoryColumns& columns) {
+    Pending pending{entry, {0, 0, 0}, std::string()};
+    // 在主线程中确定字符串的键并组装条目帧；字符串帧由写线程按需补上
+    auto dictionaries = dictionaries_of(columns);
+    const std::string* values[3] = {&entry.model, &entry.system_prompt, &entry.session_id};
+    for (size_t d = 0; d < dictionaries.size(); ++d) {
+        pending.keys[d] = dictionaries[d]->key_at(dictionaries[d]->intern(*values[d]));
+    }
+    std::string metrics = serialize_metrics(entry.metrics);
+    EntryFrame frame{};
+    frame.type = FrameEntry;
+    frame.turn_number = entry.turn_number;
+    frame.timestamp = entry.timestamp;
+    frame.model = pending.keys[0];
+    frame.prompt = pending.keys[1];
+    frame.session = pending.keys[2];
+    frame.user_length = static_cast<uint32_t>(entry.user_message.size());
+    frame.assistant_length = static_cast<uint32_t>(entry.assistant_response.size());
+    frame.metrics_length = static_cast<uint32_t>(metrics.size());
+    put_frame(pending.frame, &frame, sizeof(frame),
+              {entry.user_message, entry.assistant_response, metrics});
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        if (write_failed) {
+            return false;
+        }
+        queued_bytes += pending.frame.size();
+        queued.push_back(std::move(pending));
+        submitted++;
+        if (!writer.joinable()) {
+            writer = std::thread(&HistoryJournal::write_loop, this);
+        }
+    }
+    queue_cv.notify_one();
+    return true;
+}
+
+void HistoryJournal::write_loop() {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    while (true) {
+        queue_cv.wait(lock, [this] { return stopping || !queued.empty() || seal_requested; });
+        if (queued.empty()) {
+            if (stopping) {
+                break; // 已全部写出，尚未开始的转存留到下次
+            }
+            // 没有待写的记录时转存一次，还有可转存的块时先写出期间入队的记录再继续
+            seal_requested = false;
+            sealing = true;
+            uint64_t first_id = seal_first_id;
+            size_t hot_rows = seal_hot_rows;
+            lock.unlock();
+            bool more = seal_once(first_id, hot_rows);
+            lock.lock();
+            sealing = false;
+            seal_requested = seal_requested || more;
+            continue;
+        }
+        // 组提交：等待更多记录入队，直到时间或大小预算用完，或有人在等待flush
+        queue_cv.wait_for(lock, kGroupCommitDelay, [this] {
+            return stopping || flush_requested || queued_bytes >= kGroupCommitBytes;
+        });
+        std::deque<Pending> batch;
+        batch.swap(queued);
+        queued_bytes = 0;
+        lock.unlock();
+
+        bool ok = write_batch(batch); // 可能等待其他进程的压缩，主线程不受影响
+
+        lock.lock();
+        if (!ok) {
+            write_failed = true; // 之后的追加都会失败
+        }
+        synced += batch.size();
+        if (queued.empty()) {
+            flush_requested = false;
+        }
+        synced_cv.notify_all();
+    }
+}
+
+void HistoryJournal::request_seal(uint64_t first_id, size_t hot_rows) {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        if (write_failed) {
+            return;
+        }
+        seal_requested = true;
+        seal_first_id = first_id;
+        seal_hot_rows = hot_rows;
+        if (!writer.joinable()) {
+            writer = std::thread(&HistoryJournal::write_loop, this);
+        }
+    }
+    queue_cv.notify_one();
+}
+
+bool HistoryJournal::is_sealing() const {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    return seal_requested || sealing;
+}
+
+bool HistoryJournal::seal_once(uint64_t first_id, size_t hot_rows) {
+    // 不使用主线程的映射和各列：像另一个进程一样打开并压缩，持有的是自己的锁描述符
+    HistoryJournal sealer(journal_path);
+    HistoryColumns columns;
+    if (!sealer.exists() || !sealer.open(columns)) {
+        return false;
+    }
+    auto first_row = [&columns, first_id] {
+        return first_id < columns.first_id ? 0 : std::min(columns.row_of(first_id), columns.rows());
+    };
+    if (sealer.sealable_rows(columns, first_row(), hot_rows) == 0) {
+        return false;
+    }
+    HistoryRefresh change;
+    if (!sealer.compact(columns, first_row(), hot_rows, change)) {
+        return false;
+    }
+    return sealer.sealable_rows(columns, first_row(), hot_rows) > 0;
+}
+
+bool HistoryJournal::write_batch(std::deque<Pending>& batch) {
+    if (write_lock_fd < 0) {
+        // 与主线程使用不同的打开文件，flock才能在两个线程之间互斥
+        write_lock_fd = open_lock_file();
+    }
+    {
+        // 持有排他锁直到写完：文件末尾在此期间不会改变，也不会被替换
+        FileLock lock(write_lock_fd, LOCK_EX);
+        if (!prepare_writer()) {
+            return false;
+        }
+        std::string frames;
+        std::vector<uint64_t> bodies;
+        bodies.reserve(batch.size());
+        for (const Pending& pending : batch) {
+            // 当前文件中还没有写过的字符串先写一个字符串帧（重复写入无害）
+            const std::string* values[3] = {&pending.entry.model, &pending.entry.system_prompt,
+                                            &pending.entry.session_id};
+            for (size_t d = 0; d < write_keys.size(); ++d) {
+                if (write_keys[d].insert(pending.keys[d]).second) {
+                    StringFrame frame{FrameString, static_cast<uint8_t>(d), {}, pending.keys[d]};
+                    put_frame(frames, &frame, sizeof(frame), {*values[d]});
+                }
+            }
+            bodies.push_back(write_valid_end + frames.size() + sizeof(FrameHeader) + sizeof(EntryFrame));
+            frames += pending.frame;
+        }
+        // 一次write写出整组记录
+        if (!write_all(write_fd, frames.data(), frames.size())) {
+            std::cerr << "Error: Failed to append history record: " << std::strerror(errno) << std::endl;
+            // 截断写了一半的数据，其中的字符串帧也一起丢弃了
+            if (::ftruncate(write_fd, static_cast<off_t>(write_valid_end)) != 0) {
+                std::cerr << "Error: Cannot truncate history journal: "
+                          << std::strerror(errno) << std::endl;
+            }
+            for (auto& keys : write_keys) {
+                keys.clear();
+            }
+            return false;
+        }
+        write_valid_end += frames.size();
+        // 在释放锁之前登记：主线程读到这些帧时一定能认出
+        std::lock_guard<std::mutex> guard(queue_mutex);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            written.push_back({write_device, write_inode, bodies[i], std::move(batch[i].entry)});
+        }
+    }
+    // fdatasync不需要持有锁
+    if (::fdatasync(write_fd) != 0) {
+        std::cerr << "Error: Failed to sync history records: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool HistoryJournal::prepare_writer() {
+    struct stat current;
+    if (::stat(journal_path.c_str(), &current) != 0) {
+        std::cerr << "Error: Cannot open history journal for writing: "
+                  << journal_path << " (" << std::strerror(errno) << ")" << std::endl;
+        return false;
+    }
+    if (write_fd < 0 || static_cast<uint64_t>(current.st_ino) != write_inode ||
+        static_cast<uint64_t>(current.st_dev) != write_device) {
+        // 第一次写入，或热文件已被压缩或重写：打开新的文件，从快照结束处开始校验
+        if (write_fd >= 0) {
+            ::close(write_fd);
+        }
+        write_fd = ::open(journal_path.c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+        HistoryFileHeader header{};
+        struct stat opened;
+        if (write_fd < 0 || ::fstat(write_fd, &opened) != 0 ||
+            ::pread(write_fd, &header, sizeof(header), 0) < static_cast<ssize_t>(kVersion1HeaderSize) ||
+            std::memcmp(header.magic, "GFH1", 4) != 0) {
+            std::cerr << "Error: Cannot open history journal for writing: " << journal_path << std::endl;
+            if (write_fd >= 0) {
+                ::close(write_fd);
+                write_fd = -1;
+            }
+            return false;
+        }
+        write_device = static_cast<uint64_t>(opened.st_dev);
+        write_inode = static_cast<uint64_t>(opened.st_ino);
+        write_frames_offset = header.frames_offset;
+        write_valid_end = header.frames_offset;
+        for (auto& keys : write_keys) {
+            keys.clear();
+        }
+    }
+    struct stat st;
+    if (::fstat(write_fd, &st) != 0) {
+        return false;
+    }
+    uint64_t file_size = static_cast<uint64_t>(st.st_size);
+    if (file_size < write_valid_end) {
+        write_valid_end = write_frames_offset; // 尾部被截断过：重新校验
+    }
+    if (file_size < write_valid_end) {
+        std::cerr << "Error: Not a valid history file: " << journal_path << std::endl;
+        return false;
+    }
+    if (file_size > write_valid_end) {
+        // 只校验其他进程在上次之后追加的帧
+        std::string tail(static_cast<size_t>(file_size - write_valid_end), '\0');
+        if (!pread_all(write_fd, &tail[0], tail.size(), write_valid_end)) {
+            return false;
+        }
+        uint64_t end = write_valid_end + valid_frames_length(tail.data(), tail.size());
+        if (end < file_size) {
+            // 崩溃留下的不完整尾部：截断后再写，否则新记录会接在无法解析的数据之后
+            std::cerr << "Warning: Recovering history journal, discarding "
+                      << (file_size - end) << " bytes of torn tail." << std::endl;
+            if (::ftruncate(write_fd, static_cast<off_t>(end)) != 0) {
+                std::cerr << "Error: Cannot truncate history journal: "
+                          << std::strerror(errno) << std::endl;
+                return false;
+            }
+        }
+        write_valid_end = end;
+    }
+    return true;
+}
+
+bool HistoryJournal::has_unread() const {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    return synced < submitted || !written.empty();
+}
+
+bool HistoryJournal::flush(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    uint64_t target = submitted;
+    if (synced < target) {
+        flush_requested = true;
+        queue_cv.notify_one();
+        auto done = [this, target] { return synced >= target; };
+        if (timeout == std::chrono::milliseconds::max()) {
+            synced_cv.wait(lock, done);
+        } else if (!synced_cv.wait_for(lock, timeout, done)) {
+            return false;
+        }
+    }
+    return !write_failed;
+}
+
+std::string HistoryJournal::segment_directory() const {
+    return journal_path + ".cold";
+}
+
+std::string HistoryJournal::segment_path(uint64_t first_id) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.seg", static_cast<unsigned long long>(first_id));
+    return (std::filesystem::path(segment_directory()) / name).string();
+}
+
+bool HistoryJournal::write_snapshot(size_t count, uint64_t first_id, uint64_t store,
+                                    const ColdSegment::RowAt& row_at) {
+    std::string temp_path = journal_path + ".tmp";
+    int temp_fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (temp_fd < 0) {
+        std::cerr << "Error: Cannot open history file for writing: " << temp_path << std::endl;
+        return false;
+    }
+    HistoryFileHeader header{};
+    std::memcpy(header.magic, "GFH1", 4);
+    header.version = kFormatVersion;
+    header.rows = count;
+    header.base_id = first_id;
+    header.store_id = store;
+
+    SnapshotWriter out(temp_fd);
+    out.write(&header, sizeof(header)); // 占位，最后再写入真正的文件头
+
+    // 正文区：逐行写出，同时在内存中积累各列
+    HistoryTables tables;
+    SnapshotRow row;
+    for (size_t i = 0; i < count; ++i) {
+        row = SnapshotRow();
+        row_at(i, row);
+        tables.add(row, out.offset());
+        out.write(row.user);
+        out.write(row.assistant);
+        out.write(row.metrics);
+    }
+    tables.write(out, header.dictionaries, header.columns);
+    header.frames_offset = out.offset();
+
+    bool ok = out.drain() &&
+              ::pwrite(temp_fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header)) &&
+              ::fsync(temp_fd) == 0;
+    ::close(temp_fd);
+    if (!ok || ::rename(temp_path.c_str(), journal_path.c_str()) != 0) {
+        std::cerr << "Error: Failed to compact history journal: " << std::strerror(errno) << std::endl;
+        ::unlink(temp_path.c_str());
+        return false;
+    }
+    sync_parent_directory(journal_path);
+    return true;
+}
+
+bool HistoryJournal::reopen(HistoryColumns& columns) {
+    // 旧的描述符和映射指向被替换掉的文件（写线程使用自己的描述符）
+    columns.clear();
+    segments.clear();
+    unmap_journal();
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    return load(columns);
+}
+
+bool HistoryJournal::rewrite(const std::vector<HistoryEntry>& entries,
+                             HistoryColumns& columns) {
+    flush(); // 写线程也要加锁，先让它写完已入队的记录
+    FileLock lock(lock_descriptor(), LOCK_EX);
+    return write_entries(entries, columns);
+}
+
+bool HistoryJournal::create(const std::vector<HistoryEntry>& entries, HistoryColumns& columns,
+                            bool& created) {
+    flush();
+    FileLock lock(lock_descriptor(), LOCK_EX);
+    // 在锁内再检查一次：同时启动的其他进程可能已经创建了日志并追加了记录
+    created = !exists();
+    return created ? write_entries(entries, columns) : reopen(columns);
+}
+
+bool HistoryJournal::write_entries(const std::vector<HistoryEntry>& entries,
+                                   HistoryColumns& columns) {
+    // 先删除冷段：之后崩溃时旧的热文件仍然自成一体
+    std::error_code error;
+    std::filesystem::remove_all(segment_directory(), error);
+    std::string metrics;
+    bool ok = write_snapshot(entries.size(), 0, generate_store_id(),
+                             [&entries, &metrics](size_t i, SnapshotRow& row) {
+                                 const HistoryEntry& entry = entries[i];
+                                 metrics = serialize_metrics(entry.metrics);
+                                 row.timestamp = entry.timestamp;
+                                 row.model = entry.model;
+                                 row.prompt = entry.system_prompt;
+                                 row.session = entry.session_id;
+                                 row.turn_number = entry.turn_number;
+                                 row.user = entry.user_message;
+                                 row.assistant = entry.assistant_response;
+                                 row.metrics = metrics;
+                             });
+    {
+        // 之前写出的条目已随旧文件一起丢弃
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        written.clear();
+    }
+    own_rows.clear();
+    return ok && reopen(columns);
+}
+
+void HistoryJournal::snapshot_row(const HistoryColumns& columns, size_t r, SnapshotRow& row,
+                                  std::string& buffer) const {
+    std::string_view text = body(columns, r, buffer);
+    if (text.size() != columns.body_length(r)) {
+        text = std::string_view(); // 读取失败的正文留空
+    }
+    size_t user_length = std::min<size_t>(columns.user_lengths[r], text.size());
+    size_t assistant_length = columns.assistant_lengths[r];
+    row.timestamp = columns.timestamps[r];
+    row.model = columns.models.at(columns.model_ids[r]);
+    row.prompt = columns.prompts.at(columns.prompt_ids[r]);
+    row.session = columns.sessions.at(columns.session_ids[r]);
+    row.turn_number = columns.turn_numbers[r];
+    row.user = text.substr(0, user_length);
+    row.assistant = text.substr(user_length, assistant_length);
+    row.metrics = text.substr(std::min(text.size(), user_length + assistant_length));
+}
+
+size_t HistoryJournal::sealable_rows(const HistoryColumns& columns, size_t first_row,
+                                     size_t hot_rows) const {
+    size_t rows = columns.rows();
+    size_t seal_begin = std::max(std::min(first_row, rows), hot_row_start);
+    size_t seal_end = rows > hot_rows ? rows - hot_rows : 0;
+    if (seal_end <= seal_begin) {
+        return 0;
+    }
+    auto row_bytes = [&columns, seal_begin](size_t i) {
+        size_t r = seal_begin + i;
+        return uint64_t(columns.user_lengths[r]) + columns.assistant_lengths[r] + columns.metrics_lengths[r];
+    };
+    size_t count = ColdSegment::full_block_rows(seal_end - seal_begin, row_bytes, kMaxSealBlocks);
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < count; ++i) {
+        bytes += row_bytes(i);
+    }
+    return bytes >= kMinSealBytes ? count : 0;
+}
+
+bool HistoryJournal::compact(HistoryColumns& columns, size_t first_row, size_t hot_rows,
+                             HistoryRefresh& change) {
+    change = HistoryRefresh::Unchanged;
+    if (!flush()) {
+        return false;
+    }
+    // 持有排他锁直到替换完成：压缩前先读取其他进程追加的条目，一起写入新的热文件
+    FileLock lock(lock_descriptor(), LOCK_EX);
+    if (!catch_up(columns, change)) {
+        return false;
+    }
+    if (change == HistoryRefresh::Reloaded) {
+        return true; // 其他进程刚刚压缩过，行号已改变
+    }
+    size_t rows = columns.rows();
+    first_row = std::min(first_row, rows);
+    // 热文件中first_row之前的条目已被淘汰，直接丢弃；其余超出hot_rows的部分按整块转存为冷段
+    size_t seal_begin = std::max(first_row, hot_row_start);
+    size_t seal_end = seal_begin + sealable_rows(columns, first_row, hot_rows);
+    std::string buffer;
+    auto rows_from = [this, &columns, &buffer](size_t begin) {
+        return [this, &columns, &buffer, begin](size_t i, SnapshotRow& row) {
+            snapshot_row(columns, begin + i, row, buffer);
+        };
+    };
+    // 先写冷段再替换热文件，中间崩溃时两者重叠的部分在加载时以冷段为准
+    if (seal_end > seal_begin) {
+        std::error_code error;
+        std::filesystem::create_directories(segment_directory(), error);
+        uint64_t first_id = columns.id_of(seal_begin);
+        // 沿用最近一个冷段的字典，不再重新采样训练
+        std::string_view dictionary = segments.empty() ? std::string_view()
+                                                       : segments.back().segment->get_dictionary();
+        if (!ColdSegment::write(segment_path(first_id), first_id, seal_end - seal_begin,
+                                rows_from(seal_begin), dictionary)) {
+            return false;
+        }
+    }
+    if (!write_snapshot(rows - seal_end, columns.id_of(seal_end), store_id, rows_from(seal_end))) {
+        return false;
+    }
+    unlink_segments(first_row);
+    return reopen(columns);
+}
+
+void HistoryJournal::drop_segments(size_t first_row) {
+    bool any = std::any_of(segments.begin(), segments.end(), [first_row](const Segment& slot) {
+        return !slot.dropped && slot.first_row + slot.segment->get_rows() <= first_row;
+    });
+    if (any) {
+        // 其他进程可能正在加载冷段
+        FileLock lock(lock_descriptor(), LOCK_EX);
+        unlink_segments(first_row);
+    }
+}
+
+void HistoryJournal::unlink_segments(size_t first_row) {
+    for (auto& slot : segments) {
+        if (!slot.dropped && slot.first_row + slot.segment->get_rows() <= first_row) {
+            ::unlink(slot.segment->get_path().c_str());
+            slot.dropped = true;
+        }
+    }
+}
+
+std::vector<HistoryJournal::SegmentInfo> HistoryJournal::get_segments() const {
+    std::vector<SegmentInfo> info;
+    for (const auto& slot : segments) {
+        if (!slot.dropped) {
+            info.push_back({slot.first_row, slot.segment->get_rows(), slot.segment->get_file_size()});
+        }
+    }
+    return info;
+}
@@ -0,0 +1,341 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "history.hpp"
+#include "history_columns.hpp"
+#include "history_segment.hpp"
+
+/**
+ * @brief 二进制的历史记录日志
+ *
+ * 热文件由两部分组成：
+ * - 快照：压缩或重写时整体生成。先是所有条目的正文（连续存放），之后是三个字符串
+ *   字典（模型、系统提示、会话ID）和按列存放的定长字段。加载时各列直接引用只读
+ *   映射中的数组，不解析也不复制，正文只在访问时读取。
+ * - 追加记录：快照之后的新条目，每条是一个带长度和校验和的帧。条目帧用键引用字典
+ *   中的字符串，第一次出现的字符串在条目帧之前写一个字符串帧。
+ *
+ * 新条目只追加这几个帧，不重写整个文件；压缩时先写临时文件再原子rename。
+ * 加载时校验和不符或不完整的尾部帧（崩溃导致）会被截断。
+ *
+ * 较早的条目转存到 <日志路径>.cold/ 下的冷段（见ColdSegment），热文件只保留最近的
+ * 条目，压缩的代价与冷段中的条目数无关。冷段按第一行的记录编号命名，各段与热文件的
+ * 编号首尾相接；整段都已淘汰的冷段直接删除。转存需要压缩正文，由后台线程在没有待写
+ * 记录时进行（request_seal）。
+ *
+ * 多个进程可以同时读写同一份历史。追加、压缩和重写都持有 <日志路径>.lock 上的
+ * 排他flock（锁在单独的文件上，热文件被rename替换时锁不受影响）；发现热文件已被
+ * 其他进程压缩或重写时重新打开。加载和refresh持有共享锁，只读取上次之后新增的帧
+ * （包括本进程后台线程写出的帧），不重新加载整个文件。
+ *
+ * append只把条目放入队列，加锁、检查文件末尾和写入都由后台线程完成：其他进程压缩
+ * 期间聊天循环不会阻塞。后台线程使用自己的追加描述符和锁描述符（flock按打开的文件
+ * 区分持有者，与主线程的锁互斥），同一时间段内的多条记录合并为一次写入和一次
+ * fdatasync。写出的条目在主线程下次读取新增的帧时加入各列，之前不可见
+ * （has_unread()，HistoryManager在查询前等待它们写出并读入）；flush()等待本进程追加的记录全部落盘。
+ */
+class HistoryJournal {
+private:
+    std::string journal_path;
+    int fd;                 // 主线程读取、映射和截断用的文件描述符
+    int lock_fd;            // 主线程持有进程间锁用的描述符，按需打开
+    const char* map_data;   // 日志的只读映射，快照中的列直接引用这里的数据
+    size_t map_size;
+    uint64_t journal_size;  // 已读取到的位置（含映射之后追加的部分）
+    uint64_t store_id;      // 历史存储的编号，重写时重新生成，压缩时保持不变
+    uint64_t base_id;       // 热文件快照第一行的记录编号
+    size_t snapshot_rows;   // 快照中的条目数
+    size_t appended_rows;   // 快照之后追加的条目数
+    size_t hot_row_start;   // 热文件中第一个条目的行号，之前的行都在冷段中
+
+    // 已加载的冷段，按记录编号排列
+    struct Segment {
+        std::unique_ptr<ColdSegment> segment;
+        size_t first_row; // 第一行的行号
+        bool dropped;     // 文件已删除（映射在重新打开之前仍然有效）
+    };
+    std::vector<Segment> segments;
+
+    // 等待后台线程写入的条目：字符串的键在入队时确定，条目帧已经组装好
+    struct Pending {
+        HistoryEntry entry;
+        uint64_t keys[3];
+        std::string frame;
+    };
+    // 后台线程已写出、主线程还没有读到的条目，按所在文件和正文偏移认出
+    struct Written {
+        uint64_t device;
+        uint64_t inode;
+        uint64_t body;
+        HistoryEntry entry;
+    };
+
+    // 后台写线程的状态，均由queue_mutex保护
+    std::thread writer;
+    mutable std::mutex queue_mutex;
+    std::condition_variable queue_cv;  // 有新记录或需要尽快写出
+    std::condition_variable synced_cv; // 一组记录已落盘
+    std::deque<Pending> queued;
+    size_t queued_bytes;
+    uint64_t submitted;                // 本进程入队的条目数
+    uint64_t synced;                   // 其中已写出并fdatasync（或写入失败）的条目数
+    std::vector<Written> written;
+    bool flush_requested;
+    bool stopping;
+    bool seal_requested;               // 有待进行的转存（request_seal）
+    bool sealing;                      // 写线程正在转存
+    uint64_t seal_first_id;            // 转存时最早需要保留的记录编号
+    size_t seal_hot_rows;              // 转存时热文件中至少保留的条目数
+    bool write_failed;                 // 写入失败后拒绝继续追加，直到日志被重新打开
+
+    // 只由后台写线程访问
+    int write_fd;                      // 追加描述符，热文件被替换后重新打开
+    int write_lock_fd;                 // 后台线程持有进程间锁用的描述符
+    uint64_t write_device;
+    uint64_t write_inode;
+    uint64_t write_frames_offset;      // 快照结束的位置
+    uint64_t write_valid_end;          // 在此之前的帧都已校验
+    std::array<std::unordered_set<uint64_t>, 3> write_keys; // 已向当前文件写过字符串帧的键
+
+    // 主线程在读取新增的帧时认出的本进程条目（记录编号, 条目），由take_own_rows取走
+    std::vector<std::pair<uint64_t, HistoryEntry>> own_rows;
+
+    // 打开主线程的文件描述符
+    bool open_descriptor();
+    // 进程间锁文件的描述符，无法打开时返回-1（不加锁）
+    int lock_descriptor();
+    int open_lock_file() const;
+    // 映射日志并加载各列（调用方持有锁）
+    bool load(HistoryColumns& columns);
+    // 映射/解除映射日志文件
+    bool map_journal();
+    void unmap_journal();
+    // 校验快照，加载冷段，并让各列引用映射中的数组；编号已由冷段覆盖的行被跳过，
+    // skip_frames返回同样需要跳过的追加条目数
+    bool load_snapshot(HistoryColumns& columns, uint64_t& frames_offset, uint64_t& skip_frames);
+    // 加载与热文件相接的冷段，next_id返回冷段之后的第一个记录编号
+    bool load_segments(HistoryColumns& columns, uint64_t hot_base_id, uint64_t& next_id);
+    // 解析追加的帧：data是文件中[begin, end)的内容，跳过前skip_entries个条目，
+    // 返回第一个不完整或校验和不符的帧的偏移
+    uint64_t scan_frames(HistoryColumns& columns, const char* data, uint64_t begin, uint64_t end,
+                         uint64_t skip_entries);
+    // 截断valid_end之后崩溃时写了一半的帧（写入都持有排他锁，持有任何锁时看到的都不是正在写入的帧）
+    bool truncate_tail(uint64_t valid_end, uint64_t file_size);
+    // 读取新增的帧；热文件已被替换时重新打开（调用方持有锁）
+    bool catch_up(HistoryColumns& columns, HistoryRefresh& change);
+    // 在快照之后的行中认出后台线程写出的本进程条目
+    void match_own_rows(const HistoryColumns& columns);
+    // 删除所有行都在first_row之前的冷段文件（调用方持有排他锁）
+    void unlink_segments(size_t first_row);
+    // 写入快照并重新打开（调用方持有排他锁）
+    bool write_entries(const std::vector<HistoryEntry>& entries, HistoryColumns& columns);
+    // 组装第row行写入快照或冷段
+    void snapshot_row(const HistoryColumns& columns, size_t row, SnapshotRow& out,
+                      std::string& buffer) const;
+    // 把行写成只含快照的临时文件，然后原子替换日志
+    bool write_snapshot(size_t count, uint64_t first_id, uint64_t store,
+                        const ColdSegment::RowAt& row_at);
+    // 冷段的目录和文件路径
+    std::string segment_directory() const;
+    std::string segment_path(uint64_t first_id) const;
+    // 后台写线程：成组写出并fdatasync入队的记录
+    void write_loop();
+    // 持有排他锁写出一组记录（后台线程）
+    bool write_batch(std::deque<Pending>& batch);
+    // 独立打开日志并转存一次冷段（后台线程），返回是否还有可转存的块
+    bool seal_once(uint64_t first_id, size_t hot_rows);
+    // 让追加描述符指向当前的热文件，并截断崩溃留下的不完整尾部（后台线程，持有排他锁）
+    bool prepare_writer();
+    // 在日志被替换之后重新打开（调用方持有锁）
+    bool reopen(HistoryColumns& columns);
+
+public:
+    /**
+     * @brief 构造函数
+     * @param path 日志文件路径
+     */
+    explicit HistoryJournal(const std::string& path);
+    ~HistoryJournal();
+
+    HistoryJournal(const HistoryJournal&) = delete;
+    HistoryJournal& operator=(const HistoryJournal&) = delete;
+
+    /**
+     * @brief 日志文件是否存在
+     */
+    bool exists() const;
+
+    /**
+     * @brief 映射日志并加载各列，不读取任何正文
+     * @param columns 日志中的全部条目
+     * @return 是否成功打开
+     */
+    bool open(HistoryColumns& columns);
+
+    /**
+     * @brief 获取一行的正文（用户消息、助手回复、请求指标依次相连）
+     * @param columns 日志中的条目
+     * @param row 行号
+     * @param buffer 正文不在映射范围内时使用的缓冲区
+     * @return 正文，读取失败时为空
+     */
+    std::string_view body(const HistoryColumns& columns, size_t row, std::string& buffer) const;
+
+    /**
+     * @brief 读取一行并组装为完整的条目
+     * @param columns 日志中的条目
+     * @param row 行号
+     * @param entry 组装得到的条目
+     * @return 是否成功读取
+     */
+    bool read(const HistoryColumns& columns, size_t row, HistoryEntry& entry) const;
+
+    /**
+     * @brief 读取新追加的条目（其他进程的和本进程后台线程写出的），热文件被其他进程
+     *        压缩或重写时重新打开
+     * @param columns 新条目加入其末尾
+     * @param change 返回读取到的修改
+     * @param wait 等待本进程的记录写出和获得锁的时间上限，为0时只尝试一次；
+     *             拿不到锁时（其他进程正在压缩）不读取，change为Unchanged
+     * @return 是否成功读取
+     */
+    bool refresh(HistoryColumns& columns, HistoryRefresh& change, std::chrono::milliseconds wait);
+
+    /**
+     * @brief 取走最近读取新增的帧时认出的本进程条目
+     * @return (记录编号, 条目)，按记录编号排列
+     */
+    std::vector<std::pair<uint64_t, HistoryEntry>> take_own_rows();
+
+    /**
+     * @brief 追加一个条目：只放入队列，由后台线程加锁写入并fdatasync，不等待文件锁或磁盘
+     *
+     * 字符串字段在这里驻留到columns的字典中；条目本身在下次refresh读到它时才加入各列。
+     * @param entry 历史记录条目
+     * @param columns 日志中的条目
+     * @return 是否成功入队（之前的写入失败时返回false）
+     */
+    bool append(const HistoryEntry& entry, HistoryColumns& columns);
+
+    /**
+     * @brief 本进程追加的条目中是否还有没加入各列的：仍在队列中，或已写出但还没有被refresh读到
+     */
+    bool has_unread() const;
+
+    /**
+     * @brief 等待已入队的记录全部写入并fsync
+     * @param timeout 等待的时间上限
+     * @return 是否全部成功写入（超时也返回false）
+     */
+    bool flush(std::chrono::milliseconds timeout = std::chrono::milliseconds::max());
+
+    /**
+     * @brief 用给定条目重写日志，通过临时文件+rename保证原子性，同时删除全部冷段
+     * @param entries 需要保留的条目
+     * @param columns 重写后的条目
+     * @return 是否成功重写
+     */
+    bool rewrite(const std::vector<HistoryEntry>& entries, HistoryColumns& columns);
+
+    /**
+     * @brief 日志不存在时用给定条目创建；其他进程已经创建时直接打开已有的日志
+     * @param entries 新日志中的条目
+     * @param columns 日志中的条目
+     * @param created 返回是否新建了日志
+     * @return 是否成功
+     */
+    bool create(const std::vector<HistoryEntry>& entries, HistoryColumns& columns, bool& created);
+
+    /**
+     * @brief 压缩时会转存为冷段的行数：超出hot_rows的部分中恰好组成完整块的前若干行，
+     *        每次最多转存固定数量的块，其余的留在热文件中等以后的压缩；这些块的正文
+     *        不足一定大小（远大于一块）时为0，转存要重写整个热文件，块数太少时不值得
+     * @param columns 日志中的条目
+     * @param first_row 最早需要保留的行
+     * @param hot_rows 热文件中至少保留的条目数
+     */
+    size_t sealable_rows(const HistoryColumns& columns, size_t first_row, size_t hot_rows) const;
+
+    /**
+     * @brief 压缩日志：丢弃first_row之前的条目，超出hot_rows的部分中已组成完整块的
+     *        条目（见sealable_rows）转存为新的冷段，已有的冷段不变；正文直接拷贝而不重新组装
+     * @param columns 日志中的条目，压缩后重新加载（记录编号不变，行号会改变）
+     * @param first_row 最早需要保留的行
+     * @param hot_rows 热文件中至少保留的条目数
+     * @param change 返回压缩前发现的其他进程的修改；为Reloaded时其他进程刚压缩过，本次不再压缩
+     * @return 是否成功压缩
+     */
+    bool compact(HistoryColumns& columns, size_t first_row, size_t hot_rows, HistoryRefresh& change);
+
+    /**
+     * @brief 请后台写线程把热文件中较早的条目转存为冷段，不等待
+     *
+     * 写线程在没有待写的记录时独立打开日志并压缩（与另一个进程压缩相同，主线程下次
+     * 读取时发现热文件已被替换并重新打开），每次转存的块数有上限，重复进行直到
+     * sealable_rows为0；转存期间入队的记录在这一次转存之后写出。析构时只等待正在
+     * 进行的一次转存。
+     * @param first_id 最早需要保留的记录编号
+     * @param hot_rows 热文件中至少保留的条目数
+     */
+    void request_seal(uint64_t first_id, size_t hot_rows);
+
+    /**
+     * @brief 是否有已请求或正在进行的转存
+     */
+    bool is_sealing() const;
+
+    /**
+     * @brief 删除所有行都在first_row之前的冷段文件，已加载的数据在重新打开前仍可访问
+     */
+    void drop_segments(size_t first_row);
+
+    /**
+     * @brief 冷段的信息，按记录编号排列（不含已删除的）
+     */
+    struct SegmentInfo {
+        size_t first_row; // 第一行的行号
+        size_t rows;      // 行数
+        uint64_t bytes;   // 文件大小
+    };
+    std::vector<SegmentInfo> get_segments() const;
+
+    /**
+     * @brief 热文件中第一个条目的行号，之前的行都在冷段中
+     */
+    size_t get_hot_row_start() const { return hot_row_start; }
+
+    /**
+     * @brief 快照之后追加的条目数，过多时应压缩以保持加载速度
+     */
+    size_t get_appended_count() const { return appended_rows; }
+
+    /**
+     * @brief 获取历史存储的编号，历史被重写后会改变，压缩时保持不变
+     * @return 存储编号
+     */
+    uint64_t get_store_id() const { return store_id; }
+
+    /**
+     * @brief 获取日志文件路径
+     * @return 日志文件路径
+     */
+    const std::string& get_path() const { return journal_path; }
+
+    /**
+     * @brief 将请求指标序列化为紧凑的JSON（为空时返回空串）
+     * @param metrics 请求指标
+     * @return 序列化后的文本
+     */
+    static std::string serialize_metrics(const Json::Value& metrics);
+};
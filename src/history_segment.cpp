@@ -0,0 +1,548 @@
+#include "history_segment.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace history_io {
+
+bool write_all(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = ::write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        length -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+bool pread_all(int fd, char* data, size_t length, uint64_t offset) {
+    while (length > 0) {
+        ssize_t n = ::pread(fd, data, length, static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        length -= static_cast<size_t>(n);
+        offset += static_cast<uint64_t>(n);
+    }
+    return true;
+}
+
+void sync_parent_directory(const std::string& path) {
+    std::string dir = std::filesystem::path(path).parent_path().string();
+    if (dir.empty()) {
+        dir = ".";
+    }
+    int dir_fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dir_fd >= 0) {
+        ::fsync(dir_fd);
+        ::close(dir_fd);
+    }
+}
+
+uint32_t checksum(const char* data, size_t length) {
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * 16777619u;
+    }
+    return hash;
+}
+
+} // namespace history_io
+
+void SnapshotWriter::write(const void* data, size_t length) {
+    buffer.append(static_cast<const char*>(data), length);
+    position += length;
+    if (buffer.size() >= (1 << 20)) {
+        drain();
+    }
+}
+
+void SnapshotWriter::align() {
+    static const char zeros[8] = {};
+    write(zeros, (8 - position % 8) % 8);
+}
+
+bool SnapshotWriter::drain() {
+    ok = ok && history_io::write_all(fd, buffer.data(), buffer.size());
+    buffer.clear();
+    return ok;
+}
+
+void HistoryTables::add(const SnapshotRow& row, uint64_t body) {
+    timestamps.push_back(row.timestamp);
+    bodies.push_back(body);
+    lengths[0].push_back(static_cast<uint32_t>(row.user.size()));
+    lengths[1].push_back(static_cast<uint32_t>(row.assistant.size()));
+    lengths[2].push_back(static_cast<uint32_t>(row.metrics.size()));
+    std::string_view values[3] = {row.model, row.prompt, row.session};
+    for (size_t d = 0; d < 3; ++d) {
+        ids[d].push_back(dictionaries[d].intern(values[d]));
+    }
+    turn_numbers.push_back(row.turn_number);
+}
+
+void HistoryTables::write(SnapshotWriter& out, uint64_t dictionary_offsets[3],
+                          uint64_t& columns) const {
+    for (size_t d = 0; d < 3; ++d) {
+        out.align();
+        dictionary_offsets[d] = out.offset();
+        uint64_t size = dictionaries[d].size();
+        out.write(&size, sizeof(size));
+        for (uint32_t id = 0; id < size; ++id) {
+            uint64_t key = dictionaries[d].key_at(id);
+            out.write(&key, sizeof(key));
+        }
+        uint32_t start = 0;
+        out.write(&start, sizeof(start));
+        for (uint32_t id = 0; id < size; ++id) {
+            start += static_cast<uint32_t>(dictionaries[d].at(id).size());
+            out.write(&start, sizeof(start));
+        }
+        for (uint32_t id = 0; id < size; ++id) {
+            out.write(dictionaries[d].at(id));
+        }
+    }
+
+    out.align();
+    columns = out.offset();
+    out.write_array(timestamps);
+    out.write_array(bodies);
+    for (const auto& column : lengths) {
+        out.write_array(column);
+    }
+    for (const auto& column : ids) {
+        out.write_array(column);
+    }
+    out.write_array(turn_numbers);
+}
+
+bool HistoryTables::load_dictionaries(const char* base, uint64_t limit, const uint64_t offsets[3],
+                                      HistoryColumns& columns, std::vector<uint32_t> ids[3]) {
+    StringDictionary* dictionaries[3] = {&columns.models, &columns.prompts, &columns.sessions};
+    for (size_t d = 0; d < 3; ++d) {
+        uint64_t offset = offsets[d];
+        uint64_t count = 0;
+        if (offset % 8 != 0 || offset + sizeof(count) > limit) {
+            return false;
+        }
+        std::memcpy(&count, base + offset, sizeof(count));
+        if (count > limit / 12) {
+            return false;
+        }
+        const char* keys = base + offset + sizeof(count);
+        const char* starts = keys + count * sizeof(uint64_t);
+        const char* text = starts + (count + 1) * sizeof(uint32_t);
+        if (text > base + limit) {
+            return false;
+        }
+        ids[d].clear();
+        ids[d].reserve(count);
+        for (uint64_t i = 0; i < count; ++i) {
+            uint64_t key = 0;
+            uint32_t begin = 0;
+            uint32_t end = 0;
+            std::memcpy(&key, keys + i * sizeof(uint64_t), sizeof(key));
+            std::memcpy(&begin, starts + i * sizeof(uint32_t), sizeof(begin));
+            std::memcpy(&end, starts + (i + 1) * sizeof(uint32_t), sizeof(end));
+            if (begin > end || text + end > base + limit) {
+                return false;
+            }
+            ids[d].push_back(dictionaries[d]->intern(key, std::string_view(text + begin, end - begin)));
+        }
+    }
+    return true;
+}
+
+bool HistoryTables::map_columns(const char* base, uint64_t limit, uint64_t offset, uint64_t rows,
+                                uint64_t skip, const std::vector<uint32_t> ids[3],
+                                HistoryColumns& columns) {
+    if (offset % 8 != 0 || offset > limit || rows > (limit - offset) / kRowBytes || skip > rows) {
+        return false;
+    }
+    size_t count = static_cast<size_t>(rows - skip);
+    const char* cursor = base + offset;
+    auto next = [&cursor, rows, skip, count](auto& column) {
+        using T = std::remove_reference_t<decltype(column[0])>;
+        column.map(reinterpret_cast<const T*>(cursor) + skip, count);
+        cursor += rows * sizeof(T);
+    };
+    next(columns.timestamps);
+    next(columns.bodies);
+    next(columns.user_lengths);
+    next(columns.assistant_lengths);
+    next(columns.metrics_lengths);
+
+    // 字典ID：文件中的编号与内存中的一致时直接引用，否则转换后保存在内存中
+    Column<uint32_t>* id_columns[3] = {&columns.model_ids, &columns.prompt_ids, &columns.session_ids};
+    for (size_t d = 0; d < 3; ++d) {
+        const uint32_t* source = reinterpret_cast<const uint32_t*>(cursor) + skip;
+        bool identity = true;
+        for (uint32_t i = 0; i < ids[d].size() && identity; ++i) {
+            identity = ids[d][i] == i;
+        }
+        if (identity) {
+            id_columns[d]->map(source, count);
+        } else {
+            std::vector<uint32_t> translated(count);
+            for (size_t i = 0; i < count; ++i) {
+                translated[i] = source[i] < ids[d].size() ? ids[d][source[i]] : UINT32_MAX;
+            }
+            id_columns[d]->adopt(std::move(translated));
+        }
+        cursor += rows * sizeof(uint32_t);
+    }
+    next(columns.turn_numbers);
+    return true;
+}
+
+// 冷段文件头：之后依次是预置字典、压缩块、块表、字典区和列区
+struct ColdSegmentHeader {
+    char magic[4];            // "GFC1"
+    uint32_t version;         // 格式版本
+    uint64_t rows;            // 行数
+    uint64_t base_id;         // 第一行的记录编号
+    uint64_t dictionaries[3]; // 模型、系统提示、会话ID字典的偏移
+    uint64_t columns;         // 列区的偏移
+    uint64_t blocks;          // 块表的偏移
+    uint64_t block_count;
+    uint64_t zdict;           // 预置字典的偏移
+    uint64_t zdict_size;
+    uint64_t raw_bytes;       // 解压后的正文总长
+};
+
+// 块表的一项：一块只包含完整的若干行正文
+struct ColdBlock {
+    uint64_t raw_start; // 块中第一个字节在正文流中的偏移
+    uint64_t offset;    // 压缩数据在文件中的偏移
+    uint32_t size;      // 压缩后的长度
+    uint32_t raw_size;  // 解压后的长度
+};
+
+static const uint32_t kSegmentVersion = 1;
+static const size_t kDictionaryBytes = 32 * 1024;  // zlib预置字典最多使用32KB
+static const size_t kMinDictionaryBytes = 1024;    // 更小的字典不值得保存
+static const int kCompressionLevel = 6; // zlib的默认级别：更低的级别压缩比明显下降，更高的级别收益很小
+static const size_t kSampleRows = 256;             // 训练字典时最多采样的行数
+static const size_t kSampleBytes = 4 * 1024;       // 每行最多采样的字节数
+
+std::string ColdSegment::train_dictionary(const std::vector<std::string>& samples, size_t capacity) {
+    static const size_t kSegment = 48; // 候选片段长度
+    static const size_t kDmer = 8;     // 计算频率的子串长度
+    std::string all;
+    for (const auto& sample : samples) {
+        all += sample;
+    }
+    if (all.size() <= capacity) {
+        return all;
+    }
+
+    // 统计每个8字节子串出现的次数（按哈希计数，冲突只会稍微高估）
+    static const unsigned kHashBits = 20;
+    std::vector<uint32_t> frequency(size_t(1) << kHashBits);
+    auto dmer = [&all](size_t pos) {
+        uint64_t value = 0;
+        std::memcpy(&value, all.data() + pos, kDmer);
+        return static_cast<size_t>((value * 0x9E3779B97F4A7C15ull) >> (64 - kHashBits));
+    };
+    for (size_t pos = 0; pos + kDmer <= all.size(); ++pos) {
+        frequency[dmer(pos)]++;
+    }
+
+    // 把样本分成若干段，每段选出子串频率之和最高的片段，选中后其子串计数清零以免重复
+    size_t epochs = std::max<size_t>(1, capacity / kSegment);
+    size_t epoch_size = all.size() / epochs;
+    std::vector<std::pair<uint64_t, size_t>> chosen; // (得分, 起点)
+    for (size_t e = 0; e < epochs && epoch_size >= kSegment; ++e) {
+        size_t begin = e * epoch_size;
+        size_t end = std::min(all.size(), begin + epoch_size);
+        uint64_t score = 0;
+        for (size_t pos = begin; pos + kDmer <= begin + kSegment; ++pos) {
+            score += frequency[dmer(pos)];
+        }
+        uint64_t best = score;
+        size_t best_pos = begin;
+        for (size_t pos = begin + 1; pos + kSegment <= end; ++pos) {
+            score -= frequency[dmer(pos - 1)];
+            score += frequency[dmer(pos + kSegment - kDmer)];
+            if (score > best) {
+                best = score;
+                best_pos = pos;
+            }
+        }
+        if (best <= kSegment - kDmer + 1) {
+            continue; // 片段中的子串都只出现一次，不值得放进字典
+        }
+        chosen.push_back({best, best_pos});
+        for (size_t pos = best_pos; pos + kDmer <= best_pos + kSegment; ++pos) {
+            frequency[dmer(pos)] = 0;
+        }
+    }
+
+    // 得分越高越靠后：zlib引用较近的内容更省空间
+    std::sort(chosen.begin(), chosen.end());
+    std::string dictionary;
+    for (const auto& segment : chosen) {
+        dictionary.append(all, segment.second, kSegment);
+    }
+    if (dictionary.size() > capacity) {
+        dictionary.erase(0, dictionary.size() - capacity);
+    }
+    return dictionary;
+}
+
+size_t ColdSegment::full_block_rows(size_t count, const RowBytes& row_bytes, size_t max_blocks) {
+    size_t full = 0;
+    size_t blocks = 0;
+    uint64_t raw = 0;
+    for (size_t i = 0; i < count && blocks < max_blocks; ++i) {
+        raw += row_bytes(i);
+        if (raw >= kBlockBytes) {
+            blocks++;
+            full = i + 1;
+            raw = 0;
+        }
+    }
+    return full;
+}
+
+bool ColdSegment::write(const std::string& path, uint64_t base_id, size_t count, const RowAt& row_at,
+                        std::string_view previous_dictionary) {
+    SnapshotRow row;
+    std::string dictionary(previous_dictionary);
+    if (dictionary.empty()) {
+        // 均匀采样一部分正文训练预置字典
+        // 字典保存在段内，大小不超过正文总长（按样本估算）的1/16，较小的段不使用字典
+        std::vector<std::string> samples;
+        uint64_t sampled_bytes = 0;
+        size_t step = std::max<size_t>(1, count / kSampleRows);
+        for (size_t i = 0; i < count; i += step) {
+            row = SnapshotRow();
+            row_at(i, row);
+            sampled_bytes += row.user.size() + row.assistant.size() + row.metrics.size();
+            std::string sample(row.user.substr(0, kSampleBytes / 4));
+            sample.append(row.assistant.substr(0, kSampleBytes - sample.size()));
+            samples.push_back(std::move(sample));
+        }
+        uint64_t estimated_bytes = samples.empty() ? 0 : sampled_bytes * count / samples.size();
+        size_t capacity = static_cast<size_t>(std::min<uint64_t>(kDictionaryBytes, estimated_bytes / 16));
+        if (capacity >= kMinDictionaryBytes) {
+            dictionary = train_dictionary(samples, capacity);
+        }
+    }
+
+    std::string temp_path = path + ".tmp";
+    int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cerr << "Error: Cannot open history segment for writing: " << temp_path << std::endl;
+        return false;
+    }
+    ColdSegmentHeader header{};
+    std::memcpy(header.magic, "GFC1", 4);
+    header.version = kSegmentVersion;
+    header.rows = count;
+    header.base_id = base_id;
+
+    SnapshotWriter out(fd);
+    out.write(&header, sizeof(header)); // 占位，最后再写入真正的文件头
+    header.zdict = out.offset();
+    header.zdict_size = dictionary.size();
+    out.write(dictionary);
+
+    std::vector<ColdBlock> table;
+    std::string raw;
+    std::string compressed;
+    bool ok = true;
+    auto compress_block = [&]() {
+        if (raw.empty() || !ok) {
+            return;
+        }
+        z_stream stream{};
+        ok = deflateInit(&stream, kCompressionLevel) == Z_OK;
+        if (!ok) {
+            return;
+        }
+        if (!dictionary.empty()) {
+            deflateSetDictionary(&stream, reinterpret_cast<const Bytef*>(dictionary.data()),
+                                 static_cast<uInt>(dictionary.size()));
+        }
+        compressed.resize(deflateBound(&stream, static_cast<uLong>(raw.size())));
+        stream.next_in = reinterpret_cast<Bytef*>(&raw[0]);
+        stream.avail_in = static_cast<uInt>(raw.size());
+        stream.next_out = reinterpret_cast<Bytef*>(&compressed[0]);
+        stream.avail_out = static_cast<uInt>(compressed.size());
+        ok = deflate(&stream, Z_FINISH) == Z_STREAM_END;
+        size_t size = stream.total_out;
+        deflateEnd(&stream);
+        if (ok) {
+            table.push_back({header.raw_bytes, out.offset(), static_cast<uint32_t>(size),
+                             static_cast<uint32_t>(raw.size())});
+            out.write(compressed.data(), size);
+            header.raw_bytes += raw.size();
+        }
+        raw.clear();
+    };
+
+    HistoryTables tables;
+    for (size_t i = 0; i < count; ++i) {
+        row = SnapshotRow();
+        row_at(i, row);
+        tables.add(row, header.raw_bytes + raw.size());
+        raw.append(row.user.data(), row.user.size());
+        raw.append(row.assistant.data(), row.assistant.size());
+        raw.append(row.metrics.data(), row.metrics.size());
+        if (raw.size() >= kBlockBytes) {
+            compress_block();
+        }
+    }
+    compress_block();
+
+    out.align();
+    header.blocks = out.offset();
+    header.block_count = table.size();
+    out.write_array(table);
+    tables.write(out, header.dictionaries, header.columns);
+
+    ok = ok && out.drain() &&
+         ::pwrite(fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header)) &&
+         ::fsync(fd) == 0;
+    ::close(fd);
+    if (!ok || ::rename(temp_path.c_str(), path.c_str()) != 0) {
+        std::cerr << "Error: Failed to write history segment: " << path << std::endl;
+        ::unlink(temp_path.c_str());
+        return false;
+    }
+    history_io::sync_parent_directory(path);
+    return true;
+}
+
+bool ColdSegment::peek(const std::string& path, uint64_t& base_id, uint64_t& rows) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    ColdSegmentHeader header;
+    bool ok = history_io::pread_all(fd, reinterpret_cast<char*>(&header), sizeof(header), 0) &&
+              std::memcmp(header.magic, "GFC1", 4) == 0 && header.version == kSegmentVersion;
+    ::close(fd);
+    if (ok) {
+        base_id = header.base_id;
+        rows = header.rows;
+    }
+    return ok;
+}
+
+ColdSegment::ColdSegment(const std::string& path) : path(path) {}
+
+ColdSegment::~ColdSegment() {
+    if (map_data) {
+        ::munmap(const_cast<char*>(map_data), map_size);
+    }
+}
+
+bool ColdSegment::open(HistoryColumns& columns) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(ColdSegmentHeader)) {
+        ::close(fd);
+        return false;
+    }
+    void* mapped = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd); // 映射在关闭描述符后仍然有效
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    map_data = static_cast<const char*>(mapped);
+    map_size = static_cast<size_t>(st.st_size);
+
+    ColdSegmentHeader header;
+    std::memcpy(&header, map_data, sizeof(header));
+    if (std::memcmp(header.magic, "GFC1", 4) != 0 || header.version != kSegmentVersion ||
+        header.zdict + header.zdict_size > map_size || header.blocks % 8 != 0 ||
+        header.blocks > map_size ||
+        header.block_count > (map_size - header.blocks) / sizeof(ColdBlock) ||
+        header.columns > map_size) {
+        return false;
+    }
+    dictionary = std::string_view(map_data + header.zdict, header.zdict_size);
+    blocks = map_data + header.blocks;
+    block_count = static_cast<size_t>(header.block_count);
+    base_id = header.base_id;
+    rows = static_cast<size_t>(header.rows);
+
+    std::vector<uint32_t> ids[3];
+    return HistoryTables::load_dictionaries(map_data, header.columns, header.dictionaries, columns, ids) &&
+           HistoryTables::map_columns(map_data, map_size, header.columns, header.rows, 0, ids, columns);
+}
+
+bool ColdSegment::read(uint64_t offset, uint64_t length, std::string& out) const {
+    // 块表按raw_start递增，找到最后一个起点不大于offset的块
+    size_t low = 0;
+    size_t high = block_count;
+    ColdBlock block;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        std::memcpy(&block, blocks + middle * sizeof(ColdBlock), sizeof(block));
+        if (block.raw_start <= offset) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low == 0) {
+        return false;
+    }
+    size_t index = low - 1;
+    std::memcpy(&block, blocks + index * sizeof(ColdBlock), sizeof(block));
+    if (offset - block.raw_start + length > block.raw_size ||
+        block.offset + block.size > map_size) {
+        return false;
+    }
+
+    if (cached_block != index) {
+        cached_block = SIZE_MAX;
+        cache.resize(block.raw_size);
+        z_stream stream{};
+        if (inflateInit(&stream) != Z_OK) {
+            return false;
+        }
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(map_data + block.offset));
+        stream.avail_in = block.size;
+        stream.next_out = reinterpret_cast<Bytef*>(&cache[0]);
+        stream.avail_out = block.raw_size;
+        int status = inflate(&stream, Z_FINISH);
+        if (status == Z_NEED_DICT) {
+            inflateSetDictionary(&stream, reinterpret_cast<const Bytef*>(dictionary.data()),
+                                 static_cast<uInt>(dictionary.size()));
+            status = inflate(&stream, Z_FINISH);
+        }
+        bool ok = status == Z_STREAM_END && stream.total_out == block.raw_size;
+        inflateEnd(&stream);
+        if (!ok) {
+            std::cerr << "Warning: Corrupt block in history segment: " << path << std::endl;
+            return false;
+        }
+        cached_block = index;
+    }
+    out.assign(cache, static_cast<size_t>(offset - block.raw_start), static_cast<size_t>(length));
+    return true;
+}
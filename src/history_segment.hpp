@@ -0,0 +1,199 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "history_columns.hpp"
+
+// 历史文件共用的底层读写
+namespace history_io {
+// 写出全部数据，处理EINTR和部分写入
+bool write_all(int fd, const char* data, size_t length);
+// 从指定偏移读取全部数据
+bool pread_all(int fd, char* data, size_t length, uint64_t offset);
+// rename之后fsync所在目录，确保目录项持久化
+void sync_parent_directory(const std::string& path);
+// FNV-1a校验和
+uint32_t checksum(const char* data, size_t length);
+} // namespace history_io
+
+/**
+ * @brief 写入快照或冷段时的一行，字符串字段和正文都只是引用
+ */
+struct SnapshotRow {
+    int64_t timestamp = 0;
+    std::string_view model;
+    std::string_view prompt;
+    std::string_view session;
+    int32_t turn_number = 0;
+    std::string_view user;
+    std::string_view assistant;
+    std::string_view metrics;
+};
+
+/**
+ * @brief 带缓冲的顺序写入，记录当前偏移
+ */
+class SnapshotWriter {
+public:
+    explicit SnapshotWriter(int fd) : fd(fd) {}
+
+    void write(const void* data, size_t length);
+    void write(std::string_view data) { write(data.data(), data.size()); }
+    template <typename T>
+    void write_array(const std::vector<T>& values) {
+        write(values.data(), values.size() * sizeof(T));
+    }
+    // 补齐到8字节边界，使映射后的数组按类型对齐
+    void align();
+    bool drain();
+    uint64_t offset() const { return position; }
+
+private:
+    int fd;
+    std::string buffer;
+    uint64_t position = 0;
+    bool ok = true;
+};
+
+/**
+ * @brief 快照和冷段共用的字典区和列区
+ *
+ * 字典：uint64_t 个数，uint64_t 键[个数]，uint32_t 起点[个数+1]，字符串内容。
+ * 列区依次是：int64_t 时间戳、uint64_t 正文偏移、uint32_t 用户消息/助手回复/指标长度、
+ * uint32_t 模型/系统提示/会话ID、int32_t 轮次，每列rows个。
+ */
+class HistoryTables {
+public:
+    static const size_t kRowBytes = 8 + 8 + 4 * 3 + 4 * 3 + 4;
+
+    /**
+     * @brief 加入一行，body为它的正文在文件（或冷段的正文流）中的偏移
+     */
+    void add(const SnapshotRow& row, uint64_t body);
+
+    size_t rows() const { return timestamps.size(); }
+
+    /**
+     * @brief 写出三个字典和列区
+     * @param dictionaries 返回各字典的偏移
+     * @param columns 返回列区的偏移
+     */
+    void write(SnapshotWriter& out, uint64_t dictionaries[3], uint64_t& columns) const;
+
+    /**
+     * @brief 读取三个字典，把其中的字符串驻留到columns的字典中
+     * @param base 文件映射
+     * @param limit 字典区不能超过的偏移
+     * @param offsets 各字典的偏移
+     * @param ids 返回 文件中的ID -> columns中的ID
+     */
+    static bool load_dictionaries(const char* base, uint64_t limit, const uint64_t offsets[3],
+                                  HistoryColumns& columns, std::vector<uint32_t> ids[3]);
+
+    /**
+     * @brief 把列区中第skip行之后的各列加入columns
+     *
+     * 定长字段直接引用映射；字典ID按ids转换，转换是恒等时同样直接引用映射。
+     */
+    static bool map_columns(const char* base, uint64_t limit, uint64_t offset, uint64_t rows,
+                            uint64_t skip, const std::vector<uint32_t> ids[3],
+                            HistoryColumns& columns);
+
+private:
+    StringDictionary dictionaries[3];
+    std::vector<int64_t> timestamps;
+    std::vector<uint64_t> bodies;
+    std::vector<uint32_t> lengths[3];
+    std::vector<uint32_t> ids[3];
+    std::vector<int32_t> turn_numbers;
+};
+
+/**
+ * @brief 压缩的冷段：一段较早的历史，写入后不再修改
+ *
+ * 正文按约64KB分块，每块用zlib独立压缩，读取一条记录只需解压它所在的块；
+ * 第一个冷段从正文中采样训练一个预置字典（保存在段内），之后的冷段沿用上一段的
+ * 字典，使较小的块也能利用各条记录之间重复的内容。字典区和列区不压缩，加载时与
+ * 热文件一样直接映射。
+ */
+class ColdSegment {
+public:
+    using RowAt = std::function<void(size_t, SnapshotRow&)>;
+    using RowBytes = std::function<uint64_t(size_t)>;
+
+    static const size_t kBlockBytes = 64 * 1024; // 每块正文的目标大小
+
+    /**
+     * @brief 把count行写成新的冷段（先写临时文件再rename）
+     * @param path 冷段文件路径
+     * @param base_id 第一行的记录编号
+     * @param count 行数
+     * @param row_at 第i行的内容，返回的引用在下一次调用前有效
+     * @param dictionary 预置字典（通常取自上一个冷段），为空时从这些行中采样训练
+     */
+    static bool write(const std::string& path, uint64_t base_id, size_t count, const RowAt& row_at,
+                      std::string_view dictionary = std::string_view());
+
+    /**
+     * @brief 前多少行恰好组成完整的块（写入时按同样的规则分块）
+     * @param count 候选的行数
+     * @param row_bytes 第i行正文的字节数
+     * @param max_blocks 最多的块数
+     * @return 行数，不足一个完整的块时为0
+     */
+    static size_t full_block_rows(size_t count, const RowBytes& row_bytes, size_t max_blocks);
+
+    /**
+     * @brief 读取冷段文件头，得到第一行的记录编号和行数
+     * @return 是否是有效的冷段
+     */
+    static bool peek(const std::string& path, uint64_t& base_id, uint64_t& rows);
+
+    explicit ColdSegment(const std::string& path);
+    ~ColdSegment();
+
+    ColdSegment(const ColdSegment&) = delete;
+    ColdSegment& operator=(const ColdSegment&) = delete;
+
+    /**
+     * @brief 映射冷段，把字典驻留到columns中并加入各列
+     */
+    bool open(HistoryColumns& columns);
+
+    /**
+     * @brief 读取正文流中的一段（解压它所在的块，最近的块会被缓存）
+     * @param offset 正文偏移
+     * @param length 长度
+     * @param out 读取的内容
+     * @return 是否成功
+     */
+    bool read(uint64_t offset, uint64_t length, std::string& out) const;
+
+    const std::string& get_path() const { return path; }
+    uint64_t get_base_id() const { return base_id; }
+    size_t get_rows() const { return rows; }
+    uint64_t get_file_size() const { return map_size; }
+    std::string_view get_dictionary() const { return dictionary; }
+
+    /**
+     * @brief 从样本中选出最常重复的片段组成预置字典（简化的COVER算法）
+     * @param samples 样本
+     * @param capacity 字典大小上限
+     * @return 字典内容，重复次数越多的片段越靠后（离压缩数据越近）
+     */
+    static std::string train_dictionary(const std::vector<std::string>& samples, size_t capacity);
+
+private:
+    std::string path;
+    const char* map_data = nullptr;
+    size_t map_size = 0;
+    uint64_t base_id = 0;
+    size_t rows = 0;
+    const char* blocks = nullptr;       // 块表
+    size_t block_count = 0;
+    std::string_view dictionary;        // 预置字典
+    mutable size_t cached_block = SIZE_MAX;
+    mutable std::string cache;          // 最近解压的块
+};
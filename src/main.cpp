@@ -5,6 +5,7 @@
 #include <curl/curl.h>
 #include <json/value.h>
 #include "deepseek.hpp"
+#include "batch_runner.hpp"
 #include "config.hpp"
 #include "history.hpp"
 #include "global_manager.hpp"
@@ -12,72 +13,153 @@
 #include <readline/history.h>
 #include <unistd.h>
 #include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
 #include <signal.h>
 #include <atomic>
 #include <thread>
 #include <chrono>
+#include <iomanip>
 
-// 信号处理函数 - 优化被打断时的历史保存
+// 收到中断信号后，保存和退出必须在这个时间内完成，否则强制退出
+static const unsigned kShutdownTimeoutSeconds = 3;
+
+// 信号处理函数：只设置原子标志并写自管道唤醒事件循环，
+// 取消请求、保存部分回复和写盘都由主线程完成
 void signal_handler(int signal) {
-    if (signal == SIGINT || signal == SIGTERM) {
-        GlobalManager& gm = GlobalManager::getInstance();
-        gm.setRunning(false);
-        gm.setInterruptStream(true);
-        
-        // 静默中断当前操作
-        rl_done = 1;
-        
-        // 给程序一点时间自然退出
-        std::this_thread::sleep_for(std::chrono::milliseconds(50));
-        
-        // 保存未完成的对话
-        gm.saveCurrentState();
-        
-        // 静默保存数据并退出
-        
-        // 安静退出，只显示简单的告别
-        std::cout << "\n" << std::endl;
-        std::exit(0);
+    GlobalManager& gm = GlobalManager::getInstance();
+    if (gm.isInterrupted()) {
+        // 第二次中断：不再等待保存，立即退出
+        _exit(128 + signal);
     }
+    gm.notifyInterrupt();
+    // 兜底：保存卡住时由SIGALRM强制退出，保证Ctrl+C到退出的时间有上界
+    alarm(kShutdownTimeoutSeconds);
+}
+
+void shutdown_timeout_handler(int) {
+    static const char message[] = "\nShutdown timed out, exiting without saving.\n";
+    ssize_t ignored = write(STDERR_FILENO, message, sizeof(message) - 1);
+    (void)ignored;
+    _exit(130);
+}
+
+// 不带SA_RESTART安装信号处理函数，阻塞中的读取会以EINTR返回
+void install_signal_handler(int signal, void (*handler)(int)) {
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = handler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = 0;
+    sigaction(signal, &action, nullptr);
 }
 
 // 自定义readline信号处理
 void setup_readline_signals() {
-    // 让readline处理信号，但我们仍然可以捕获它们
-    rl_catch_signals = 1;
+    // 信号由我们自己处理，readline不再安装SIGINT等处理函数
+    rl_catch_signals = 0;
     rl_catch_sigwinch = 1;
 }
 
-// 安全的readline函数，能够正确处理信号中断
+// readline回调接口读到完整一行（或EOF）时的结果
+static char* completed_line = nullptr;
+static bool line_completed = false;
+
+static void on_line_completed(char* line) {
+    completed_line = line;
+    line_completed = true;
+    rl_callback_handler_remove();
+}
+
+// 安全的readline函数：同时等待终端输入和中断自管道，中断时立即返回
 char* safe_readline(const char* prompt) {
-    char* line = nullptr;
+    GlobalManager& gm = GlobalManager::getInstance();
+    completed_line = nullptr;
+    line_completed = false;
+    rl_callback_handler_install(prompt, on_line_completed);
     
-    while (GlobalManager::getInstance().isRunning()) {
-        line = readline(prompt);
-        
-        // 如果readline返回NULL，可能是因为EOF或信号中断
-        if (!line) {
-            if (!GlobalManager::getInstance().isRunning()) {
-                // 被信号中断
-                break;
+    struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {gm.getInterruptFd(), POLLIN, 0}};
+    nfds_t count = gm.getInterruptFd() >= 0 ? 2 : 1;
+    while (!line_completed && gm.isRunning()) {
+        if (poll(fds, count, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
             }
-            // EOF情况，用户按了Ctrl+D
             break;
         }
-        
-        // 正常获得输入
-        return line;
+        if (count > 1 && (fds[1].revents & POLLIN)) {
+            break; // 被信号中断
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            rl_callback_read_char();
+        }
     }
     
-    return nullptr;
+    if (!line_completed) {
+        // 被中断：恢复终端状态，返回NULL
+        rl_callback_handler_remove();
+        return nullptr;
+    }
+    // 正常获得输入，或EOF（用户按了Ctrl+D）时为NULL
+    return completed_line;
 }
+
+// 解析--since/--until/--day，收窄时间范围[since, until)；只写日期时--until包含当天
+static bool parse_time_option(const arg_parser& parser, const std::string& option,
+                              int64_t& since, int64_t& until) {
+    if (!parser.has_option(option)) {
+        return true;
+    }
+    std::string text = parser.get_option_value(option);
+    int64_t time = 0;
+    if (!parse_history_timestamp(text, time)) {
+        std::cerr << "Invalid time for " << option << ": '" << text
+                  << "'. Use YYYY-MM-DD or YYYY-MM-DD HH:MM[:SS]." << std::endl;
+        return false;
+    }
+    bool date_only = text.find(':') == std::string::npos;
+    if (option == "--until") {
+        until = std::min(until, date_only ? history_day_start(time, 1) : time);
+    } else {
+        since = std::max(since, time);
+        if (option == "--day") {
+            until = std::min(until, history_day_start(time, 1));
+        }
+    }
+    return true;
+}
+
+// 批处理同时进行的请求数上限
+static const long kMaxBatchConcurrency = 256;
+
+// 解析取值在[min_value, max_value]之间的整数选项，负数和非数字都按用法错误报告
+static bool parse_count_option(const arg_parser& parser, const std::string& option,
+                               long min_value, long max_value, long& value) {
+    std::string text = parser.get_option_value(option);
+    size_t used = 0;
+    try {
+        value = std::stol(text, &used);
+    } catch (const std::exception&) {
+        used = 0;
+    }
+    if (used == 0 || used != text.size() || value < min_value || value > max_value) {
+        std::cerr << "Invalid value for " << option << ": '" << text
+                  << "'. Use an integer from " << min_value << " to " << max_value << "." << std::endl;
+        return false;
+    }
+    return true;
+}
+
 int main(int argc,char** argv){
     // 设置readline信号处理
     setup_readline_signals();
     
     // 注册信号处理器
-    signal(SIGINT, signal_handler);   // Ctrl+C
-    signal(SIGTERM, signal_handler);  // 终止信号
+    GlobalManager::getInstance().initInterruptPipe();
+    install_signal_handler(SIGINT, signal_handler);   // Ctrl+C
+    install_signal_handler(SIGTERM, signal_handler);  // 终止信号
+    install_signal_handler(SIGALRM, shutdown_timeout_handler);
     
     arg_parser parser(argc, argv);
     auto positional_args = parser.get_positional_args();
@@ -88,12 +170,28 @@ int main(int argc,char** argv){
         std::cout << "  -v|--version                Show version information\n";
         std::cout << "  -s|--stream [on|off]        Enable streaming mode or not,default to on\n";
         std::cout << "  -c|--config <path>          Specify configuration file path\n";
-        std::cout << "  --history [show|clear|search|sessions] History management commands\n";
+        std::cout << "  --history [show|clear|search|sessions|days|export|import] History management commands\n";
         std::cout << "  --history-count <num>       Number of history entries to show (default: 10)\n";
+        std::cout << "  --since <time>              Show history from this local time (YYYY-MM-DD[ HH:MM[:SS]])\n";
+        std::cout << "  --until <time>              Show history before this time (a bare date includes that day)\n";
+        std::cout << "  --day <YYYY-MM-DD>          Show history of one day\n";
         std::cout << "  --session <session_id>      Continue specific session or 'new' for new session\n";
         std::cout << "  --load-context <session_id> Load conversation context from session\n";
         std::cout << "  --max-context <num>         Maximum context turns to load (default: 10)\n";
+        std::cout << "  --context-budget <tokens>   Estimated token budget per request, 0 = unlimited (default: 32000)\n";
         std::cout << "  --no-history                Disable history saving for this session\n";
+        std::cout << "  --batch <prompts.jsonl>     Run prompts non-interactively and exit\n";
+        std::cout << "  --concurrency <num>         Requests in flight in batch mode (default: 4)\n";
+        std::cout << "  --output <path>             Batch results file (default: stdout)\n";
+        std::cout << "  --batch-order [completion|input] Order of batch results (default: completion)\n";
+        std::cout << "  --endpoint <url>            Override the chat completions endpoint (e.g. a mock server)\n";
+        std::cout << "  --metrics-file <path>       Write latency/throughput metrics (.prom for Prometheus, else JSON)\n";
+        std::cout << "  --retries <num>             Retries after a transient failure (default: 2)\n";
+        std::cout << "  --hedge-after <ms>          Send a hedged duplicate request after this delay, 0 = off\n";
+        std::cout << "  --rate-limit <req/s>        Requests per second shared by all gf processes, 0 = off\n";
+        std::cout << "  --max-concurrent <num>      Requests in flight across all gf processes, 0 = off\n";
+        std::cout << "  --background                Yield to interactive sessions when rate limited\n";
+        std::cout << "  --cache | --no-cache        Answer identical requests from the on-disk response cache\n";
         return 0;
     }
 
@@ -120,6 +218,7 @@ int main(int argc,char** argv){
     HistoryManager* history_manager = nullptr;
     if (enable_history) {
         history_manager = new HistoryManager(config.get_history_path(), config.get_max_history_entries());
+        history_manager->set_retention(config.get_history_retention());
         if (!history_manager->load_history()) {
             std::cerr << "Warning: Failed to load history, starting with empty history." << std::endl;
         }
@@ -137,32 +236,57 @@ int main(int argc,char** argv){
         std::string history_cmd = parser.get_option_value("--history");
         
         if (history_cmd == "show") {
-            int count = 10; // 默认显示10条
-            if (parser.has_option("--history-count")) {
-                count = std::stoi(parser.get_option_value("--history-count"));
+            if (parser.has_option("--since") || parser.has_option("--until") || parser.has_option("--day")) {
+                // 按时间范围显示：默认显示范围内的全部条目
+                int64_t since = INT64_MIN;
+                int64_t until = INT64_MAX;
+                if (!parse_time_option(parser, "--day", since, until) ||
+                    !parse_time_option(parser, "--since", since, until) ||
+                    !parse_time_option(parser, "--until", since, until)) {
+                    delete history_manager;
+                    return 1;
+                }
+                int count = -1;
+                if (parser.has_option("--history-count")) {
+                    count = std::stoi(parser.get_option_value("--history-count"));
+                }
+                history_manager->display_history_range(since, until, count, true);
+            } else {
+                int count = 10; // 默认显示10条
+                if (parser.has_option("--history-count")) {
+                    count = std::stoi(parser.get_option_value("--history-count"));
+                }
+                history_manager->display_history(count, true);
             }
-            history_manager->display_history(count, true);
+        } else if (history_cmd == "days") {
+            history_manager->display_days();
         } else if (history_cmd == "clear") {
             history_manager->clear_history();
             history_manager->save_history();
             std::cout << "History cleared successfully." << std::endl;
         } else if (history_cmd == "search") {
-            std::cout << "Enter search keyword: ";
+            std::cout << "Enter search query (whole words, ANDed; use OR and \"phrases\"; "
+                         "falls back to substring match if nothing is found): ";
             std::string keyword;
             std::getline(std::cin, keyword);
             if (!keyword.empty()) {
-                auto results = history_manager->search_history(keyword);
+                auto results = history_manager->search(keyword);
                 if (results.empty()) {
                     std::cout << "No matching history entries found." << std::endl;
                 } else {
                     std::cout << "\nFound " << results.size() << " matching entries:" << std::endl;
-                    for (size_t i = 0; i < results.size(); ++i) {
-                        const auto& entry = results[i];
-                        std::cout << "\n[" << (i + 1) << "] " << entry.timestamp;
+                    int count = 10; // 默认显示得分最高的10条
+                    if (parser.has_option("--history-count")) {
+                        count = std::stoi(parser.get_option_value("--history-count"));
+                    }
+                    for (size_t i = 0; i < results.size() && static_cast<int>(i) < count; ++i) {
+                        const auto entry = history_manager->get_entry(results[i].index);
+                        std::cout << "\n[" << (i + 1) << "] " << format_history_timestamp(entry.timestamp);
                         if (!entry.session_id.empty()) {
                             std::cout << " (Session: " << entry.session_id << ", Turn: " << entry.turn_number << ")";
                         }
-                        std::cout << std::endl;
+                        std::cout << " score " << std::fixed << std::setprecision(2) << results[i].score
+                                  << std::defaultfloat << std::endl;
                         std::cout << "User: " << entry.user_message << std::endl;
                         std::cout << "Assistant: " << entry.assistant_response.substr(0, 200);
                         if (entry.assistant_response.length() > 200) std::cout << "...";
@@ -192,8 +316,16 @@ int main(int argc,char** argv){
                     std::cout << "Invalid input. Please enter a number." << std::endl;
                 }
             }
+        } else if (history_cmd == "export") {
+            // 导出为JSON Lines写到标准输出，可以重定向到文件备份
+            size_t exported = history_manager->export_history(std::cout);
+            std::cerr << "Exported " << exported << " history entries." << std::endl;
+        } else if (history_cmd == "import") {
+            size_t imported = history_manager->import_history(std::cin);
+            history_manager->save_history();
+            std::cout << "Imported " << imported << " history entries." << std::endl;
         } else {
-            std::cerr << "Invalid history command. Use 'show', 'clear', or 'search'." << std::endl;
+            std::cerr << "Invalid history command. Use 'show', 'clear', 'search', 'sessions', 'days', 'export' or 'import'." << std::endl;
         }
         
         // 清理并退出（历史记录命令不进入聊天模式）
@@ -229,6 +361,94 @@ int main(int argc,char** argv){
         return 1;
     }
     deepseek ds(api_key, is_stream, history_manager);
+    ds.set_endpoint(parser.has_option("--endpoint") ? parser.get_option_value("--endpoint")
+                                                    : config.get_api_endpoint());
+    ds.set_metrics_in_history(config.get_record_request_metrics());
+    std::string metrics_file = parser.has_option("--metrics-file")
+                                   ? parser.get_option_value("--metrics-file")
+                                   : config.get_metrics_file();
+    ds.set_metrics_file(metrics_file);
+    
+    // 上下文token预算
+    ContextWindowOptions context_window;
+    int context_budget = parser.has_option("--context-budget")
+                             ? std::stoi(parser.get_option_value("--context-budget"))
+                             : config.get_context_token_budget();
+    context_window.max_tokens = context_budget > 0 ? static_cast<size_t>(context_budget) : 0;
+    if (!parse_context_overflow(config.get_context_overflow(), context_window.overflow)) {
+        std::cerr << "Unknown context_overflow \"" << config.get_context_overflow()
+                  << "\", using drop" << std::endl;
+    }
+    context_window.collapsed_tokens = static_cast<size_t>(std::max(1, config.get_context_collapsed_tokens()));
+    ds.set_context_window(context_window);
+    
+    // 瞬时故障的重试和对冲策略
+    RetryPolicy retry_policy = config.get_retry_policy();
+    if (parser.has_option("--retries")) {
+        retry_policy.max_attempts = std::max(1, std::stoi(parser.get_option_value("--retries")) + 1);
+    }
+    if (parser.has_option("--hedge-after")) {
+        retry_policy.hedge_after_ms = std::max(0L, std::stol(parser.get_option_value("--hedge-after")));
+    }
+    ds.set_retry_policy(retry_policy);
+    
+    // 客户端限流：共享同一API密钥的进程通过状态文件协调
+    RateLimitOptions rate_limit = config.get_rate_limit();
+    if (parser.has_option("--rate-limit")) {
+        rate_limit.requests_per_second = std::max(0.0, std::stod(parser.get_option_value("--rate-limit")));
+    }
+    if (parser.has_option("--max-concurrent")) {
+        rate_limit.max_concurrency = std::max(0, std::stoi(parser.get_option_value("--max-concurrent")));
+    }
+    ds.set_rate_limit(rate_limit);
+    if (parser.has_option("--background")) {
+        ds.set_request_priority(RequestPriority::Background);
+    }
+    
+    // 磁盘响应缓存：相同的请求直接回放缓存的回复
+    bool use_cache = parser.has_option("--cache") ||
+                     (config.get_response_cache_enabled() && !parser.has_option("--no-cache"));
+    if (use_cache) {
+        ds.set_response_cache(config.get_response_cache());
+        ds.set_cache_replay_rate(config.get_cache_replay_tokens_per_second());
+    }
+    
+    // 批处理模式：非交互式并发执行文件中的所有prompt
+    if (parser.has_option("--batch")) {
+        BatchOptions batch_options;
+        batch_options.input_path = parser.get_option_value("--batch");
+        batch_options.output_path = parser.get_option_value("--output");
+        batch_options.model = config.get_default_model();
+        batch_options.system_prompt = config.get_default_system_prompt();
+        if (parser.has_option("--concurrency")) {
+            long concurrency = 0;
+            if (!parse_count_option(parser, "--concurrency", 1, kMaxBatchConcurrency, concurrency)) {
+                delete history_manager;
+                return 1;
+            }
+            batch_options.concurrency = static_cast<size_t>(concurrency);
+        }
+        batch_options.preserve_order = parser.get_option_value("--batch-order") == "input";
+        
+        BatchRunner runner(ds, history_manager, batch_options);
+        bool ok = runner.run();
+        if (!metrics_file.empty()) {
+            ds.get_metrics().write_file(metrics_file);
+        }
+        const BatchStats& stats = runner.get_stats();
+        double seconds = stats.elapsed_seconds > 0 ? stats.elapsed_seconds : 1e-9;
+        std::cerr << "Batch finished: " << stats.succeeded << "/" << stats.total
+                  << " succeeded, " << stats.failed << " failed in "
+                  << stats.elapsed_seconds << " s" << std::endl;
+        std::cerr << "Throughput: " << (stats.succeeded / seconds) << " requests/s, "
+                  << (stats.tokens / seconds) << " tokens/s" << std::endl;
+        
+        if (history_manager) {
+            history_manager->save_history();
+            delete history_manager;
+        }
+        return ok ? 0 : 1;
+    }
     
     // 处理会话相关参数
     std::string session_to_use;
@@ -242,9 +462,7 @@ int main(int argc,char** argv){
         } else {
             // 验证会话是否存在
             if (history_manager) {
-                auto session_ids = history_manager->get_all_session_ids();
-                bool session_exists = std::find(session_ids.begin(), session_ids.end(), session_to_use) != session_ids.end();
-                if (session_exists) {
+                if (history_manager->has_session(session_to_use)) {
                     ds.set_current_session(session_to_use);
                     std::cout << "Continuing session: " << session_to_use << std::endl;
                 } else {
@@ -267,9 +485,7 @@ int main(int argc,char** argv){
         }
         
         if (history_manager) {
-            auto session_ids = history_manager->get_all_session_ids();
-            bool session_exists = std::find(session_ids.begin(), session_ids.end(), context_session) != session_ids.end();
-            if (session_exists) {
+            if (history_manager->has_session(context_session)) {
                 ds.load_session_context(context_session, max_context);
                 std::cout << "Loaded context from session: " << context_session 
                           << " (max " << max_context << " turns)" << std::endl;
@@ -283,7 +499,14 @@ int main(int argc,char** argv){
     
     // 设置系统提示
     std::string default_prompt = config.get_default_system_prompt();
-    std::string sysprompt = readline(("Waiting for system prompt, default: \"" + default_prompt + "\": ").c_str());
+    char* sysprompt_line = safe_readline(("Waiting for system prompt, default: \"" + default_prompt + "\": ").c_str());
+    if (!GlobalManager::getInstance().isRunning()) {
+        std::cout << "\n" << std::endl;
+        delete history_manager;
+        return 0;
+    }
+    std::string sysprompt = sysprompt_line ? sysprompt_line : "";
+    free(sysprompt_line);
     if (!sysprompt.empty()) {
         ds.set_system_prompt(sysprompt);
     } else {
@@ -324,6 +547,9 @@ int main(int argc,char** argv){
             std::cout << "  /sessions     - List all sessions\n";
             std::cout << "  /load <id>    - Load session context\n";
             std::cout << "  /clear        - Clear current conversation context\n";
+            std::cout << "  /stats        - Show connection and latency statistics\n";
+            std::cout << "  /context      - Show context size and token budget\n";
+            std::cout << "  /cache [clear] - Show response cache statistics, or empty the cache\n";
             std::cout << "  /exit         - Exit the program\n";
             continue;
         } else if (prompt == "/new") {
@@ -334,21 +560,23 @@ int main(int argc,char** argv){
             continue;
         } else if (prompt == "/session") {
             if (history_manager) {
+                history_manager->refresh(); // 其他gf进程可能向同一会话追加了条目
                 std::cout << "Current session: " << ds.get_current_session_id() << std::endl;
-                auto session_history = history_manager->get_session_history(ds.get_current_session_id());
-                std::cout << "Session turns: " << session_history.size() << std::endl;
+                const SessionInfo* info = history_manager->get_session_info(ds.get_current_session_id());
+                std::cout << "Session turns: " << (info ? info->positions.size() : 0) << std::endl;
             }
             continue;
         } else if (prompt == "/sessions") {
             if (history_manager) {
+                history_manager->refresh();
                 history_manager->display_sessions();
             }
             continue;
         } else if (prompt.substr(0, 6) == "/load ") {
             if (history_manager) {
                 std::string session_id = prompt.substr(6);
-                auto session_ids = history_manager->get_all_session_ids();
-                if (std::find(session_ids.begin(), session_ids.end(), session_id) != session_ids.end()) {
+                history_manager->refresh();
+                if (history_manager->has_session(session_id)) {
                     ds.load_session_context(session_id, 10);
                     ds.set_current_session(session_id);
                     std::cout << "Loaded context from session: " << session_id << std::endl;
@@ -361,6 +589,36 @@ int main(int argc,char** argv){
             ds.clear_conversation_context();
             std::cout << "Conversation context cleared." << std::endl;
             continue;
+        } else if (prompt == "/stats") {
+            ConnectionStats stats = ds.get_connection_stats();
+            std::cout << "New connections: " << stats.new_connections
+                      << ", handles created: " << stats.handles_created << std::endl;
+            ds.get_metrics().print(std::cout);
+            continue;
+        } else if (prompt == "/context") {
+            const Conversation& conversation = ds.get_conversation();
+            size_t budget = ds.get_context_window().max_tokens;
+            std::cout << "Messages: " << conversation.size()
+                      << (conversation.has_system_prompt() ? " + system prompt" : "") << std::endl;
+            std::cout << "Estimated tokens: " << conversation.total_tokens() << " / "
+                      << (budget ? std::to_string(budget) : std::string("unlimited")) << std::endl;
+            std::cout << "Last request size: " << ds.get_last_request_bytes() << " bytes" << std::endl;
+            continue;
+        } else if (prompt == "/cache" || prompt == "/cache clear") {
+            ResponseCache* cache = ds.get_response_cache();
+            if (!cache) {
+                std::cout << "Response cache is disabled (enable with --cache or response_cache_enabled)." << std::endl;
+            } else if (prompt == "/cache clear") {
+                std::cout << "Removed " << cache->clear() << " cached responses." << std::endl;
+            } else {
+                ResponseCacheStats stats = cache->get_stats();
+                uint64_t lookups = stats.hits + stats.misses;
+                std::cout << "Cached responses: " << stats.entries << " (" << stats.bytes << " bytes)" << std::endl;
+                std::cout << "Hits: " << stats.hits << ", misses: " << stats.misses << ", hit rate: "
+                          << (lookups ? 100.0 * static_cast<double>(stats.hits) / static_cast<double>(lookups) : 0.0)
+                          << "%, stored: " << stats.stores << ", evicted: " << stats.evictions << std::endl;
+            }
+            continue;
         } else if (prompt == "/exit") {
             std::cout << "Exiting..." << std::endl;
             break;
@@ -380,25 +638,47 @@ int main(int argc,char** argv){
         gm.setConversationInProgress(true);
         
         std::cout << "\n[DeepSeek回答]\n"  << std::endl;
-        // 发送请求并获取响应
-        std::string response = ds.ask(config.get_default_model(), prompt);
+        // 发送请求并获取响应，重试之后仍然失败时报告错误并继续对话
+        std::string response;
+        try {
+            response = ds.ask(config.get_default_model(), prompt);
+        } catch (const std::exception& e) {
+            gm.setConversationInProgress(false);
+            gm.setCurrentUserInput("");
+            std::cerr << "\nRequest failed: " << e.what() << std::endl;
+            continue;
+        }
+        
+        // 被中断时保留对话状态，退出循环后保存部分回复
+        if (!gm.isRunning()) {
+            break;
+        }
         
         // 对话完成，清除状态
         gm.setConversationInProgress(false);
         gm.setCurrentUserInput("");
         gm.setCurrentAssistantResponse("");
         
-        // 检查响应是否因为中断而异常
-        if (!GlobalManager::getInstance().isRunning() || response.empty()) {
+        // 检查响应是否异常
+        if (response.empty()) {
             break; // 静默退出
         }
         
         std::cout << "\n";
     }
     
-    // 静默保存数据
+    GlobalManager& gm = GlobalManager::getInstance();
+    if (gm.isInterrupted()) {
+        // 被中断：在主线程中保存未完成的对话（部分回复加上中断标记）
+        gm.saveCurrentState();
+        std::cout << "\n" << std::endl;
+    }
+    
+    // 静默保存数据（被中断时saveCurrentState已经落盘，压缩留到下次启动或正常退出）
     if (history_manager) {
-        history_manager->save_history();
+        if (!gm.isInterrupted()) {
+            history_manager->save_history();
+        }
         delete history_manager;
     }
     
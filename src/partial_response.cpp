@@ -0,0 +1,64 @@
+#include "partial_response.hpp"
+#include <algorithm>
+#include <cstring>
+
+PartialResponse::~PartialResponse() {
+  while (head) {
+    Block *next = head->next;
+    delete head;
+    head = next;
+  }
+}
+
+void PartialResponse::append(std::string_view text) {
+  if (text.empty()) {
+    return;
+  }
+  if (!head) {
+    head = tail = new Block;
+    tail_used = 0;
+  }
+  size_t length = published.load(std::memory_order_relaxed);
+  while (!text.empty()) {
+    if (tail_used == Block::kCapacity) {
+      // clear之后沿用之前分配的块，不够时才分配新块
+      if (!tail->next) {
+        tail->next = new Block;
+      }
+      tail = tail->next;
+      tail_used = 0;
+    }
+    size_t n = std::min(text.size(), Block::kCapacity - tail_used);
+    std::memcpy(tail->data + tail_used, text.data(), n);
+    tail_used += n;
+    length += n;
+    text.remove_prefix(n);
+  }
+  // 数据和块链接写完之后才发布长度
+  published.store(length, std::memory_order_release);
+}
+
+void PartialResponse::clear() {
+  published.store(0, std::memory_order_release);
+  tail = head;
+  tail_used = 0;
+}
+
+std::string PartialResponse::snapshot() const {
+  size_t length = published.load(std::memory_order_acquire);
+  std::string result;
+  if (length == 0) {
+    return result; // 写入方可能正在分配第一个块，此时不能读head
+  }
+  result.reserve(length);
+  // 只在还有已发布的数据时才读下一个块的指针，写入方可能正在链接新块
+  const Block *block = head;
+  while (result.size() < length) {
+    size_t n = std::min(Block::kCapacity, length - result.size());
+    result.append(block->data, n);
+    if (result.size() < length) {
+      block = block->next;
+    }
+  }
+  return result;
+}
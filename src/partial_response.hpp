@@ -0,0 +1,60 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief 正在接收的回复的只追加缓冲区，供中断时保存部分回复
+ *
+ * 内容写在固定大小、分配后不再移动的块中，写入方追加数据后以release语义
+ * 发布新的长度；读取方先以acquire语义读长度，再只读取已发布的部分，因此
+ * 写入线程追加时其他线程（例如退出流程）可以随时取快照，不会读到正在移动
+ * 的内存。每个token的开销只与它本身的长度有关，与已收到的回复长度无关。
+ *
+ * 只允许一个写入方。clear()只重置长度并保留已分配的块，不与读取并发时调用。
+ */
+class PartialResponse {
+private:
+  struct Block {
+    static constexpr size_t kCapacity = 16 * 1024 - 2 * sizeof(void *);
+    Block *next = nullptr;
+    char data[kCapacity];
+  };
+
+  Block *head = nullptr;
+  Block *tail = nullptr;     // 正在写入的块（只有写入方访问）
+  size_t tail_used = 0;      // 正在写入的块已用的字节数
+  std::atomic<size_t> published{0};
+
+public:
+  PartialResponse() = default;
+  ~PartialResponse();
+
+  PartialResponse(const PartialResponse &) = delete;
+  PartialResponse &operator=(const PartialResponse &) = delete;
+
+  /**
+   * @brief 追加一段内容并发布新的长度
+   * @param text 增量内容
+   */
+  void append(std::string_view text);
+
+  /**
+   * @brief 清空内容，保留已分配的块供下一次回复使用
+   */
+  void clear();
+
+  /**
+   * @brief 已发布的字节数
+   */
+  size_t size() const { return published.load(std::memory_order_acquire); }
+
+  bool empty() const { return size() == 0; }
+
+  /**
+   * @brief 复制已发布的内容
+   * @return 调用时刻的完整部分回复
+   */
+  std::string snapshot() const;
+};
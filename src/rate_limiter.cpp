@@ -0,0 +1,248 @@
+#include "rate_limiter.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <ctime>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr uint32_t kMagic = 0x47465231; // "GFR1"
+constexpr int kMaxProcesses = 64;
+// 等待并发名额或让路给交互式请求时的轮询间隔
+constexpr long kPollMs = 20;
+// 状态文件中的时间晚于当前时间这么多，说明是重启之前留下的
+constexpr int64_t kStaleNs = 3600LL * 1000000000LL;
+
+int64_t monotonic_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+bool process_alive(int32_t pid) {
+  return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+} // namespace
+
+// 共享状态的内存布局，所有进程读写同一份
+struct RateLimiter::State {
+  struct Lease {
+    int32_t pid;                  // 0表示空闲
+    uint32_t in_flight;           // 该进程正在进行的请求数
+    uint32_t interactive_waiting; // 该进程是否有交互式请求在等待
+  };
+
+  uint32_t magic;
+  uint32_t reserved;
+  double tokens;            // 令牌桶中剩余的令牌
+  int64_t refilled_ns;      // 上次填充的时间（CLOCK_MONOTONIC）
+  int64_t blocked_until_ns; // 服务端限流后所有进程暂停到此时
+  int64_t swept_ns;         // 上次回收已退出进程的时间
+  Lease leases[kMaxProcesses];
+};
+
+template <typename F> auto RateLimiter::locked(F &&operation) {
+  std::lock_guard<std::mutex> guard(mutex);
+  if (fd < 0) {
+    return operation();
+  }
+  while (flock(fd, LOCK_EX) != 0 && errno == EINTR) {
+  }
+  auto result = operation();
+  flock(fd, LOCK_UN);
+  return result;
+}
+
+RateLimiter::RateLimiter(const RateLimitOptions &options) : options(options), pid(getpid()) {
+  if (this->options.burst <= 0.0) {
+    this->options.burst = std::max(1.0, this->options.requests_per_second);
+  }
+  if (!this->options.state_path.empty()) {
+    fd = open(this->options.state_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 &&
+        (st.st_size >= static_cast<off_t>(sizeof(State)) || ftruncate(fd, sizeof(State)) == 0)) {
+      void *mapped = mmap(nullptr, sizeof(State), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (mapped != MAP_FAILED) {
+        state = static_cast<State *>(mapped);
+      }
+    }
+    if (!state) {
+      std::cerr << "Warning: cannot share rate limit state via " << this->options.state_path
+                << ", limiting this process only" << std::endl;
+      if (fd >= 0) {
+        close(fd);
+        fd = -1;
+      }
+    }
+  }
+  if (!state) {
+    state = new State();
+  }
+  locked([this] {
+    if (state->magic != kMagic) {
+      *state = State();
+      state->magic = kMagic;
+      state->tokens = this->options.burst;
+      state->refilled_ns = monotonic_ns();
+    }
+    return 0;
+  });
+}
+
+RateLimiter::~RateLimiter() {
+  locked([this] {
+    for (State::Lease &lease : state->leases) {
+      if (lease.pid == pid) {
+        lease = State::Lease();
+      }
+    }
+    return 0;
+  });
+  if (fd >= 0) {
+    munmap(state, sizeof(State));
+    close(fd);
+  } else {
+    delete state;
+  }
+}
+
+int RateLimiter::lease_index() {
+  int free_index = -1;
+  for (int i = 0; i < kMaxProcesses; ++i) {
+    if (state->leases[i].pid == pid) {
+      return i;
+    }
+    if (free_index < 0 && state->leases[i].pid == 0) {
+      free_index = i;
+    }
+  }
+  if (free_index >= 0) {
+    state->leases[free_index] = State::Lease{pid, 0, 0};
+  }
+  return free_index;
+}
+
+void RateLimiter::sweep(int64_t now_ns) {
+  // 每秒最多检查一次，避免每次获取都对所有进程发信号
+  if (now_ns - state->swept_ns < 1000000000LL) {
+    return;
+  }
+  state->swept_ns = now_ns;
+  for (State::Lease &lease : state->leases) {
+    if (lease.pid != 0 && lease.pid != pid && !process_alive(lease.pid)) {
+      lease = State::Lease();
+    }
+  }
+}
+
+long RateLimiter::try_acquire(RequestPriority priority) {
+  return locked([&]() -> long {
+    int64_t now = monotonic_ns();
+    // 重启后CLOCK_MONOTONIC从头开始，文件中的时间会在“未来”
+    if (state->refilled_ns > now) {
+      state->refilled_ns = now;
+      state->swept_ns = 0;
+    }
+    if (state->blocked_until_ns - now > kStaleNs) {
+      state->blocked_until_ns = 0;
+    }
+    sweep(now);
+
+    int index = lease_index();
+    if (index < 0) {
+      // 进程表已满，不再参与协调，只受服务端限流约束
+      return 0;
+    }
+    State::Lease &own = state->leases[index];
+    bool interactive = priority == RequestPriority::Interactive;
+    auto wait = [&](long ms) {
+      if (interactive) {
+        own.interactive_waiting = 1;
+      }
+      return std::max(1L, ms);
+    };
+
+    if (state->blocked_until_ns > now) {
+      return wait((state->blocked_until_ns - now + 999999) / 1000000);
+    }
+
+    uint32_t in_flight = 0;
+    bool interactive_waiting = false;
+    for (const State::Lease &lease : state->leases) {
+      if (lease.pid != 0) {
+        in_flight += lease.in_flight;
+        interactive_waiting = interactive_waiting || lease.interactive_waiting;
+      }
+    }
+    if (!interactive && interactive_waiting) {
+      return wait(kPollMs);
+    }
+    if (options.max_concurrency > 0) {
+      uint32_t limit = static_cast<uint32_t>(options.max_concurrency);
+      // 后台请求为交互式请求保留一个名额
+      if (!interactive && limit > 1) {
+        limit--;
+      }
+      if (in_flight >= limit) {
+        return wait(kPollMs);
+      }
+    }
+    if (options.requests_per_second > 0.0) {
+      double elapsed = static_cast<double>(now - state->refilled_ns) / 1e9;
+      state->tokens =
+          std::min(options.burst, state->tokens + elapsed * options.requests_per_second);
+      state->refilled_ns = now;
+      if (state->tokens < 1.0) {
+        double seconds = (1.0 - state->tokens) / options.requests_per_second;
+        return wait(static_cast<long>(std::ceil(seconds * 1000.0)));
+      }
+      state->tokens -= 1.0;
+    }
+
+    own.in_flight++;
+    if (interactive) {
+      own.interactive_waiting = 0;
+    }
+    return 0;
+  });
+}
+
+void RateLimiter::release() {
+  locked([this] {
+    for (State::Lease &lease : state->leases) {
+      if (lease.pid == pid && lease.in_flight > 0) {
+        lease.in_flight--;
+      }
+    }
+    return 0;
+  });
+}
+
+void RateLimiter::abandon() {
+  locked([this] {
+    for (State::Lease &lease : state->leases) {
+      if (lease.pid == pid) {
+        lease.interactive_waiting = 0;
+      }
+    }
+    return 0;
+  });
+}
+
+void RateLimiter::penalize(long delay_ms) {
+  locked([&] {
+    int64_t until = monotonic_ns() + static_cast<int64_t>(delay_ms) * 1000000LL;
+    state->blocked_until_ns = std::max(state->blocked_until_ns, until);
+    state->tokens = 0.0;
+    return 0;
+  });
+}
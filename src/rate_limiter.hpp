@@ -0,0 +1,93 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+/**
+ * @brief 客户端限流的配置
+ */
+struct RateLimitOptions {
+  double requests_per_second = 0.0; // 令牌桶的填充速率，0表示不限速
+  double burst = 0.0;               // 令牌桶容量，0表示取max(1, requests_per_second)
+  int max_concurrency = 0;          // 同时进行的请求数上限，0表示不限制
+  std::string state_path;           // 多进程共享的状态文件，为空时只在本进程内限流
+
+  bool enabled() const { return requests_per_second > 0.0 || max_concurrency > 0; }
+};
+
+/**
+ * @brief 请求的优先级
+ */
+enum class RequestPriority {
+  Interactive, // 交互式对话，用户正在等待
+  Background,  // 批处理、对冲等可以让路的请求
+};
+
+/**
+ * @brief 令牌桶加并发上限的客户端限流器，可在同一主机的多个进程间协调
+ *
+ * 状态保存在一个映射到内存的小文件中，用flock互斥，所有使用同一个API密钥、
+ * 指向同一状态文件的进程共享一个令牌桶和并发计数。每个进程占用的并发数
+ * 按pid记录，进程崩溃后它占用的名额会在下一次获取时被回收。
+ *
+ * 获取是非阻塞的：try_acquire立即返回需要等待的时间，调用方在自己的事件
+ * 循环中等待，等待期间仍然可以响应取消。交互式请求获取失败时会登记为
+ * 等待者，此时所有进程的后台请求都让路；后台请求还会为交互式请求保留
+ * 一个并发名额。
+ */
+class RateLimiter {
+private:
+  struct State;
+
+  RateLimitOptions options;
+  std::mutex mutex; // flock只在进程之间互斥，进程内的线程用mutex
+  int fd = -1;
+  State *state = nullptr;
+  int32_t pid;
+
+  // 在state中找到（必要时分配）本进程的记录
+  int lease_index();
+  // 回收已退出进程的记录
+  void sweep(int64_t now_ns);
+  // 加锁后执行操作
+  template <typename F> auto locked(F &&operation);
+
+public:
+  /**
+   * @brief 创建限流器
+   * @param options 限流配置；状态文件无法打开时退化为进程内限流
+   */
+  explicit RateLimiter(const RateLimitOptions &options);
+  ~RateLimiter();
+
+  RateLimiter(const RateLimiter &) = delete;
+  RateLimiter &operator=(const RateLimiter &) = delete;
+
+  /**
+   * @brief 尝试为一个请求获取名额
+   * @param priority 请求的优先级
+   * @return 0表示已获取，请求结束后须调用release；否则为建议的等待毫秒数
+   */
+  long try_acquire(RequestPriority priority);
+
+  /**
+   * @brief 请求结束，归还并发名额
+   */
+  void release();
+
+  /**
+   * @brief 交互式请求放弃等待（被取消）时撤销等待登记
+   */
+  void abandon();
+
+  /**
+   * @brief 服务端返回429等限流响应时调用，所有进程一起暂停
+   * @param delay_ms 暂停的毫秒数
+   */
+  void penalize(long delay_ms);
+
+  /**
+   * @brief 是否与其他进程共享状态
+   */
+  bool is_shared() const { return fd >= 0; }
+};
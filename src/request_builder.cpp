@@ -0,0 +1,152 @@
+#include "request_builder.hpp"
+#include <cstddef>
+#include <cstdio>
+
+namespace {
+
+const char kPrefix[] = "{\"messages\":[";
+const size_t kPrefixSize = sizeof(kPrefix) - 1;
+
+// 需要转义的字节：控制字符、引号和反斜杠
+struct EscapeTable {
+  bool escape[256];
+  EscapeTable() {
+    for (int c = 0; c < 256; ++c) {
+      escape[c] = c < 0x20 || c == '"' || c == '\\';
+    }
+  }
+};
+const EscapeTable kEscapeTable;
+
+} // namespace
+
+RequestBuilder::RequestBuilder()
+    : buffer(kPrefix), system_end(kPrefixSize), messages_end(kPrefixSize) {}
+
+void RequestBuilder::append_json_string(std::string &out, std::string_view text) {
+  static const char hex[] = "0123456789abcdef";
+  out.reserve(out.size() + text.size() + 2);
+  out += '"';
+  size_t run_start = 0;
+  for (size_t i = 0; i < text.size(); ++i) {
+    unsigned char c = static_cast<unsigned char>(text[i]);
+    if (!kEscapeTable.escape[c]) {
+      continue;
+    }
+    // 成段追加不需要转义的部分
+    out.append(text.data() + run_start, i - run_start);
+    run_start = i + 1;
+    switch (c) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    case '\r':
+      out += "\\r";
+      break;
+    case '\t':
+      out += "\\t";
+      break;
+    case '\b':
+      out += "\\b";
+      break;
+    case '\f':
+      out += "\\f";
+      break;
+    default:
+      out += "\\u00";
+      out += hex[c >> 4];
+      out += hex[c & 0xF];
+    }
+  }
+  out.append(text.data() + run_start, text.size() - run_start);
+  out += '"';
+}
+
+void RequestBuilder::append_message(std::string_view role, std::string_view content) {
+  buffer += "{\"content\":";
+  append_json_string(buffer, content);
+  buffer += ",\"role\":";
+  append_json_string(buffer, role);
+  buffer += "},";
+}
+
+void RequestBuilder::replace_system_message(std::string_view prompt) {
+  std::string system_message;
+  if (!prompt.empty()) {
+    system_message += "{\"content\":";
+    append_json_string(system_message, prompt);
+    system_message += ",\"role\":\"system\"},";
+  }
+  // 只移动系统消息之后的部分，已转换的消息不需要重新转义
+  size_t old_size = system_end - kPrefixSize;
+  buffer.replace(kPrefixSize, old_size, system_message);
+  ptrdiff_t delta = static_cast<ptrdiff_t>(system_message.size()) - static_cast<ptrdiff_t>(old_size);
+  system_end += delta;
+  messages_end += delta;
+  for (size_t &end : message_ends) {
+    end += delta;
+  }
+}
+
+void RequestBuilder::erase_front_messages(size_t count) {
+  if (count >= message_ends.size()) {
+    buffer.resize(system_end);
+    message_ends.clear();
+    return;
+  }
+  size_t removed = message_ends[count - 1] - system_end;
+  buffer.erase(system_end, removed);
+  message_ends.erase(message_ends.begin(), message_ends.begin() + count);
+  for (size_t &end : message_ends) {
+    end -= removed;
+  }
+}
+
+void RequestBuilder::sync(const Conversation &conversation) {
+  buffer.resize(messages_end);
+  if (messages_end > kPrefixSize) {
+    buffer.back() = ','; // 恢复上一次build替换掉的逗号
+  }
+  if (source != &conversation || generation != conversation.get_generation()) {
+    // 有消息被截断或修改，丢弃已转换的消息
+    buffer.resize(system_end);
+    message_ends.clear();
+    generation = conversation.get_generation();
+  } else if (erased_front != conversation.get_erased_front()) {
+    erase_front_messages(conversation.get_erased_front() - erased_front);
+  }
+  erased_front = conversation.get_erased_front();
+  if (source != &conversation || system_version != conversation.get_system_version()) {
+    replace_system_message(conversation.get_system_prompt());
+    system_version = conversation.get_system_version();
+  }
+  source = &conversation;
+  for (size_t i = message_ends.size(); i < conversation.size(); ++i) {
+    append_message(Conversation::role_name(conversation.role(i)), conversation.content(i));
+    message_ends.push_back(buffer.size());
+  }
+  messages_end = buffer.size();
+}
+
+std::string_view RequestBuilder::build(const Conversation &conversation, std::string_view model,
+                                       double temperature, bool stream) {
+  sync(conversation);
+  if (messages_end > kPrefixSize) {
+    buffer.back() = ']';
+  } else {
+    buffer += ']';
+  }
+  buffer += ",\"model\":";
+  append_json_string(buffer, model);
+  buffer += stream ? ",\"stream\":true" : ",\"stream\":false";
+  char number[48];
+  std::snprintf(number, sizeof(number), ",\"temperature\":%.15g}", temperature);
+  buffer += number;
+  return buffer;
+}
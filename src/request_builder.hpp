@@ -0,0 +1,66 @@
+#pragma once
+#include "conversation.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief chat completions请求体的增量构建器
+ *
+ * 对话以Conversation保存，只在发送时转换为JSON。已经转换过的消息保留在一个
+ * 可增长的缓冲区中，每次构建只转义新追加的消息；系统提示变化时只替换缓冲区
+ * 开头的一段，最早的消息被删除时只移除对应的一段，消息被截断或修改时才从头
+ * 重建。返回的视图可以直接作为
+ * CURLOPT_POSTFIELDS零拷贝发送。输出为紧凑的UTF-8 JSON，键的顺序与
+ * Json::writeString一致（messages、model、stream、temperature）。
+ */
+class RequestBuilder {
+private:
+  // {"messages":[系统消息,消息,消息,  每条消息之后都带逗号，build时把最后一个逗号换成]
+  std::string buffer;
+  size_t system_end;                // 系统消息在buffer中的结束位置
+  size_t messages_end;              // 消息部分在buffer中的结束位置
+  std::vector<size_t> message_ends; // 已转换的每条消息的结束位置
+  const Conversation *source = nullptr; // 缓冲区对应的对话
+  uint64_t system_version = 0;          // 已转换的系统提示版本
+  uint64_t generation = 0;              // 已转换的消息代数
+  uint64_t erased_front = 0;            // 已同步的从开头删除的消息数
+
+  void append_message(std::string_view role, std::string_view content);
+  void replace_system_message(std::string_view prompt);
+  void erase_front_messages(size_t count);
+  void sync(const Conversation &conversation);
+
+public:
+  RequestBuilder();
+
+  /**
+   * @brief 生成完整的请求体
+   * @param conversation 要发送的对话
+   * @param model 模型名称
+   * @param temperature 温度参数
+   * @param stream 是否请求流式响应
+   * @return 请求体视图，在下一次调用build之前有效
+   */
+  std::string_view build(const Conversation &conversation, std::string_view model,
+                         double temperature, bool stream);
+
+  /**
+   * @brief 已转换的消息数（不含系统提示）
+   */
+  size_t message_count() const { return message_ends.size(); }
+
+  /**
+   * @brief 消息部分已序列化的字节数
+   */
+  size_t messages_size() const { return messages_end; }
+
+  /**
+   * @brief 把字符串转义为JSON字符串字面量（含引号）并追加到out
+   * @param out 输出缓冲区
+   * @param text UTF-8文本，原样保留非ASCII字符
+   */
+  static void append_json_string(std::string &out, std::string_view text);
+};
@@ -0,0 +1,355 @@
+#include "request_metrics.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <tuple>
+
+namespace {
+
+// curl的*_TIME_T以微秒为单位
+double info_ms(CURL *curl, CURLINFO info) {
+  curl_off_t value = 0;
+  if (curl_easy_getinfo(curl, info, &value) != CURLE_OK) {
+    return 0.0;
+  }
+  return static_cast<double>(value) / 1000.0;
+}
+
+// 最近秩法求分位数，samples会被部分重排
+double percentile(std::vector<double> &samples, double q) {
+  if (samples.empty()) {
+    return 0.0;
+  }
+  size_t rank = static_cast<size_t>(q * static_cast<double>(samples.size()) + 0.5);
+  rank = std::min(std::max(rank, static_cast<size_t>(1)), samples.size()) - 1;
+  std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+  return samples[rank];
+}
+
+void write_summary(std::ostream &out, const std::string &name, const std::string &help,
+                   const std::vector<std::pair<const char *, double>> &quantiles,
+                   double sum, size_t count) {
+  out << "# HELP " << name << " " << help << "\n";
+  out << "# TYPE " << name << " summary\n";
+  for (const auto &quantile : quantiles) {
+    out << name << "{quantile=\"" << quantile.first << "\"} " << quantile.second << "\n";
+  }
+  out << name << "_sum " << sum << "\n";
+  out << name << "_count " << count << "\n";
+}
+
+void write_counter(std::ostream &out, const std::string &name, const std::string &help,
+                   uint64_t value) {
+  out << "# HELP " << name << " " << help << "\n";
+  out << "# TYPE " << name << " counter\n";
+  out << name << " " << value << "\n";
+}
+
+// 从非流式响应中取出usage.completion_tokens，不必为此再解析一遍整个JSON
+uint64_t completion_tokens(std::string_view body) {
+  static const std::string_view key = "\"completion_tokens\"";
+  size_t pos = body.rfind(key);
+  if (pos == std::string_view::npos) {
+    return 0;
+  }
+  pos += key.size();
+  while (pos < body.size() && (body[pos] == ' ' || body[pos] == ':')) {
+    pos++;
+  }
+  uint64_t value = 0;
+  while (pos < body.size() && body[pos] >= '0' && body[pos] <= '9') {
+    value = value * 10 + static_cast<uint64_t>(body[pos++] - '0');
+  }
+  return value;
+}
+
+} // namespace
+
+RequestMetrics RequestMetrics::collect(CURL *curl, const StreamContext *stream_ctx,
+                                       uint64_t request_bytes,
+                                       std::string_view response_body) {
+  RequestMetrics metrics;
+  // curl的各阶段时间都是从请求开始累计的，相减得到每个阶段各自的耗时
+  double namelookup = info_ms(curl, CURLINFO_NAMELOOKUP_TIME_T);
+  double connect = info_ms(curl, CURLINFO_CONNECT_TIME_T);
+  double appconnect = info_ms(curl, CURLINFO_APPCONNECT_TIME_T);
+  metrics.dns_ms = namelookup;
+  metrics.connect_ms = connect > namelookup ? connect - namelookup : 0.0;
+  metrics.tls_ms = appconnect > connect ? appconnect - connect : 0.0;
+  metrics.ttfb_ms = info_ms(curl, CURLINFO_STARTTRANSFER_TIME_T);
+  metrics.total_ms = info_ms(curl, CURLINFO_TOTAL_TIME_T);
+  metrics.request_bytes = request_bytes;
+
+  long num_connects = 0;
+  curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &num_connects);
+  metrics.reused_connection = num_connects == 0;
+
+  if (stream_ctx) {
+    metrics.stream = true;
+    metrics.response_bytes = stream_ctx->bytes_received;
+    metrics.tokens = stream_ctx->token_count;
+    metrics.ttft_ms = stream_ctx->time_to_first_token() * 1000.0;
+    metrics.tokens_per_second = stream_ctx->tokens_per_second();
+    metrics.inter_token_ms = stream_ctx->token_gaps_ms;
+  } else {
+    curl_off_t downloaded = 0;
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &downloaded);
+    metrics.response_bytes = static_cast<uint64_t>(downloaded);
+    metrics.ttft_ms = metrics.ttfb_ms;
+    metrics.tokens = completion_tokens(response_body);
+  }
+  return metrics;
+}
+
+Json::Value RequestMetrics::to_json() const {
+  Json::Value json;
+  // 保留一位小数，避免历史记录中出现过长的浮点数
+  auto round = [](double value) { return std::round(value * 10.0) / 10.0; };
+  json["dns_ms"] = round(dns_ms);
+  json["connect_ms"] = round(connect_ms);
+  json["tls_ms"] = round(tls_ms);
+  json["ttfb_ms"] = round(ttfb_ms);
+  json["ttft_ms"] = round(ttft_ms);
+  json["total_ms"] = round(total_ms);
+  json["tokens"] = static_cast<Json::UInt64>(tokens);
+  json["tokens_per_s"] = round(tokens_per_second);
+  json["request_bytes"] = static_cast<Json::UInt64>(request_bytes);
+  if (context_tokens > 0) {
+    json["context_tokens"] = static_cast<Json::UInt64>(context_tokens);
+  }
+  if (!inter_token_ms.empty()) {
+    std::vector<double> gaps(inter_token_ms.begin(), inter_token_ms.end());
+    json["itl_p50_ms"] = round(percentile(gaps, 0.50));
+    json["itl_p99_ms"] = round(percentile(gaps, 0.99));
+  }
+  return json;
+}
+
+MetricsRecorder::Summary MetricsRecorder::summarize(const Series &series) {
+  Summary summary;
+  summary.count = series.samples.size();
+  if (summary.count == 0) {
+    return summary;
+  }
+  std::vector<double> samples = series.samples;
+  summary.mean = series.sum / static_cast<double>(summary.count);
+  summary.p50 = percentile(samples, 0.50);
+  summary.p90 = percentile(samples, 0.90);
+  summary.p99 = percentile(samples, 0.99);
+  summary.max = *std::max_element(samples.begin(), samples.end());
+  return summary;
+}
+
+void MetricsRecorder::record(const RequestMetrics &metrics) {
+  std::lock_guard<std::mutex> lock(mutex);
+  requests++;
+  if (metrics.reused_connection) {
+    reused_connections++;
+  }
+  total_tokens += metrics.tokens;
+  request_bytes += metrics.request_bytes;
+  response_bytes += metrics.response_bytes;
+  dns_ms.add(metrics.dns_ms);
+  connect_ms.add(metrics.connect_ms);
+  tls_ms.add(metrics.tls_ms);
+  ttfb_ms.add(metrics.ttfb_ms);
+  ttft_ms.add(metrics.ttft_ms);
+  total_ms.add(metrics.total_ms);
+  request_kb.add(static_cast<double>(metrics.request_bytes) / 1024.0);
+  if (metrics.tokens_per_second > 0.0) {
+    tokens_per_second.add(metrics.tokens_per_second);
+  }
+  for (float gap : metrics.inter_token_ms) {
+    inter_token_ms.add(gap);
+  }
+}
+
+void MetricsRecorder::record_failure() {
+  std::lock_guard<std::mutex> lock(mutex);
+  failures++;
+}
+
+void MetricsRecorder::record_retry() {
+  std::lock_guard<std::mutex> lock(mutex);
+  retries++;
+}
+
+void MetricsRecorder::record_hedge() {
+  std::lock_guard<std::mutex> lock(mutex);
+  hedges++;
+}
+
+void MetricsRecorder::record_throttle(double wait_ms) {
+  std::lock_guard<std::mutex> lock(mutex);
+  throttled++;
+  throttle_wait_ms += wait_ms;
+}
+
+void MetricsRecorder::record_cache_lookup(bool hit) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (hit) {
+    cache_hits++;
+  } else {
+    cache_misses++;
+  }
+}
+
+uint64_t MetricsRecorder::get_request_count() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return requests;
+}
+
+void MetricsRecorder::print(std::ostream &out) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  out << "Requests: " << requests << " (" << failures << " failed, " << retries
+      << " retried, " << hedges << " hedged, " << reused_connections
+      << " on reused connections)" << std::endl;
+  if (throttled > 0) {
+    out << "Rate limited: " << throttled << " requests delayed, " << throttle_wait_ms
+        << " ms in total" << std::endl;
+  }
+  if (cache_hits + cache_misses > 0) {
+    out << "Response cache: " << cache_hits << " hits, " << cache_misses << " misses"
+        << std::endl;
+  }
+  out << "Tokens: " << total_tokens << ", request bytes: " << request_bytes
+      << ", response bytes: " << response_bytes << std::endl;
+  if (requests == 0) {
+    return;
+  }
+  std::ios_base::fmtflags flags = out.flags();
+  std::streamsize precision = out.precision();
+  out << std::fixed << std::setprecision(1);
+  out << std::left << std::setw(16) << "metric" << std::right << std::setw(10) << "mean"
+      << std::setw(10) << "p50" << std::setw(10) << "p90" << std::setw(10) << "p99"
+      << std::setw(10) << "max" << std::endl;
+  const std::pair<const char *, const Series *> rows[] = {
+      {"dns_ms", &dns_ms},         {"connect_ms", &connect_ms},
+      {"tls_ms", &tls_ms},         {"ttfb_ms", &ttfb_ms},
+      {"ttft_ms", &ttft_ms},       {"itl_ms", &inter_token_ms},
+      {"total_ms", &total_ms},     {"tokens/s", &tokens_per_second},
+      {"request_kb", &request_kb},
+  };
+  for (const auto &row : rows) {
+    Summary summary = summarize(*row.second);
+    if (summary.count == 0) {
+      continue;
+    }
+    out << std::left << std::setw(16) << row.first << std::right << std::setw(10)
+        << summary.mean << std::setw(10) << summary.p50 << std::setw(10) << summary.p90
+        << std::setw(10) << summary.p99 << std::setw(10) << summary.max << std::endl;
+  }
+  out.flags(flags);
+  out.precision(precision);
+}
+
+Json::Value MetricsRecorder::to_json() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  Json::Value json;
+  json["requests"] = static_cast<Json::UInt64>(requests);
+  json["failures"] = static_cast<Json::UInt64>(failures);
+  json["retries"] = static_cast<Json::UInt64>(retries);
+  json["hedges"] = static_cast<Json::UInt64>(hedges);
+  json["throttled"] = static_cast<Json::UInt64>(throttled);
+  json["throttle_wait_ms"] = throttle_wait_ms;
+  json["cache_hits"] = static_cast<Json::UInt64>(cache_hits);
+  json["cache_misses"] = static_cast<Json::UInt64>(cache_misses);
+  json["reused_connections"] = static_cast<Json::UInt64>(reused_connections);
+  json["tokens"] = static_cast<Json::UInt64>(total_tokens);
+  json["request_bytes"] = static_cast<Json::UInt64>(request_bytes);
+  json["response_bytes"] = static_cast<Json::UInt64>(response_bytes);
+  const std::pair<const char *, const Series *> series[] = {
+      {"dns_ms", &dns_ms},         {"connect_ms", &connect_ms},
+      {"tls_ms", &tls_ms},         {"ttfb_ms", &ttfb_ms},
+      {"ttft_ms", &ttft_ms},       {"inter_token_ms", &inter_token_ms},
+      {"total_ms", &total_ms},     {"tokens_per_second", &tokens_per_second},
+      {"request_kb", &request_kb},
+  };
+  for (const auto &item : series) {
+    Summary summary = summarize(*item.second);
+    Json::Value value;
+    value["count"] = static_cast<Json::UInt64>(summary.count);
+    value["mean"] = summary.mean;
+    value["p50"] = summary.p50;
+    value["p90"] = summary.p90;
+    value["p99"] = summary.p99;
+    value["max"] = summary.max;
+    json[item.first] = value;
+  }
+  return json;
+}
+
+std::string MetricsRecorder::to_prometheus() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  std::ostringstream out;
+  write_counter(out, "gf_requests_total", "Completed chat completion requests.", requests);
+  write_counter(out, "gf_request_failures_total", "Failed chat completion requests.", failures);
+  write_counter(out, "gf_retries_total", "Retries after a transient failure.", retries);
+  write_counter(out, "gf_hedged_requests_total", "Hedged duplicate requests sent.", hedges);
+  write_counter(out, "gf_throttled_requests_total", "Requests delayed by the client rate limiter.",
+                throttled);
+  write_counter(out, "gf_cache_hits_total", "Replies served from the response cache.", cache_hits);
+  write_counter(out, "gf_cache_misses_total", "Response cache lookups that missed.", cache_misses);
+  write_counter(out, "gf_reused_connections_total", "Requests served on a reused connection.",
+                reused_connections);
+  write_counter(out, "gf_tokens_total", "Tokens received.", total_tokens);
+  write_counter(out, "gf_request_bytes_total", "Request body bytes sent.", request_bytes);
+  write_counter(out, "gf_response_bytes_total", "Response body bytes received.", response_bytes);
+
+  // 时间统一换算成秒，符合Prometheus的惯例
+  const std::tuple<const char *, const char *, const Series *, double> series[] = {
+      {"gf_request_dns_seconds", "DNS resolution time.", &dns_ms, 1e-3},
+      {"gf_request_connect_seconds", "TCP connect time.", &connect_ms, 1e-3},
+      {"gf_request_tls_seconds", "TLS handshake time.", &tls_ms, 1e-3},
+      {"gf_request_ttfb_seconds", "Time to first byte.", &ttfb_ms, 1e-3},
+      {"gf_request_ttft_seconds", "Time to first token.", &ttft_ms, 1e-3},
+      {"gf_inter_token_seconds", "Gap between consecutive tokens.", &inter_token_ms, 1e-3},
+      {"gf_request_duration_seconds", "Total request time.", &total_ms, 1e-3},
+      {"gf_tokens_per_second", "Generation rate of streamed responses.", &tokens_per_second, 1.0},
+      {"gf_request_size_bytes", "Request body size.", &request_kb, 1024.0},
+  };
+  for (const auto &item : series) {
+    const Series &values = *std::get<2>(item);
+    double scale = std::get<3>(item);
+    Summary summary = summarize(values);
+    write_summary(out, std::get<0>(item), std::get<1>(item),
+                  {{"0.5", summary.p50 * scale}, {"0.9", summary.p90 * scale},
+                   {"0.99", summary.p99 * scale}},
+                  values.sum * scale, summary.count);
+  }
+  return out.str();
+}
+
+bool MetricsRecorder::write_file(const std::string &path) const {
+  auto has_suffix = [&path](const std::string &suffix) {
+    return path.size() >= suffix.size() &&
+           path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0;
+  };
+  bool prometheus = has_suffix(".prom") || has_suffix(".txt");
+  std::string content;
+  if (prometheus) {
+    content = to_prometheus();
+  } else {
+    Json::StreamWriterBuilder writer;
+    writer["indentation"] = "  ";
+    writer["precision"] = 3;
+    writer["precisionType"] = "decimal";
+    content = Json::writeString(writer, to_json()) + "\n";
+  }
+
+  std::string temp_path = path + ".tmp";
+  {
+    std::ofstream file(temp_path, std::ios::out | std::ios::trunc);
+    if (!file.is_open()) {
+      return false;
+    }
+    file << content;
+    if (!file.good()) {
+      return false;
+    }
+  }
+  return std::rename(temp_path.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,164 @@
+#pragma once
+#include <curl/curl.h>
+#include <json/json.h>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "stream_context.hpp"
+
+/**
+ * @brief 单个请求的耗时和吞吐指标
+ *
+ * 网络阶段的耗时取自curl（均为毫秒），生成相关的指标取自流式上下文。
+ * 非流式请求没有逐token的计时，ttft_ms等于首字节时间。
+ */
+struct RequestMetrics {
+  double dns_ms = 0.0;       // DNS解析
+  double connect_ms = 0.0;   // TCP连接（复用连接时为0）
+  double tls_ms = 0.0;       // TLS握手（复用连接或明文时为0）
+  double ttfb_ms = 0.0;      // 从开始到收到首字节
+  double ttft_ms = 0.0;      // 从开始到收到首个token
+  double total_ms = 0.0;     // 请求总耗时
+  uint64_t tokens = 0;       // 收到的token数
+  double tokens_per_second = 0.0;
+  uint64_t request_bytes = 0;  // 请求体大小
+  uint64_t context_tokens = 0; // 本地估算的上下文token数，0表示未估算
+  uint64_t response_bytes = 0; // 响应体大小
+  bool stream = false;
+  bool reused_connection = false;
+  std::vector<float> inter_token_ms; // 相邻token的到达间隔
+
+  /**
+   * @brief 从完成的传输中收集指标
+   * @param curl 刚完成传输的句柄
+   * @param stream_ctx 流式请求的上下文，非流式请求传nullptr
+   * @param request_bytes 请求体字节数
+   * @param response_body 非流式请求的响应体，从中读取usage中的token数
+   * @return 该请求的指标
+   */
+  static RequestMetrics collect(CURL *curl, const StreamContext *stream_ctx,
+                                uint64_t request_bytes,
+                                std::string_view response_body = {});
+
+  /**
+   * @brief 转换为写入历史记录的紧凑JSON（token间隔只保留p50/p99）
+   */
+  Json::Value to_json() const;
+};
+
+/**
+ * @brief 会话内所有请求的指标汇总，提供p50/p90/p99
+ *
+ * 每个请求只保存几个数值，token间隔全部保留以计算分位数。线程安全，
+ * 批处理和交互模式可以共用同一个实例。
+ */
+class MetricsRecorder {
+private:
+  // 一个指标的全部样本
+  struct Series {
+    std::vector<double> samples;
+    double sum = 0.0;
+
+    void add(double value) {
+      samples.push_back(value);
+      sum += value;
+    }
+  };
+  // 分位数汇总
+  struct Summary {
+    size_t count = 0;
+    double mean = 0.0;
+    double p50 = 0.0;
+    double p90 = 0.0;
+    double p99 = 0.0;
+    double max = 0.0;
+  };
+
+  mutable std::mutex mutex;
+  uint64_t requests = 0;
+  uint64_t failures = 0;
+  uint64_t retries = 0;
+  uint64_t hedges = 0;
+  uint64_t throttled = 0;       // 被客户端限流推迟的请求数
+  double throttle_wait_ms = 0.0; // 被限流推迟的总时间
+  uint64_t cache_hits = 0;
+  uint64_t cache_misses = 0;
+  uint64_t reused_connections = 0;
+  uint64_t total_tokens = 0;
+  uint64_t request_bytes = 0;
+  uint64_t response_bytes = 0;
+  Series dns_ms;
+  Series connect_ms;
+  Series tls_ms;
+  Series ttfb_ms;
+  Series ttft_ms;
+  Series total_ms;
+  Series tokens_per_second;
+  Series inter_token_ms;
+  Series request_kb;
+
+  static Summary summarize(const Series &series);
+
+public:
+  /**
+   * @brief 记录一个成功完成的请求
+   */
+  void record(const RequestMetrics &metrics);
+
+  /**
+   * @brief 记录一个失败的请求（只计数，不参与分位数），每次失败的尝试各记一次
+   */
+  void record_failure();
+
+  /**
+   * @brief 记录一次重试
+   */
+  void record_retry();
+
+  /**
+   * @brief 记录一次对冲请求
+   */
+  void record_hedge();
+
+  /**
+   * @brief 记录一个被客户端限流推迟的请求
+   * @param wait_ms 等待的毫秒数
+   */
+  void record_throttle(double wait_ms);
+
+  /**
+   * @brief 记录一次响应缓存查找
+   * @param hit 是否命中
+   */
+  void record_cache_lookup(bool hit);
+
+  /**
+   * @brief 已记录的成功请求数
+   */
+  uint64_t get_request_count() const;
+
+  /**
+   * @brief 以人类可读的表格输出汇总，用于/stats命令
+   */
+  void print(std::ostream &out) const;
+
+  /**
+   * @brief 汇总为JSON
+   */
+  Json::Value to_json() const;
+
+  /**
+   * @brief 汇总为Prometheus文本格式
+   */
+  std::string to_prometheus() const;
+
+  /**
+   * @brief 写出汇总文件，先写临时文件再重命名，读取方不会看到写了一半的内容
+   * @param path 目标路径，扩展名为 .prom 或 .txt 时写Prometheus文本格式，否则写JSON
+   * @return 是否写入成功
+   */
+  bool write_file(const std::string &path) const;
+};
@@ -0,0 +1,253 @@
+#include "response_cache.hpp"
+#include <json/json.h>
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace {
+
+constexpr std::string_view kSuffix = ".json";
+
+// 统一换行符并去掉首尾空白，只是空白不同的提问命中同一条缓存
+std::string normalize(std::string_view text) {
+  size_t begin = text.find_first_not_of(" \t\r\n");
+  if (begin == std::string_view::npos) {
+    return std::string();
+  }
+  size_t end = text.find_last_not_of(" \t\r\n") + 1;
+  std::string normalized;
+  normalized.reserve(end - begin);
+  for (size_t i = begin; i < end; ++i) {
+    if (text[i] == '\r' && i + 1 < end && text[i + 1] == '\n') {
+      continue;
+    }
+    normalized += text[i];
+  }
+  return normalized;
+}
+
+// 两个独立的64位哈希拼成128位的键
+struct KeyHasher {
+  uint64_t fnv = 14695981039346656037ull; // FNV-1a
+  uint64_t mix = 0x9E3779B97F4A7C15ull;
+
+  void update(std::string_view data) {
+    for (unsigned char c : data) {
+      fnv = (fnv ^ c) * 1099511628211ull;
+      mix = (mix ^ c) * 0xFF51AFD7ED558CCDull;
+      mix ^= mix >> 31;
+    }
+  }
+
+  std::string hex() const {
+    char buffer[33];
+    std::snprintf(buffer, sizeof(buffer), "%016llx%016llx",
+                  static_cast<unsigned long long>(fnv), static_cast<unsigned long long>(mix));
+    return buffer;
+  }
+};
+
+// 先写入长度，避免相邻字段拼接后产生歧义
+void append_field(std::string &request, std::string_view data) {
+  request += std::to_string(data.size());
+  request += ':';
+  request.append(data.data(), data.size());
+}
+
+time_t file_time(const std::filesystem::path &path) {
+  struct stat st;
+  return ::stat(path.c_str(), &st) == 0 ? st.st_mtime : 0;
+}
+
+} // namespace
+
+ResponseCache::ResponseCache(const ResponseCacheOptions &options) : options(options) {}
+
+std::string ResponseCache::make_request(std::string_view model, double temperature,
+                                        const Conversation &conversation) {
+  std::string request;
+  append_field(request, model);
+  char number[48];
+  std::snprintf(number, sizeof(number), "%.17g", temperature);
+  append_field(request, number);
+  append_field(request, normalize(conversation.get_system_prompt()));
+  for (size_t i = 0; i < conversation.size(); ++i) {
+    append_field(request, Conversation::role_name(conversation.role(i)));
+    append_field(request, normalize(conversation.content(i)));
+  }
+  return request;
+}
+
+std::string ResponseCache::make_key(std::string_view request) {
+  KeyHasher hasher;
+  hasher.update(request);
+  return hasher.hex();
+}
+
+std::string ResponseCache::path_of(const std::string &name) const {
+  return (std::filesystem::path(options.directory) / (name + std::string(kSuffix))).string();
+}
+
+void ResponseCache::scan() {
+  scanned = true;
+  std::error_code ec;
+  std::filesystem::directory_iterator it(options.directory, ec);
+  if (ec) {
+    return; // 目录还不存在
+  }
+  time_t now = time(nullptr);
+  for (const auto &item : it) {
+    std::string filename = item.path().filename().string();
+    if (filename.size() <= kSuffix.size() ||
+        filename.compare(filename.size() - kSuffix.size(), kSuffix.size(), kSuffix) != 0) {
+      continue;
+    }
+    std::string name = filename.substr(0, filename.size() - kSuffix.size());
+    Entry entry{static_cast<uint64_t>(item.file_size(ec)), file_time(item.path())};
+    // 修改时间不早于写入时间，修改时间都已超过有效期的条目一定过期了
+    if (options.ttl_seconds > 0 && now - entry.used > options.ttl_seconds) {
+      std::filesystem::remove(item.path(), ec);
+      stats.evictions++;
+      continue;
+    }
+    entries[name] = entry;
+    stats.bytes += entry.bytes;
+  }
+  stats.entries = entries.size();
+}
+
+void ResponseCache::remove(const std::string &name) {
+  std::error_code ec;
+  std::filesystem::remove(path_of(name), ec);
+  auto it = entries.find(name);
+  if (it != entries.end()) {
+    stats.bytes -= std::min(stats.bytes, it->second.bytes);
+    entries.erase(it);
+  }
+  stats.entries = entries.size();
+  stats.evictions++;
+}
+
+void ResponseCache::evict() {
+  while (stats.bytes > options.max_bytes && !entries.empty()) {
+    auto oldest = std::min_element(entries.begin(), entries.end(), [](const auto &a, const auto &b) {
+      return a.second.used < b.second.used;
+    });
+    remove(oldest->first);
+  }
+}
+
+bool ResponseCache::lookup(const std::string &key, std::string_view request,
+                           std::string &response) {
+  if (!scanned) {
+    scan();
+  }
+  std::ifstream file(path_of(key));
+  Json::Value root;
+  Json::CharReaderBuilder reader;
+  std::string errors;
+  if (!file.is_open() || !Json::parseFromStream(reader, file, &root, &errors) ||
+      !root.isObject()) {
+    stats.misses++;
+    return false;
+  }
+  time_t now = time(nullptr);
+  if (options.ttl_seconds > 0 &&
+      now - static_cast<time_t>(root.get("created", 0).asInt64()) > options.ttl_seconds) {
+    file.close();
+    remove(key);
+    stats.misses++;
+    return false;
+  }
+  // 键只是哈希：请求不同（哈希冲突）时视为未命中，之后的写入会覆盖该条目
+  if (root.get("request", "").asString() != request) {
+    stats.misses++;
+    return false;
+  }
+  response = root.get("response", "").asString();
+  // 更新修改时间，淘汰时按最近使用排序
+  utimensat(AT_FDCWD, path_of(key).c_str(), nullptr, 0);
+  auto it = entries.find(key);
+  if (it != entries.end()) {
+    it->second.used = now;
+  }
+  stats.hits++;
+  return true;
+}
+
+void ResponseCache::store(const std::string &key, std::string_view request,
+                          std::string_view model, std::string_view response) {
+  if (!scanned) {
+    scan();
+  }
+  std::error_code ec;
+  std::filesystem::create_directories(options.directory, ec);
+
+  Json::Value root;
+  root["model"] = std::string(model);
+  root["created"] = static_cast<Json::Int64>(time(nullptr));
+  root["request"] = std::string(request);
+  root["response"] = std::string(response);
+  Json::StreamWriterBuilder writer;
+  writer["indentation"] = "";
+  writer["emitUTF8"] = true;
+  std::string data = Json::writeString(writer, root);
+
+  // 先写临时文件再重命名，其他进程不会读到写了一半的条目
+  std::string path = path_of(key);
+  std::string temp_path = path + ".tmp" + std::to_string(getpid());
+  {
+    std::ofstream file(temp_path, std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!file.is_open()) {
+      return;
+    }
+    file.write(data.data(), static_cast<std::streamsize>(data.size()));
+    if (!file) {
+      file.close();
+      std::filesystem::remove(temp_path, ec);
+      return;
+    }
+  }
+  std::filesystem::rename(temp_path, path, ec);
+  if (ec) {
+    std::filesystem::remove(temp_path, ec);
+    return;
+  }
+
+  auto it = entries.find(key);
+  if (it != entries.end()) {
+    stats.bytes -= std::min(stats.bytes, it->second.bytes);
+  }
+  entries[key] = Entry{data.size(), time(nullptr)};
+  stats.bytes += data.size();
+  stats.entries = entries.size();
+  stats.stores++;
+  evict();
+}
+
+size_t ResponseCache::clear() {
+  if (!scanned) {
+    scan();
+  }
+  size_t count = entries.size();
+  std::error_code ec;
+  for (const auto &entry : entries) {
+    std::filesystem::remove(path_of(entry.first), ec);
+  }
+  entries.clear();
+  stats.entries = 0;
+  stats.bytes = 0;
+  return count;
+}
+
+ResponseCacheStats ResponseCache::get_stats() {
+  if (!scanned) {
+    scan();
+  }
+  return stats;
+}
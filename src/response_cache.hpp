@@ -0,0 +1,116 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <map>
+#include <string>
+#include <string_view>
+#include "conversation.hpp"
+
+/**
+ * @brief 响应缓存的配置
+ */
+struct ResponseCacheOptions {
+  std::string directory;              // 缓存目录，每条缓存一个文件
+  long ttl_seconds = 86400;           // 缓存的有效期，0表示永不过期
+  uint64_t max_bytes = 64ull << 20;   // 缓存目录的总大小上限，超出时淘汰最久未用的条目
+};
+
+/**
+ * @brief 响应缓存的统计
+ */
+struct ResponseCacheStats {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t stores = 0;
+  uint64_t evictions = 0; // 因超出大小上限或过期而删除的条目数
+  size_t entries = 0;     // 当前的条目数
+  uint64_t bytes = 0;     // 当前占用的字节数
+};
+
+/**
+ * @brief 磁盘上的响应缓存，用于重复提问相同问题的脚本任务
+ *
+ * 键是(模型, 温度, 规范化后的全部消息)的128位哈希：消息内容统一换行符并去掉
+ * 首尾空白，流式与非流式请求共用同一个键。哈希不是密码学哈希，条目中同时保存
+ * 规范化后的请求，命中时逐字节比较，冲突时视为未命中。只有完整的回复才会写入
+ * （2xx、流式收到[DONE]、非流式解析成功），错误和被中断的回复不会被缓存。
+ * 每条缓存是目录中的一个JSON文件，
+ * 先写临时文件再重命名，多个进程可以共用同一个目录。命中时更新文件的修改时间，
+ * 超出大小上限时按修改时间淘汰最久未用的条目。目录索引在第一次使用时扫描一次，
+ * 之后只跟踪本进程的写入，因此大小上限在多进程共用时是近似的。
+ */
+class ResponseCache {
+private:
+  struct Entry {
+    uint64_t bytes;
+    time_t used; // 最近一次写入或命中的时间
+  };
+
+  ResponseCacheOptions options;
+  ResponseCacheStats stats;
+  std::map<std::string, Entry> entries; // 文件名到大小和使用时间
+  bool scanned = false;
+
+  // 扫描缓存目录，建立索引并删除过期的条目
+  void scan();
+  // 删除一个条目
+  void remove(const std::string &name);
+  // 淘汰最久未用的条目，直到总大小不超过上限
+  void evict();
+  std::string path_of(const std::string &name) const;
+
+public:
+  /**
+   * @brief 创建缓存，目录在第一次写入时创建
+   * @param options 缓存配置
+   */
+  explicit ResponseCache(const ResponseCacheOptions &options);
+
+  /**
+   * @brief 把一个请求规范化为用于比较的文本
+   * @param model 模型名称
+   * @param temperature 采样温度
+   * @param conversation 要发送的对话（含系统提示）
+   * @return 带长度前缀的各字段依次拼接
+   */
+  static std::string make_request(std::string_view model, double temperature,
+                                  const Conversation &conversation);
+
+  /**
+   * @brief 计算规范化请求的缓存键
+   * @param request make_request返回的文本
+   * @return 32个十六进制字符
+   */
+  static std::string make_key(std::string_view request);
+
+  /**
+   * @brief 查找缓存的回复
+   * @param key make_key返回的键
+   * @param request make_request返回的文本，与条目中保存的请求不同时视为未命中
+   * @param response 命中时写入回复内容
+   * @return 是否命中（过期的条目视为未命中并被删除）
+   */
+  bool lookup(const std::string &key, std::string_view request, std::string &response);
+
+  /**
+   * @brief 保存一个完整的回复
+   * @param key make_key返回的键
+   * @param request make_request返回的文本，查找时据此校验
+   * @param model 模型名称，一并写入条目便于查看
+   * @param response 回复内容
+   */
+  void store(const std::string &key, std::string_view request, std::string_view model,
+             std::string_view response);
+
+  /**
+   * @brief 删除所有条目
+   * @return 删除的条目数
+   */
+  size_t clear();
+
+  /**
+   * @brief 命中、未命中和占用空间的统计
+   */
+  ResponseCacheStats get_stats();
+};
@@ -0,0 +1,88 @@
+#include "retry_policy.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <ctime>
+
+bool RetryPolicy::is_success_status(long status) {
+  return status >= 200 && status < 300;
+}
+
+bool RetryPolicy::is_retryable_status(long status) {
+  return status == 408 || status == 429 || status == 500 || status == 502 ||
+         status == 503 || status == 504;
+}
+
+bool RetryPolicy::is_retryable_error(CURLcode code) {
+  switch (code) {
+  case CURLE_COULDNT_RESOLVE_HOST:
+  case CURLE_COULDNT_CONNECT:
+  case CURLE_OPERATION_TIMEDOUT:
+  case CURLE_SEND_ERROR:
+  case CURLE_RECV_ERROR:
+  case CURLE_GOT_NOTHING:
+  case CURLE_PARTIAL_FILE:
+  case CURLE_HTTP2:
+  case CURLE_HTTP2_STREAM:
+  case CURLE_SSL_CONNECT_ERROR:
+    return true;
+  default:
+    return false;
+  }
+}
+
+long RetryPolicy::retry_after_ms(CURL *curl) const {
+  struct curl_header *header = nullptr;
+  if (curl_easy_header(curl, "Retry-After", 0, CURLH_HEADER, -1, &header) != CURLHE_OK) {
+    return -1;
+  }
+  // 先按秒截断再换算成毫秒：超过上限的等待一律视为"太久"
+  uint64_t limit_seconds = static_cast<uint64_t>(std::max(max_retry_after_ms, 0L)) / 1000 + 1;
+  std::string value = header->value;
+  uint64_t seconds = 0;
+  const char *end = value.data() + value.size();
+  auto parsed = std::from_chars(value.data(), end, seconds);
+  if (parsed.ptr == end && !value.empty()) {
+    return static_cast<long>(std::min(seconds, limit_seconds) * 1000);
+  }
+  if (parsed.ec == std::errc::result_out_of_range) {
+    // 全是数字但超出64位
+    return -1;
+  }
+  // HTTP日期格式
+  time_t when = curl_getdate(value.c_str(), nullptr);
+  if (when < 0) {
+    return -1;
+  }
+  time_t now = std::time(nullptr);
+  if (when <= now) {
+    return 0;
+  }
+  return static_cast<long>(std::min(static_cast<uint64_t>(when - now), limit_seconds) * 1000);
+}
+
+long Backoff::delay_ms(const RetryPolicy &policy, int retry, long retry_after) {
+  if (retry_after >= 0) {
+    return retry_after;
+  }
+  long ceiling = policy.base_delay_ms;
+  for (int i = 1; i < retry && ceiling < policy.max_delay_ms; ++i) {
+    ceiling *= 2;
+  }
+  ceiling = std::min(ceiling, policy.max_delay_ms);
+  if (ceiling <= 0) {
+    return 0;
+  }
+  return std::uniform_int_distribution<long>(0, ceiling)(rng);
+}
+
+std::string describe_failure(CURLcode result, long status, const std::string &body) {
+  if (result != CURLE_OK) {
+    return "cURL error: " + std::string(curl_easy_strerror(result));
+  }
+  std::string description = "HTTP " + std::to_string(status);
+  if (!body.empty()) {
+    description += ": " + body.substr(0, 200);
+  }
+  return description;
+}
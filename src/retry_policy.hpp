@@ -0,0 +1,74 @@
+#pragma once
+#include <curl/curl.h>
+#include <random>
+#include <string>
+
+/**
+ * @brief 瞬时故障的重试和对冲策略
+ *
+ * 连接失败、超时和429/5xx等瞬时故障按带抖动的指数退避重试，服务端给出
+ * Retry-After时按其等待。流式请求只在还没有向用户输出任何内容时重试，
+ * 避免重复输出；非流式请求的响应在完成前不会被使用，任何瞬时故障都可以安全
+ * 重试。对冲请求在第一次尝试迟迟没有响应时再发出一个相同的请求，先响应的
+ * 一个被采用，另一个被取消。
+ */
+struct RetryPolicy {
+  int max_attempts = 3;             // 每个请求最多尝试的次数，1表示不重试
+  long base_delay_ms = 500;         // 第一次重试的退避上限，之后每次翻倍
+  long max_delay_ms = 8000;         // 退避的最大值
+  long max_retry_after_ms = 30000;  // 服务端要求等待更久时不再重试
+  long hedge_after_ms = 0;          // 超过此时长仍未响应时发出对冲请求，0表示不对冲
+
+  /**
+   * @brief 该HTTP状态码是否表示成功（任意2xx），交互式请求和批处理使用同一判断
+   */
+  static bool is_success_status(long status);
+
+  /**
+   * @brief 该HTTP状态码是否表示可以重试的瞬时故障（408、429和5xx中的网关/过载类）
+   */
+  static bool is_retryable_status(long status);
+
+  /**
+   * @brief 该curl错误是否表示可以重试的网络故障
+   */
+  static bool is_retryable_error(CURLcode code);
+
+  /**
+   * @brief 读取响应中的Retry-After头
+   *
+   * 过大的值截断到刚好超过max_retry_after_ms，调用方据此放弃重试，不会溢出。
+   * @param curl 已完成传输的句柄
+   * @return 需要等待的毫秒数，没有该头或无法解析时返回-1
+   */
+  long retry_after_ms(CURL *curl) const;
+};
+
+/**
+ * @brief 带全抖动（full jitter）的指数退避
+ *
+ * 第n次重试在[0, min(max_delay, base_delay * 2^(n-1))]之间均匀取值，
+ * 多个客户端同时失败时不会在同一时刻一起重试。
+ */
+class Backoff {
+private:
+  std::mt19937 rng{std::random_device{}()};
+
+public:
+  /**
+   * @brief 计算下一次重试前的等待时间
+   * @param policy 重试策略
+   * @param retry 第几次重试，从1开始
+   * @param retry_after 服务端要求的等待毫秒数，-1表示没有
+   * @return 等待的毫秒数
+   */
+  long delay_ms(const RetryPolicy &policy, int retry, long retry_after);
+};
+
+/**
+ * @brief 描述一次失败的尝试，用于错误信息和重试提示
+ * @param result curl的传输结果
+ * @param status HTTP状态码
+ * @param body 错误响应体，只取开头一部分
+ */
+std::string describe_failure(CURLcode result, long status, const std::string &body = "");
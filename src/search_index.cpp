@@ -0,0 +1,1038 @@
+#include "search_index.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// 索引文件：文件头、合并段（文档表、词项表、词项文本、倒排表），之后是一条条追加的倒排记录：
+// [uint32 长度][uint32 校验和][uint64 记录编号][varint 文档词数][varint 词项数]
+// 每个词项：[varint 字节数][词项][位置]
+// 合并段的倒排表按词项连续存放，每个文档：[varint 文档序号差值][位置]
+// 位置：[varint 用户消息中的位置数][varint 位置差值...][varint 助手回复中的位置数][varint 位置差值...]
+//      （两个字段各自从0开始差分）
+struct SearchIndexHeader {
+    char magic[4];            // "GFTS"
+    uint32_t version;         // 索引格式版本
+    uint64_t store_id;        // 所属历史存储的编号
+    uint64_t log_offset;      // 合并段的结束位置，之后是追加的倒排记录
+    uint64_t document_count;  // 合并段中的文档数
+    uint64_t term_count;      // 合并段中的词项数
+    uint64_t total_length;    // 合并段中文档的总词数
+    uint64_t strings_offset;  // 词项文本的起点
+    uint64_t postings_offset; // 倒排表的起点
+};
+
+// 合并段中的文档，文档序号即在表中的位置
+struct SearchIndex::BaseDocument {
+    uint64_t id;
+    uint32_t length;
+    uint32_t reserved;
+};
+
+// 合并段中的词项，按文本的字节序排列；倒排表到下一个词项的倒排表为止
+struct SearchIndex::BaseTerm {
+    uint64_t postings;    // 相对倒排表起点的偏移
+    uint32_t text;        // 相对词项文本起点的偏移
+    uint32_t text_length;
+};
+
+// 版本1按日志偏移引用记录；版本2每个中日韩字另有单字词项；版本3只有追加记录
+static const uint32_t kSearchIndexVersion = 4;
+
+// 追加的文档至少有这么多、且达到合并段的1/kMergeRatio时合并，加载时需要解析的记录保持较少
+static const size_t kMergeMinDocuments = 256;
+static const size_t kMergeRatio = 8;
+
+// 已淘汰的文档至少有这么多（且多于有效文档）时合并，只保留有效的部分
+static const size_t kRewriteThreshold = 1024;
+
+// 助手回复中的词位置从该值开始，与用户消息区分开，短语也不会跨字段匹配
+static const uint32_t kAssistantPositionBase = 0x80000000u;
+
+// BM25参数
+static const double kBm25K1 = 1.2;
+static const double kBm25B = 0.75;
+
+using DocumentTerms = std::vector<std::pair<std::string, std::vector<uint32_t>>>;
+
+static uint32_t checksum(const char* data, size_t length) {
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * 16777619u;
+    }
+    return hash;
+}
+
+template <typename T>
+static void put(std::string& out, T value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+static bool get(const char*& data, const char* end, T& value) {
+    if (static_cast<size_t>(end - data) < sizeof(value)) {
+        return false;
+    }
+    std::memcpy(&value, data, sizeof(value));
+    data += sizeof(value);
+    return true;
+}
+
+static void put_varint(std::string& out, uint32_t value) {
+    while (value >= 0x80) {
+        out += static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+static bool get_varint(const char*& data, const char* end, uint32_t& value) {
+    value = 0;
+    for (int shift = 0; data < end && shift < 35; shift += 7) {
+        unsigned char byte = static_cast<unsigned char>(*data++);
+        value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 写出一个文档中词项的位置（递增排列，用户消息的在前）
+static void put_positions(std::string& out, const uint32_t* begin, const uint32_t* end) {
+    const uint32_t* split = std::lower_bound(begin, end, kAssistantPositionBase);
+    put_varint(out, static_cast<uint32_t>(split - begin));
+    uint32_t previous = 0;
+    for (const uint32_t* p = begin; p != split; ++p) {
+        put_varint(out, *p - previous);
+        previous = *p;
+    }
+    put_varint(out, static_cast<uint32_t>(end - split));
+    previous = kAssistantPositionBase;
+    for (const uint32_t* p = split; p != end; ++p) {
+        put_varint(out, *p - previous);
+        previous = *p;
+    }
+}
+
+// 读取一个文档中词项的位置，追加到positions
+static bool get_positions(const char*& data, const char* end, std::vector<uint32_t>& positions) {
+    for (uint32_t base : {0u, kAssistantPositionBase}) {
+        uint32_t count = 0;
+        if (!get_varint(data, end, count)) {
+            return false;
+        }
+        uint32_t position = base;
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t delta = 0;
+            if (!get_varint(data, end, delta)) {
+                return false;
+            }
+            position += delta;
+            positions.push_back(position);
+        }
+    }
+    return true;
+}
+
+// 作用域结束时释放索引文件上的flock（描述符在此期间可能因合并而重新打开）
+class FileUnlock {
+public:
+    explicit FileUnlock(const int& fd) : fd(fd) {}
+    ~FileUnlock() {
+        if (fd >= 0) {
+            ::flock(fd, LOCK_UN);
+        }
+    }
+    FileUnlock(const FileUnlock&) = delete;
+    FileUnlock& operator=(const FileUnlock&) = delete;
+
+private:
+    const int& fd;
+};
+
+static bool write_all(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = ::write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        length -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+// 对一条历史分词，得到每个词项的位置列表（按位置递增），返回总词数
+static uint32_t collect_terms(const HistoryEntry& entry, DocumentTerms& doc_terms) {
+    std::unordered_map<std::string, size_t> slots;
+    uint32_t length = 0;
+    auto add = [&](std::string_view term, uint32_t position) {
+        auto it = slots.find(std::string(term));
+        if (it == slots.end()) {
+            it = slots.emplace(std::string(term), doc_terms.size()).first;
+            doc_terms.emplace_back(it->first, std::vector<uint32_t>());
+        }
+        doc_terms[it->second].second.push_back(position);
+        length++;
+    };
+    SearchIndex::tokenize(entry.user_message, add);
+    SearchIndex::tokenize(entry.assistant_response, [&](std::string_view term, uint32_t position) {
+        add(term, kAssistantPositionBase + position);
+    });
+    return length;
+}
+
+SearchIndex::SearchIndex(const std::string& journal_path)
+    : index_path(journal_path + ".fts"), store_id(0), fd(-1), file_checked(false),
+      loaded(false), total_length(0), min_id(0), evicted(0), map_data(nullptr), map_size(0),
+      base_terms(nullptr), base_term_count(0), base_strings(nullptr), base_postings(nullptr),
+      base_postings_size(0), base_documents(0), log_end(0) {}
+
+SearchIndex::~SearchIndex() {
+    // 未写出的记录由HistoryManager在日志落盘后flush，这里直接丢弃
+    unmap_file();
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+void SearchIndex::attach(uint64_t store, bool discard_file) {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    if (discard_file) {
+        ::unlink(index_path.c_str());
+    }
+    store_id = store;
+    file_checked = false;
+    unload();
+    pending.clear();
+}
+
+bool SearchIndex::open_existing() {
+    file_checked = true;
+    fd = ::open(index_path.c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    SearchIndexHeader header;
+    if (::pread(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)) ||
+        std::memcmp(header.magic, "GFTS", 4) != 0 || header.version != kSearchIndexVersion ||
+        header.store_id != store_id) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    return true;
+}
+
+// 没有合并段的文件头
+static std::string empty_index(uint64_t store_id) {
+    SearchIndexHeader header{};
+    std::memcpy(header.magic, "GFTS", 4);
+    header.version = kSearchIndexVersion;
+    header.store_id = store_id;
+    header.log_offset = sizeof(header);
+    header.strings_offset = sizeof(header);
+    header.postings_offset = sizeof(header);
+    return std::string(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+bool SearchIndex::create_file() {
+    file_checked = true;
+    rewrite_file(empty_index(store_id));
+    if (fd < 0) {
+        std::cerr << "Warning: Cannot create search index: " << index_path
+                  << " (" << std::strerror(errno) << ")" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool SearchIndex::lock_file() {
+    while (fd >= 0) {
+        while (::flock(fd, LOCK_EX) != 0 && errno == EINTR) {
+        }
+        struct stat opened;
+        struct stat current;
+        if (::fstat(fd, &opened) == 0 && ::stat(index_path.c_str(), &current) == 0 &&
+            opened.st_ino == current.st_ino && opened.st_dev == current.st_dev) {
+            return true;
+        }
+        // 其他进程合并后rename了新文件：内存中的文档序号对新文件无效
+        ::close(fd);
+        fd = -1;
+        if (loaded) {
+            unload();
+        }
+        open_existing();
+    }
+    return false;
+}
+
+bool SearchIndex::map_file(uint64_t& log_offset) {
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(SearchIndexHeader)) {
+        return false;
+    }
+    void* mapped = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    map_data = static_cast<const char*>(mapped);
+    map_size = static_cast<size_t>(st.st_size);
+
+    SearchIndexHeader header;
+    std::memcpy(&header, map_data, sizeof(header));
+    uint64_t documents_end = sizeof(header) + header.document_count * sizeof(BaseDocument);
+    uint64_t terms_end = documents_end + header.term_count * sizeof(BaseTerm);
+    if (header.document_count > map_size / sizeof(BaseDocument) ||
+        header.term_count > map_size / sizeof(BaseTerm) || terms_end > header.strings_offset ||
+        header.strings_offset > header.postings_offset || header.postings_offset > header.log_offset ||
+        header.log_offset > map_size) {
+        return false;
+    }
+    base_terms = reinterpret_cast<const BaseTerm*>(map_data + documents_end);
+    base_term_count = static_cast<size_t>(header.term_count);
+    base_strings = map_data + header.strings_offset;
+    base_postings = map_data + header.postings_offset;
+    base_postings_size = header.log_offset - header.postings_offset;
+    // 查询时不再检查词项表中的偏移
+    uint64_t strings_size = header.postings_offset - header.strings_offset;
+    uint64_t previous = 0;
+    for (size_t i = 0; i < base_term_count; ++i) {
+        const BaseTerm& term = base_terms[i];
+        if (static_cast<uint64_t>(term.text) + term.text_length > strings_size ||
+            term.postings < previous || term.postings > base_postings_size) {
+            return false;
+        }
+        previous = term.postings;
+    }
+
+    // 文档表很小，复制到内存中与追加的文档统一编号
+    const char* cursor = map_data + sizeof(header);
+    documents.reserve(static_cast<size_t>(header.document_count));
+    document_ids.reserve(static_cast<size_t>(header.document_count));
+    for (uint64_t i = 0; i < header.document_count; ++i) {
+        BaseDocument document;
+        std::memcpy(&document, cursor, sizeof(document));
+        cursor += sizeof(document);
+        documents.push_back({document.id, document.length});
+        document_ids.insert(document.id);
+        evicted += document.id < min_id;
+    }
+    base_documents = documents.size();
+    total_length = header.total_length;
+    log_offset = header.log_offset;
+    return true;
+}
+
+void SearchIndex::unmap_file() {
+    if (map_data) {
+        ::munmap(const_cast<char*>(map_data), map_size);
+    }
+    map_data = nullptr;
+    map_size = 0;
+    base_terms = nullptr;
+    base_term_count = 0;
+    base_strings = nullptr;
+    base_postings = nullptr;
+    base_postings_size = 0;
+    base_documents = 0;
+}
+
+size_t SearchIndex::read_records(const char* data, size_t size) {
+    const char* cursor = data;
+    const char* end = data + size;
+    std::vector<uint32_t> positions;
+    while (cursor < end) {
+        const char* record_start = cursor;
+        uint32_t length = 0;
+        uint32_t sum = 0;
+        if (!get(cursor, end, length) || !get(cursor, end, sum) ||
+            static_cast<size_t>(end - cursor) < length || checksum(cursor, length) != sum) {
+            return static_cast<size_t>(record_start - data); // 写了一半的尾部记录
+        }
+        const char* record_end = cursor + length;
+        uint64_t id = 0;
+        uint32_t doc_length = 0;
+        uint32_t term_count = 0;
+        get(cursor, record_end, id);
+        get_varint(cursor, record_end, doc_length);
+        get_varint(cursor, record_end, term_count);
+        if (id < min_id || !document_ids.insert(id).second) {
+            // 已淘汰，或者同一条记录已由另一个进程补充过
+            evicted += id < min_id;
+            cursor = record_end;
+            continue;
+        }
+        // 直接解码到倒排表，不构造中间的词项列表
+        uint32_t doc = static_cast<uint32_t>(documents.size());
+        documents.push_back({id, doc_length});
+        total_length += doc_length;
+        for (uint32_t i = 0; i < term_count; ++i) {
+            uint32_t term_size = 0;
+            if (!get_varint(cursor, record_end, term_size) ||
+                static_cast<size_t>(record_end - cursor) < term_size) {
+                break;
+            }
+            Postings& postings = terms[std::string(cursor, term_size)];
+            cursor += term_size;
+            postings.docs.push_back(doc);
+            postings.starts.push_back(static_cast<uint32_t>(postings.positions.size()));
+            if (!get_positions(cursor, record_end, postings.positions)) {
+                break;
+            }
+        }
+        cursor = record_end;
+    }
+    return size;
+}
+
+uint64_t SearchIndex::load(uint64_t min, std::vector<uint64_t>* missing) {
+    pending.clear(); // 未写出的记录在覆盖范围之外，由调用方重新补充
+    unload();
+    min_id = min;
+    if (!file_checked) {
+        open_existing();
+    }
+    if (fd < 0) {
+        create_file();
+    }
+    bool locked = fd >= 0 && lock_file();
+    loaded = true;
+    if (!locked) {
+        return 0; // 无法创建索引文件：只在内存中建立
+    }
+    // 其他进程的追加和合并不会与读取、截断交错
+    FileUnlock unlock(fd);
+    uint64_t log_offset = 0;
+    if (!map_file(log_offset)) {
+        std::cerr << "Warning: Rebuilding damaged search index: " << index_path << std::endl;
+        unload();
+        loaded = true;
+        rewrite_file(empty_index(store_id));
+        if (fd < 0 || !map_file(log_offset)) {
+            unload();
+            loaded = true;
+            return 0;
+        }
+    }
+    size_t valid = read_records(map_data + log_offset, map_size - static_cast<size_t>(log_offset));
+    log_end = log_offset + valid;
+    if (log_end < map_size && ::ftruncate(fd, static_cast<off_t>(log_end)) != 0) {
+        // 写了一半的尾部记录：截断，之后的条目由调用方重新补充
+        std::cerr << "Warning: Cannot truncate search index: " << index_path << std::endl;
+    }
+    if (should_merge()) {
+        merge();
+    }
+
+    uint64_t covered = 0;
+    std::vector<uint64_t> ids;
+    ids.reserve(documents.size());
+    for (const auto& document : documents) {
+        covered = std::max(covered, document.id + 1);
+        if (document.id >= min_id) {
+            ids.push_back(document.id);
+        }
+    }
+    if (missing) {
+        // 各进程的记录在文件中交错排列，排序后找出缺少的编号
+        std::sort(ids.begin(), ids.end());
+        uint64_t next = min_id;
+        for (uint64_t id : ids) {
+            for (; next < id; ++next) {
+                missing->push_back(next);
+            }
+            next = std::max(next, id + 1);
+        }
+    }
+    return covered;
+}
+
+void SearchIndex::unload() {
+    loaded = false;
+    unmap_file();
+    terms.clear();
+    documents.clear();
+    document_ids.clear();
+    total_length = 0;
+    evicted = 0;
+    log_end = 0;
+}
+
+void SearchIndex::rewrite_file(const std::string& contents) {
+    // 新建索引时不持有锁，各进程使用自己的临时文件
+    std::string temp_path = index_path + ".tmp." + std::to_string(::getpid());
+    int temp_fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (temp_fd < 0) {
+        return;
+    }
+    bool ok = write_all(temp_fd, contents.data(), contents.size());
+    ::close(temp_fd);
+    if (!ok || ::rename(temp_path.c_str(), index_path.c_str()) != 0) {
+        ::unlink(temp_path.c_str());
+        return;
+    }
+    // 之后的记录追加到新文件；关闭旧文件同时释放其上的锁，等待的进程会发现文件已被替换
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    fd = ::open(index_path.c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+}
+
+void SearchIndex::catch_up() {
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) <= log_end) {
+        return;
+    }
+    std::string data(static_cast<size_t>(st.st_size - log_end), '\0');
+    if (::pread(fd, &data[0], data.size(), static_cast<off_t>(log_end)) !=
+        static_cast<ssize_t>(data.size())) {
+        return;
+    }
+    size_t valid = read_records(data.data(), data.size());
+    if (valid < data.size() && ::ftruncate(fd, static_cast<off_t>(log_end + valid)) != 0) {
+        std::cerr << "Warning: Cannot truncate search index: " << index_path << std::endl;
+    }
+    log_end += valid;
+}
+
+bool SearchIndex::should_merge() const {
+    size_t appended = documents.size() - base_documents;
+    size_t live = documents.size() - std::min(evicted, documents.size());
+    return (appended >= kMergeMinDocuments && appended * kMergeRatio >= base_documents) ||
+           (evicted >= kRewriteThreshold && evicted > live);
+}
+
+void SearchIndex::merge() {
+    // 新的文档序号：按原来的顺序保留未淘汰的文档，各倒排表仍然递增
+    std::vector<uint32_t> renumber(documents.size(), UINT32_MAX);
+    std::string document_table;
+    uint64_t merged_length = 0;
+    uint32_t next = 0;
+    for (size_t i = 0; i < documents.size(); ++i) {
+        if (documents[i].id < min_id) {
+            continue;
+        }
+        renumber[i] = next++;
+        put(document_table, BaseDocument{documents[i].id, documents[i].length, 0});
+        merged_length += documents[i].length;
+    }
+
+    // 合并段和追加记录的词项都按字节序归并
+    std::vector<const std::pair<const std::string, Postings>*> appended;
+    appended.reserve(terms.size());
+    for (const auto& term : terms) {
+        appended.push_back(&term);
+    }
+    std::sort(appended.begin(), appended.end(),
+              [](const auto* a, const auto* b) { return a->first < b->first; });
+    std::string term_table;
+    std::string strings;
+    std::string postings;
+    uint64_t term_count = 0;
+    size_t base_index = 0;
+    size_t appended_index = 0;
+    Postings merged;
+    while (base_index < base_term_count || appended_index < appended.size()) {
+        std::string_view text;
+        merged.docs.clear();
+        merged.starts.clear();
+        merged.positions.clear();
+        int order = base_index == base_term_count ? 1
+                    : appended_index == appended.size()
+                        ? -1
+                        : term_text(base_terms[base_index]).compare(appended[appended_index]->first);
+        if (order <= 0) {
+            text = term_text(base_terms[base_index]);
+            decode_base(base_terms[base_index++], merged);
+        }
+        if (order >= 0) {
+            const Postings& tail = appended[appended_index]->second;
+            text = appended[appended_index++]->first;
+            for (size_t slot = 0; slot < tail.docs.size(); ++slot) {
+                auto range = positions_of(tail, slot);
+                merged.docs.push_back(tail.docs[slot]);
+                merged.starts.push_back(static_cast<uint32_t>(merged.positions.size()));
+                merged.positions.insert(merged.positions.end(), range.first, range.second);
+            }
+        }
+        size_t start = postings.size();
+        uint32_t previous = 0;
+        for (size_t slot = 0; slot < merged.docs.size(); ++slot) {
+            uint32_t doc = renumber[merged.docs[slot]];
+            if (doc == UINT32_MAX) {
+                continue;
+            }
+            put_varint(postings, doc - previous);
+            previous = doc;
+            auto range = positions_of(merged, slot);
+            put_positions(postings, range.first, range.second);
+        }
+        if (postings.size() == start) {
+            continue; // 只出现在已淘汰的文档中
+        }
+        put(term_table, BaseTerm{start, static_cast<uint32_t>(strings.size()),
+                                 static_cast<uint32_t>(text.size())});
+        strings.append(text);
+        term_count++;
+    }
+
+    SearchIndexHeader header{};
+    std::memcpy(header.magic, "GFTS", 4);
+    header.version = kSearchIndexVersion;
+    header.store_id = store_id;
+    header.document_count = next;
+    header.term_count = term_count;
+    header.total_length = merged_length;
+    header.strings_offset = sizeof(header) + document_table.size() + term_table.size();
+    header.postings_offset = header.strings_offset + strings.size();
+    header.log_offset = header.postings_offset + postings.size();
+    std::string contents(reinterpret_cast<const char*>(&header), sizeof(header));
+    contents.reserve(header.log_offset);
+    contents += document_table;
+    contents += term_table;
+    contents += strings;
+    contents += postings;
+    postings.clear();
+    postings.shrink_to_fit();
+
+    // 重新映射新文件；rename失败时映射的仍是原来的文件
+    unload();
+    loaded = true;
+    rewrite_file(contents);
+    uint64_t log_offset = 0;
+    if (fd < 0 || !map_file(log_offset)) {
+        unload();
+        loaded = true;
+        return;
+    }
+    log_end = log_offset + read_records(map_data + log_offset, map_size - static_cast<size_t>(log_offset));
+}
+
+void SearchIndex::index_document(uint64_t id, uint32_t length, const DocumentTerms& doc_terms) {
+    document_ids.insert(id);
+    uint32_t doc = static_cast<uint32_t>(documents.size());
+    documents.push_back({id, length});
+    total_length += length;
+    for (const auto& term : doc_terms) {
+        Postings& postings = terms[term.first];
+        postings.docs.push_back(doc);
+        postings.starts.push_back(static_cast<uint32_t>(postings.positions.size()));
+        postings.positions.insert(postings.positions.end(), term.second.begin(), term.second.end());
+    }
+}
+
+void SearchIndex::add(uint64_t id, const HistoryEntry& entry, bool flush_now) {
+    if (!loaded) {
+        // 未加载时只维护已有的有效索引文件，没有文件就等下次查询时重建
+        if (!file_checked) {
+            open_existing();
+        }
+        if (fd < 0) {
+            return;
+        }
+    } else if (document_ids.count(id) > 0) {
+        return; // 其他进程已经补充了这条记录
+    }
+
+    DocumentTerms doc_terms;
+    uint32_t length = collect_terms(entry, doc_terms);
+    if (loaded) {
+        index_document(id, length, doc_terms);
+    }
+    if (fd < 0) {
+        return;
+    }
+
+    std::string record;
+    put(record, id);
+    put_varint(record, length);
+    put_varint(record, static_cast<uint32_t>(doc_terms.size()));
+    for (const auto& term : doc_terms) {
+        put_varint(record, static_cast<uint32_t>(term.first.size()));
+        record += term.first;
+        // 位置按递增顺序收集，用户消息的在前
+        const auto& positions = term.second;
+        put_positions(record, positions.data(), positions.data() + positions.size());
+    }
+    put(pending, static_cast<uint32_t>(record.size()));
+    put(pending, checksum(record.data(), record.size()));
+    pending += record;
+    if (flush_now) {
+        flush();
+    }
+}
+
+void SearchIndex::flush() {
+    if (pending.empty() || fd < 0 || !lock_file()) {
+        pending.clear();
+        return;
+    }
+    FileUnlock unlock(fd);
+    // 内存中的记录与映射的文件对应时（没有映射时只在内存中），先读入其他进程在此之前追加的记录，
+    // 之后的位置才与文件一致
+    bool mapped = loaded && map_data;
+    if (mapped) {
+        catch_up();
+    }
+    if (!write_all(fd, pending.data(), pending.size())) {
+        std::cerr << "Warning: Cannot write search index: " << index_path << std::endl;
+        pending.clear();
+        if (loaded) {
+            unload(); // 内存中的记录与文件不一致，下次查询时重新加载
+        }
+        return;
+    }
+    pending.clear();
+    if (mapped && loaded) {
+        struct stat st;
+        log_end = ::fstat(fd, &st) == 0 ? static_cast<uint64_t>(st.st_size) : log_end;
+        if (should_merge()) {
+            merge();
+        }
+    }
+}
+
+std::vector<std::vector<std::string>> SearchIndex::split_query(const std::string& query) {
+    std::vector<std::vector<std::string>> groups(1);
+    size_t pos = 0;
+    while (pos < query.size()) {
+        char c = query[pos];
+        if (c == ' ' || c == '\t') {
+            pos++;
+        } else if (c == '"') {
+            // 短语：引号内的全部词必须按顺序相邻出现
+            size_t end = query.find('"', pos + 1);
+            if (end == std::string::npos) {
+                end = query.size();
+            }
+            if (end > pos + 1) {
+                groups.back().push_back(query.substr(pos + 1, end - pos - 1));
+            }
+            pos = end + 1;
+        } else {
+            size_t end = query.find_first_of(" \t\"", pos);
+            if (end == std::string::npos) {
+                end = query.size();
+            }
+            std::string_view word = std::string_view(query).substr(pos, end - pos);
+            if (word == "OR") {
+                if (!groups.back().empty()) {
+                    groups.emplace_back();
+                }
+            } else {
+                groups.back().emplace_back(word);
+            }
+            pos = end;
+        }
+    }
+    if (groups.back().empty()) {
+        groups.pop_back();
+    }
+    return groups;
+}
+
+std::vector<std::vector<SearchIndex::Clause>> SearchIndex::parse_query(const std::string& query) {
+    std::vector<std::vector<Clause>> groups;
+    for (const auto& words : split_query(query)) {
+        std::vector<Clause> clauses;
+        for (const auto& word : words) {
+            // 单个词切出多个词项时（如中文词、foo-bar）也按短语匹配
+            Clause clause;
+            tokenize(word, [&](std::string_view term, uint32_t position) {
+                clause.terms.emplace_back(std::string(term), position);
+            });
+            if (!clause.terms.empty()) {
+                uint32_t first = clause.terms.front().second;
+                for (auto& term : clause.terms) {
+                    term.second -= first;
+                }
+                clauses.push_back(std::move(clause));
+            }
+        }
+        if (!clauses.empty()) {
+            groups.push_back(std::move(clauses));
+        }
+    }
+    return groups;
+}
+
+// 单个中日韩字符，返回它的字节数；否则返回0
+static size_t single_cjk_size(std::string_view term) {
+    size_t pos = 0;
+    if (term.empty() || !search_detail::is_cjk(search_detail::next_codepoint(term, pos))) {
+        return 0;
+    }
+    return pos == term.size() ? pos : 0;
+}
+
+std::pair<const uint32_t*, const uint32_t*> SearchIndex::positions_of(const Postings& postings,
+                                                                      size_t slot) {
+    const uint32_t* begin = postings.positions.data() + postings.starts[slot];
+    const uint32_t* end = postings.positions.data() +
+        (slot + 1 < postings.starts.size() ? postings.starts[slot + 1] : postings.positions.size());
+    return std::make_pair(begin, end);
+}
+
+std::string_view SearchIndex::term_text(const BaseTerm& term) const {
+    return std::string_view(base_strings + term.text, term.text_length);
+}
+
+const SearchIndex::BaseTerm* SearchIndex::find_base_term(std::string_view term) const {
+    const BaseTerm* end = base_terms + base_term_count;
+    const BaseTerm* it = std::lower_bound(base_terms, end, term,
+        [this](const BaseTerm& entry, std::string_view text) { return term_text(entry) < text; });
+    return it != end && term_text(*it) == term ? it : nullptr;
+}
+
+void SearchIndex::decode_base(const BaseTerm& term, Postings& out) const {
+    size_t index = static_cast<size_t>(&term - base_terms);
+    uint64_t end = index + 1 < base_term_count ? base_terms[index + 1].postings : base_postings_size;
+    const char* cursor = base_postings + term.postings;
+    const char* limit = base_postings + end;
+    uint32_t doc = 0;
+    while (cursor < limit) {
+        uint32_t delta = 0;
+        if (!get_varint(cursor, limit, delta)) {
+            break;
+        }
+        doc += delta;
+        out.docs.push_back(doc);
+        out.starts.push_back(static_cast<uint32_t>(out.positions.size()));
+        if (!get_positions(cursor, limit, out.positions)) {
+            break;
+        }
+    }
+}
+
+SearchIndex::Postings SearchIndex::postings_of(std::string_view term) const {
+    // 合并段中的文档序号都小于追加的文档，直接相接仍然递增
+    Postings postings;
+    if (const BaseTerm* base = find_base_term(term)) {
+        decode_base(*base, postings);
+    }
+    auto it = terms.find(std::string(term));
+    if (it != terms.end()) {
+        const Postings& tail = it->second;
+        uint32_t offset = static_cast<uint32_t>(postings.positions.size());
+        postings.docs.insert(postings.docs.end(), tail.docs.begin(), tail.docs.end());
+        for (uint32_t start : tail.starts) {
+            postings.starts.push_back(start + offset);
+        }
+        postings.positions.insert(postings.positions.end(), tail.positions.begin(), tail.positions.end());
+    }
+    return postings;
+}
+
+SearchIndex::Postings SearchIndex::character_postings(const std::string& character) const {
+    // 字在二元组“字?”中的位置是二元组的位置，在“?字”中是下一个位置
+    std::vector<std::pair<uint32_t, uint32_t>> hits; // (文档, 位置)
+    auto collect = [&](const Postings& postings, uint32_t shift) {
+        for (size_t slot = 0; slot < postings.docs.size(); ++slot) {
+            auto range = positions_of(postings, slot);
+            for (const uint32_t* p = range.first; p != range.second; ++p) {
+                hits.emplace_back(postings.docs[slot], *p + shift);
+            }
+        }
+    };
+    // 词项是这个字本身，或者是它和另一个中日韩字符组成的二元组时，返回字在其中的位移
+    std::string_view target(character);
+    auto shift_of = [&](std::string_view key, uint32_t& shift) {
+        if (key == target) {
+            shift = 0;
+            return true;
+        }
+        if (key.size() <= target.size()) {
+            return false;
+        }
+        if (key.substr(0, target.size()) == target && single_cjk_size(key.substr(target.size())) > 0) {
+            shift = 0;
+            return true;
+        }
+        if (key.substr(key.size() - target.size()) == target &&
+            single_cjk_size(key.substr(0, key.size() - target.size())) > 0) {
+            shift = 1;
+            return true;
+        }
+        return false;
+    };
+    // 词表中没有按字的索引，逐个检查（合并段中只比较映射的文本，不解码倒排表）
+    Postings decoded;
+    uint32_t shift = 0;
+    for (size_t i = 0; i < base_term_count; ++i) {
+        if (shift_of(term_text(base_terms[i]), shift)) {
+            decoded.docs.clear();
+            decoded.starts.clear();
+            decoded.positions.clear();
+            decode_base(base_terms[i], decoded);
+            collect(decoded, shift);
+        }
+    }
+    for (const auto& term : terms) {
+        if (shift_of(term.first, shift)) {
+            collect(term.second, shift);
+        }
+    }
+
+    // 字串中间的字同时出现在前后两个二元组中
+    std::sort(hits.begin(), hits.end());
+    hits.erase(std::unique(hits.begin(), hits.end()), hits.end());
+    Postings merged;
+    for (const auto& hit : hits) {
+        if (merged.docs.empty() || merged.docs.back() != hit.first) {
+            merged.docs.push_back(hit.first);
+            merged.starts.push_back(static_cast<uint32_t>(merged.positions.size()));
+        }
+        merged.positions.push_back(hit.second);
+    }
+    return merged;
+}
+
+// 在递增的docs中从from开始查找第一个不小于doc的位置：先倍增步长再二分，
+// 按递增顺序依次查找时总代价与较短的一方成正比
+static size_t advance_to(const std::vector<uint32_t>& docs, size_t from, uint32_t doc) {
+    size_t bound = 1;
+    while (from + bound < docs.size() && docs[from + bound] < doc) {
+        bound *= 2;
+    }
+    auto first = docs.begin() + static_cast<std::ptrdiff_t>(std::min(from + bound / 2, docs.size()));
+    auto last = docs.begin() + static_cast<std::ptrdiff_t>(std::min(from + bound + 1, docs.size()));
+    return static_cast<size_t>(std::lower_bound(first, last, doc) - docs.begin());
+}
+
+std::unordered_map<uint32_t, uint32_t> SearchIndex::match_clause(const Clause& clause,
+                                                                 uint32_t fields) const {
+    std::unordered_map<uint32_t, uint32_t> matches;
+    std::vector<Postings> lists; // 单字合并包含它的二元组，其他词项合并两部分的倒排表
+    lists.reserve(clause.terms.size());
+    size_t pivot = 0;
+    for (const auto& term : clause.terms) {
+        if (single_cjk_size(term.first) > 0) {
+            lists.push_back(character_postings(term.first));
+        } else {
+            lists.push_back(postings_of(term.first));
+        }
+        if (lists.back().docs.empty()) {
+            return matches;
+        }
+        if (lists.back().docs.size() < lists[pivot].docs.size()) {
+            pivot = lists.size() - 1;
+        }
+    }
+
+    // 以文档最少的词项为主，在其他词项的倒排表中向后查找同一文档，再二分查找对应位置
+    const Postings& main = lists[pivot];
+    uint32_t pivot_offset = clause.terms[pivot].second;
+    std::vector<std::pair<const uint32_t*, const uint32_t*>> ranges(lists.size());
+    std::vector<size_t> cursors(lists.size(), 0);
+    for (size_t slot = 0; slot < main.docs.size(); ++slot) {
+        uint32_t doc = main.docs[slot];
+        bool all_present = true;
+        for (size_t i = 0; i < lists.size() && all_present; ++i) {
+            const auto& docs = lists[i].docs;
+            cursors[i] = advance_to(docs, cursors[i], doc);
+            if (cursors[i] == docs.size() || docs[cursors[i]] != doc) {
+                all_present = false;
+            } else {
+                ranges[i] = positions_of(lists[i], cursors[i]);
+            }
+        }
+        if (!all_present) {
+            continue;
+        }
+
+        uint32_t hits = 0;
+        for (const uint32_t* p = ranges[pivot].first; p != ranges[pivot].second; ++p) {
+            if (*p < pivot_offset) {
+                continue;
+            }
+            uint32_t base = *p - pivot_offset;
+            uint32_t field = base >= kAssistantPositionBase ? FieldAssistant : FieldUser;
+            if (!(fields & field)) {
+                continue;
+            }
+            bool phrase = true;
+            for (size_t i = 0; i < lists.size() && phrase; ++i) {
+                if (i != pivot) {
+                    phrase = std::binary_search(ranges[i].first, ranges[i].second,
+                                                base + clause.terms[i].second);
+                }
+            }
+            if (phrase) {
+                hits++;
+            }
+        }
+        if (hits > 0) {
+            matches.emplace(doc, hits);
+        }
+    }
+    return matches;
+}
+
+std::vector<SearchMatch> SearchIndex::search(const std::string& query, uint32_t fields) const {
+    std::vector<SearchMatch> results;
+    if (documents.empty()) {
+        return results;
+    }
+    double doc_count = static_cast<double>(documents.size());
+    double average_length = static_cast<double>(total_length) / doc_count;
+
+    std::unordered_map<uint32_t, double> scores;
+    for (const auto& group : parse_query(query)) {
+        // 同一组内的子句取交集，每个子句按命中次数和稀有程度计分
+        std::unordered_map<uint32_t, double> group_scores;
+        bool first = true;
+        for (const auto& clause : group) {
+            auto matches = match_clause(clause, fields);
+            double df = static_cast<double>(matches.size());
+            double idf = std::log(1.0 + (doc_count - df + 0.5) / (df + 0.5));
+            std::unordered_map<uint32_t, double> next;
+            for (const auto& match : matches) {
+                if (!first && group_scores.find(match.first) == group_scores.end()) {
+                    continue;
+                }
+                double tf = static_cast<double>(match.second);
+                double norm = 1.0 - kBm25B + kBm25B * documents[match.first].length / average_length;
+                double score = idf * tf * (kBm25K1 + 1.0) / (tf + kBm25K1 * norm);
+                next.emplace(match.first, (first ? 0.0 : group_scores[match.first]) + score);
+            }
+            group_scores.swap(next);
+            first = false;
+            if (group_scores.empty()) {
+                break;
+            }
+        }
+        // 不同组之间取并集，同时满足多组的文档得分累加
+        for (const auto& scored : group_scores) {
+            scores[scored.first] += scored.second;
+        }
+    }
+
+    results.reserve(scores.size());
+    for (const auto& scored : scores) {
+        results.push_back({documents[scored.first].id, scored.second});
+    }
+    std::sort(results.begin(), results.end(), [](const SearchMatch& a, const SearchMatch& b) {
+        if (a.score != b.score) {
+            return a.score > b.score;
+        }
+        return a.id > b.id; // 得分相同时较新的在前
+    });
+    return results;
+}
@@ -0,0 +1,339 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "history.hpp"
+
+/**
+ * @brief 一个查询结果：记录编号和相关度得分
+ */
+struct SearchMatch {
+    uint64_t id;  // 历史记录的编号
+    double score; // BM25得分
+};
+
+/**
+ * @brief 历史记录的全文倒排索引
+ *
+ * 英文等按单词切分（ASCII转小写，全角字母数字转半角），中日韩文字按相邻
+ * 二元组切分，只有孤立的单字才作为单字词项；查询单个字时合并包含它的二元组，
+ * 因此单字查询和多字词查询都能命中。每个词项记录出现的文档和位置，支持多词
+ * AND/OR、短语查询，结果按BM25排序。只匹配整词：quote不会命中quoted。
+ *
+ * 索引保存在日志旁边的 .fts 文件中，分为两部分：
+ * - 合并段：文档表、按字节序排列的词项表（词项文本和倒排表的偏移）和编码后的倒排表。
+ *   加载时只映射文件并复制文档表，查询时在词项表中二分查找，只解码用到的词项。
+ * - 追加记录：合并之后每追加一条历史只追加该条目的倒排记录，加载时读入内存。
+ *   追加的文档达到合并段的一定比例时，与合并段一起重写为新的合并段。
+ * 文档用历史记录的编号引用，压缩和转存冷段都不改变编号，因此索引不受影响；
+ * 文件头记录所属历史存储的编号，历史被重写后索引作废并在下次查询时重建。
+ * 该文件可以随时从日志重建，因此写入时不做fsync，加载时丢弃写了一半的尾部。
+ *
+ * 多个进程同时使用时，每个进程只追加自己写入的历史记录的倒排记录（写入和加载都持有
+ * 该文件上的flock）。某个进程的记录没有写出（崩溃或文件被其他进程重写）时，
+ * 加载会报告缺少的编号，由调用方补充。
+ */
+class SearchIndex {
+public:
+    // 查询字段
+    enum Field : uint32_t {
+        FieldUser = 1,
+        FieldAssistant = 2,
+        FieldAll = FieldUser | FieldAssistant,
+    };
+
+    /**
+     * @brief 对文本分词，索引和查询使用同样的规则
+     * @param text UTF-8文本
+     * @param emit 回调 (词项, 位置)；中日韩文字生成二元组，孤立的单个字生成单字
+     */
+    template <typename F>
+    static void tokenize(std::string_view text, F&& emit);
+
+    /**
+     * @brief 把查询语句按OR拆成多组，每组是其中的词和短语的原文（不分词）
+     *
+     * 与search的语义相同：组内的词和短语都要出现，任意一组满足即可。
+     * 供索引没有结果时逐条按子串查找使用。
+     * @param query 查询语句
+     * @return 各组的词和短语，不含空组
+     */
+    static std::vector<std::vector<std::string>> split_query(const std::string& query);
+
+    /**
+     * @brief 构造函数
+     * @param journal_path 历史日志路径，索引保存在 journal_path + ".fts"
+     */
+    explicit SearchIndex(const std::string& journal_path);
+    ~SearchIndex();
+
+    SearchIndex(const SearchIndex&) = delete;
+    SearchIndex& operator=(const SearchIndex&) = delete;
+
+    /**
+     * @brief 关联到历史存储，丢弃内存中的索引（不读取文件）
+     * @param store_id 历史存储的编号，历史被重写后会改变
+     * @param discard_file 日志已被重写时为true，同时删除旧的索引文件
+     */
+    void attach(uint64_t store_id, bool discard_file = false);
+
+    /**
+     * @brief 映射索引文件并读入合并之后追加的记录，文件缺失或不属于当前日志时新建
+     * @param min_id 编号小于该值的记录已被淘汰，不再加载
+     * @param missing 不为空时返回[min_id, 返回值)中索引文件缺少的编号，需要调用add补充
+     * @return 已索引的最大编号加1，之后的记录需要调用add补充
+     */
+    uint64_t load(uint64_t min_id, std::vector<uint64_t>* missing = nullptr);
+
+    /**
+     * @brief 丢弃内存中的倒排表（其他进程追加了记录），下次查询前需要重新加载
+     *
+     * 尚未写出的倒排记录保留，仍由flush写入文件。
+     */
+    void unload();
+
+    /**
+     * @brief 索引一条新记录
+     *
+     * 索引已加载时更新内存并追加到文件；未加载时只在索引文件有效的情况下
+     * 追加到文件，否则跳过（下次查询时会重建）。
+     * @param id 记录编号
+     * @param entry 历史记录条目
+     * @param flush 是否立即写入文件，批量添加时可以最后再调用flush
+     */
+    void add(uint64_t id, const HistoryEntry& entry, bool flush = true);
+
+    /**
+     * @brief 写出尚未写入文件的倒排记录，应在对应的日志记录落盘之后调用
+     *
+     * 索引已加载且追加的记录足够多时，同时重写合并段。
+     */
+    void flush();
+
+    /**
+     * @brief 执行查询
+     *
+     * 以空白分隔的词之间是AND关系，大写的OR分隔多组条件，双引号括起的是短语。
+     * 例如：`移动语义 "rvalue reference" OR 完美转发`
+     * @param query 查询语句
+     * @param fields 搜索的字段
+     * @return 匹配的记录，按得分从高到低排列
+     */
+    std::vector<SearchMatch> search(const std::string& query, uint32_t fields = FieldAll) const;
+
+    /**
+     * @brief 索引是否已加载
+     */
+    bool is_loaded() const { return loaded; }
+
+private:
+    // 一个词项的倒排表：文档按编号递增，positions按文档分段
+    struct Postings {
+        std::vector<uint32_t> docs;
+        std::vector<uint32_t> starts; // 每个文档的位置在positions中的起点
+        std::vector<uint32_t> positions;
+    };
+    // 已索引的文档，合并段中的在前
+    struct Document {
+        uint64_t id;
+        uint32_t length; // 词数，用于BM25长度归一化
+    };
+    // 合并段中的文档和词项（文件中的定长记录）
+    struct BaseDocument;
+    struct BaseTerm;
+    // 查询子句：一组词项及其相对位置，单个词也是一个子句
+    struct Clause {
+        std::vector<std::pair<std::string, uint32_t>> terms;
+    };
+
+    std::string index_path;
+    uint64_t store_id;      // 所属历史存储的编号
+    int fd;                 // 索引文件的追加描述符，-1表示文件无效或尚未检查
+    bool file_checked;      // 是否已检查过索引文件
+    bool loaded;
+    std::unordered_map<std::string, Postings> terms; // 合并之后追加的记录的倒排表
+    std::vector<Document> documents;
+    std::unordered_set<uint64_t> document_ids; // 已加载的文档的编号，其他进程补充过的记录不重复加入
+    uint64_t total_length;
+    std::string pending;    // 尚未写入文件的倒排记录
+    uint64_t min_id;        // 编号小于该值的记录已被淘汰
+    size_t evicted;         // 已加载的文档中已被淘汰的数量（追加记录中的不加载，也计入）
+
+    // 索引文件的只读映射，合并段直接引用其中的数据
+    const char* map_data;
+    size_t map_size;
+    const BaseTerm* base_terms;
+    size_t base_term_count;
+    const char* base_strings;
+    const char* base_postings;
+    uint64_t base_postings_size;
+    size_t base_documents;  // documents中来自合并段的文档数
+    uint64_t log_end;       // 已读入内存的追加记录的结束位置
+
+    // 打开已有的索引文件并校验文件头
+    bool open_existing();
+    // 新建只有文件头的索引文件（先写临时文件再rename，其他进程映射的原文件不被截断）
+    bool create_file();
+    // 用给定内容替换索引文件并重新打开
+    void rewrite_file(const std::string& contents);
+    // 锁定当前的索引文件；文件已被其他进程的合并替换时改为锁定新文件（内存中的索引随之作废）
+    bool lock_file();
+    // 映射索引文件，加载合并段的文档表，返回追加记录的起点（调用方持有锁）
+    bool map_file(uint64_t& log_offset);
+    void unmap_file();
+    // 读入追加的倒排记录，返回其中完整记录的长度
+    size_t read_records(const char* data, size_t size);
+    // 读入log_end之后其他进程追加的记录（调用方持有锁）
+    void catch_up();
+    // 追加的文档足够多，或已淘汰的文档多于有效文档时合并
+    bool should_merge() const;
+    // 把合并段和追加的记录重写为新的合并段，丢弃已淘汰的文档（调用方持有锁，没有未写出的记录）
+    void merge();
+    // 合并段中的词项文本，以及按文本二分查找
+    std::string_view term_text(const BaseTerm& term) const;
+    const BaseTerm* find_base_term(std::string_view term) const;
+    // 解码合并段中一个词项的倒排表，追加到out
+    void decode_base(const BaseTerm& term, Postings& out) const;
+    // 一个词项在合并段和追加记录中的倒排表
+    Postings postings_of(std::string_view term) const;
+    // 倒排表中第slot个文档的位置范围
+    static std::pair<const uint32_t*, const uint32_t*> positions_of(const Postings& postings, size_t slot);
+    // 单个中日韩字符的倒排表：孤立的单字和包含它的二元组按字的位置合并
+    Postings character_postings(const std::string& character) const;
+    // 把一个文档的词项加入内存倒排表
+    void index_document(uint64_t id, uint32_t length,
+                        const std::vector<std::pair<std::string, std::vector<uint32_t>>>& doc_terms);
+    // 匹配一个子句，返回 文档编号 -> 命中次数
+    std::unordered_map<uint32_t, uint32_t> match_clause(const Clause& clause, uint32_t fields) const;
+    // 解析查询语句为 OR(AND(子句...)...)，每个词和短语分词后成为一个子句
+    static std::vector<std::vector<Clause>> parse_query(const std::string& query);
+};
+
+namespace search_detail {
+
+// 解码一个UTF-8字符，返回码点并前移pos；非法字节按单字节返回0xFFFD
+inline uint32_t next_codepoint(std::string_view text, size_t& pos) {
+    unsigned char c = static_cast<unsigned char>(text[pos]);
+    size_t length = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xE ? 3 : (c >> 3) == 0x1E ? 4 : 0;
+    if (length == 0 || pos + length > text.size()) {
+        pos++;
+        return 0xFFFD;
+    }
+    uint32_t cp = length == 1 ? c : c & (0x7F >> length);
+    for (size_t i = 1; i < length; ++i) {
+        unsigned char cc = static_cast<unsigned char>(text[pos + i]);
+        if ((cc & 0xC0) != 0x80) {
+            pos++;
+            return 0xFFFD;
+        }
+        cp = (cp << 6) | (cc & 0x3F);
+    }
+    pos += length;
+    return cp;
+}
+
+inline bool is_cjk(uint32_t cp) {
+    return (cp >= 0x3040 && cp <= 0x30FF) ||   // 平假名、片假名
+           (cp >= 0x3400 && cp <= 0x4DBF) ||   // CJK扩展A
+           (cp >= 0x4E00 && cp <= 0x9FFF) ||   // CJK统一汉字
+           (cp >= 0xAC00 && cp <= 0xD7AF) ||   // 韩文音节
+           (cp >= 0xF900 && cp <= 0xFAFF) ||   // CJK兼容汉字
+           (cp >= 0x20000 && cp <= 0x2FFFF);   // CJK扩展B及以后
+}
+
+// 单词字符：ASCII字母数字和下划线，以及标点、符号、表情以外的其他文字
+inline bool is_word(uint32_t cp) {
+    if (cp < 0x80) {
+        return (cp >= '0' && cp <= '9') || (cp >= 'a' && cp <= 'z') ||
+               (cp >= 'A' && cp <= 'Z') || cp == '_';
+    }
+    return !(cp <= 0xBF || (cp >= 0x2000 && cp <= 0x2BFF) || (cp >= 0x3000 && cp <= 0x303F) ||
+             (cp >= 0xFE30 && cp <= 0xFE4F) || (cp >= 0xFF00 && cp <= 0xFFEF) ||
+             cp == 0xFFFD || cp >= 0x1F000);
+}
+
+inline void append_utf8(std::string& out, uint32_t cp) {
+    if (cp < 0x80) {
+        out += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+        out += static_cast<char>(0xC0 | (cp >> 6));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        out += static_cast<char>(0xE0 | (cp >> 12));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (cp >> 18));
+        out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+}
+
+} // namespace search_detail
+
+template <typename F>
+void SearchIndex::tokenize(std::string_view text, F&& emit) {
+    using namespace search_detail;
+    uint32_t position = 0;
+    std::string word;
+    size_t cjk_start = std::string_view::npos; // 当前中日韩文字串的起点
+    size_t cjk_chars = 0;
+    size_t previous = 0;  // 上一个中日韩字符的起点
+
+    auto finish_word = [&]() {
+        if (!word.empty()) {
+            emit(std::string_view(word), position++);
+            word.clear();
+        }
+    };
+    auto finish_cjk = [&](size_t end) {
+        // 单个字没有二元组可用，按单字索引
+        if (cjk_chars == 1) {
+            emit(text.substr(cjk_start, end - cjk_start), position);
+        }
+        position += static_cast<uint32_t>(cjk_chars);
+        cjk_start = std::string_view::npos;
+        cjk_chars = 0;
+    };
+
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t start = pos;
+        uint32_t cp = next_codepoint(text, pos);
+        if (cp >= 0xFF01 && cp <= 0xFF5E) {
+            cp -= 0xFEE0; // 全角ASCII转半角
+        }
+        if (is_cjk(cp)) {
+            finish_word();
+            uint32_t current = position + static_cast<uint32_t>(cjk_chars);
+            if (cjk_start == std::string_view::npos) {
+                cjk_start = start;
+            } else {
+                emit(text.substr(previous, pos - previous), current - 1);
+            }
+            previous = start;
+            cjk_chars++;
+            continue;
+        }
+        if (cjk_start != std::string_view::npos) {
+            finish_cjk(start);
+        }
+        if (is_word(cp)) {
+            if (cp >= 'A' && cp <= 'Z') {
+                cp += 'a' - 'A';
+            }
+            append_utf8(word, cp);
+        } else {
+            finish_word();
+        }
+    }
+    finish_word();
+    if (cjk_start != std::string_view::npos) {
+        finish_cjk(text.size());
+    }
+}
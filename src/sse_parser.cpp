@@ -0,0 +1,236 @@
+#include "sse_parser.hpp"
+#include <cstring>
+
+// 以下辅助函数在JSON文本上原地扫描，pos始终指向下一个未处理的字符
+
+static void skip_ws(std::string_view s, size_t &pos) {
+  while (pos < s.size() &&
+         (s[pos] == ' ' || s[pos] == '\t' || s[pos] == '\n' || s[pos] == '\r'))
+    ++pos;
+}
+
+// 跳过一个字符串字面量，pos指向开头的引号；body返回引号之间的原始字符
+static bool scan_string(std::string_view s, size_t &pos, std::string_view &body,
+                        bool &has_escape) {
+  if (pos >= s.size() || s[pos] != '"')
+    return false;
+  size_t start = ++pos;
+  has_escape = false;
+  while (pos < s.size()) {
+    char c = s[pos];
+    if (c == '"') {
+      body = s.substr(start, pos - start);
+      ++pos;
+      return true;
+    }
+    if (c == '\\') {
+      has_escape = true;
+      pos += 2;
+      continue;
+    }
+    ++pos;
+  }
+  return false;
+}
+
+// 跳过任意一个JSON值（对象和数组按括号深度跳过）
+static bool skip_value(std::string_view s, size_t &pos) {
+  skip_ws(s, pos);
+  if (pos >= s.size())
+    return false;
+  char c = s[pos];
+  if (c == '"') {
+    std::string_view body;
+    bool has_escape;
+    return scan_string(s, pos, body, has_escape);
+  }
+  if (c == '{' || c == '[') {
+    int depth = 0;
+    while (pos < s.size()) {
+      c = s[pos];
+      if (c == '"') {
+        std::string_view body;
+        bool has_escape;
+        if (!scan_string(s, pos, body, has_escape))
+          return false;
+        continue;
+      }
+      if (c == '{' || c == '[') {
+        ++depth;
+      } else if (c == '}' || c == ']') {
+        if (--depth == 0) {
+          ++pos;
+          return true;
+        }
+      }
+      ++pos;
+    }
+    return false;
+  }
+  // 数字、true、false、null
+  while (pos < s.size() && s[pos] != ',' && s[pos] != '}' && s[pos] != ']' &&
+         s[pos] != ' ' && s[pos] != '\n' && s[pos] != '\r' && s[pos] != '\t')
+    ++pos;
+  return true;
+}
+
+// 在pos处的对象中查找成员key，成功时pos指向该成员的值
+static bool find_member(std::string_view s, size_t &pos, std::string_view key) {
+  skip_ws(s, pos);
+  if (pos >= s.size() || s[pos] != '{')
+    return false;
+  ++pos;
+  while (true) {
+    skip_ws(s, pos);
+    if (pos >= s.size() || s[pos] == '}')
+      return false;
+    std::string_view name;
+    bool has_escape;
+    if (!scan_string(s, pos, name, has_escape))
+      return false;
+    skip_ws(s, pos);
+    if (pos >= s.size() || s[pos] != ':')
+      return false;
+    ++pos;
+    skip_ws(s, pos);
+    if (name == key)
+      return true;
+    if (!skip_value(s, pos))
+      return false;
+    skip_ws(s, pos);
+    if (pos < s.size() && s[pos] == ',')
+      ++pos;
+  }
+}
+
+static void append_utf8(std::string &out, unsigned long cp) {
+  if (cp < 0x80) {
+    out.push_back(static_cast<char>(cp));
+  } else if (cp < 0x800) {
+    out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+    out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  } else if (cp < 0x10000) {
+    out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+    out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+    out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  } else {
+    out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+    out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+    out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+    out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  }
+}
+
+static bool parse_hex4(std::string_view s, size_t pos, unsigned long &value) {
+  if (pos + 4 > s.size())
+    return false;
+  value = 0;
+  for (size_t i = pos; i < pos + 4; ++i) {
+    char c = s[i];
+    value <<= 4;
+    if (c >= '0' && c <= '9')
+      value |= static_cast<unsigned long>(c - '0');
+    else if (c >= 'a' && c <= 'f')
+      value |= static_cast<unsigned long>(c - 'a' + 10);
+    else if (c >= 'A' && c <= 'F')
+      value |= static_cast<unsigned long>(c - 'A' + 10);
+    else
+      return false;
+  }
+  return true;
+}
+
+bool SseParser::decode_json_string(std::string_view body, std::string &out) {
+  size_t pos = 0;
+  while (pos < body.size()) {
+    // 批量拷贝不含转义的片段
+    const void *found = std::memchr(body.data() + pos, '\\', body.size() - pos);
+    size_t escape = found ? static_cast<const char *>(found) - body.data()
+                          : body.size();
+    out.append(body.data() + pos, escape - pos);
+    pos = escape;
+    if (pos >= body.size())
+      break;
+    if (pos + 1 >= body.size())
+      return false;
+    char c = body[pos + 1];
+    pos += 2;
+    switch (c) {
+    case '"': out.push_back('"'); break;
+    case '\\': out.push_back('\\'); break;
+    case '/': out.push_back('/'); break;
+    case 'b': out.push_back('\b'); break;
+    case 'f': out.push_back('\f'); break;
+    case 'n': out.push_back('\n'); break;
+    case 'r': out.push_back('\r'); break;
+    case 't': out.push_back('\t'); break;
+    case 'u': {
+      unsigned long cp;
+      if (!parse_hex4(body, pos, cp))
+        return false;
+      pos += 4;
+      // 代理对：emoji等BMP以外的字符
+      if (cp >= 0xD800 && cp <= 0xDBFF) {
+        unsigned long low;
+        if (pos + 6 <= body.size() && body[pos] == '\\' &&
+            body[pos + 1] == 'u' && parse_hex4(body, pos + 2, low) &&
+            low >= 0xDC00 && low <= 0xDFFF) {
+          cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+          pos += 6;
+        } else {
+          cp = 0xFFFD;
+        }
+      } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+        cp = 0xFFFD;
+      }
+      append_utf8(out, cp);
+      break;
+    }
+    default:
+      return false;
+    }
+  }
+  return true;
+}
+
+bool SseParser::extract_delta_content(std::string_view json,
+                                      std::string &scratch,
+                                      std::string_view &content) {
+  size_t pos = 0;
+  if (!find_member(json, pos, "choices"))
+    return false;
+  if (pos >= json.size() || json[pos] != '[')
+    return false;
+  ++pos; // 进入数组，定位到第一个元素
+  if (!find_member(json, pos, "delta") || !find_member(json, pos, "content"))
+    return false;
+  std::string_view body;
+  bool has_escape;
+  if (!scan_string(json, pos, body, has_escape))
+    return false; // content为null或非字符串
+  if (!has_escape) {
+    content = body; // 无转义时直接引用接收缓冲区
+    return true;
+  }
+  scratch.clear();
+  if (!decode_json_string(body, scratch))
+    return false;
+  content = scratch;
+  return true;
+}
+
+bool SseParser::process_line(std::string_view line, std::string_view &content) {
+  if (!line.empty() && line.back() == '\r')
+    line.remove_suffix(1);
+  // 只关心data字段，空行和注释行（如": keep-alive"）直接忽略
+  if (line.size() < 5 || line.compare(0, 5, "data:") != 0)
+    return false;
+  line.remove_prefix(5);
+  if (!line.empty() && line.front() == ' ')
+    line.remove_prefix(1);
+  if (line == "[DONE]") {
+    done = true;
+    return false;
+  }
+  return extract_delta_content(line, scratch, content) && !content.empty();
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include <string>
+#include <string_view>
+
+/**
+ * @brief 增量式SSE流解析器
+ *
+ * 直接在接收缓冲区上以string_view的方式切分行，并且不构建JSON DOM，
+ * 只按路径 choices[0].delta.content 提取增量内容。跨越回调边界的不完整行
+ * 会暂存在内部缓冲区中，等待下一段数据补全。
+ */
+class SseParser {
+private:
+  std::string carry;   // 上一次回调遗留的不完整行
+  std::string scratch; // 含转义字符的内容的解码缓冲区
+  bool done;
+
+  // 处理一个完整的行（不含换行符），返回是否提取到内容
+  bool process_line(std::string_view line, std::string_view &content);
+
+public:
+  SseParser() : done(false) {}
+
+  /**
+   * @brief Feeds a chunk of received bytes into the parser.
+   * @param chunk Bytes received from the network, may split lines anywhere.
+   * @param on_content Called with every non-empty delta content. The view is
+   * only valid during the call.
+   * @return Number of content deltas extracted from this chunk.
+   */
+  template <typename F> size_t feed(std::string_view chunk, F &&on_content);
+
+  /**
+   * @brief Whether the terminating "data: [DONE]" event has been seen
+   */
+  bool is_done() const { return done; }
+
+  /**
+   * @brief Reset the parser so that it can be used for a new stream
+   */
+  void reset() {
+    carry.clear();
+    done = false;
+  }
+
+  /**
+   * @brief Extracts choices[0].delta.content from a chunk JSON object without
+   * building a DOM.
+   * @param json The JSON text of one SSE data payload.
+   * @param scratch Buffer used when the content contains escape sequences.
+   * @param content Receives a view of the decoded content, either into json or
+   * into scratch.
+   * @return true if a string content was found, false otherwise.
+   */
+  static bool extract_delta_content(std::string_view json, std::string &scratch,
+                                    std::string_view &content);
+
+  /**
+   * @brief Decodes a JSON string literal body (without the surrounding quotes)
+   * and appends it as UTF-8 to out.
+   * @param body The raw characters between the quotes.
+   * @param out The string to append to.
+   * @return false if the escape sequences are malformed.
+   */
+  static bool decode_json_string(std::string_view body, std::string &out);
+};
+
+// 模板函数的实现
+template <typename F>
+size_t SseParser::feed(std::string_view chunk, F &&on_content) {
+  size_t extracted = 0;
+  std::string_view content;
+  size_t pos = 0;
+  // 先补全上一次遗留的不完整行
+  if (!carry.empty()) {
+    size_t newline = chunk.find('\n');
+    if (newline == std::string_view::npos) {
+      carry.append(chunk.data(), chunk.size());
+      return 0;
+    }
+    carry.append(chunk.data(), newline);
+    if (process_line(carry, content)) {
+      on_content(content);
+      extracted++;
+    }
+    carry.clear();
+    pos = newline + 1;
+  }
+  // 其余的完整行直接在接收缓冲区上处理，无需拷贝
+  while (pos < chunk.size()) {
+    size_t newline = chunk.find('\n', pos);
+    if (newline == std::string_view::npos) {
+      carry.assign(chunk.data() + pos, chunk.size() - pos);
+      break;
+    }
+    if (process_line(chunk.substr(pos, newline - pos), content)) {
+      on_content(content);
+      extracted++;
+    }
+    pos = newline + 1;
+  }
+  return extracted;
+}
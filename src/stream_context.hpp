@@ -0,0 +1,58 @@
+#pragma once
+#include <curl/curl.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "cancellation_token.hpp"
+#include "partial_response.hpp"
+#include "sse_parser.hpp"
+
+/**
+ * @brief 单个流式请求的状态，通过CURLOPT_WRITEDATA传给写回调
+ *
+ * 每个请求拥有独立的行缓冲、累计内容、计数和计时信息，
+ * 因此同一进程内可以同时存在多个流而互不干扰。
+ */
+struct StreamContext {
+  using clock = std::chrono::steady_clock;
+
+  SseParser parser;           // 行缓冲和增量解析状态
+  std::string content;        // 已累计的回复内容
+  size_t token_count = 0;     // 收到的增量内容条数
+  size_t bytes_received = 0;  // 收到的原始字节数
+  clock::time_point start_time = clock::now();
+  clock::time_point first_token_time;
+  clock::time_point last_token_time;
+  std::vector<float> token_gaps_ms; // 每个token与上一个token的到达间隔
+  bool echo = true;                          // 是否实时输出到stdout
+  const CancellationToken *cancel = nullptr; // 请求的取消令牌，为空表示不可取消
+  CURL *handle = nullptr;   // 传输所用的句柄，用于读取状态码
+  long http_status = 0;     // 响应的状态码，收到第一块数据时读取
+  std::string error_body;   // 状态码表示错误时的原始响应体（不是SSE）
+  PartialResponse *partial = nullptr; // 同时发布部分回复的缓冲，为空表示不发布
+
+  /**
+   * @brief 是否已收到过至少一个增量内容
+   */
+  bool has_tokens() const { return token_count > 0; }
+
+  /**
+   * @brief 首个token的延迟（秒），尚未收到时返回0
+   */
+  double time_to_first_token() const {
+    if (!has_tokens())
+      return 0.0;
+    return std::chrono::duration<double>(first_token_time - start_time).count();
+  }
+
+  /**
+   * @brief 从首个token到最后一个token之间的生成速率
+   */
+  double tokens_per_second() const {
+    double seconds =
+        std::chrono::duration<double>(last_token_time - first_token_time)
+            .count();
+    return seconds > 0.0 ? (token_count - 1) / seconds : 0.0;
+  }
+};
@@ -0,0 +1,15 @@
+#include "token_estimate.hpp"
+
+size_t estimate_tokens(std::string_view text) {
+  size_t ascii = 0;
+  size_t others = 0;
+  for (unsigned char c : text) {
+    if (c < 0x80) {
+      ascii++;
+    } else if ((c & 0xC0) != 0x80) {
+      others++; // 多字节字符的首字节，续字节不计
+    }
+  }
+  // 以十分之一token为单位累加，避免浮点运算
+  return (ascii * 3 + others * 6 + 9) / 10;
+}
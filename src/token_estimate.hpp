@@ -0,0 +1,14 @@
+#pragma once
+#include <cstddef>
+#include <string_view>
+
+/**
+ * @brief 在本地粗略估算一段文本的token数，不调用分词器
+ *
+ * 按DeepSeek公布的换算比例：一个英文字符约0.3个token，一个中文字符约0.6个
+ * token。ASCII按字节计，其他字符按UTF-8码点计，结果向上取整。估算值只用于
+ * 控制上下文大小，不保证与服务端的计费一致。
+ * @param text UTF-8文本
+ * @return 估算的token数
+ */
+size_t estimate_tokens(std::string_view text);
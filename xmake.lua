@@ -1,7 +1,82 @@
 add_rules("mode.debug", "mode.release")
-add_requires("jsoncpp", "libcurl", "readline")
+add_requires("jsoncpp", "libcurl", "readline", "zlib")
+
+-- 除main.cpp外的全部源码，供主程序和基准测试共用
+target("gfcore")
+    set_languages("c++17")
+    set_kind("static")
+    add_files("src/*.cpp|main.cpp")
+    add_includedirs("src", {public = true})
+    add_packages("jsoncpp", "libcurl", "zlib", {public = true})
+
 target("gf")
     set_languages("c++17")
     set_kind("binary")
-    add_files("src/*.cpp")
+    add_deps("gfcore")
+    add_files("src/main.cpp")
     add_packages("jsoncpp", "libcurl", "readline")
+
+target("bench_sse")
+    set_languages("c++17")
+    set_kind("binary")
+    set_default(false)
+    add_deps("gfcore")
+    add_files("bench/bench_sse.cpp")
+
+target("bench_history")
+    set_languages("c++17")
+    set_kind("binary")
+    set_default(false)
+    add_deps("gfcore")
+    add_files("bench/bench_history.cpp")
+
+target("bench_search")
+    set_languages("c++17")
+    set_kind("binary")
+    set_default(false)
+    add_deps("gfcore")
+    add_files("bench/bench_search.cpp")
+
+-- 多进程并发写入同一份历史的压力测试
+target("bench_history_concurrent")
+    set_languages("c++17")
+    set_kind("binary")
+    set_default(false)
+    add_deps("gfcore")
+    add_files("bench/bench_history_concurrent.cpp")
+
+-- 本地DeepSeek替身服务器，可配置token速率、分块、延迟和失败注入
+target("mock_server")
+    set_languages("c++17")
+    set_kind("binary")
+    set_default(false)
+    add_deps("gfcore")
+    add_files("bench/mock_server.cpp", "bench/mock_server_main.cpp")
+
+target("bench_e2e")
+    set_languages("c++17")
+    set_kind("binary")
+    set_default(false)
+    add_deps("gfcore")
+    add_files("bench/bench_e2e.cpp", "bench/mock_server.cpp")
+
+target("bench_request")
+    set_languages("c++17")
+    set_kind("binary")
+    set_default(false)
+    add_deps("gfcore")
+    add_files("bench/bench_request.cpp")
+
+target("bench_retry")
+    set_languages("c++17")
+    set_kind("binary")
+    set_default(false)
+    add_deps("gfcore")
+    add_files("bench/bench_retry.cpp", "bench/mock_server.cpp")
+
+target("bench_partial")
+    set_languages("c++17")
+    set_kind("binary")
+    set_default(false)
+    add_deps("gfcore")
+    add_files("bench/bench_partial.cpp")